@@ -1,45 +1,18 @@
-QT       += core gui widgets svg
-QT       += widgets
-QT       += opengl
-QT       += printsupport
-
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-CONFIG += c++11
-
-# You can make your code fail to compile if it uses deprecated APIs.
-# In order to do so, uncomment the following line.
-#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
-
-SOURCES += \
-    main.cpp \
-    mainwindow.cpp
-
-HEADERS += \
-    mainwindow.h
-
-FORMS += \
-    mainwindow.ui
-
-
-INCLUDEPATH += /usr/local/include
-
-LIBS += -L/usr/local/lib -L/usr/local/lib64 \
-        -lgdal -lproj
-
-# GDAL configuration
-
-INCLUDEPATH += /usr/local/include
-LIBS += -L/usr/local/lib -lgdal -lproj -lgeos_c
-
-
-# Default rules for deployment.
-qnx: target.path = /tmp/$${TARGET}/bin
-else: unix:!android: target.path = /opt/$${TARGET}/bin
-!isEmpty(target.path): INSTALLS += target
-
-RESOURCES += \
-    Resources.qrc
-
-DISTFILES +=
-
+TEMPLATE = subdirs
+
+# core: GUI-free library with the data providers, transforms, processing
+#       and render/export jobs
+# app: the desktop application
+# cli: command-line driver for batch rendering and processing
+# benchmarks, tests: Qt Test targets linking the core library
+SUBDIRS += \
+    core \
+    app \
+    cli \
+    benchmarks \
+    tests
+
+app.depends = core
+cli.depends = core
+benchmarks.depends = core
+tests.depends = core
@@ -0,0 +1,46 @@
+QT       += core gui widgets svg
+QT       += widgets
+QT       += opengl
+QT       += printsupport
+QT       += concurrent
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++11
+
+# You can make your code fail to compile if it uses deprecated APIs.
+# In order to do so, uncomment the following line.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+TARGET = Qgis_demo
+
+SOURCES += \
+    main.cpp \
+    mainwindow.cpp \
+    mapview.cpp \
+    profilerview.cpp
+
+HEADERS += \
+    mainwindow.h \
+    mapview.h \
+    profilerview.h
+
+FORMS += \
+    mainwindow.ui
+
+
+# Data providers, transforms, processing and export, with the GDAL
+# configuration they need
+include(../core/core.pri)
+
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
+
+RESOURCES += \
+    Resources.qrc
+
+DISTFILES +=
+
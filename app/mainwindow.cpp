@@ -45,6 +45,30 @@
 #include <QTextStream>
 #include <QCloseEvent>
 #include <QFileDialog>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <QSet>
+#include <QProgressDialog>
+#include <QtMath>
+
+#include "crscatalogue.h"
+#include "crsregistry.h"
+#include "featurebufferitem.h"
+#include "geoprocessing.h"
+#include "layerloader.h"
+#include "mapexport.h"
+#include "mapview.h"
+#include "pointgenerators.h"
+#include "profiler.h"
+#include "profilerview.h"
+#include "projectexport.h"
+#include "projectpackage.h"
+#include "rastercalculator.h"
+#include "reprojection.h"
+#include "tiledrasteritem.h"
+#include "vectoranalysis.h"
+#include "warptilesource.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -69,10 +93,21 @@ MainWindow::MainWindow(QWidget *parent)
     , layersDock(nullptr)
     , browserDock(nullptr)
     , processingToolboxDock(nullptr)
+    , processingTree(nullptr)
+    , processingJobsTree(nullptr)
+    , jobScheduler(nullptr)
+    , projectExporter(nullptr)
+    , exportProgressDialog(nullptr)
+    , exportProgressBar(nullptr)
+    , exportFilesTree(nullptr)
+    , mapExporter(nullptr)
+    , mapExportProgress(nullptr)
     , layerStylingDock(nullptr)
     , imagePropertiesDock(nullptr)
+    , profilerDock(nullptr)
     , mapViewsTabWidget(nullptr)
     , mapView(nullptr)
+    , nextMapViewNumber(2)
     , mapScene(nullptr)
     , currentImageItem(nullptr)
     , layersTree(nullptr)
@@ -91,6 +126,8 @@ MainWindow::MainWindow(QWidget *parent)
     , projectInfoLabel(nullptr)
     , recentProjectsMenu(nullptr)
     , projectModified(false)
+    , deferredOpenGeneration(0)
+    , deferredOpenPending(0)
     , currentScale(1.0)
     , rotationAngle(0.0)
     , appSettings(nullptr)
@@ -101,12 +138,15 @@ MainWindow::MainWindow(QWidget *parent)
     , printLayoutAction(nullptr)
     , exitAction(nullptr)
     , newMapViewAction(nullptr)
+    , linkMapViewsAction(nullptr)
     , panAction(nullptr)
     , zoomInAction(nullptr)
     , zoomOutAction(nullptr)
     , identifyAction(nullptr)
     , measureAction(nullptr)
     , bookmarkAction(nullptr)
+    , profilerAction(nullptr)
+    , profilerOverlayAction(nullptr)
     , toggleEditingAction(nullptr)
     , saveLayerEditsAction(nullptr)
     , openAttributeTableAction(nullptr)
@@ -137,6 +177,7 @@ MainWindow::MainWindow(QWidget *parent)
     , exportToPdfAction(nullptr)
     , exportToImageAction(nullptr)
     , saveAllLayersAction(nullptr)
+    , packageLayersAction(nullptr)
 {
     // Seed the random number generator
     srand(time(nullptr));
@@ -144,6 +185,11 @@ MainWindow::MainWindow(QWidget *parent)
     // Initialize settings
     appSettings = new QSettings("QGISDemo", "Application");
 
+    // Background processing jobs
+    jobScheduler = new ProcessingJobScheduler(this);
+    projectExporter = new ProjectExporter(this);
+    mapExporter = new MapExporter(this);
+
     // Set default project name
     currentProjectName = "Untitled";
 
@@ -181,6 +227,9 @@ MainWindow::MainWindow(QWidget *parent)
     // Register GDAL drivers
     GDALAllRegister();
 
+    // Read the EPSG catalogue for the CRS selector while the window comes up
+    CrsCatalogue::load();
+
     // Load recent projects
     recentProjects = appSettings->value("recentProjects").toStringList();
     updateRecentProjectsMenu();
@@ -200,6 +249,10 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // Project layers not opened yet are not needed any more
+    layerOpenPool.clear();
+    layerOpenPool.waitForDone();
+
     // Clean up GDAL
     if (gdalDataset) {
         GDALClose(gdalDataset);
@@ -215,6 +268,22 @@ MainWindow::~MainWindow()
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    // Both questions come first: running jobs are only canceled once the
+    // window is really closing
+    const bool jobsRunning = jobScheduler && jobScheduler->activeJobCount() > 0;
+    if (jobsRunning) {
+        QMessageBox::StandardButton reply = QMessageBox::question(
+                    this,
+                    "Processing Jobs",
+                    QString("%1 processing job(s) are still running.\n\nCancel them and exit?")
+                    .arg(jobScheduler->activeJobCount()));
+
+        if (reply != QMessageBox::Yes) {
+            event->ignore();
+            return;
+        }
+    }
+
     if (projectModified) {
         QMessageBox::StandardButton reply = QMessageBox::question(
                     this,
@@ -226,16 +295,18 @@ void MainWindow::closeEvent(QCloseEvent *event)
                     );
 
         if (reply == QMessageBox::Cancel) {
-            event->ignore();  // Don't close
-        } else if (reply == QMessageBox::Save) {
+            event->ignore();  // Don't close; the jobs keep running
+            return;
+        }
+        if (reply == QMessageBox::Save) {
             onSaveProject();    // Save and close
-            event->accept();
-        } else {
-            event->accept();  // Discard changes and close
         }
-    } else {
-        event->accept();  // No unsaved changes, close normally
     }
+
+    if (jobsRunning) {
+        jobScheduler->cancelAll();
+    }
+    event->accept();
 }
 
 void MainWindow::dragEnterEvent(QDragEnterEvent *event)
@@ -307,6 +378,10 @@ void MainWindow::setupUI()
     if (processingToolboxDock) addDockWidget(Qt::RightDockWidgetArea, processingToolboxDock);
     if (layerStylingDock) addDockWidget(Qt::RightDockWidgetArea, layerStylingDock);
     if (imagePropertiesDock) addDockWidget(Qt::RightDockWidgetArea, imagePropertiesDock);
+    if (profilerDock) {
+        addDockWidget(Qt::BottomDockWidgetArea, profilerDock);
+        profilerDock->hide();
+    }
 
     // Tabify dock widgets
     if (browserDock && layersDock) {
@@ -340,6 +415,15 @@ void MainWindow::setupMenuBar()
     saveProjectAction = projectMenu->addAction(QIcon(":/icons/save.png"), "&Save Project", this, &MainWindow::onSaveProject, QKeySequence::Save);
     saveAsProjectAction = projectMenu->addAction(QIcon(":/icons/saveAs.png"), "Save Project &As...", this, &MainWindow::onSaveAsProject, QKeySequence::SaveAs);
 
+    // Off: the project references layer files where they are. On: they are
+    // placed in a layers/ directory next to it
+    packageLayersAction = projectMenu->addAction("Package Layer Files on Save");
+    packageLayersAction->setCheckable(true);
+    packageLayersAction->setChecked(appSettings->value("packageLayers", false).toBool());
+    connect(packageLayersAction, &QAction::toggled, this, [this](bool checked) {
+        appSettings->setValue("packageLayers", checked);
+    });
+
     projectMenu->addSeparator();
     exportProjectAction = projectMenu->addAction(QIcon(":/icons/export.png"), "&Export Project...", this, &MainWindow::onExportProject);
     importProjectAction = projectMenu->addAction(QIcon(":/icons/folder_open.png"), "&Import Project...", this, &MainWindow::onImportProject);
@@ -392,6 +476,14 @@ void MainWindow::setupMenuBar()
     QMenu *viewMenu = menuBar->addMenu("&View");
     newMapViewAction = viewMenu->addAction(QIcon(":/icons/new_map_view.png"), "New &Map View");
     newMapViewAction->setShortcut(QKeySequence("Ctrl+M"));
+    connect(newMapViewAction, &QAction::triggered, this, &MainWindow::onNewMapView);
+
+    linkMapViewsAction = viewMenu->addAction("&Link Map Views");
+    linkMapViewsAction->setCheckable(true);
+    linkMapViewsAction->setChecked(true);
+    connect(linkMapViewsAction, &QAction::toggled, this, [this](bool linked) {
+        if (linked && mapView) onMapViewChanged(mapView);
+    });
 
     viewMenu->addAction(QIcon(":/icons/3d-map.png"), "3D Map Views");
     viewMenu->addSeparator();
@@ -419,6 +511,7 @@ void MainWindow::setupMenuBar()
 
     identifyAction = viewMenu->addAction(QIcon(":/icons/identity.png"), "Identify Features");
     identifyAction->setShortcut(QKeySequence("Ctrl+Shift+I"));
+    identifyAction->setCheckable(true);
 
     measureAction = viewMenu->addAction(QIcon(":/icons/Measure.png"), "Measure");
 
@@ -444,6 +537,23 @@ void MainWindow::setupMenuBar()
     QAction *refreshAction = viewMenu->addAction(QIcon(":/icons/refresh.png"), "Refresh");
     refreshAction->setShortcut(QKeySequence("F5"));
 
+    viewMenu->addSeparator();
+
+    profilerAction = viewMenu->addAction("Render &Profiler");
+    profilerAction->setShortcut(QKeySequence("Ctrl+Shift+P"));
+    profilerAction->setCheckable(true);
+    connect(profilerAction, &QAction::toggled, this, &MainWindow::onToggleProfiler);
+
+    profilerOverlayAction = viewMenu->addAction("Frame Timings on Map");
+    profilerOverlayAction->setCheckable(true);
+    connect(profilerOverlayAction, &QAction::toggled, this, [this](bool checked) {
+        if (checked) profilerAction->setChecked(true);
+        if (mapView) mapView->setProfilerOverlay(checked);
+        for (MapView *view : extraMapViews) {
+            view->setProfilerOverlay(checked);
+        }
+    });
+
     // Layer Menu
     QMenu *layerMenu = menuBar->addMenu("Layer");
     layerMenu->addAction(QIcon(":/icons/new.png"), "Create Layer");
@@ -623,6 +733,11 @@ void MainWindow::setupToolBars()
     mapNavToolBar->addSeparator();
 
     QAction *identifyActionTB = mapNavToolBar->addAction(QIcon(":/icons/identity.png"), "Identify");
+    identifyActionTB->setCheckable(true);
+    if (identifyAction) {
+        connect(identifyActionTB, &QAction::toggled, identifyAction, &QAction::setChecked);
+        connect(identifyAction, &QAction::toggled, identifyActionTB, &QAction::setChecked);
+    }
     QAction *measureActionTB = mapNavToolBar->addAction(QIcon(":/icons/Measure.png"), "Measure");
     QAction *bookmarkActionTB = mapNavToolBar->addAction(QIcon(":/icons/bookmark.png"), "Bookmark", this, &MainWindow::onShowBookmarks);
 
@@ -901,7 +1016,7 @@ void MainWindow::setupDockWidgets()
     processingSearch->addAction(QIcon(":/icons/identity.png"), QLineEdit::LeadingPosition);
     processingLayout->addWidget(processingSearch);
 
-    QTreeWidget *processingTree = new QTreeWidget();
+    processingTree = new QTreeWidget();
     processingTree->setHeaderHidden(true);
 
     QTreeWidgetItem *geoProcessing = new QTreeWidgetItem(processingTree, QStringList() << "Geoprocessing");
@@ -920,9 +1035,35 @@ void MainWindow::setupDockWidgets()
     new QTreeWidgetItem(research, QStringList() << "Random Points");
     new QTreeWidgetItem(research, QStringList() << "Regular Points");
 
+    QTreeWidgetItem *rasterProcessing = new QTreeWidgetItem(processingTree, QStringList() << "Raster");
+    rasterProcessing->setIcon(0, QIcon(":/icons/processing.png"));
+    new QTreeWidgetItem(rasterProcessing, QStringList() << "Raster Calculator");
+
+    QTreeWidgetItem *terrainProcessing = new QTreeWidgetItem(processingTree, QStringList() << "Terrain");
+    terrainProcessing->setIcon(0, QIcon(":/icons/processing.png"));
+    new QTreeWidgetItem(terrainProcessing, QStringList() << "Hillshade");
+    new QTreeWidgetItem(terrainProcessing, QStringList() << "Slope");
+    new QTreeWidgetItem(terrainProcessing, QStringList() << "Aspect");
+
     processingTree->expandAll();
     processingLayout->addWidget(processingTree);
 
+    QLabel *jobsLabel = new QLabel("Jobs");
+    processingLayout->addWidget(jobsLabel);
+
+    processingJobsTree = new QTreeWidget();
+    processingJobsTree->setColumnCount(3);
+    processingJobsTree->setHeaderLabels(QStringList() << "Job" << "Progress" << "");
+    processingJobsTree->setRootIsDecorated(false);
+    processingJobsTree->setMaximumHeight(160);
+    processingJobsTree->header()->setStretchLastSection(false);
+    processingJobsTree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    processingLayout->addWidget(processingJobsTree);
+
+    QPushButton *clearJobsBtn = new QPushButton("Clear Finished");
+    connect(clearJobsBtn, &QPushButton::clicked, this, &MainWindow::onClearFinishedJobs);
+    processingLayout->addWidget(clearJobsBtn);
+
     processingToolboxDock->setWidget(processingWidget);
 
     // Layer Styling Dock
@@ -1032,6 +1173,34 @@ void MainWindow::setupDockWidgets()
     imagePropsLayout->addStretch();
 
     imagePropertiesDock->setWidget(imagePropsWidget);
+
+    // Profiler Dock: frame timeline, shown while profiling
+    profilerDock = new QDockWidget("Render Profiler", this);
+    profilerDock->setObjectName("RenderProfiler");
+    profilerDock->setAllowedAreas(Qt::BottomDockWidgetArea | Qt::TopDockWidgetArea);
+
+    QWidget *profilerWidget = new QWidget();
+    QVBoxLayout *profilerLayout = new QVBoxLayout(profilerWidget);
+    profilerLayout->setContentsMargins(5, 5, 5, 5);
+
+    QHBoxLayout *profilerButtons = new QHBoxLayout();
+    QPushButton *clearProfileBtn = new QPushButton("Clear");
+    QPushButton *exportTraceBtn = new QPushButton("Export Trace...");
+    connect(clearProfileBtn, &QPushButton::clicked, this, []() { Profiler::instance().clear(); });
+    connect(exportTraceBtn, &QPushButton::clicked, this, &MainWindow::onExportProfilerTrace);
+    profilerButtons->addWidget(clearProfileBtn);
+    profilerButtons->addWidget(exportTraceBtn);
+    profilerButtons->addStretch();
+    for (int p = 0; p < Profiler::PhaseCount; ++p) {
+        QLabel *legend = new QLabel(Profiler::phaseName(Profiler::Phase(p)));
+        legend->setStyleSheet(QString("border-left: 10px solid %1; padding-left: 4px;")
+                              .arg(ProfilerOverlay::phaseColor(Profiler::Phase(p)).name()));
+        profilerButtons->addWidget(legend);
+    }
+    profilerLayout->addLayout(profilerButtons);
+    profilerLayout->addWidget(new ProfilerTimeline());
+
+    profilerDock->setWidget(profilerWidget);
 }
 
 void MainWindow::setupCentralWidget()
@@ -1049,13 +1218,7 @@ void MainWindow::setupCentralWidget()
 
     // Create main map view
     mapScene = new QGraphicsScene(this);
-    mapView = new QGraphicsView(mapScene);
-    mapView->setRenderHint(QPainter::Antialiasing, true);
-    mapView->setDragMode(QGraphicsView::ScrollHandDrag);
-    mapView->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
-    mapView->setBackgroundBrush(QBrush(QColor(240, 240, 240)));
-    mapView->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
-    mapView->setResizeAnchor(QGraphicsView::AnchorUnderMouse);
+    mapView = createMapView();
     mapView->setContextMenuPolicy(Qt::CustomContextMenu);
 
     mapViewsTabWidget->addTab(mapView, "Map");
@@ -1064,6 +1227,90 @@ void MainWindow::setupCentralWidget()
     setCentralWidget(centralWidget);
 }
 
+MapView *MainWindow::createMapView()
+{
+    MapView *view = new MapView(mapScene);
+    view->setRenderHint(QPainter::Antialiasing, true);
+    view->setDragMode(QGraphicsView::ScrollHandDrag);
+    view->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+    view->setBackgroundBrush(QBrush(QColor(240, 240, 240)));
+    view->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+    view->setResizeAnchor(QGraphicsView::AnchorUnderMouse);
+    return view;
+}
+
+// The view in the front tab: zooming and fitting act on it
+MapView *MainWindow::currentMapView() const
+{
+    MapView *view = mapViewsTabWidget ? qobject_cast<MapView*>(mapViewsTabWidget->currentWidget()) : nullptr;
+    return view ? view : mapView;
+}
+
+MapView *MainWindow::mapViewForViewport(QObject *viewport) const
+{
+    if (mapView && viewport == mapView->viewport()) return mapView;
+    for (MapView *view : extraMapViews) {
+        if (viewport == view->viewport()) return view;
+    }
+    return nullptr;
+}
+
+// Another view of the same scene: layers, spatial indexes and raster tile
+// caches are the main view's, only the extent is its own
+void MainWindow::onNewMapView()
+{
+    if (!mapScene || !mapViewsTabWidget) return;
+
+    MapView *view = createMapView();
+    view->setWheelZoom(true);
+    view->setProfilerOverlay(mapView && mapView->profilerOverlay());
+    view->viewport()->installEventFilter(this);
+    connect(view, &MapView::viewChanged, this, &MainWindow::onMapViewChanged);
+    extraMapViews.append(view);
+
+    const int index = mapViewsTabWidget->addTab(view, QString("Map %1").arg(nextMapViewNumber++));
+    mapViewsTabWidget->setCurrentIndex(index);
+
+    // Once laid out: centring needs the viewport's size
+    QTimer::singleShot(0, view, [this, view]() {
+        if (mapView) view->showLike(mapView);
+    });
+
+    if (messageLabel) {
+        messageLabel->setText(linkMapViewsAction && linkMapViewsAction->isChecked()
+                              ? "New map view, linked to the others" : "New map view");
+    }
+}
+
+void MainWindow::onCloseMapViewTab(int index)
+{
+    // The main view stays
+    MapView *view = qobject_cast<MapView*>(mapViewsTabWidget->widget(index));
+    if (!view || view == mapView) return;
+
+    extraMapViews.removeAll(view);
+    mapViewsTabWidget->removeTab(index);
+    view->deleteLater();
+}
+
+// Linked views follow whichever one was panned or zoomed
+void MainWindow::onMapViewChanged(MapView *view)
+{
+    if (!linkMapViewsAction || !linkMapViewsAction->isChecked()) return;
+
+    QList<MapView*> views = extraMapViews;
+    if (mapView) views.prepend(mapView);
+    for (MapView *other : views) {
+        if (other != view) other->showLike(view);
+    }
+
+    if (view != mapView && mapView) {
+        currentScale = mapView->transform().m11();
+        updateMagnifier(qRound(currentScale * 100));
+        updateScale(currentScale);
+    }
+}
+
 void MainWindow::setupStatusBar()
 {
     // Get or create the main status bar
@@ -1523,6 +1770,7 @@ void MainWindow::onToggleCoordExtentDisplay(bool showCoordinates, QStackedWidget
 
 void MainWindow::onScaleChanged(const QString &text)
 {
+    MapView *view = currentMapView();
     if (text.isEmpty()) return;
 
     // Parse scale from text like "1:1000"
@@ -1532,9 +1780,9 @@ void MainWindow::onScaleChanged(const QString &text)
         double denominator = parts[1].toDouble(&ok);
         if (ok && denominator > 0) {
             double scale = 1.0 / denominator;
-            if (mapView) {
-                mapView->resetTransform();
-                mapView->scale(scale, scale);
+            if (view) {
+                view->resetTransform();
+                view->scale(scale, scale);
                 currentScale = scale;
 
                 // Update image info if needed
@@ -1555,9 +1803,9 @@ void MainWindow::onScaleChanged(const QString &text)
         bool ok;
         double scale = text.toDouble(&ok);
         if (ok && scale > 0) {
-            if (mapView) {
-                mapView->resetTransform();
-                mapView->scale(scale, scale);
+            if (view) {
+                view->resetTransform();
+                view->scale(scale, scale);
                 currentScale = scale;
 
                 // Update image info if needed
@@ -1669,6 +1917,44 @@ void MainWindow::setupConnections()
 
         // Install event filter for mouse tracking
         mapView->viewport()->installEventFilter(this);
+        connect(mapView, &MapView::viewChanged, this, &MainWindow::onMapViewChanged);
+    }
+
+    if (mapViewsTabWidget) {
+        connect(mapViewsTabWidget, &QTabWidget::tabCloseRequested, this, &MainWindow::onCloseMapViewTab);
+    }
+
+    // Processing toolbox
+    if (processingTree) {
+        connect(processingTree, &QTreeWidget::itemDoubleClicked,
+                this, &MainWindow::onProcessingAlgorithmActivated);
+    }
+
+    if (jobScheduler) {
+        connect(jobScheduler, &ProcessingJobScheduler::jobStarted,
+                this, &MainWindow::onProcessingJobStarted);
+        connect(jobScheduler, &ProcessingJobScheduler::jobProgress,
+                this, &MainWindow::onProcessingJobProgress);
+        connect(jobScheduler, &ProcessingJobScheduler::jobFinished,
+                this, &MainWindow::onProcessingJobFinished);
+    }
+
+    if (projectExporter) {
+        connect(projectExporter, &ProjectExporter::fileProgress,
+                this, &MainWindow::onProjectExportFileProgress);
+        connect(projectExporter, &ProjectExporter::fileFinished,
+                this, &MainWindow::onProjectExportFileFinished);
+        connect(projectExporter, &ProjectExporter::progress,
+                this, &MainWindow::onProjectExportProgress);
+        connect(projectExporter, &ProjectExporter::finished,
+                this, &MainWindow::onProjectExportFinished);
+    }
+
+    connect(this, &MainWindow::layerLoaded, this, &MainWindow::labelLayerItemsForProfiler);
+
+    if (mapExporter) {
+        connect(mapExporter, &MapExporter::progress, this, &MainWindow::onMapExportProgress);
+        connect(mapExporter, &MapExporter::finished, this, &MainWindow::onMapExportFinished);
     }
 }
 
@@ -1802,7 +2088,7 @@ void MainWindow::setupStatusBarShortcuts()
         if (coordinateMarker) {
             QRectF markerRect = coordinateMarker->boundingRect();
             QPointF center = coordinateMarker->mapToScene(markerRect.center());
-            mapView->centerOn(center);
+            if (MapView *view = currentMapView()) view->centerOn(center);
         }
     });
     // Toggle coordinate capture tool
@@ -2061,12 +2347,32 @@ void MainWindow::saveProject()
         return;
     }
 
-    // Save all layers
-    saveAllLayers();
+    int skipped = 0;
+    Project project = projectDocument(&skipped);
+
+    // By default only the project file is written; layers stay where they are
+    QStringList failed;
+    if (packageLayersAction && packageLayersAction->isChecked()) {
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        packageLayers(QFileInfo(currentProjectPath).absoluteDir().filePath("layers"), &project, &failed);
+        QApplication::restoreOverrideCursor();
+    }
+
+    QString errorMessage;
+    if (!ProjectFile::write(currentProjectPath, project, &errorMessage)) {
+        QMessageBox::critical(this, "Save Project", "Could not save project:\n" + errorMessage);
+        return;
+    }
 
-    // Here you would save the project file
-    QMessageBox::information(this, "Save Project",
-                             "Project saved: " + currentProjectName);
+    QString message = "Project saved: " + currentProjectName;
+    if (skipped > 0) {
+        message += QString("\n\n%1 memory layer(s) were not saved to a file and are not part of the project.")
+                .arg(skipped);
+    }
+    if (!failed.isEmpty()) {
+        message += "\n\nCould not package, still referenced in place: " + failed.join(", ");
+    }
+    QMessageBox::information(this, "Save Project", message);
 
     projectModified = false;  // Reset modified flag after saving
 
@@ -2075,8 +2381,21 @@ void MainWindow::saveProject()
     }
 }
 
-void MainWindow::loadProject(const QString &projectPath)
+bool MainWindow::loadProject(const QString &projectPath, int *layerCount)
 {
+    Project project;
+    QString errorMessage;
+    if (!ProjectFile::read(projectPath, &project, &errorMessage)) {
+        QMessageBox::warning(this, "Open Project",
+                             QString("Could not open project %1:\n%2").arg(projectPath, errorMessage));
+        return false;
+    }
+    if (layerCount) *layerCount = project.layers.size();
+
+    // Only the layer tree is rebuilt here; data sources open as layers
+    // become visible
+    restoreProject(project);
+
     QFileInfo fileInfo(projectPath);
     currentProjectName = fileInfo.baseName();
     currentProjectPath = projectPath;
@@ -2105,6 +2424,319 @@ void MainWindow::loadProject(const QString &projectPath)
 
     // Add to recent projects
     addRecentProject(projectPath);
+    return true;
+}
+
+// Extent of a layer in its own units, from what is already known or in
+// memory where possible
+static QRectF layerSourceExtent(const QString &type, const QString &filePath, const QVariantMap &properties,
+                                const QSharedPointer<FeatureBuffer> &features)
+{
+    if (properties.value("has_geotransform").toBool()) {
+        const double geoTransform[6] = {
+            properties.value("top_left_x").toDouble(), properties.value("pixel_width").toDouble(),
+            properties.value("rotation_x").toDouble(), properties.value("top_left_y").toDouble(),
+            properties.value("rotation_y").toDouble(), properties.value("pixel_height").toDouble()
+        };
+        return MapSettings::pixelToMap(geoTransform).mapRect(
+                    QRectF(0, 0, properties.value("width").toInt(), properties.value("height").toInt()));
+    }
+
+    if (features && !features->extent().isNull()) {
+        const Envelope extent = features->extent();
+        return QRectF(QPointF(extent.minX, extent.minY), QPointF(extent.maxX, extent.maxY));
+    }
+
+    QRectF extent;
+    if (type == "vector" && !filePath.isEmpty()) {
+        GDALDataset *dataset = (GDALDataset*)GDALOpenEx(filePath.toUtf8().constData(),
+                                                         GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                                                         nullptr, nullptr, nullptr);
+        OGRLayer *ogrLayer = dataset ? dataset->GetLayer(properties.value("layer_index").toInt()) : nullptr;
+        OGREnvelope envelope;
+        // Without forcing, formats with a stored extent answer from their header
+        if (ogrLayer && ogrLayer->GetExtent(&envelope, FALSE) == OGRERR_NONE) {
+            extent = QRectF(QPointF(envelope.MinX, envelope.MinY), QPointF(envelope.MaxX, envelope.MaxY));
+        }
+        if (dataset) GDALClose(dataset);
+    }
+    return extent;
+}
+
+Project MainWindow::projectDocument(int *skippedLayers) const
+{
+    Project project;
+    project.name = currentProjectName;
+    project.crs = mapSettings.destinationCrs();
+    if (mapView) {
+        const QRectF visible = mapView->mapToScene(mapView->viewport()->rect()).boundingRect();
+        project.viewExtent = mapSettings.sceneToMap(visible).normalized();
+    }
+
+    for (const LayerInfo &layer : loadedLayers) {
+        // In-memory results come back only once they are saved to a file
+        if (layer.filePath.isEmpty()) {
+            if (skippedLayers) ++*skippedLayers;
+            continue;
+        }
+
+        // Layers never opened keep what the project they came from stored
+        ProjectLayer entry = deferredLayers.value(layer.name);
+        entry.name = layer.name;
+        entry.type = layer.type;
+        entry.source = layer.filePath;
+
+        if (layer.treeItem) {
+            entry.group = layer.treeItem->parent() ? layer.treeItem->parent()->text(0) : QString();
+            entry.label = layer.treeItem->text(1);
+            entry.visible = layer.treeItem->checkState(0) == Qt::Checked;
+        }
+        if (layer.graphicsItem) {
+            entry.zValue = layer.graphicsItem->zValue();
+            entry.opacity = layer.graphicsItem->opacity();
+            if (FeatureBufferItem *vectorItem = dynamic_cast<FeatureBufferItem*>(layer.graphicsItem)) {
+                entry.color = vectorItem->color();
+            }
+        }
+
+        entry.properties = layer.properties;
+        entry.properties.remove("reprojected");
+        entry.properties.remove("reprojected_crs");
+        entry.properties.remove("dem_path");   // the layer's source
+        if (!deferredLayers.contains(layer.name)) {
+            const QRectF extent = layerSourceExtent(
+                        layer.type, layer.filePath, layer.properties,
+                        layer.memoryBuffer ? layer.memoryBuffer : layer.reprojectedBuffers.value(QString()));
+            if (extent.isValid()) {
+                entry.properties["extent"] = QVariantList() << extent.left() << extent.top()
+                                                            << extent.right() << extent.bottom();
+            }
+        }
+        project.layers.append(entry);
+    }
+    return project;
+}
+
+static QString layerIconPath(const QString &type)
+{
+    if (type == "vector" || type == "memory") return ":/icons/vector_layer.png";
+    if (type == "geotiff") return ":/icons/geotiff.png";
+    if (type == "georeferenced") return ":/icons/georeferenced.png";
+    return ":/icons/raster_layer.png";
+}
+
+void MainWindow::restoreProject(const Project &project)
+{
+    clearAllImages();
+
+    // Canvas CRS first, so layers opened later are drawn straight in it
+    QSharedPointer<const CrsDefinition> canvasCrs = CrsRegistry::instance().crs(project.crs);
+    if (canvasCrs) {
+        mapSettings.setDestinationCrs(project.crs, canvasCrs->wkt);
+        mapSettings.setDefaultSceneGrid(!canvasCrs->geographic);
+        if (projectionLabel) {
+            projectionLabel->setText("Render: " + getCRSDisplayName(project.crs));
+        }
+    } else {
+        mapSettings.setDestinationCrs(QString(), QString());
+        // Drawn as loaded: keep the pixel grid of the project's GeoTIFF
+        for (const ProjectLayer &entry : project.layers) {
+            if (entry.type == "geotiff" && entry.properties.value("has_geotransform").toBool()) {
+                const double geoTransform[6] = {
+                    entry.properties.value("top_left_x").toDouble(), entry.properties.value("pixel_width").toDouble(),
+                    entry.properties.value("rotation_x").toDouble(), entry.properties.value("top_left_y").toDouble(),
+                    entry.properties.value("rotation_y").toDouble(), entry.properties.value("pixel_height").toDouble()
+                };
+                mapSettings.setSceneGrid(geoTransform);
+                break;
+            }
+        }
+    }
+
+    // The tree is filled in one go with its signals blocked: checking an
+    // item here must not open its layer
+    QSignalBlocker blocker(layersTree);
+    layersTree->setUpdatesEnabled(false);
+
+    QHash<QString, QTreeWidgetItem*> groups;
+    for (int i = 0; i < layersTree->topLevelItemCount(); ++i) {
+        groups.insert(layersTree->topLevelItem(i)->text(0), layersTree->topLevelItem(i));
+    }
+
+    loadedLayers.reserve(project.layers.size());
+    QStringList openNames;
+    for (const ProjectLayer &entry : project.layers) {
+        LayerInfo layer;
+        layer.name = entry.name;
+        layer.type = entry.type;
+        layer.filePath = entry.source;
+        layer.properties = entry.properties;
+
+        QTreeWidgetItem *layerItem = new QTreeWidgetItem(QStringList() << entry.name << entry.label);
+        layerItem->setCheckState(0, entry.visible ? Qt::Checked : Qt::Unchecked);
+        layerItem->setIcon(0, QIcon(layerIconPath(entry.type)));
+        layerItem->setToolTip(0, entry.source);
+        layer.treeItem = layerItem;
+
+        QString groupName = entry.group;
+        if (groupName.isEmpty()) {
+            groupName = entry.type == "vector" || entry.type == "memory" ? "Vector Layers" : "Raster Layers";
+        }
+        QTreeWidgetItem *group = groups.value(groupName);
+        if (!group) {
+            group = new QTreeWidgetItem(layersTree, QStringList() << groupName);
+            group->setIcon(0, QIcon(":/icons/folder.png"));
+            group->setExpanded(true);
+            groups.insert(groupName, group);
+        }
+        group->addChild(layerItem);
+
+        loadedLayers.append(layer);
+        deferredLayers.insert(entry.name, entry);
+        if (entry.visible) {
+            openNames.append(entry.name);
+        }
+    }
+
+    layersTree->setUpdatesEnabled(true);
+
+    deferredViewExtent = project.viewExtent;
+    openDeferredLayersInBackground(openNames);
+}
+
+// Visible project layers open in parallel on the loader pool. Each is added
+// to the scene as it comes in; the view is fitted once, after the last.
+void MainWindow::openDeferredLayersInBackground(const QStringList &names)
+{
+    const int generation = ++deferredOpenGeneration;
+    deferredOpenPending = 0;
+
+    QPointer<MainWindow> self(this);
+    for (const LayerInfo &layer : loadedLayers) {
+        if (!names.contains(layer.name)) continue;
+        ++deferredOpenPending;
+
+        const QString name = layer.name;
+        const QString type = layer.type;
+        const QString filePath = layer.filePath;
+        const QVariantMap properties = layer.properties;
+        layerOpenPool.start([this, self, generation, name, type, filePath, properties]() {
+            const LoadedLayer loaded = LayerLoader::load(name, type, filePath, properties);
+            QMetaObject::invokeMethod(this, [self, generation, loaded]() {
+                if (self) self->finishDeferredLayer(generation, loaded);
+            }, Qt::QueuedConnection);
+        });
+    }
+
+    if (deferredOpenPending == 0) {
+        finishDeferredLayer(generation, LoadedLayer());
+    } else if (messageLabel) {
+        messageLabel->setText(QString("Opening %1 layers").arg(deferredOpenPending));
+    }
+}
+
+void MainWindow::finishDeferredLayer(int generation, const LoadedLayer &loaded)
+{
+    // A result for a project that has since been closed
+    if (generation != deferredOpenGeneration) return;
+
+    if (!loaded.name.isEmpty()) {
+        --deferredOpenPending;
+        for (LayerInfo &layer : loadedLayers) {
+            // Removed, or opened already by being shown, while it loaded
+            if (layer.name != loaded.name || !deferredLayers.contains(layer.name)) continue;
+
+            QString errorMessage;
+            if (!addLoadedLayer(layer, loaded, &errorMessage) && messageLabel) {
+                messageLabel->setText(QString("Could not open %1: %2").arg(layer.name, errorMessage));
+            } else if (messageLabel && deferredOpenPending > 0) {
+                messageLabel->setText(QString("Opened %1 (%2 more)").arg(layer.name).arg(deferredOpenPending));
+            }
+            break;
+        }
+    }
+    if (deferredOpenPending > 0) return;
+    labelLayerItemsForProfiler();
+
+    // Every visible layer is open: show what the project showed
+    if (deferredViewExtent.isValid() && mapView) {
+        mapView->fitInView(mapSettings.mapToScene(deferredViewExtent), Qt::KeepAspectRatio);
+        currentScale = mapView->transform().m11();
+        updateMagnifier(qRound(currentScale * 100));
+        updateScale(currentScale);
+    } else {
+        fitAllImages();
+    }
+    deferredViewExtent = QRectF();
+}
+
+bool MainWindow::openDeferredLayer(LayerInfo &layer, QString *errorMessage)
+{
+    if (!deferredLayers.contains(layer.name)) return true;
+    return addLoadedLayer(layer, LayerLoader::load(layer.name, layer.type, layer.filePath, layer.properties),
+                          errorMessage);
+}
+
+// Makes the graphics item of a deferred layer from its opened data source
+bool MainWindow::addLoadedLayer(LayerInfo &layer, const LoadedLayer &loaded, QString *errorMessage)
+{
+    if (!loaded.errorMessage.isEmpty()) {
+        if (errorMessage) *errorMessage = loaded.errorMessage;
+        return false;
+    }
+    const ProjectLayer entry = deferredLayers.value(layer.name);
+    for (auto it = loaded.properties.constBegin(); it != loaded.properties.constEnd(); ++it) {
+        layer.properties.insert(it.key(), it.value());
+    }
+
+    QGraphicsItem *item = nullptr;
+    if (loaded.features) {
+        // A memory layer saved to a file comes back as a memory layer
+        if (layer.type == "memory") {
+            layer.memoryBuffer = loaded.features;
+        } else {
+            layer.reprojectedBuffers.insert(QString(), loaded.features);
+        }
+
+        const QColor color = entry.color.isValid() ? entry.color
+                                                   : FeatureBufferItem::defaultColor(loaded.features->geometryType());
+        FeatureBufferItem *vectorItem = new FeatureBufferItem(loaded.features, color);
+        vectorItem->setTransform(mapSettings.mapToSceneTransform());
+        item = vectorItem;
+    } else if (loaded.tiles) {
+        TiledRasterItem *rasterItem = new TiledRasterItem(loaded.tiles);
+        rasterItem->setTransform(mapSettings.rasterToScene(loaded.geoTransform));
+        item = rasterItem;
+        if (layer.type == "terrain") {
+            layer.properties["dem_path"] = LayerLoader::rasterDataset(layer.filePath, layer.properties);
+        }
+    } else if (!loaded.image.isNull()) {
+        QGraphicsPixmapItem *pixmapItem = new QGraphicsPixmapItem(QPixmap::fromImage(loaded.image));
+        if (loaded.hasGeoTransform) {
+            pixmapItem->setTransform(mapSettings.rasterToScene(loaded.geoTransform));
+        }
+        item = pixmapItem;
+    } else {
+        if (errorMessage) *errorMessage = "Nothing to open for " + layer.filePath;
+        return false;
+    }
+
+    item->setZValue(entry.zValue);
+    item->setOpacity(entry.opacity);
+    mapSettings.markPlaced(item);
+    mapScene->addItem(item);
+
+    layer.graphicsItem = item;
+    deferredLayers.remove(layer.name);
+
+    const bool visible = !layer.treeItem || layer.treeItem->checkState(0) == Qt::Checked;
+    if (!mapSettings.destinationCrs().isEmpty()) {
+        QString reprojectError;
+        reprojectLayer(layer, mapSettings.destinationCrs(), mapSettings.destinationWkt(), &reprojectError);
+    } else {
+        applyReprojectedVisibility(layer, visible);
+    }
+    return true;
 }
 
 void MainWindow::addRecentProject(const QString &projectPath)
@@ -2337,22 +2969,23 @@ void MainWindow::loadRasterFile(const QString &filePath)
         memcpy(georefInfo.geoTransform, geoTransform, sizeof(double) * 6);
         georefInfo.projection = projection;
 
+        // The main GeoTIFF defines the scene grid; everything drawn so far
+        // moves onto it
+        if (isMainGeoTIFF) {
+            mapSettings.setSceneGrid(geoTransform);
+            reanchorLayers();
+        }
+
         // Position the image based on geotransform
-        double topLeftX = geoTransform[0];
-        double topLeftY = geoTransform[3];
-
-        // Convert to scene coordinates
-        QPointF scenePos = geographicToSceneCoords(topLeftX, topLeftY);
-        if (!scenePos.isNull()) {
-            pixmapItem->setPos(scenePos);
-
-            // If it's the main GeoTIFF, store it
-            if (isMainGeoTIFF) {
-                geoTIFFItem = pixmapItem;
-                currentImageItem = pixmapItem;
-                currentImagePath = filePath;
-                currentPixmap = pixmap;
-            }
+        pixmapItem->setTransform(mapSettings.rasterToScene(geoTransform));
+        mapSettings.markPlaced(pixmapItem);
+
+        // If it's the main GeoTIFF, store it
+        if (isMainGeoTIFF) {
+            geoTIFFItem = pixmapItem;
+            currentImageItem = pixmapItem;
+            currentImagePath = filePath;
+            currentPixmap = pixmap;
         }
     }
 
@@ -2457,7 +3090,8 @@ void MainWindow::loadRasterFile(const QString &filePath)
 }
 void MainWindow::fitAllGeoreferencedImages()
 {
-    if (!mapView || !mapScene || georeferencedImagesInfo.isEmpty()) return;
+    MapView *view = currentMapView();
+    if (!view || !mapScene || georeferencedImagesInfo.isEmpty()) return;
 
     // Find bounds of all georeferenced images in scene coordinates
     QRectF sceneBounds;
@@ -2479,9 +3113,9 @@ void MainWindow::fitAllGeoreferencedImages()
     }
 
     // Also include any vector layers
-    for (QGraphicsItem *item : currentVectorItems) {
-        if (item) {
-            sceneBounds = sceneBounds.united(item->boundingRect());
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.type == "vector" && layer.shownItem()) {
+            sceneBounds = sceneBounds.united(layer.shownItem()->sceneBoundingRect());
         }
     }
 
@@ -2490,8 +3124,8 @@ void MainWindow::fitAllGeoreferencedImages()
         double padding = qMax(sceneBounds.width(), sceneBounds.height()) * 0.1;
         sceneBounds.adjust(-padding, -padding, padding, padding);
 
-        mapView->fitInView(sceneBounds, Qt::KeepAspectRatio);
-        currentScale = mapView->transform().m11();
+        view->fitInView(sceneBounds, Qt::KeepAspectRatio);
+        currentScale = view->transform().m11();
         updateMagnifier(qRound(currentScale * 100));
         updateScale(currentScale);
     }
@@ -2522,6 +3156,23 @@ void MainWindow::addLayerToScene(const LayerInfo &layer)
 
 void MainWindow::updateLayerVisibility(const QString &layerName, bool visible)
 {
+    for (LayerInfo &layer : loadedLayers) {
+        if (layer.name != layerName) continue;
+
+        // Project layers open the first time they are shown
+        if (visible && deferredLayers.contains(layer.name)) {
+            QString errorMessage;
+            if (!openDeferredLayer(layer, &errorMessage)) {
+                if (messageLabel) {
+                    messageLabel->setText(QString("Could not open %1: %2").arg(layer.name, errorMessage));
+                }
+                return;
+            }
+        }
+        applyReprojectedVisibility(layer, visible);
+        return;
+    }
+
     //    LayerInfo *layer = getLayerByName(layerName);
     //    if (layer && layer->graphicsItem) {
     //        layer->graphicsItem->setVisible(visible);
@@ -2536,6 +3187,11 @@ void MainWindow::removeLayer(const QString &layerName)
             LayerInfo &layer = loadedLayers[i];
 
             // Remove from scene
+            if (layer.reprojectedItem) {
+                mapScene->removeItem(layer.reprojectedItem);
+                delete layer.reprojectedItem;
+                layer.reprojectedItem = nullptr;
+            }
             if (layer.graphicsItem) {
                 mapScene->removeItem(layer.graphicsItem);
                 delete layer.graphicsItem;
@@ -2553,6 +3209,7 @@ void MainWindow::removeLayer(const QString &layerName)
             }
 
             // Remove from list
+            deferredLayers.remove(layerName);
             loadedLayers.removeAt(i);
             projectModified = true;  // Mark project as modified
 
@@ -2574,10 +3231,11 @@ void MainWindow::removeLayer(const QString &layerName)
 
 void MainWindow::fitImageToView()
 {
-    if (!currentImageItem || !mapView) return;
+    MapView *view = currentMapView();
+    if (!currentImageItem || !view) return;
 
-    mapView->fitInView(currentImageItem, Qt::KeepAspectRatio);
-    currentScale = mapView->transform().m11();
+    view->fitInView(currentImageItem, Qt::KeepAspectRatio);
+    currentScale = view->transform().m11();
     updateMagnifier(qRound(currentScale * 100));
     updateScale(currentScale);
 
@@ -2616,53 +3274,23 @@ void MainWindow::saveAllLayers()
         dir.mkpath(".");
     }
 
-    // Create layers subdirectory
-    QString layersDir = QDir(projectDir).filePath("layers");
-    if (!QDir(layersDir).exists()) {
-        QDir(layersDir).mkpath(".");
-    }
-
-    // Save each layer
-    int savedCount = 0;
-    for (int i = 0; i < loadedLayers.size(); ++i) {
-        const LayerInfo &layer = loadedLayers[i];
-        QString savePath = QDir(layersDir).filePath(
-                    layer.name + "." + QFileInfo(layer.filePath).suffix());
-
-        if (QFile::copy(layer.filePath, savePath)) {
-            savedCount++;
-
-            if (messageLabel) {
-                messageLabel->setText("Saved: " + layer.name);
-            }
-        } else {
-            QMessageBox::warning(this, "Save Error",
-                                 "Could not save layer: " + layer.name);
-        }
+    // Place each layer in the layers subdirectory; files saved before and
+    // not changed since are left alone
+    Project project = projectDocument();
+    QStringList failed;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    packageLayers(QDir(projectDir).filePath("layers"), &project, &failed);
+    QApplication::restoreOverrideCursor();
+    const int savedCount = project.layers.size() - failed.size();
+    if (!failed.isEmpty()) {
+        QMessageBox::warning(this, "Save Error", "Could not save layers: " + failed.join(", "));
     }
 
-    // Save project file
     QString projectFile = QDir(projectDir).filePath(currentProjectName + ".qgz");
-    QFile file(projectFile);
-    if (file.open(QIODevice::WriteOnly)) {
-        // Save project metadata
-        QTextStream stream(&file);
-        stream << "# QGIS Project File\n";
-        stream << "Project: " << currentProjectName << "\n";
-        stream << "Created: " << QDateTime::currentDateTime().toString() << "\n";
-        stream << "Layers: " << loadedLayers.size() << "\n";
-        stream << "\n";
-
-        for (int i = 0; i < loadedLayers.size(); ++i) {
-            const LayerInfo &layer = loadedLayers[i];
-            stream << "Layer: " << layer.name << "\n";
-            stream << "  Type: " << layer.type << "\n";
-            stream << "  File: " << layer.filePath << "\n";
-            stream << "\n";
-        }
-
-        file.close();
-
+    QString errorMessage;
+    if (!ProjectFile::write(projectFile, project, &errorMessage)) {
+        QMessageBox::warning(this, "Save Error", "Could not write project file:\n" + errorMessage);
+    } else {
         // Add to recent projects
         addRecentProject(projectFile);
 
@@ -2673,37 +3301,170 @@ void MainWindow::saveAllLayers()
     }
 }
 
+// Places every layer's files (with their sidecars) in 'layersDir' and
+// points the project at them. Returns how many files were written; files
+// already there and unchanged cost a stat each.
+int MainWindow::packageLayers(const QString &layersDir, Project *project, QStringList *failedLayers)
+{
+    int written = 0;
+    QHash<QString, QString> placed;   // source -> packaged file, for sources shared by layers
+    for (ProjectLayer &entry : project->layers) {
+        const QString source = QFileInfo(entry.source).absoluteFilePath();
+        if (placed.contains(source)) {
+            entry.source = placed.value(source);
+            continue;
+        }
+
+        const QStringList files = ProjectPackage::datasetFiles(source);
+        if (files.isEmpty()) {
+            if (failedLayers) *failedLayers << entry.name;
+            continue;
+        }
+
+        QString target;
+        bool ok = true;
+        for (const QString &file : files) {
+            const QString path = QDir(layersDir).filePath(
+                        ProjectPackage::packagedFileName(entry.name, source, file));
+            if (target.isEmpty()) target = path;
+
+            const ProjectPackage::Transfer transfer = ProjectPackage::placeFile(file, path);
+            if (transfer == ProjectPackage::Failed) {
+                ok = false;
+                break;
+            }
+            if (transfer != ProjectPackage::Unchanged) ++written;
+        }
+
+        if (!ok) {
+            if (failedLayers) *failedLayers << entry.name;
+            continue;
+        }
+        if (messageLabel) {
+            messageLabel->setText("Saved: " + entry.name);
+        }
+        placed.insert(source, target);
+        entry.source = target;
+    }
+    return written;
+}
+
 QString MainWindow::getGeoTIFFFilesFilter()
 {
     return tr("GeoTIFF Files (*.tif *.tiff *.geotiff);;"
               "All Files (*)");
 }
 
-void MainWindow::exportProject(const QString &directory)
+void MainWindow::exportProject(const QString &directory, bool geoPackage)
 {
-    // Create export directory
-    QString exportDir = QDir(directory).filePath(
-                currentProjectName + "_export_" +
-                QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"));
+    if (projectExporter->isRunning()) {
+        QMessageBox::information(this, "Export Project", "An export is already running.");
+        exportProgressDialog->raise();
+        return;
+    }
+
+    // One directory per project, so exporting again resumes an interrupted
+    // export or brings a finished one up to date
+    QString exportDir = QDir(directory).filePath(currentProjectName + "_export");
     QDir dir(exportDir);
     if (!dir.exists()) {
         dir.mkpath(".");
     }
 
-    // Create layers subdirectory
-    QString layersExportDir = QDir(exportDir).filePath("layers");
-    QDir(layersExportDir).mkpath(".");
+    if (!projectExporter->start(projectDocument(), exportDir,
+                                geoPackage ? ProjectExporter::GeoPackage : ProjectExporter::LayerFiles)) {
+        return;
+    }
 
-    // Export layers
-    int exportedCount = 0;
-    for (int i = 0; i < loadedLayers.size(); ++i) {
-        const LayerInfo &layer = loadedLayers[i];
-        QString exportPath = QDir(layersExportDir).filePath(
-                    layer.name + "." + QFileInfo(layer.filePath).suffix());
+    if (!exportProgressDialog) {
+        exportProgressDialog = new QDialog(this);
+        exportProgressDialog->resize(600, 400);
+        QVBoxLayout *layout = new QVBoxLayout(exportProgressDialog);
 
-        if (QFile::copy(layer.filePath, exportPath)) {
-            exportedCount++;
-        }
+        exportProgressBar = new QProgressBar();
+        exportProgressBar->setRange(0, 1000);
+        exportProgressBar->setFormat("%p%");
+        layout->addWidget(exportProgressBar);
+
+        exportFilesTree = new QTreeWidget();
+        exportFilesTree->setHeaderLabels(QStringList() << "File" << "Size" << "Status");
+        exportFilesTree->setRootIsDecorated(false);
+        exportFilesTree->setUniformRowHeights(true);
+        exportFilesTree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+        layout->addWidget(exportFilesTree);
+
+        QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Cancel);
+        connect(buttons, &QDialogButtonBox::rejected, projectExporter, &ProjectExporter::cancel);
+        layout->addWidget(buttons);
+    }
+
+    // One row per file, filled in as the pool works through them
+    const QVector<ProjectExporter::File> files = projectExporter->files();
+    exportFilesTree->clear();
+    exportFileItems.clear();
+    for (const ProjectExporter::File &file : files) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(exportFilesTree, QStringList()
+                                                    << file.path
+                                                    << QLocale().formattedDataSize(file.size)
+                                                    << (file.state == ProjectExporter::Failed ? file.errorMessage
+                                                                                              : QString("Queued")));
+        item->setToolTip(0, file.source);
+        exportFileItems.append(item);
+    }
+    exportProgressBar->setValue(0);
+    exportProgressDialog->setWindowTitle("Exporting " + currentProjectName);
+    exportProgressDialog->show();
+}
+
+void MainWindow::onProjectExportFileProgress(int index, qint64 bytesDone, qint64 bytesTotal)
+{
+    if (index < 0 || index >= exportFileItems.size()) return;
+    const int percent = bytesTotal > 0 ? int(bytesDone * 100 / bytesTotal) : 100;
+    exportFileItems[index]->setText(2, QString("%1%").arg(percent));
+}
+
+void MainWindow::onProjectExportFileFinished(int index, int state)
+{
+    if (index < 0 || index >= exportFileItems.size()) return;
+    QString status;
+    switch (state) {
+    case ProjectExporter::Copied: status = "Copied"; break;
+    case ProjectExporter::Skipped: status = "Unchanged"; break;
+    case ProjectExporter::Canceled: status = "Canceled"; break;
+    default: {
+        const QVector<ProjectExporter::File> files = projectExporter->files();
+        status = "Failed: " + files.value(index).errorMessage;
+        break;
+    }
+    }
+    exportFileItems[index]->setText(2, status);
+}
+
+void MainWindow::onProjectExportProgress(qint64 bytesDone, qint64 bytesTotal)
+{
+    exportProgressBar->setValue(bytesTotal > 0 ? int(bytesDone * 1000 / bytesTotal) : 1000);
+}
+
+void MainWindow::onProjectExportFinished(bool success)
+{
+    const QString exportDir = projectExporter->directory();
+    const QVector<ProjectExporter::File> files = projectExporter->files();
+    int copied = 0, unchanged = 0, failed = 0;
+    for (const ProjectExporter::File &file : files) {
+        if (file.state == ProjectExporter::Copied) ++copied;
+        else if (file.state == ProjectExporter::Skipped) ++unchanged;
+        else ++failed;
+    }
+
+    // The exported project points at the exported files
+    Project project = projectExporter->exportedProject();
+    int exportedCount = 0;
+    for (const ProjectLayer &layer : project.layers) {
+        if (layer.source.startsWith(QDir(exportDir).filePath("layers"))) ++exportedCount;
+    }
+    QString errorMessage;
+    if (!ProjectFile::write(QDir(exportDir).filePath(currentProjectName + ".qgz"), project, &errorMessage)) {
+        QMessageBox::warning(this, "Export Error", "Could not write project file:\n" + errorMessage);
     }
 
     // Create project metadata file
@@ -2747,6 +3508,7 @@ void MainWindow::exportProject(const QString &directory)
         stream << "\n";
         stream << "Directory Structure:\n";
         stream << "- layers/: Contains all exported layer files\n";
+        stream << "- manifest.json: Exported files with their xxHash checksums\n";
         stream << "- project_export.txt: Project metadata and layer information\n";
         stream << "- README.txt: This file\n";
         stream << "\n";
@@ -2759,12 +3521,25 @@ void MainWindow::exportProject(const QString &directory)
 
     emit projectExported(exportDir);
 
-    QMessageBox::information(this, "Export Complete",
+    exportProgressDialog->hide();
+    if (success) {
+        QMessageBox::information(this, "Export Complete",
+                                 QString("Project exported to:\n%1\n\n"
+                                         "%2 files copied, %3 unchanged.\n\n"
+                                         "Project metadata saved in project_export.txt")
+                                 .arg(exportDir)
+                                 .arg(copied)
+                                 .arg(unchanged));
+    } else {
+        QMessageBox::warning(this, "Export Incomplete",
                              QString("Project exported to:\n%1\n\n"
-                                     "%2 layers exported.\n\n"
-                                     "Project metadata saved in project_export.txt")
+                                     "%2 files copied, %3 unchanged, %4 not exported.\n\n"
+                                     "Export to the same directory again to resume.")
                              .arg(exportDir)
-                             .arg(exportedCount));
+                             .arg(copied)
+                             .arg(unchanged)
+                             .arg(failed));
+    }
 }
 
 void MainWindow::importProject(const QString &directory)
@@ -2778,29 +3553,71 @@ void MainWindow::importProject(const QString &directory)
         return;
     }
 
+    // An export is checked against its manifest before anything opens, so
+    // a partial copy is reported rather than showing up as broken layers
+    const QStringList changed = ProjectExporter::changedFiles(directory);
+    if (!changed.isEmpty()) {
+        QMessageBox::warning(this, "Import Project",
+                             QString("%1 file(s) of this export are missing or differ from its manifest:\n%2")
+                             .arg(changed.size()).arg(changed.mid(0, 10).join("\n")));
+    }
+
     QString projectFile = dir.filePath(projectFiles.first());
-    loadProject(projectFile);
+    int projectLayers = 0;
+    const bool loaded = loadProject(projectFile, &projectLayers);
+
+    // The project lists its layers itself; the directory scan is only for
+    // exports without them or whose project file cannot be read
+    if (loaded && projectLayers > 0) {
+        return;
+    }
 
-    // Look for layers directory
-    QString layersDir = dir.filePath("layers");
-    if (QDir(layersDir).exists()) {
-        // Load all supported files from layers directory
-        QStringList filters;
-        filters << "*.shp" << "*.svg" << "*.ai" << "*.eps" << "*.pdf"
-                << "*.jpg" << "*.jpeg" << "*.png" << "*.gif" << "*.tif" << "*.tiff" << "*.bmp";
+    QDir layersDir(dir.filePath("layers"));
+    if (!layersDir.exists()) {
+        return;
+    }
 
-        QStringList layerFiles = QDir(layersDir).entryList(filters, QDir::Files);
+    // Vector and raster files are restored as one project, so they open in
+    // parallel and the view is fitted once; drawings load one by one
+    const QStringList vectorSuffixes = {"shp", "gpkg", "geojson", "json", "kml", "gml"};
+    const QStringList rasterSuffixes = {"jpg", "jpeg", "png", "gif", "tif", "tiff", "bmp"};
+    const QStringList drawingSuffixes = {"svg", "ai", "eps", "pdf"};
 
-        int loadedCount = 0;
-        for (const QString &layerFile : layerFiles) {
-            QString filePath = QDir(layersDir).filePath(layerFile);
-            loadFile(filePath);
-            loadedCount++;
+    Project project;
+    project.name = QFileInfo(projectFile).completeBaseName();
+    QStringList drawings;
+    QSet<QString> names;
+    for (const QFileInfo &info : layersDir.entryInfoList(QDir::Files, QDir::Name)) {
+        const QString suffix = info.suffix().toLower();
+        if (drawingSuffixes.contains(suffix)) {
+            drawings.append(info.absoluteFilePath());
+            continue;
         }
+        const bool vector = vectorSuffixes.contains(suffix);
+        if (!vector && !rasterSuffixes.contains(suffix)) continue;
 
-        if (messageLabel) {
-            messageLabel->setText(QString("Imported project with %1 layers").arg(loadedCount));
+        ProjectLayer entry;
+        entry.name = info.completeBaseName();
+        for (int n = 2; names.contains(entry.name); ++n) {
+            entry.name = QString("%1 (%2)").arg(info.completeBaseName()).arg(n);
         }
+        names.insert(entry.name);
+        entry.type = vector ? "vector" : "raster";
+        entry.label = vector ? "Vector" : "Raster";
+        entry.source = info.absoluteFilePath();
+        project.layers.append(entry);
+    }
+
+    if (!project.layers.isEmpty()) {
+        restoreProject(project);
+    }
+    for (const QString &filePath : drawings) {
+        loadFile(filePath);
+    }
+
+    if (messageLabel) {
+        messageLabel->setText(QString("Imported project with %1 layers")
+                              .arg(project.layers.size() + drawings.size()));
     }
 }
 
@@ -2944,8 +3761,16 @@ void MainWindow::onExportProject()
                                                         getSaveLocation(),
                                                         QFileDialog::ShowDirsOnly);
 
-    if (!saveDir.isEmpty()) {
-        exportProject(saveDir);
+    if (saveDir.isEmpty()) {
+        return;
+    }
+
+    const QStringList modes = QStringList() << "Copy layer files as they are"
+                                            << "Consolidate layers into one GeoPackage";
+    bool ok = false;
+    const QString mode = QInputDialog::getItem(this, "Export Project", "Layers:", modes, 0, false, &ok);
+    if (ok) {
+        exportProject(saveDir, mode == modes[1]);
     }
 }
 
@@ -2967,6 +3792,14 @@ void MainWindow::onSaveLayer()
     QTreeWidgetItem *currentItem = layersTree->currentItem();
     if (currentItem && currentItem->parent()) {
         QString layerName = currentItem->text(0);
+
+        for (LayerInfo &layer : loadedLayers) {
+            if (layer.name == layerName && layer.type == "memory") {
+                saveMemoryLayer(layer);
+                return;
+            }
+        }
+
         //        LayerInfo *layer = getLayerByName(layerName);
 
         //        if (layer) {
@@ -2990,38 +3823,28 @@ void MainWindow::onSaveLayerAs()
 
 void MainWindow::onExportToPdf()
 {
+    if (!mapView || !mapScene) return;
+    if (mapExporter->isRunning()) {
+        QMessageBox::information(this, "Export to PDF", "A map export is already running.");
+        return;
+    }
+
     QString fileName = QFileDialog::getSaveFileName(this,
                                                     "Export to PDF",
                                                     QDir(getSaveLocation()).filePath(currentProjectName + "_export.pdf"),
-                                                    "PDF Files (*.pdf);;All Files (*)");
+                                                    "PDF Files (*.pdf)");
 
     if (!fileName.isEmpty()) {
-        // In a real QGIS app, this would export the map to PDF
-        QMessageBox::information(this, "Export PDF",
-                                 "Map would be exported to PDF: " + fileName);
-
-        if (messageLabel) {
-            messageLabel->setText("Exported to PDF: " + fileName);
+        if (QFileInfo(fileName).suffix().toLower() != "pdf") {
+            fileName += ".pdf";
         }
+        exportMapToFile(fileName);
     }
 }
 
 void MainWindow::onExportToImage()
 {
-    //    QString fileName = QFileDialog->getSaveFileName(this,
-    //        "Export to Image",
-    //        QDir(getSaveLocation()).filePath(currentProjectName + "_export.png"),
-    //        "PNG Files (*.png);;JPEG Files (*.jpg *.jpeg);;All Files (*)");
-
-    //    if (!fileName.isEmpty()) {
-    //        // In a real QGIS app, this would export the map view to an image
-    //        QMessageBox::information(this, "Export Image",
-    //            "Map would be exported to image: " + fileName);
-
-    //        if (messageLabel) {
-    //            messageLabel->setText("Exported to image: " + fileName);
-    //        }
-    //    }
+    onExportMap();
 }
 
 void MainWindow::onSaveAllLayers()
@@ -3105,10 +3928,11 @@ void MainWindow::onRotateRight()
 
 void MainWindow::onZoomImageIn()
 {
-    if (!mapView) return;
+    MapView *view = currentMapView();
+    if (!view) return;
 
-    mapView->scale(1.2, 1.2);
-    currentScale *= 1.2;
+    view->scale(1.2, 1.2);
+    currentScale = view->transform().m11();
 
     // Update status bar
     updateMagnifier(qRound(currentScale * 100));
@@ -3122,10 +3946,11 @@ void MainWindow::onZoomImageIn()
 
 void MainWindow::onZoomImageOut()
 {
-    if (!mapView) return;
+    MapView *view = currentMapView();
+    if (!view) return;
 
-    mapView->scale(1/1.2, 1/1.2);
-    currentScale /= 1.2;
+    view->scale(1/1.2, 1/1.2);
+    currentScale = view->transform().m11();
 
     // Update status bar
     updateMagnifier(qRound(currentScale * 100));
@@ -3139,9 +3964,10 @@ void MainWindow::onZoomImageOut()
 
 void MainWindow::onResetZoom()
 {
-    if (!mapView || !currentImageItem) return;
+    MapView *view = currentMapView();
+    if (!view || !currentImageItem) return;
 
-    mapView->resetTransform();
+    view->resetTransform();
     currentScale = 1.0;
 
     // Re-apply rotation if any
@@ -3200,9 +4026,10 @@ void MainWindow::onPanMap()
 
 void MainWindow::onZoomIn()
 {
-    if (mapView) {
-        mapView->scale(1.2, 1.2);
-        currentScale *= 1.2;
+    MapView *view = currentMapView();
+    if (view) {
+        view->scale(1.2, 1.2);
+        currentScale = view->transform().m11();
         updateScale(currentScale);
         updateMagnifier(qRound(currentScale * 100));
     }
@@ -3210,9 +4037,10 @@ void MainWindow::onZoomIn()
 
 void MainWindow::onZoomOut()
 {
-    if (mapView) {
-        mapView->scale(1/1.2, 1/1.2);
-        currentScale /= 1.2;
+    MapView *view = currentMapView();
+    if (view) {
+        view->scale(1/1.2, 1/1.2);
+        currentScale = view->transform().m11();
         updateScale(currentScale);
         updateMagnifier(qRound(currentScale * 100));
     }
@@ -3397,256 +4225,181 @@ void MainWindow::onOpenGeoTIFF()
                                                     lastUsedDirectory,
                                                     "GeoTIFF Files (*.tif *.tiff *.geotiff);;All Files (*)");
 
-    if (!fileName.isEmpty()) {
-        lastUsedDirectory = QFileInfo(fileName).path();
-
-        // Close any previously loaded GDAL dataset
-        if (gdalDataset) {
-            GDALClose(gdalDataset);
-            gdalDataset = nullptr;
-        }
+    if (fileName.isEmpty()) return;
+    lastUsedDirectory = QFileInfo(fileName).path();
 
-        // Open the GeoTIFF file
-        gdalDataset = (GDALDataset*)GDALOpen(fileName.toUtf8().constData(), GA_ReadOnly);
-
-        if (!gdalDataset) {
-            QMessageBox::critical(this, "Error", "Failed to open GeoTIFF file");
-            return;
-        }
+    // Close any previously loaded GDAL dataset
+    if (gdalDataset) {
+        GDALClose(gdalDataset);
+        gdalDataset = nullptr;
+    }
 
-        // Get geotransform
-        hasGeoTransform = (gdalDataset->GetGeoTransform(gdalGeoTransform) == CE_None);
+    // Kept open for its georeferencing; the pixels are read by the layer
+    gdalDataset = (GDALDataset*)GDALOpen(fileName.toUtf8().constData(), GA_ReadOnly);
 
-        if (!hasGeoTransform) {
-            QMessageBox::warning(this, "Warning",
-                                 "This GeoTIFF doesn't have geographic transformation information.\n"
-                                 "Coordinates will not be available.");
-        }
+    if (!gdalDataset) {
+        QMessageBox::critical(this, "Error", "Failed to open GeoTIFF file");
+        return;
+    }
 
-        // Get raster size
-        int xSize = gdalDataset->GetRasterXSize();
-        int ySize = gdalDataset->GetRasterYSize();
-        geoTIFFSize = QSize(xSize, ySize);
+    if (gdalDataset->GetRasterCount() == 0) {
+        QMessageBox::warning(this, "Error", "No raster bands found in file");
+        GDALClose(gdalDataset);
+        gdalDataset = nullptr;
+        return;
+    }
 
-        // Get projection info
-        const char *wkt = gdalDataset->GetProjectionRef();
-        QString projection = QString(wkt);
+    // Get geotransform
+    hasGeoTransform = (gdalDataset->GetGeoTransform(gdalGeoTransform) == CE_None);
 
-        // Update projection in status bar
-        if (!projection.isEmpty()) {
-            QString displayText;
+    if (!hasGeoTransform) {
+        QMessageBox::warning(this, "Warning",
+                             "This GeoTIFF doesn't have geographic transformation information.\n"
+                             "Coordinates will not be available.");
+    }
 
-            // Check for WGS84 in projection string
-            bool hasWGS84 = false;
-            if (projection.contains("WGS84", Qt::CaseInsensitive) ||
-                    projection.contains("WGS 84", Qt::CaseInsensitive) ||
-                    projection.contains("World Geodetic System 1984", Qt::CaseInsensitive)) {
-                hasWGS84 = true;
-                displayText += "WGS84 , ";
-            }
+    // Get raster size
+    geoTIFFSize = QSize(gdalDataset->GetRasterXSize(), gdalDataset->GetRasterYSize());
 
-            // Extract EPSG code from projection string
-            QString epsgCode;
-            QRegularExpression epsgRegex(R"(EPSG:(\d+))");
-            QRegularExpressionMatch match = epsgRegex.match(projection);
+    // Get projection info
+    const char *wkt = gdalDataset->GetProjectionRef();
+    QString projection = QString(wkt);
 
-            if (match.hasMatch()) {
-                epsgCode = "EPSG:" + match.captured(1);
-            } else {
-                // Try to find any numeric EPSG-like code
-                QRegularExpression numberRegex(R"(\b(\d{4,6})\b)");
-                match = numberRegex.match(projection);
-                if (match.hasMatch()) {
-                    epsgCode = "EPSG:" + match.captured(1);
-                }
-            }
+    // Update projection in status bar
+    if (!projection.isEmpty()) {
+        // Parsed and identified once per distinct WKT
+        QSharedPointer<const CrsDefinition> crs = CrsRegistry::instance().crs(projection);
+        const bool hasWGS84 = crs && crs->name.contains("WGS 84");
+        const QString displayText = hasWGS84 ? "WGS84 , " : QString();
 
-            // Add EPSG if found
-            if (!epsgCode.isEmpty()) {
-                // If we already added WGS84 from text detection, also check EPSG for WGS84
-                if (!hasWGS84 && (epsgCode == "EPSG:4326" || epsgCode == "EPSG:4979")) {
-                    displayText += "WGS84 ,";
-                }
-                displayText += epsgCode;
-                updateProjection(displayText);
-            } else if (hasWGS84) {
-                // If we have WGS84 but no EPSG
-                updateProjection(displayText + "(No EPSG)");
-            } else {
-                updateProjection("GeoTIFF (No EPSG)");
-            }
-        } else {
-            updateProjection("GeoTIFF (No Projection)");
-        }
-
-        // Load the raster data
-        int bandCount = gdalDataset->GetRasterCount();
-        qDebug() << "Band count:" << bandCount;
-
-        if (bandCount >= 3) {
-            // RGB image
-            geoTIFFImage = QImage(xSize, ySize, QImage::Format_RGB32);
-            geoTIFFImage.fill(Qt::black);
-
-            // Read red, green, blue bands
-            for (int b = 1; b <= 3 && b <= bandCount; b++) {
-                GDALRasterBand *band = gdalDataset->GetRasterBand(b);
-                if (!band) continue;
-
-                QVector<unsigned char> buffer(xSize * ySize);
-                CPLErr err = band->RasterIO(GF_Read, 0, 0, xSize, ySize,
-                                            buffer.data(), xSize, ySize, GDT_Byte, 0, 0);
-
-                if (err == CE_None) {
-                    // Copy band data to appropriate color channel
-                    for (int y = 0; y < ySize; y++) {
-                        for (int x = 0; x < xSize; x++) {
-                            QRgb pixel = geoTIFFImage.pixel(x, y);
-                            int value = buffer[y * xSize + x];
-
-                            if (b == 1) { // Red
-                                pixel = qRgb(value, qGreen(pixel), qBlue(pixel));
-                            } else if (b == 2) { // Green
-                                pixel = qRgb(qRed(pixel), value, qBlue(pixel));
-                            } else if (b == 3) { // Blue
-                                pixel = qRgb(qRed(pixel), qGreen(pixel), value);
-                            }
-                            geoTIFFImage.setPixel(x, y, pixel);
-                        }
-                    }
-                }
-            }
-        } else if (bandCount >= 1) {
-            // Grayscale or single band
-            GDALRasterBand *band = gdalDataset->GetRasterBand(1);
-            if (band) {
-                QVector<unsigned char> buffer(xSize * ySize);
-                CPLErr err = band->RasterIO(GF_Read, 0, 0, xSize, ySize,
-                                            buffer.data(), xSize, ySize, GDT_Byte, 0, 0);
-
-                if (err == CE_None) {
-                    geoTIFFImage = QImage(buffer.data(), xSize, ySize,
-                                          xSize, QImage::Format_Grayscale8).copy();
-                } else {
-                    // Create a blank image if reading fails
-                    geoTIFFImage = QImage(xSize, ySize, QImage::Format_Grayscale8);
-                    geoTIFFImage.fill(Qt::gray);
-                }
-            }
+        if (crs && !crs->authId.isEmpty()) {
+            updateProjection(displayText + crs->authId);
+        } else if (hasWGS84) {
+            // If we have WGS84 but no EPSG
+            updateProjection(displayText + "(No EPSG)");
         } else {
-            QMessageBox::warning(this, "Error", "No raster bands found in file");
-            GDALClose(gdalDataset);
-            gdalDataset = nullptr;
-            return;
+            updateProjection("GeoTIFF (No EPSG)");
         }
+    } else {
+        updateProjection("GeoTIFF (No Projection)");
+    }
 
-        if (geoTIFFImage.isNull()) {
-            QMessageBox::warning(this, "Error", "Failed to create image from GeoTIFF");
-            GDALClose(gdalDataset);
-            gdalDataset = nullptr;
-            return;
-        }
+    QFileInfo fileInfo(fileName);
+    QString layerName = fileInfo.baseName();
 
-        // Clear existing items
-        if (mapScene) {
-            mapScene->clear();
-            currentImageItem = nullptr;
-            geoTIFFItem = nullptr;
+    // Opened again: its old items make way for the new ones
+    int layerIndex = -1;
+    for (int i = 0; i < loadedLayers.size(); ++i) {
+        LayerInfo &layer = loadedLayers[i];
+        if (layer.name != layerName || layer.type != "geotiff") continue;
+        layerIndex = i;
+        for (QGraphicsItem *item : { layer.graphicsItem, layer.reprojectedItem }) {
+            if (!item) continue;
+            mapScene->removeItem(item);
+            delete item;
         }
+        layer.graphicsItem = nullptr;
+        layer.reprojectedItem = nullptr;
+        layer.properties.remove("reprojected_crs");
+        break;
+    }
 
-        // Add GeoTIFF to scene
-        if (mapScene) {
-            QPixmap geoTIFFPixmap = QPixmap::fromImage(geoTIFFImage);
-            if (geoTIFFPixmap.isNull()) {
-                QMessageBox::warning(this, "Error", "Failed to create pixmap from image");
-                GDALClose(gdalDataset);
-                gdalDataset = nullptr;
-                return;
-            }
-
-            geoTIFFItem = mapScene->addPixmap(geoTIFFPixmap);
-            currentImageItem = geoTIFFItem;
+    if (layerIndex < 0) {
+        // Create layer info
+        LayerInfo layer;
+        layer.name = layerName;
+        layer.filePath = fileName;
+        layer.type = "geotiff";
+        layer.properties["format"] = "geotiff";
 
-            // Store the image path
-            currentImagePath = fileName;
-            currentPixmap = geoTIFFPixmap;
+        // Add to layers tree
+        QTreeWidgetItem *layerItem = new QTreeWidgetItem(
+                    QStringList() << layerName << "GeoTIFF");
+        layerItem->setCheckState(0, Qt::Checked);
+        layer.treeItem = layerItem;
 
-            // Fit in view
-            if (mapView) {
-                mapView->fitInView(geoTIFFItem, Qt::KeepAspectRatio);
-                currentScale = mapView->transform().m11();
-                updateMagnifier(qRound(currentScale * 100));
-                updateScale(currentScale);
+        // Find or create raster group
+        QTreeWidgetItem *rasterGroup = nullptr;
+        for (int i = 0; i < layersTree->topLevelItemCount(); ++i) {
+            if (layersTree->topLevelItem(i)->text(0) == "Raster Layers") {
+                rasterGroup = layersTree->topLevelItem(i);
+                break;
             }
+        }
 
-            isGeoTIFFLoaded = true;
+        if (!rasterGroup) {
+            rasterGroup = new QTreeWidgetItem(layersTree, QStringList() << "Raster Layers");
+            rasterGroup->setExpanded(true);
+        }
 
-            // Update image info
-            updateImageInfo();
+        rasterGroup->addChild(layerItem);
 
-            // Add to layers tree
-            QFileInfo fileInfo(fileName);
-            QString layerName = fileInfo.baseName();
+        loadedLayers.append(layer);
+        layerIndex = loadedLayers.size() - 1;
+        projectModified = true;
 
-            // Check if layer already loaded
-            bool alreadyLoaded = false;
-            for (int i = 0; i < loadedLayers.size(); ++i) {
-                if (loadedLayers[i].name == layerName && loadedLayers[i].type == "geotiff") {
-                    alreadyLoaded = true;
-                    break;
-                }
-            }
+        // Update project info
+        if (projectInfoLabel) {
+            projectInfoLabel->setText(QString("Project: %1\nLayers: %2")
+                                      .arg(currentProjectName)
+                                      .arg(loadedLayers.size()));
+        }
+    }
+    // Georeferencing is read afresh by the loader
+    LayerInfo &layer = loadedLayers[layerIndex];
+    layer.properties.remove("has_geotransform");
 
-            if (!alreadyLoaded) {
-                // Create layer info
-                LayerInfo layer;
-                layer.name = layerName;
-                layer.filePath = fileName;
-                layer.type = "geotiff";
-                layer.graphicsItem = geoTIFFItem;
-                layer.properties["format"] = "geotiff";
-                layer.properties["width"] = geoTIFFImage.width();
-                layer.properties["height"] = geoTIFFImage.height();
-                layer.properties["has_geotransform"] = hasGeoTransform;
-
-                // Add to layers tree
-                QTreeWidgetItem *layerItem = new QTreeWidgetItem(
-                            QStringList() << layerName << "GeoTIFF");
-                layerItem->setCheckState(0, Qt::Checked);
-                layer.treeItem = layerItem;
-
-                // Find or create raster group
-                QTreeWidgetItem *rasterGroup = nullptr;
-                for (int i = 0; i < layersTree->topLevelItemCount(); ++i) {
-                    if (layersTree->topLevelItem(i)->text(0) == "Raster Layers") {
-                        rasterGroup = layersTree->topLevelItem(i);
-                        break;
-                    }
-                }
+    // The scene is this raster's pixel grid, as shown in the canvas CRS
+    // once one is chosen; everything drawn so far moves onto it
+    if (hasGeoTransform) {
+        if (mapSettings.destinationCrs().isEmpty() || !setMainRasterSceneGrid(fileName)) {
+            mapSettings.setSceneGrid(gdalGeoTransform);
+        }
+    } else {
+        mapSettings.setDefaultSceneGrid();
+    }
+    reanchorLayers();
 
-                if (!rasterGroup) {
-                    rasterGroup = new QTreeWidgetItem(layersTree, QStringList() << "Raster Layers");
-                    rasterGroup->setExpanded(true);
-                }
+    // Opened like a project layer: tiled when georeferenced, so only what
+    // is in view is read, and reprojected to the canvas CRS if there is one
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QString errorMessage;
+    const bool added = addLoadedLayer(layer, LayerLoader::load(layer.name, layer.type, layer.filePath,
+                                                               layer.properties), &errorMessage);
+    QApplication::restoreOverrideCursor();
+
+    if (!added) {
+        QMessageBox::warning(this, "Error", "Failed to load GeoTIFF: " + errorMessage);
+        GDALClose(gdalDataset);
+        gdalDataset = nullptr;
+        isGeoTIFFLoaded = false;
+        geoTIFFItem = nullptr;
+        return;
+    }
 
-                rasterGroup->addChild(layerItem);
+    layer.properties["width"] = geoTIFFSize.width();
+    layer.properties["height"] = geoTIFFSize.height();
+    layer.properties["has_geotransform"] = hasGeoTransform;
+    geoTIFFItem = layer.graphicsItem;
+    currentImageItem = layer.graphicsItem;
+    currentImagePath = fileName;
+    isGeoTIFFLoaded = true;
+    labelLayerItemsForProfiler();
 
-                loadedLayers.append(layer);
-                projectModified = true;
+    // Fit in view
+    if (MapView *view = currentMapView()) {
+        view->fitInView(layer.shownItem(), Qt::KeepAspectRatio);
+        currentScale = view->transform().m11();
+        updateMagnifier(qRound(currentScale * 100));
+        updateScale(currentScale);
+    }
 
-                // Update project info
-                if (projectInfoLabel) {
-                    projectInfoLabel->setText(QString("Project: %1\nLayers: %2")
-                                              .arg(currentProjectName)
-                                              .arg(loadedLayers.size()));
-                }
-            }
+    // Update image info
+    updateImageInfo();
 
-            if (messageLabel) {
-                messageLabel->setText("Loaded GeoTIFF: " + fileInfo.fileName() +
-                                      (hasGeoTransform ? " (with coordinates)" : " (no geotransform)"));
-            }
-        }
+    if (messageLabel) {
+        messageLabel->setText("Loaded GeoTIFF: " + fileInfo.fileName() +
+                              (hasGeoTransform ? " (with coordinates)" : " (no geotransform)"));
     }
 }
 
@@ -3794,13 +4547,14 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
         }
     }
 
-    // Existing event filter code for map view...
-    if (mapView && mapView->viewport() && obj == mapView->viewport()) {
+    // Existing event filter code for map views (the main one and its tabs)...
+    if (MapView *view = mapViewForViewport(obj)) {
         if (event->type() == QEvent::MouseMove) {
             QMouseEvent *mouseEvent = static_cast<QMouseEvent*>(event);
-            QPointF scenePos = mapView->mapToScene(mouseEvent->pos());
+            QPointF scenePos = view->mapToScene(mouseEvent->pos());
             updateCoordinates(scenePos);
-            return true;
+            // Not consumed: the view still pans by dragging
+            return false;
         }
         else if (event->type() == QEvent::Wheel) {
             QWheelEvent *wheelEvent = static_cast<QWheelEvent*>(event);
@@ -3814,9 +4568,14 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
         }
         else if (event->type() == QEvent::MouseButtonPress) {
             QMouseEvent *mouseEvent = static_cast<QMouseEvent*>(event);
+            if (identifyAction && identifyAction->isChecked() &&
+                mouseEvent->button() == Qt::LeftButton) {
+                identifyFeaturesAt(view->mapToScene(mouseEvent->pos()));
+                return true;
+            }
             if (coordinatesToolBtn && coordinatesToolBtn->isChecked() &&
                 mouseEvent->button() == Qt::LeftButton) {
-                QPointF scenePos = mapView->mapToScene(mouseEvent->pos());
+                QPointF scenePos = view->mapToScene(mouseEvent->pos());
                 QPointF geoCoords = sceneToGeographicCoords(scenePos);
                 QString message;
                 if (!qIsNaN(geoCoords.x())) {
@@ -4128,38 +4887,31 @@ void MainWindow::jumpToLocation(double lon, double lat)
                  << gdalGeoTransform[0] << gdalGeoTransform[1] << gdalGeoTransform[2]
                  << gdalGeoTransform[3] << gdalGeoTransform[4] << gdalGeoTransform[5];
 
-        // IMPORTANT: GDAL geotransform expects (x=longitude, y=latitude)
-        double pixelX, pixelY;
-
-        // Convert geographic to pixel coordinates using the geotransform
-        if (fabs(gdalGeoTransform[2]) < 1e-10 && fabs(gdalGeoTransform[4]) < 1e-10) {
-            // Simple case: no rotation in the geotransform
-            pixelX = (lon - gdalGeoTransform[0]) / gdalGeoTransform[1];
-            pixelY = (lat - gdalGeoTransform[3]) / gdalGeoTransform[5];
-
-            qDebug() << "  Simple transform: pixelX =" << pixelX << "pixelY =" << pixelY;
-        } else {
-            // Complex case: need to solve linear equations
-            double det = gdalGeoTransform[1] * gdalGeoTransform[5] -
-                    gdalGeoTransform[2] * gdalGeoTransform[4];
+        // Longitude/latitude into the canvas CRS, then onto the scene
+        const QPointF scene = geographicToSceneCoords(lon, lat);
+        if (qIsNaN(scene.x()) || qIsNaN(scene.y())) {
+            QMessageBox::warning(this, "Error", "Cannot transform these coordinates to the map CRS");
+            return;
+        }
 
-            if (fabs(det) < 1e-10) {
-                errorMsg = "Geotransform is singular (determinant near zero)";
-                QMessageBox::warning(this, "Transformation Error", errorMsg);
-                return;
+        // Pixels of the GeoTIFF as it is drawn, reprojected or not
+        QGraphicsItem *shown = geoTIFFItem;
+        for (const LayerInfo &layer : loadedLayers) {
+            if (layer.graphicsItem == geoTIFFItem) {
+                shown = layer.shownItem();
+                break;
             }
-
-            pixelX = (gdalGeoTransform[5] * (lon - gdalGeoTransform[0]) -
-                    gdalGeoTransform[2] * (lat - gdalGeoTransform[3])) / det;
-            pixelY = (gdalGeoTransform[1] * (lat - gdalGeoTransform[3]) -
-                    gdalGeoTransform[4] * (lon - gdalGeoTransform[0])) / det;
-
-            qDebug() << "  Complex transform: pixelX =" << pixelX << "pixelY =" << pixelY;
         }
+        const QPointF pixel = shown->mapFromScene(scene);
+        const double pixelX = pixel.x();
+        const double pixelY = pixel.y();
+        const QSizeF shownSize = shown->boundingRect().size();
+
+        qDebug() << "  Pixel coordinates: pixelX =" << pixelX << "pixelY =" << pixelY;
 
         // Check bounds
-        withinBounds = (pixelX >= 0 && pixelX < geoTIFFSize.width() &&
-                        pixelY >= 0 && pixelY < geoTIFFSize.height());
+        withinBounds = (pixelX >= 0 && pixelX < shownSize.width() &&
+                        pixelY >= 0 && pixelY < shownSize.height());
 
         if (!withinBounds) {
             errorMsg = QString("Coordinates are outside image bounds\n"
@@ -4167,16 +4919,15 @@ void MainWindow::jumpToLocation(double lon, double lat)
                                "Image size: %3 x %4")
                     .arg(pixelX, 0, 'f', 1)
                     .arg(pixelY, 0, 'f', 1)
-                    .arg(geoTIFFSize.width())
-                    .arg(geoTIFFSize.height());
+                    .arg(qRound(shownSize.width()))
+                    .arg(qRound(shownSize.height()));
 
             QMessageBox::warning(this, "Out of Bounds", errorMsg);
             // Still continue but mark as out of bounds
         }
 
-        // Store the pixel coordinates for scene placement
-        sceneX = pixelX;
-        sceneY = pixelY;
+        sceneX = scene.x();
+        sceneY = scene.y();
 
         qDebug() << "  Final scene coordinates:" << sceneX << sceneY;
 
@@ -4303,38 +5054,39 @@ void MainWindow::jumpToLocation(double lon, double lat)
     // Center the view on the marker with animation
     QPointF targetCenter(sceneX, sceneY);
 
-    // Animate the zoom and pan
-    QTimer::singleShot(50, this, [this, targetCenter, withinBounds]() {
-        if (mapView) {
+    // Animate the zoom and pan, in the view the jump was asked from
+    QPointer<MapView> view = currentMapView();
+    QTimer::singleShot(50, this, [this, view, targetCenter, withinBounds]() {
+        if (view) {
             // Smoothly center on the target
-            mapView->centerOn(targetCenter);
+            view->centerOn(targetCenter);
 
             // Zoom in for better visibility
-            QTimer::singleShot(100, this, [this, targetCenter, withinBounds]() {
-                if (mapView) {
+            QTimer::singleShot(100, this, [this, view, targetCenter, withinBounds]() {
+                if (view) {
                     // Calculate zoom level
                     double zoomFactor = withinBounds ? 8.0 : 4.0; // Zoom more if within bounds
 
                     // Get current transform
-                    QTransform currentTransform = mapView->transform();
+                    QTransform currentTransform = view->transform();
 
                     // Reset and apply zoom centered on marker
-                    mapView->resetTransform();
-                    mapView->scale(zoomFactor, zoomFactor);
-                    currentScale = mapView->transform().m11();
+                    view->resetTransform();
+                    view->scale(zoomFactor, zoomFactor);
+                    currentScale = view->transform().m11();
 
                     // Update status bar
                     updateMagnifier(qRound(currentScale * 100));
                     updateScale(currentScale);
 
                     // Re-center on marker
-                    mapView->centerOn(targetCenter);
+                    view->centerOn(targetCenter);
 
                     // Add a slight animation effect
-                    QTimer::singleShot(50, this, [this, targetCenter]() {
-                        if (mapView) {
+                    QTimer::singleShot(50, this, [this, view, targetCenter]() {
+                        if (view) {
                             // Slight bounce effect
-                            mapView->centerOn(targetCenter);
+                            view->centerOn(targetCenter);
 
                             // Flash the marker
                             flashMarker();
@@ -4428,171 +5180,78 @@ bool MainWindow::hasAnyGeoreferencedLayer()
     return !georeferencedImages.isEmpty();
 }
 
-QPointF MainWindow::geographicToSceneCoords(double lon, double lat)
+// Canvas map units <-> WGS 84 longitude/latitude. The canvas is in the CRS
+// the user chose, or else that of the main GeoTIFF; without either its
+// units are taken to be degrees already.
+bool MainWindow::transformLonLat(const QPointF &point, bool toLonLat, QPointF *result) const
 {
-    // First, try to convert using the main GeoTIFF
-    if (isGeoTIFFLoaded && hasGeoTransform && gdalDataset) {
-        // Convert geographic to pixel coordinates
-        double pixelX, pixelY;
-
-        if (fabs(gdalGeoTransform[2]) < 1e-10 && fabs(gdalGeoTransform[4]) < 1e-10) {
-            // Simple case
-            pixelX = (lon - gdalGeoTransform[0]) / gdalGeoTransform[1];
-            pixelY = (lat - gdalGeoTransform[3]) / gdalGeoTransform[5];
-        } else {
-            // Complex case
-            double det = gdalGeoTransform[1] * gdalGeoTransform[5] -
-                    gdalGeoTransform[2] * gdalGeoTransform[4];
-
-            if (fabs(det) < 1e-10) return QPointF();
-
-            pixelX = (gdalGeoTransform[5] * (lon - gdalGeoTransform[0]) -
-                    gdalGeoTransform[2] * (lat - gdalGeoTransform[3])) / det;
-            pixelY = (gdalGeoTransform[1] * (lat - gdalGeoTransform[3]) -
-                    gdalGeoTransform[4] * (lon - gdalGeoTransform[0])) / det;
-        }
-
-        // Convert to scene coordinates
-        if (geoTIFFItem) {
-            return geoTIFFItem->mapToScene(QPointF(pixelX, pixelY));
-        }
+    QString canvasWkt = mapSettings.destinationWkt();
+    if (canvasWkt.isEmpty() && gdalDataset && hasGeoTransform) {
+        canvasWkt = QString::fromUtf8(gdalDataset->GetProjectionRef());
     }
-
-    // Try to find which georeferenced image contains these coordinates
-    for (const GeoreferenceInfo &georefInfo : georeferencedImagesInfo) {
-        if (georefInfo.hasTransform) {
-            // Calculate pixel coordinates for this image
-            double pixelX, pixelY;
-
-            if (fabs(georefInfo.geoTransform[2]) < 1e-10 &&
-                    fabs(georefInfo.geoTransform[4]) < 1e-10) {
-                // Simple case
-                pixelX = (lon - georefInfo.geoTransform[0]) / georefInfo.geoTransform[1];
-                pixelY = (lat - georefInfo.geoTransform[3]) / georefInfo.geoTransform[5];
-            } else {
-                // Complex case
-                double det = georefInfo.geoTransform[1] * georefInfo.geoTransform[5] -
-                        georefInfo.geoTransform[2] * georefInfo.geoTransform[4];
-
-                if (fabs(det) < 1e-10) continue;
-
-                pixelX = (georefInfo.geoTransform[5] * (lon - georefInfo.geoTransform[0]) -
-                        georefInfo.geoTransform[2] * (lat - georefInfo.geoTransform[3])) / det;
-                pixelY = (georefInfo.geoTransform[1] * (lat - georefInfo.geoTransform[3]) -
-                        georefInfo.geoTransform[4] * (lon - georefInfo.geoTransform[0])) / det;
-            }
-
-            // Check if within image bounds
-            if (pixelX >= 0 && pixelX < georefInfo.imageSize.width() &&
-                    pixelY >= 0 && pixelY < georefInfo.imageSize.height()) {
-
-                if (georefInfo.imageItem) {
-                    return georefInfo.imageItem->mapToScene(QPointF(pixelX, pixelY));
-                }
-            }
-        }
+    CrsRegistry &registry = CrsRegistry::instance();
+    QSharedPointer<const CrsDefinition> canvasCrs = canvasWkt.isEmpty() ? nullptr : registry.crs(canvasWkt);
+    if (!canvasCrs) {
+        *result = point;
+        return true;
     }
 
-    // If no specific image found, create a relative position
-    // Find the bounding box of all georeferenced images
-    if (!georeferencedImagesInfo.isEmpty()) {
-        double minLon = std::numeric_limits<double>::max();
-        double maxLon = -std::numeric_limits<double>::max();
-        double minLat = std::numeric_limits<double>::max();
-        double maxLat = -std::numeric_limits<double>::max();
-
-        for (const GeoreferenceInfo &georefInfo : georeferencedImagesInfo) {
-            if (georefInfo.hasTransform) {
-                double topLeftX = georefInfo.geoTransform[0];
-                double topLeftY = georefInfo.geoTransform[3];
-                double bottomRightX = topLeftX + georefInfo.imageSize.width() * georefInfo.geoTransform[1];
-                double bottomRightY = topLeftY + georefInfo.imageSize.height() * georefInfo.geoTransform[5];
-
-                minLon = qMin(minLon, qMin(topLeftX, bottomRightX));
-                maxLon = qMax(maxLon, qMax(topLeftX, bottomRightX));
-                minLat = qMin(minLat, qMin(topLeftY, bottomRightY));
-                maxLat = qMax(maxLat, qMax(topLeftY, bottomRightY));
-            }
-        }
+    QSharedPointer<const CrsDefinition> wgs84 = registry.crs("EPSG:4326");
+    if (!wgs84) return false;
+    PJ *transformation = toLonLat ? ProjThreadContext::local().transformation(canvasCrs->wkt, wgs84->wkt)
+                                  : ProjThreadContext::local().transformation(wgs84->wkt, canvasCrs->wkt);
+    if (!transformation) return false;
 
-        // Calculate relative position
-        double scale = 1000.0; // Scale factor
-        double x = (lon - minLon) * scale;
-        double y = (maxLat - lat) * scale; // Invert Y axis
+    const PJ_COORD coord = proj_trans(transformation, PJ_FWD, proj_coord(point.x(), point.y(), 0, 0));
+    if (!qIsFinite(coord.xy.x) || !qIsFinite(coord.xy.y)) return false;
+    *result = QPointF(coord.xy.x, coord.xy.y);
+    return true;
+}
 
-        return QPointF(x, y);
+QPointF MainWindow::geographicToSceneCoords(double lon, double lat)
+{
+    QPointF mapPoint;
+    if (!transformLonLat(QPointF(lon, lat), false, &mapPoint)) {
+        return QPointF(qQNaN(), qQNaN());
     }
-
-    return QPointF();
+    return mapSettings.mapToScene(mapPoint);
 }
 
 QPointF MainWindow::sceneToGeographicCoords(const QPointF &scenePoint)
 {
-    // Check all georeferenced images
-    for (const GeoreferenceInfo &georefInfo : georeferencedImagesInfo) {
-        if (georefInfo.imageItem && georefInfo.hasTransform &&
-                georefInfo.imageItem->contains(scenePoint)) {
-
-            QPointF itemPos = georefInfo.imageItem->mapFromScene(scenePoint);
-
-            // Clamp to image bounds
-            double imgX = qBound(0.0, itemPos.x(), (double)georefInfo.imageSize.width() - 1);
-            double imgY = qBound(0.0, itemPos.y(), (double)georefInfo.imageSize.height() - 1);
-
-            // Convert to geographic coordinates using the image's geotransform
-            double geoX = georefInfo.geoTransform[0] +
-                    imgX * georefInfo.geoTransform[1] +
-                    imgY * georefInfo.geoTransform[2];
-
-            double geoY = georefInfo.geoTransform[3] +
-                    imgX * georefInfo.geoTransform[4] +
-                    imgY * georefInfo.geoTransform[5];
-
-            return QPointF(geoX, geoY);
+    // A plain image without georeference has no map coordinates
+    bool georeferenced = (isGeoTIFFLoaded && hasGeoTransform) || !georeferencedImagesInfo.isEmpty() ||
+            !mapSettings.destinationCrs().isEmpty();
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.type == "vector" || layer.type == "memory") {
+            georeferenced = true;
+            break;
         }
     }
-
-    // Fall back to main GeoTIFF if available
-    if (isGeoTIFFLoaded && hasGeoTransform && gdalDataset && geoTIFFItem) {
-        if (geoTIFFItem->contains(scenePoint)) {
-            QPointF itemPos = geoTIFFItem->mapFromScene(scenePoint);
-            int imgX = qRound(itemPos.x());
-            int imgY = qRound(itemPos.y());
-
-            // Clamp to image bounds
-            imgX = qBound(0, imgX, geoTIFFSize.width() - 1);
-            imgY = qBound(0, imgY, geoTIFFSize.height() - 1);
-
-            // Convert to geographic coordinates
-            double geoX = gdalGeoTransform[0] +
-                    imgX * gdalGeoTransform[1] +
-                    imgY * gdalGeoTransform[2];
-
-            double geoY = gdalGeoTransform[3] +
-                    imgX * gdalGeoTransform[4] +
-                    imgY * gdalGeoTransform[5];
-
-            return QPointF(geoX, geoY);
-        }
+    QPointF lonLat;
+    if (!georeferenced || !transformLonLat(mapSettings.sceneToMap(scenePoint), true, &lonLat)) {
+        return QPointF(qQNaN(), qQNaN());
     }
-
-    return QPointF(qQNaN(), qQNaN());
+    return lonLat;
 }
 
 
 
 void MainWindow::fitAllImages()
 {
-    if (!mapView || !mapScene || loadedLayers.isEmpty()) return;
+    MapView *view = currentMapView();
+    if (!view || !mapScene || loadedLayers.isEmpty()) return;
 
     QRectF totalBounds;
     bool first = true;
 
     for (const LayerInfo &layer : loadedLayers) {
-        if (layer.graphicsItem) {
-            QRectF bounds = layer.graphicsItem->boundingRect();
-            QPointF pos = layer.graphicsItem->pos();
-            bounds.translate(pos);
+        QGraphicsItem *item = layer.graphicsItem;
+        if (layer.reprojectedItem && layer.properties["reprojected"].toBool()) {
+            item = layer.reprojectedItem;
+        }
+        if (item) {
+            QRectF bounds = item->sceneBoundingRect();
 
             if (first) {
                 totalBounds = bounds;
@@ -4606,8 +5265,8 @@ void MainWindow::fitAllImages()
     if (!totalBounds.isEmpty()) {
         // Add some padding
         totalBounds.adjust(-50, -50, 50, 50);
-        mapView->fitInView(totalBounds, Qt::KeepAspectRatio);
-        currentScale = mapView->transform().m11();
+        view->fitInView(totalBounds, Qt::KeepAspectRatio);
+        currentScale = view->transform().m11();
         updateMagnifier(qRound(currentScale * 100));
         updateScale(currentScale);
     }
@@ -4670,7 +5329,7 @@ void MainWindow::clearAllImages()
     hasGeoTransform = false;
     isGeoTIFFLoaded = false;
     geoTIFFItem = nullptr;
-    geoTIFFImage = QImage();
+    mapSettings.setDefaultSceneGrid();
     geoTIFFSize = QSize();
 
     // Clear georeference info
@@ -4684,8 +5343,10 @@ void MainWindow::clearAllImages()
 
     // Clear loaded layers
     loadedLayers.clear();
-    currentVectorItems.clear();
-    layerVectorItems.clear();
+    deferredLayers.clear();
+    layerOpenPool.clear();
+    ++deferredOpenGeneration;
+    deferredOpenPending = 0;
     currentCrosshairItems.clear();
 
     // Clear layers tree but keep groups
@@ -4900,7 +5561,8 @@ void MainWindow::addMarkerActions()
 
 void MainWindow::zoomToExtents()
 {
-    if (!mapView || !mapScene) return;
+    MapView *view = currentMapView();
+    if (!view || !mapScene) return;
 
     QRectF bounds;
     if (isGeoTIFFLoaded && geoTIFFItem) {
@@ -4916,8 +5578,8 @@ void MainWindow::zoomToExtents()
     }
 
     if (!bounds.isEmpty()) {
-        mapView->fitInView(bounds, Qt::KeepAspectRatio);
-        currentScale = mapView->transform().m11();
+        view->fitInView(bounds, Qt::KeepAspectRatio);
+        currentScale = view->transform().m11();
         updateMagnifier(qRound(currentScale * 100));
         updateScale(currentScale);
 
@@ -5008,8 +5670,8 @@ void MainWindow::clearCurrentImage()
     hasGeoTransform = false;
     isGeoTIFFLoaded = false;
     geoTIFFItem = nullptr;
-    geoTIFFImage = QImage();
     geoTIFFSize = QSize();
+    mapSettings.setDefaultSceneGrid();
 
     // Clear the scene
     if (mapScene) {
@@ -5048,8 +5710,8 @@ void MainWindow::updateImageInfo()
                         "<b>Move mouse to see coordinates</b>"
                         ).arg(
                         fileInfo.fileName(),
-                        QString::number(geoTIFFImage.width()),
-                        QString::number(geoTIFFImage.height()),
+                        QString::number(geoTIFFSize.width()),
+                        QString::number(geoTIFFSize.height()),
                         hasGeoTransform ? "Yes" : "No",
                         QString::number(qRound(currentScale * 100)),
                         QString::number(qRound(rotationAngle))
@@ -5059,7 +5721,7 @@ void MainWindow::updateImageInfo()
         } else if (currentImageItem) {
             // Original code for regular images
             QFileInfo fileInfo(currentImagePath);
-            QPixmap pixmap = currentImageItem->pixmap();
+            const QSizeF size = currentImageItem->boundingRect().size();
 
             QString info = QString(
                         "<b>File:</b> %1<br>"
@@ -5069,8 +5731,8 @@ void MainWindow::updateImageInfo()
                         "<b>Rotation:</b> %6°"
                         ).arg(
                         fileInfo.fileName(),
-                        QString::number(pixmap.width()),
-                        QString::number(pixmap.height()),
+                        QString::number(qRound(size.width())),
+                        QString::number(qRound(size.height())),
                         fileInfo.suffix().toUpper(),
                         QString::number(qRound(currentScale * 100)),
                         QString::number(qRound(rotationAngle))
@@ -5123,7 +5785,7 @@ void MainWindow::onLoadVectorFile(const QString &filePath)
 
 void MainWindow::drawVectorLayer(const QString &filePath)
 {
-    // Open vector file using GDAL
+    // Only the layer list is read here; features are read by the loader
     GDALDataset *dataset = (GDALDataset*)GDALOpenEx(
                 filePath.toUtf8().constData(),
                 GDAL_OF_VECTOR | GDAL_OF_READONLY,
@@ -5142,76 +5804,30 @@ void MainWindow::drawVectorLayer(const QString &filePath)
         return;
     }
 
-    // Get layer count
-    int layerCount = dataset->GetLayerCount();
+    struct SourceLayer {
+        QString name;
+        QString geometryType;
+    };
+    QVector<SourceLayer> sourceLayers;
+    for (int i = 0; i < dataset->GetLayerCount(); i++) {
+        OGRLayer *layer = dataset->GetLayer(i);
+        const char *layerName = layer ? layer->GetName() : nullptr;
+        sourceLayers.append({ layerName ? QString(layerName) : QString("Layer %1").arg(i + 1),
+                              FeatureBufferItem::geometryTypeLabel(layer ? layer->GetGeomType() : wkbUnknown) });
+    }
+    GDALClose(dataset);
 
-    if (layerCount == 0) {
+    if (sourceLayers.isEmpty()) {
         QMessageBox::information(this, "No Layers", "No layers found in vector file");
-        GDALClose(dataset);
         return;
     }
 
-    // Colors for different geometry types
-    QColor pointColor(255, 0, 0, 200);      // Red
-    QColor lineColor(0, 0, 255, 200);       // Blue
-    QColor polygonColor(0, 255, 0, 150);    // Green with transparency
-    QColor multiPointColor(255, 165, 0, 200); // Orange
-    QColor multiLineColor(75, 0, 130, 200);   // Indigo
-    QColor multiPolygonColor(238, 130, 238, 150); // Violet
-
-    // Determine scale factor based on coordinate system
-    double scaleFactor = 100.0;
-    if (isGeoTIFFLoaded && hasGeoTransform) {
-        // If we have a georeferenced image, use appropriate scaling
-        scaleFactor = 1000.0;
-    }
-
-    // Process each layer
-    for (int i = 0; i < layerCount; i++) {
-        OGRLayer *layer = dataset->GetLayer(i);
-        if (!layer) continue;
-
-        // Reset reading
-        layer->ResetReading();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
 
-        // Get layer name
-        const char *layerName = layer->GetName();
-        QString qLayerName = layerName ? QString(layerName) : QString("Layer %1").arg(i + 1);
-
-        // Get geometry type
-        OGRwkbGeometryType geomType = wkbFlatten(layer->GetGeomType());
-        QColor color;
-        QString geomTypeStr;
-
-        switch (geomType) {
-        case wkbPoint:
-            color = pointColor;
-            geomTypeStr = "Point";
-            break;
-        case wkbLineString:
-            color = lineColor;
-            geomTypeStr = "Line";
-            break;
-        case wkbPolygon:
-            color = polygonColor;
-            geomTypeStr = "Polygon";
-            break;
-        case wkbMultiPoint:
-            color = multiPointColor;
-            geomTypeStr = "MultiPoint";
-            break;
-        case wkbMultiLineString:
-            color = multiLineColor;
-            geomTypeStr = "MultiLine";
-            break;
-        case wkbMultiPolygon:
-            color = multiPolygonColor;
-            geomTypeStr = "MultiPolygon";
-            break;
-        default:
-            color = QColor(128, 128, 128, 200);  // Gray for unknown types
-            geomTypeStr = "Unknown";
-        }
+    QStringList failed;
+    for (int i = 0; i < sourceLayers.size(); i++) {
+        const QString &qLayerName = sourceLayers[i].name;
+        const QString &geomTypeStr = sourceLayers[i].geometryType;
 
         // Create layer info
         LayerInfo layerInfo;
@@ -5245,37 +5861,20 @@ void MainWindow::drawVectorLayer(const QString &filePath)
 
         vectorGroup->addChild(layerItem);
 
-        // Store items for this layer
-        QList<QGraphicsItem*> layerItems;
-
-        // Draw features
-        OGRFeature *feature;
-        int featureCount = 0;
-        int maxFeatures = 1000;  // Limit for performance
-
-        while ((feature = layer->GetNextFeature()) != nullptr && featureCount < maxFeatures) {
-            OGRGeometry *geometry = feature->GetGeometryRef();
-            if (geometry) {
-                drawGeometry(geometry, color, scaleFactor);
-                // Note: drawGeometry adds items to currentVectorItems
-            }
-            OGRFeature::DestroyFeature(feature);
-            featureCount++;
-        }
-
-        // Store layer items
-        layerVectorItems[qLayerName] = currentVectorItems;
-        currentVectorItems.clear();
-
-        // Get feature count for the entire layer
-        layer->ResetReading();
-        int totalFeatures = layer->GetFeatureCount();
-        layerInfo.properties["feature_count"] = totalFeatures;
-        layerInfo.properties["features_drawn"] = qMin(featureCount, maxFeatures);
-
-        // Add layer to loaded layers
-        loadedLayers.append(layerInfo);
-        projectModified = true;
+        // Read like a project layer: every feature into one FeatureBuffer,
+        // drawn by one item and reprojected to the canvas CRS if there is one
+        loadedLayers.append(layerInfo);
+        LayerInfo &layer = loadedLayers.last();
+        QString errorMessage;
+        const LoadedLayer loaded = LayerLoader::load(layer.name, layer.type, layer.filePath, layer.properties);
+        if (!addLoadedLayer(layer, loaded, &errorMessage)) {
+            failed << QString("%1: %2").arg(qLayerName, errorMessage);
+            delete layerItem;
+            loadedLayers.removeLast();
+            continue;
+        }
+        layer.properties["feature_count"] = loaded.features->count();
+        projectModified = true;
 
         // Update project info
         if (projectInfoLabel) {
@@ -5285,208 +5884,24 @@ void MainWindow::drawVectorLayer(const QString &filePath)
         }
 
         // Update properties display
-        updatePropertiesDisplay(layerInfo);
+        updatePropertiesDisplay(layer);
 
         // Update status
         if (messageLabel) {
-            messageLabel->setText(QString("Loaded %1 features from %2").arg(featureCount).arg(qLayerName));
-        }
-    }
-
-    GDALClose(dataset);
-
-    // Zoom to fit all items
-    fitAllImages();
-}
-
-void MainWindow::drawGeometry(OGRGeometry *geom, const QColor &color, double scaleFactor)
-{
-    if (!geom || !mapScene) return;
-
-    OGRwkbGeometryType type = wkbFlatten(geom->getGeometryType());
-
-    switch (type) {
-    case wkbPoint:
-        drawPoint((OGRPoint*)geom, color, scaleFactor);
-        break;
-    case wkbLineString:
-        drawLine((OGRLineString*)geom, color, scaleFactor);
-        break;
-    case wkbPolygon:
-        drawPolygon((OGRPolygon*)geom, color, scaleFactor);
-        break;
-    case wkbMultiPoint:
-    case wkbMultiLineString:
-    case wkbMultiPolygon:
-        // Handle multi-geometries recursively
-        if (OGRGeometryCollection *collection = dynamic_cast<OGRGeometryCollection*>(geom)) {
-            for (int i = 0; i < collection->getNumGeometries(); i++) {
-                drawGeometry(collection->getGeometryRef(i), color, scaleFactor);
-            }
+            messageLabel->setText(QString("Loaded %1 features from %2").arg(loaded.features->count()).arg(qLayerName));
         }
-        break;
-    default:
-        qDebug() << "Unhandled geometry type:" << type;
-        break;
-    }
-}
-
-void MainWindow::drawPoint(OGRPoint *point, const QColor &color, double scaleFactor)
-{
-    if (!point || !mapScene) return;
-
-    double x = point->getX();
-    double y = point->getY();
-
-    // Scale coordinates
-    x = x * scaleFactor;
-    y = y * -scaleFactor; // Invert Y for proper display
-
-    // Create a circle for the point
-    double pointSize = 6.0;
-    QGraphicsEllipseItem *item = mapScene->addEllipse(x - pointSize/2, y - pointSize/2,
-                                                      pointSize, pointSize);
-    item->setPen(QPen(color, 1));
-    item->setBrush(QBrush(color));
-
-    // Store in current vector items
-    currentVectorItems.append(item);
-
-    // Optional: Add tooltip with coordinates
-    item->setToolTip(QString("Point: %1, %2").arg(x/scaleFactor).arg(-y/scaleFactor));
-}
-
-void MainWindow::drawLine(OGRLineString *line, const QColor &color, double scaleFactor)
-{
-    if (!line || !mapScene) return;
-
-    int pointCount = line->getNumPoints();
-    if (pointCount < 2) return;
-
-    QPainterPath path;
-
-    OGRPoint point;
-    line->getPoint(0, &point);
-    double x = point.getX() * scaleFactor;
-    double y = point.getY() * -scaleFactor;
-
-    path.moveTo(x, y);
-
-    for (int i = 1; i < pointCount; i++) {
-        line->getPoint(i, &point);
-        x = point.getX() * scaleFactor;
-        y = point.getY() * -scaleFactor;
-        path.lineTo(x, y);
-    }
-
-    QGraphicsPathItem *item = mapScene->addPath(path);
-    item->setPen(QPen(color, 2));
-
-    // Store in current vector items
-    currentVectorItems.append(item);
-
-    // Optional: Add tooltip
-    item->setToolTip(QString("Line with %1 points").arg(pointCount));
-}
-
-void MainWindow::drawPolygon(OGRPolygon *polygon, const QColor &color, double scaleFactor)
-{
-    if (!polygon || !mapScene) return;
-
-    // Outer ring
-    OGRLinearRing *ring = polygon->getExteriorRing();
-    if (!ring || ring->getNumPoints() < 3) return;
-
-    QPainterPath path;
-
-    OGRPoint point;
-    ring->getPoint(0, &point);
-    double x = point.getX() * scaleFactor;
-    double y = point.getY() * -scaleFactor;
-
-    path.moveTo(x, y);
-
-    for (int i = 1; i < ring->getNumPoints(); i++) {
-        ring->getPoint(i, &point);
-        x = point.getX() * scaleFactor;
-        y = point.getY() * -scaleFactor;
-        path.lineTo(x, y);
     }
-    path.closeSubpath();
-
-    // Draw interior rings (holes) if any
-    int interiorRingCount = polygon->getNumInteriorRings();
-    for (int r = 0; r < interiorRingCount; r++) {
-        OGRLinearRing *interiorRing = polygon->getInteriorRing(r);
-        if (interiorRing && interiorRing->getNumPoints() >= 3) {
-            OGRPoint interiorPoint;
-            interiorRing->getPoint(0, &interiorPoint);
-            double ix = interiorPoint.getX() * scaleFactor;
-            double iy = interiorPoint.getY() * -scaleFactor;
 
-            path.moveTo(ix, iy);
+    QApplication::restoreOverrideCursor();
+    labelLayerItemsForProfiler();
 
-            for (int i = 1; i < interiorRing->getNumPoints(); i++) {
-                interiorRing->getPoint(i, &interiorPoint);
-                ix = interiorPoint.getX() * scaleFactor;
-                iy = interiorPoint.getY() * -scaleFactor;
-                path.lineTo(ix, iy);
-            }
-            path.closeSubpath();
-        }
+    if (!failed.isEmpty()) {
+        QMessageBox::warning(this, "Vector Load Error",
+                             "Could not read some layers of " + filePath + ":\n" + failed.join("\n"));
     }
 
-    QGraphicsPathItem *item = mapScene->addPath(path);
-    QPen pen(color, 1);
-    item->setPen(pen);
-
-    // Fill polygon with semi-transparent color
-    QColor fillColor = color;
-    fillColor.setAlpha(100); // 40% opacity
-    item->setBrush(QBrush(fillColor));
-
-    // Store in current vector items
-    currentVectorItems.append(item);
-
-    // Optional: Add tooltip
-    item->setToolTip(QString("Polygon with %1 rings").arg(interiorRingCount + 1));
-}
-
-void MainWindow::clearVectorItems(const QString &layerName)
-{
-    if (layerName.isEmpty()) {
-        // Clear all vector items
-        for (QGraphicsItem *item : currentVectorItems) {
-            if (item && mapScene) {
-                mapScene->removeItem(item);
-                delete item;
-            }
-        }
-        currentVectorItems.clear();
-
-        // Clear all layer vector items
-        for (auto &layerItems : layerVectorItems) {
-            for (QGraphicsItem *item : layerItems) {
-                if (item && mapScene) {
-                    mapScene->removeItem(item);
-                    delete item;
-                }
-            }
-        }
-        layerVectorItems.clear();
-    } else {
-        // Clear vector items for specific layer
-        if (layerVectorItems.contains(layerName)) {
-            for (QGraphicsItem *item : layerVectorItems[layerName]) {
-                if (item && mapScene) {
-                    mapScene->removeItem(item);
-                    delete item;
-                }
-            }
-            layerVectorItems[layerName].clear();
-            layerVectorItems.remove(layerName);
-        }
-    }
+    // Zoom to fit all items
+    fitAllImages();
 }
 
 void MainWindow::setupProjectionSystem()
@@ -5556,31 +5971,169 @@ void MainWindow::setupProjectionSystem()
 
 void MainWindow::onExportMap()
 {
+    if (!mapView || !mapScene) return;
+    if (mapExporter->isRunning()) {
+        QMessageBox::information(this, "Export Map", "A map export is already running.");
+        return;
+    }
+
     QString fileName = QFileDialog::getSaveFileName(this,
         "Export Map",
-        QDir(getSaveLocation()).filePath(currentProjectName + "_export.pdf"),
-        "PDF Files (*.pdf);;PNG Files (*.png);;JPEG Files (*.jpg);;All Files (*)");
-
+        QDir(getSaveLocation()).filePath(currentProjectName + "_map.tif"),
+        "GeoTIFF Files (*.tif *.tiff);;PNG Files (*.png);;JPEG Files (*.jpg *.jpeg);;PDF Files (*.pdf)");
     if (!fileName.isEmpty()) {
-        // Create a high-resolution render of the map view
-        if (mapView && mapScene) {
-            QImage image(mapView->viewport()->size(), QImage::Format_ARGB32);
-            image.fill(Qt::white);
+        exportMapToFile(fileName);
+    }
+}
+
+// Asks for the extent and resolution, then exports in the background; the
+// format follows from the file name
+void MainWindow::exportMapToFile(QString fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    MapExporter::Settings settings;
+    if (suffix == "pdf") {
+        settings.format = "PDF";
+    } else if (suffix == "png") {
+        settings.format = "PNG";
+    } else if (suffix == "jpg" || suffix == "jpeg") {
+        settings.format = "JPEG";
+    } else if (suffix != "tif" && suffix != "tiff") {
+        fileName += ".tif";
+    }
+    settings.path = fileName;
+
+    // Extent and resolution; the size follows from the zoom of the view
+    QDialog dialog(this);
+    dialog.setWindowTitle("Export Map");
+    QFormLayout *form = new QFormLayout(&dialog);
+    QComboBox *extentCombo = new QComboBox();
+    extentCombo->addItems(QStringList() << "Current view" << "All layers");
+    form->addRow("Extent:", extentCombo);
+    QSpinBox *dpiSpin = new QSpinBox();
+    dpiSpin->setRange(24, 2400);
+    dpiSpin->setValue(300);
+    dpiSpin->setSuffix(" dpi");
+    form->addRow("Resolution:", dpiSpin);
+    QLabel *sizeLabel = new QLabel();
+    form->addRow("Size:", sizeLabel);
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    form->addRow(buttons);
+
+    const int maxSide = settings.format == "JPEG" ? 65500 : 1000000;
+    auto sceneRect = [this, extentCombo]() {
+        return extentCombo->currentIndex() == 0
+                ? mapView->mapToScene(mapView->viewport()->rect()).boundingRect()
+                : mapScene->itemsBoundingRect();
+    };
+    auto outputSize = [this, dpiSpin, &sceneRect]() {
+        const QSizeF onScreen = mapView->transform().mapRect(sceneRect()).size();
+        const double factor = double(dpiSpin->value()) / mapView->logicalDpiX();
+        return QSize(qCeil(onScreen.width() * factor), qCeil(onScreen.height() * factor));
+    };
+    auto updateSize = [sizeLabel, buttons, maxSide, &outputSize]() {
+        const QSize size = outputSize();
+        const bool fits = !size.isEmpty() && size.width() <= maxSide && size.height() <= maxSide;
+        sizeLabel->setText(QString("%1 x %2 pixels%3").arg(size.width()).arg(size.height())
+                           .arg(fits ? QString() : QString(" (too large)")));
+        buttons->button(QDialogButtonBox::Ok)->setEnabled(fits);
+    };
+    connect(extentCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), &dialog, updateSize);
+    connect(dpiSpin, QOverload<int>::of(&QSpinBox::valueChanged), &dialog, updateSize);
+    updateSize();
+    if (dialog.exec() != QDialog::Accepted) return;
 
-            QPainter painter(&image);
-            mapView->render(&painter);
-            painter.end();
+    settings.sceneRect = sceneRect();
+    settings.size = outputSize();
+    settings.dpi = dpiSpin->value();
+    settings.sceneToMap = mapSettings.sceneToMapTransform();
+    settings.wkt = mapSettings.destinationWkt();
+    if (settings.wkt.isEmpty() && mapSettings.hasRasterGrid() && gdalDataset) {
+        // Drawn as loaded on the main GeoTIFF's grid: map units are its CRS
+        settings.wkt = QString::fromUtf8(gdalDataset->GetProjectionRef());
+    }
 
-            if (image.save(fileName)) {
-                if (messageLabel) {
-                    messageLabel->setText("Map exported to: " + fileName);
-                }
-                QMessageBox::information(this, "Export Successful",
-                    QString("Map exported to:\n%1").arg(fileName));
-            }
+    if (!mapExporter->start(MapExporter::layersFromScene(mapScene), settings)) return;
+
+    if (!mapExportProgress) {
+        mapExportProgress = new QProgressDialog(this);
+        mapExportProgress->setWindowTitle("Export Map");
+        mapExportProgress->setAutoClose(false);
+        mapExportProgress->setAutoReset(false);
+        connect(mapExportProgress, &QProgressDialog::canceled, mapExporter, &MapExporter::cancel);
+    }
+    mapExportProgress->setLabelText(QString("Rendering %1 x %2 pixels to %3")
+                                    .arg(settings.size.width()).arg(settings.size.height())
+                                    .arg(QFileInfo(fileName).fileName()));
+    mapExportProgress->setRange(0, 0);
+    mapExportProgress->setValue(0);
+    mapExportProgress->show();
+}
+
+void MainWindow::onMapExportProgress(int rowsDone, int rowCount)
+{
+    if (!mapExportProgress) return;
+    mapExportProgress->setRange(0, rowCount);
+    mapExportProgress->setValue(rowsDone);
+}
+
+void MainWindow::onMapExportFinished(bool success, const QString &errorMessage)
+{
+    if (mapExportProgress) mapExportProgress->hide();
+
+    if (!success) {
+        if (messageLabel) messageLabel->setText("Map export: " + errorMessage);
+        if (errorMessage != "Canceled") {
+            QMessageBox::warning(this, "Export Error", "Could not export the map:\n" + errorMessage);
         }
+        return;
+    }
+    if (messageLabel) {
+        messageLabel->setText("Map exported to: " + mapExporter->path());
+    }
+    QMessageBox::information(this, "Export Successful",
+                             QString("Map exported to:\n%1").arg(mapExporter->path()));
+}
+
+void MainWindow::onToggleProfiler(bool enabled)
+{
+    Profiler::instance().setEnabled(enabled);
+    if (profilerDock) profilerDock->setVisible(enabled);
+    if (!enabled && profilerOverlayAction) profilerOverlayAction->setChecked(false);
+    labelLayerItemsForProfiler();
+    if (mapView) mapView->viewport()->update();
+}
+
+// Timings are reported per item; this tells the profiler which layer each
+// item draws
+void MainWindow::labelLayerItemsForProfiler()
+{
+    if (!Profiler::isEnabled()) return;
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.graphicsItem) layer.graphicsItem->setData(Profiler::LayerNameKey, layer.name);
+        if (layer.reprojectedItem) layer.reprojectedItem->setData(Profiler::LayerNameKey, layer.name);
+    }
+}
+
+void MainWindow::onExportProfilerTrace()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Trace",
+                                                    QDir(getSaveLocation()).filePath(currentProjectName + "_trace.json"),
+                                                    "Chrome Trace Files (*.json)");
+    if (fileName.isEmpty()) return;
+
+    QString errorMessage;
+    if (!Profiler::instance().writeChromeTrace(fileName, &errorMessage)) {
+        QMessageBox::warning(this, "Export Trace", "Could not write the trace:\n" + errorMessage);
+        return;
+    }
+    if (messageLabel) {
+        messageLabel->setText("Trace written to: " + fileName);
     }
 }
+
 void MainWindow::onOpenAttributeTable()
 {
     QTreeWidgetItem *currentItem = layersTree->currentItem();
@@ -5770,6 +6323,35 @@ void MainWindow::showCRSSelectionDialog()
     filterCombo->addItems({"All", "Recently Used", "Geographic", "Projected", "Custom", "Engineering", "Compound"});
     filterCombo->setMaximumWidth(150);
     filterLayout->addWidget(filterCombo);
+
+    // Areas of use are in degrees: the visible area, when it has
+    // geographic coordinates
+    QRectF viewArea;
+    if (MapView *view = currentMapView()) {
+        const QRectF visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+        double west = 180.0, south = 90.0, east = -180.0, north = -90.0;
+        bool known = true;
+        for (const QPointF &corner : { visible.topLeft(), visible.topRight(),
+                                       visible.bottomLeft(), visible.bottomRight() }) {
+            const QPointF lonLat = sceneToGeographicCoords(corner);
+            if (!qIsFinite(lonLat.x()) || !qIsFinite(lonLat.y())) {
+                known = false;
+                break;
+            }
+            west = qMin(west, lonLat.x());
+            east = qMax(east, lonLat.x());
+            south = qMin(south, lonLat.y());
+            north = qMax(north, lonLat.y());
+        }
+        if (known) {
+            viewArea = QRectF(QPointF(qMax(west, -180.0), qMax(south, -90.0)),
+                              QPointF(qMin(east, 180.0), qMin(north, 90.0)));
+        }
+    }
+    QCheckBox *inViewCheck = new QCheckBox("Used in the current view");
+    inViewCheck->setToolTip("Only systems whose area of use overlaps the visible map");
+    inViewCheck->setEnabled(!viewArea.isNull());
+    filterLayout->addWidget(inViewCheck);
     filterLayout->addStretch();
     predefinedLayout->addLayout(filterLayout);
 
@@ -5791,17 +6373,40 @@ void MainWindow::showCRSSelectionDialog()
     QGroupBox *crsGroup = new QGroupBox("Coordinate Reference System");
     QVBoxLayout *crsLayout = new QVBoxLayout(crsGroup);
 
-    QTreeWidget *crsTree = new QTreeWidget();
-    crsTree->setHeaderLabels(QStringList() << "Name" << "Authority ID" << "Type");
-    crsTree->setColumnCount(3);
+    // The whole EPSG registry, read in the background at startup; the view
+    // only formats the rows it shows
+    CrsCatalogueModel *crsModel = new CrsCatalogueModel(dialog);
+    QTreeView *crsTree = new QTreeView();
+    crsTree->setModel(crsModel);
+    crsTree->setRootIsDecorated(false);
+    crsTree->setUniformRowHeights(true);
     crsTree->setSortingEnabled(true);
+    crsTree->sortByColumn(CrsCatalogueModel::NameColumn, Qt::AscendingOrder);
     crsTree->setAlternatingRowColors(true);
+    crsTree->header()->resizeSection(CrsCatalogueModel::NameColumn, 420);
 
-    // Populate the CRS tree
-    populateCRSTree(crsTree);
+    auto updateCrsCount = [crsGroup, crsModel]() {
+        if (!crsModel->isLoaded()) {
+            crsGroup->setTitle("Coordinate Reference System (loading...)");
+        } else {
+            crsGroup->setTitle(QString("Coordinate Reference System (%1 of %2)")
+                               .arg(crsModel->rowCount()).arg(crsModel->totalCount()));
+        }
+    };
 
-    crsTree->expandAll();
-    crsTree->resizeColumnToContents(0);
+    QFuture<QSharedPointer<const CrsCatalogue>> catalogue = CrsCatalogue::load();
+    if (catalogue.isFinished()) {
+        crsModel->setCatalogue(catalogue.result());
+    } else {
+        QFutureWatcher<QSharedPointer<const CrsCatalogue>> *watcher =
+                new QFutureWatcher<QSharedPointer<const CrsCatalogue>>(dialog);
+        connect(watcher, &QFutureWatcherBase::finished, dialog, [watcher, crsModel, updateCrsCount]() {
+            crsModel->setCatalogue(watcher->result());
+            updateCrsCount();
+        });
+        watcher->setFuture(catalogue);
+    }
+    updateCrsCount();
 
     crsLayout->addWidget(crsTree);
     predefinedLayout->addWidget(crsGroup);
@@ -5904,23 +6509,11 @@ void MainWindow::showCRSSelectionDialog()
     mainLayout->addWidget(buttonBox);
 
     // Connect signals for search functionality
-    connect(searchEdit, &QLineEdit::textChanged, [crsTree, recentList](const QString &text) {
-        if (crsTree) {
-            QTreeWidgetItemIterator it(crsTree);
-            while (*it) {
-                bool matches = text.isEmpty() ||
-                              (*it)->text(0).contains(text, Qt::CaseInsensitive) ||
-                              (*it)->text(1).contains(text, Qt::CaseInsensitive) ||
-                              (*it)->text(2).contains(text, Qt::CaseInsensitive);
-                (*it)->setHidden(!matches);
-
-                // Show parent if child matches
-                if (matches && (*it)->parent()) {
-                    (*it)->parent()->setHidden(false);
-                }
-                ++it;
-            }
-        }
+    connect(searchEdit, &QLineEdit::textChanged,
+            [crsModel, filterCombo, inViewCheck, viewArea, recentList, updateCrsCount](const QString &text) {
+        // Code, name and area of use words, looked up in the catalogue index
+        crsModel->setFilter(text, filterCombo->currentText(), inViewCheck->isChecked() ? viewArea : QRectF());
+        updateCrsCount();
 
         if (recentList) {
             for (int i = 0; i < recentList->count(); ++i) {
@@ -5937,29 +6530,19 @@ void MainWindow::showCRSSelectionDialog()
         searchEdit->setFocus();
     });
 
-    connect(filterCombo, &QComboBox::currentTextChanged, [crsTree](const QString &filter) {
-        if (!crsTree) return;
-
-        QTreeWidgetItemIterator it(crsTree);
-        while (*it) {
-            if (filter == "All") {
-                (*it)->setHidden(false);
-            } else if (filter == "Recently Used") {
-                (*it)->setHidden(true);
-            } else {
-                bool matches = (*it)->text(2).contains(filter, Qt::CaseInsensitive);
-                (*it)->setHidden(!matches);
+    connect(filterCombo, &QComboBox::currentTextChanged,
+            [crsModel, searchEdit, inViewCheck, viewArea, updateCrsCount](const QString &filter) {
+        crsModel->setFilter(searchEdit->text(), filter, inViewCheck->isChecked() ? viewArea : QRectF());
+        updateCrsCount();
+    });
 
-                // Show parent if child matches
-                if (matches && (*it)->parent()) {
-                    (*it)->parent()->setHidden(false);
-                }
-            }
-            ++it;
-        }
+    connect(inViewCheck, &QCheckBox::toggled,
+            [crsModel, searchEdit, filterCombo, viewArea, updateCrsCount](bool inView) {
+        crsModel->setFilter(searchEdit->text(), filterCombo->currentText(), inView ? viewArea : QRectF());
+        updateCrsCount();
     });
 
-    connect(crsTree, &QTreeWidget::itemDoubleClicked, dialog, &QDialog::accept);
+    connect(crsTree, &QTreeView::doubleClicked, dialog, &QDialog::accept);
     connect(recentList, &QListWidget::itemDoubleClicked, dialog, &QDialog::accept);
 
     connect(setFromLayerBtn, &QPushButton::clicked, [this, dialog, layerCombo]() {
@@ -6012,18 +6595,16 @@ void MainWindow::showCRSSelectionDialog()
 
         if (tabWidget->currentIndex() == 0) {
             // From predefined CRS tab
-            if (crsTree->currentItem()) {
-                QTreeWidgetItem *selected = crsTree->currentItem();
-                if (selected && !selected->text(1).isEmpty()) {
-                    selectedCRS = selected->text(1); // Authority ID
-                } else if (recentList->currentItem()) {
-                    QString recentText = recentList->currentItem()->text();
-                    // Extract EPSG code from recent item
-                    QRegularExpression epsgRegex(R"(EPSG:\d+)");
-                    QRegularExpressionMatch match = epsgRegex.match(recentText);
-                    if (match.hasMatch()) {
-                        selectedCRS = match.captured(0);
-                    }
+            const QString authId = crsModel->authId(crsTree->currentIndex());
+            if (!authId.isEmpty()) {
+                selectedCRS = authId;
+            } else if (recentList->currentItem()) {
+                QString recentText = recentList->currentItem()->text();
+                // Extract EPSG code from recent item
+                QRegularExpression epsgRegex(R"(EPSG:\d+)");
+                QRegularExpressionMatch match = epsgRegex.match(recentText);
+                if (match.hasMatch()) {
+                    selectedCRS = match.captured(0);
                 }
             }
         } else if (tabWidget->currentIndex() == 1) {
@@ -6043,89 +6624,11 @@ void MainWindow::showCRSSelectionDialog()
 }
 
 
-void MainWindow::populateCRSTree(QTreeWidget *crsTree)
-{
-    if (!crsTree) return;
-
-    crsTree->clear();
-
-    // Sample CRS data - in a real application, you would load this from
-    // a database or EPSG files
-    QMap<QString, QList<QPair<QString, QString>>> crsData = {
-        {"Geographic (2D)", {
-            {"WGS 84", "EPSG:4326"},
-            {"NAD83", "EPSG:4269"},
-            {"ETRS89", "EPSG:4258"},
-            {"JGD2000", "EPSG:4612"},
-            {"GDA94", "EPSG:4283"},
-            {"Tokyo", "EPSG:4301"}
-        }},
-        {"Geographic (3D)", {
-            {"WGS 84 3D", "EPSG:4979"},
-            {"ETRS89 3D", "EPSG:4937"}
-        }},
-        {"Projected", {
-            {"WGS 84 / Pseudo-Mercator", "EPSG:3857"},
-            {"WGS 84 / UTM zone 33N", "EPSG:32633"},
-            {"WGS 84 / UTM zone 34N", "EPSG:32634"},
-            {"OSGB 1936 / British National Grid", "EPSG:27700"},
-            {"NAD83 / UTM zone 17N", "EPSG:26917"},
-            {"WGS 84 / World Mercator", "EPSG:3395"}
-        }},
-        {"Engineering", {
-            {"Unknown datum based upon the Clarke 1866 ellipsoid", "EPSG:6500"}
-        }},
-        {"Compound", {
-            {"WGS 84 + EGM96 height", "EPSG:9707"}
-        }},
-        {"Geocentric", {
-            {"WGS 84", "EPSG:4328"}
-        }}
-    };
-
-    for (auto it = crsData.constBegin(); it != crsData.constEnd(); ++it) {
-        QString category = it.key();
-        QTreeWidgetItem *categoryItem = new QTreeWidgetItem(crsTree, QStringList() << category);
-        categoryItem->setIcon(0, QIcon(":/icons/folder.png"));
-
-        for (const auto &crs : it.value()) {
-            QString name = crs.first;
-            QString authId = crs.second;
-
-            QTreeWidgetItem *crsItem = new QTreeWidgetItem(categoryItem);
-            crsItem->setText(0, name);
-            crsItem->setText(1, authId);
-            crsItem->setText(2, category);
-            crsItem->setIcon(0, QIcon(":/icons/projection.png"));
-
-            // Store full data as tooltip
-            crsItem->setToolTip(0, QString("%1\n%2").arg(name).arg(authId));
-            crsItem->setToolTip(1, authId);
-            crsItem->setToolTip(2, category);
-        }
-    }
-}
-
 QString MainWindow::getCRSDisplayName(const QString &crsCode)
 {
-    // Map EPSG codes to human-readable names
-    static QMap<QString, QString> crsNameMap = {
-        {"EPSG:4326", "WGS 84"},
-        {"EPSG:3857", "WGS 84 / Pseudo-Mercator"},
-        {"EPSG:32633", "WGS 84 / UTM zone 33N"},
-        {"EPSG:32634", "WGS 84 / UTM zone 34N"},
-        {"EPSG:27700", "OSGB 1936 / British National Grid"},
-        {"EPSG:4269", "NAD83"},
-        {"EPSG:4258", "ETRS89"},
-        {"EPSG:4612", "JGD2000"},
-        {"EPSG:4979", "WGS 84 3D"},
-        {"EPSG:3857", "WGS 84 / Pseudo-Mercator"},
-        {"EPSG:3395", "WGS 84 / World Mercator"},
-        {"EPSG:4328", "WGS 84 (Geocentric)"}
-    };
-
-    if (crsNameMap.contains(crsCode)) {
-        return QString("%1 - %2").arg(crsCode).arg(crsNameMap[crsCode]);
+    QSharedPointer<const CrsDefinition> crs = CrsRegistry::instance().crs(crsCode);
+    if (crs && !crs->authId.isEmpty() && !crs->name.isEmpty()) {
+        return QString("%1 - %2").arg(crs->authId, crs->name);
     }
 
     // Check if it's a PROJ.4 string
@@ -6176,15 +6679,7 @@ void MainWindow::onCRSChanged(const QString &crs)
     // For now, just log it
     qDebug() << "CRS changed to:" << crs << "(" << displayName << ")";
 
-    // Here you would also:
-    // 1. Reproject all loaded layers to the new CRS
-    // 2. Update coordinate displays
-    // 3. Refresh the map view
-    // 4. Notify other components about CRS change
-
-    // For now, we'll just update the display
-    // In a full implementation, you would integrate with PROJ/GDAL
-    // for actual coordinate transformations
+    reprojectLayers(crs);
 
     // Emit signal if needed
     // emit crsChanged(crs, displayName);
@@ -6225,3 +6720,1189 @@ void MainWindow::animateCRSChange()
         projectionLabel->setStyleSheet(originalStyle);
     });
 }
+
+// Processing Methods
+
+static QString formatThroughput(int features, qint64 elapsedMs)
+{
+    double seconds = qMax<qint64>(elapsedMs, 1) / 1000.0;
+    return QString("%1 features in %2 s (%3 features/s)")
+            .arg(features)
+            .arg(seconds, 0, 'f', 2)
+            .arg(static_cast<qint64>(features / seconds));
+}
+
+void MainWindow::onProcessingAlgorithmActivated(QTreeWidgetItem *item, int column)
+{
+    Q_UNUSED(column)
+
+    // Group items have no parent and are not algorithms
+    if (!item || !item->parent()) return;
+
+    QString algorithm = item->text(0);
+
+    if (algorithm == "Buffer") {
+        runBufferAlgorithm();
+    } else if (algorithm == "Clip") {
+        runClipAlgorithm();
+    } else if (algorithm == "Intersection") {
+        runIntersectionAlgorithm();
+    } else if (algorithm == "Line Intersections") {
+        runLineIntersectionsAlgorithm();
+    } else if (algorithm == "Sum Line Lengths") {
+        runSumLineLengthsAlgorithm();
+    } else if (algorithm == "Random Points") {
+        runRandomPointsAlgorithm();
+    } else if (algorithm == "Regular Points") {
+        runRegularPointsAlgorithm();
+    } else if (algorithm == "Raster Calculator") {
+        runRasterCalculatorAlgorithm();
+    } else if (algorithm == "Hillshade") {
+        runTerrainAlgorithm(Terrain::Hillshade);
+    } else if (algorithm == "Slope") {
+        runTerrainAlgorithm(Terrain::Slope);
+    } else if (algorithm == "Aspect") {
+        runTerrainAlgorithm(Terrain::Aspect);
+    } else if (messageLabel) {
+        messageLabel->setText("Algorithm not available yet: " + algorithm);
+    }
+}
+
+
+bool MainWindow::selectProcessingLayer(const QString &title, const QString &label,
+                                       ProcessingInput *input)
+{
+    QStringList layerNames;
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.type == "vector" || layer.type == "memory") {
+            layerNames << layer.name;
+        }
+    }
+
+    if (layerNames.isEmpty()) {
+        QMessageBox::information(this, title, "Load a vector layer first.");
+        return false;
+    }
+
+    bool ok = false;
+    QString selected = QInputDialog::getItem(this, title, label, layerNames, 0, false, &ok);
+    if (!ok || selected.isEmpty()) return false;
+
+    // Only the source is recorded here; the features are read by the job
+    for (const LayerInfo &layer : loadedLayers) {
+        if ((layer.type == "vector" || layer.type == "memory") && layer.name == selected) {
+            input->name = layer.name;
+            input->filePath = layer.filePath;
+            input->layerIndex = layer.properties.value("layer_index", 0).toInt();
+            input->geometryType = layer.properties.value("geometry_type").toString();
+            input->memory = layer.memoryBuffer;
+            return true;
+        }
+    }
+    return false;
+}
+
+int MainWindow::submitProcessingJob(const QString &title, const QString &outputName,
+                                    const ProcessingJobScheduler::JobFunction &function)
+{
+    int jobId = jobScheduler->submit(title, function);
+    ProcessingJobOutput output;
+    output.name = outputName;
+    processingJobOutputs.insert(jobId, output);
+
+    QTreeWidgetItem *item = new QTreeWidgetItem(processingJobsTree);
+    item->setText(0, QString("%1 (%2)").arg(title, outputName));
+    item->setToolTip(0, item->text(0));
+    processingJobItems.insert(jobId, item);
+
+    QProgressBar *progressBar = new QProgressBar();
+    progressBar->setRange(0, 1000);
+    progressBar->setValue(0);
+    progressBar->setFormat("Queued");
+    progressBar->setMaximumHeight(16);
+    processingJobsTree->setItemWidget(item, 1, progressBar);
+
+    QToolButton *cancelBtn = new QToolButton();
+    cancelBtn->setText("Cancel");
+    cancelBtn->setAutoRaise(true);
+    connect(cancelBtn, &QToolButton::clicked, this, [this, jobId]() {
+        jobScheduler->cancel(jobId);
+    });
+    processingJobsTree->setItemWidget(item, 2, cancelBtn);
+
+    if (processingToolboxDock) {
+        processingToolboxDock->raise();
+        processingToolboxDock->show();
+    }
+    if (messageLabel) {
+        messageLabel->setText(title + " queued");
+    }
+    return jobId;
+}
+
+int MainWindow::submitRasterProcessingJob(const QString &title, const QString &outputPath,
+                                          const QString &referenceLayer,
+                                          const ProcessingJobScheduler::JobFunction &function)
+{
+    int jobId = submitProcessingJob(title, QFileInfo(outputPath).completeBaseName(), function);
+    processingJobOutputs[jobId].rasterPath = outputPath;
+    processingJobOutputs[jobId].referenceLayer = referenceLayer;
+    return jobId;
+}
+
+QString MainWindow::processingOutputPath(const QString &name, const QString &suffix)
+{
+    QDir outputDir(QDir(getSaveLocation()).filePath("processing"));
+    if (!outputDir.exists()) {
+        outputDir.mkpath(".");
+    }
+
+    QString filePath = outputDir.filePath(name + "." + suffix);
+    if (QFile::exists(filePath)) {
+        filePath = outputDir.filePath(QString("%1_%2.%3")
+                                      .arg(name)
+                                      .arg(QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss"))
+                                      .arg(suffix));
+    }
+    return filePath;
+}
+
+void MainWindow::onProcessingJobStarted(int jobId)
+{
+    QTreeWidgetItem *item = processingJobItems.value(jobId);
+    if (!item) return;
+
+    QProgressBar *progressBar = qobject_cast<QProgressBar*>(processingJobsTree->itemWidget(item, 1));
+    if (progressBar) {
+        progressBar->setFormat("%p%");
+    }
+}
+
+void MainWindow::onProcessingJobProgress(int jobId, double percent)
+{
+    QTreeWidgetItem *item = processingJobItems.value(jobId);
+    if (!item) return;
+
+    QProgressBar *progressBar = qobject_cast<QProgressBar*>(processingJobsTree->itemWidget(item, 1));
+    if (progressBar) {
+        progressBar->setValue(qBound(0, static_cast<int>(percent * 10.0), 1000));
+    }
+}
+
+void MainWindow::onProcessingJobFinished(int jobId, bool success)
+{
+    const QString title = jobScheduler->name(jobId);
+    const ProcessingJobOutput output = processingJobOutputs.take(jobId);
+    const ProcessingJobScheduler::JobState state = jobScheduler->state(jobId);
+    const QString errorMessage = jobScheduler->errorMessage(jobId);
+    const qint64 elapsed = jobScheduler->elapsedMs(jobId);
+    QSharedPointer<FeatureBuffer> result = jobScheduler->takeResult(jobId);
+
+    QString status;
+    if (success && !output.rasterPath.isEmpty()) {
+        if (addRasterResultLayer(output.rasterPath, output.referenceLayer)) {
+            status = QString("Done in %1 s").arg(elapsed / 1000.0, 0, 'f', 2);
+            if (messageLabel) {
+                messageLabel->setText(QString("%1: wrote %2 in %3 s")
+                                      .arg(title, QFileInfo(output.rasterPath).fileName())
+                                      .arg(elapsed / 1000.0, 0, 'f', 2));
+            }
+        } else {
+            status = "Not added";
+        }
+    } else if (success && result) {
+        if (addMemoryLayer(result, output.name)) {
+            status = QString("Done in %1 s").arg(elapsed / 1000.0, 0, 'f', 2);
+            if (messageLabel) {
+                messageLabel->setText(QString("%1: %2").arg(title, formatThroughput(result->count(), elapsed)));
+            }
+        } else {
+            status = "Not added";
+        }
+    } else if (state == ProcessingJobScheduler::Canceled) {
+        status = "Canceled";
+        if (messageLabel) {
+            messageLabel->setText(title + " canceled");
+        }
+    } else {
+        status = "Failed";
+        QMessageBox::critical(this, title, QString("%1 failed: %2").arg(title, errorMessage));
+    }
+    if (success && !errorMessage.isEmpty()) {
+        QMessageBox::warning(this, title, errorMessage);
+    }
+
+    QTreeWidgetItem *item = processingJobItems.value(jobId);
+    if (item) {
+        processingJobsTree->removeItemWidget(item, 1);
+        processingJobsTree->removeItemWidget(item, 2);
+        item->setText(1, status);
+        item->setToolTip(1, errorMessage.isEmpty() ? status : errorMessage);
+    }
+}
+
+void MainWindow::onClearFinishedJobs()
+{
+    // Items still holding a cancel button belong to queued or running jobs
+    QMutableMapIterator<int, QTreeWidgetItem*> it(processingJobItems);
+    while (it.hasNext()) {
+        it.next();
+        if (!processingJobsTree->itemWidget(it.value(), 2)) {
+            delete it.value();
+            it.remove();
+        }
+    }
+}
+
+bool MainWindow::addMemoryLayer(const QSharedPointer<FeatureBuffer> &buffer, const QString &name)
+{
+    if (!buffer || !mapScene) return false;
+
+    // Layers are looked up by name, so keep memory layer names unique
+    QString layerName = name;
+    for (int suffix = 2; ; ++suffix) {
+        bool taken = false;
+        for (const LayerInfo &layer : loadedLayers) {
+            if (layer.name == layerName) {
+                taken = true;
+                break;
+            }
+        }
+        if (!taken) break;
+        layerName = QString("%1_%2").arg(name).arg(suffix);
+    }
+
+    const QColor color = FeatureBufferItem::defaultColor(buffer->geometryType());
+    const QString geomTypeStr = FeatureBufferItem::geometryTypeLabel(buffer->geometryType());
+
+    FeatureBufferItem *item = new FeatureBufferItem(buffer, color);
+    item->setTransform(mapSettings.mapToSceneTransform());
+    mapSettings.markPlaced(item);
+    mapScene->addItem(item);
+
+    LayerInfo layerInfo;
+    layerInfo.name = layerName;
+    layerInfo.type = "memory";
+    layerInfo.graphicsItem = item;
+    layerInfo.memoryBuffer = buffer;
+    layerInfo.properties["geometry_type"] = geomTypeStr;
+    layerInfo.properties["feature_count"] = buffer->count();
+    layerInfo.properties["format"] = "memory";
+
+    QTreeWidgetItem *layerItem = new QTreeWidgetItem(
+                QStringList() << layerName << "Memory (" + geomTypeStr + ")");
+    layerItem->setCheckState(0, Qt::Checked);
+    layerItem->setIcon(0, QIcon(":/icons/vector_layer.png"));
+    layerItem->setToolTip(0, "Temporary layer, use Save Layer to keep it");
+    layerInfo.treeItem = layerItem;
+
+    QTreeWidgetItem *vectorGroup = nullptr;
+    for (int j = 0; j < layersTree->topLevelItemCount(); ++j) {
+        if (layersTree->topLevelItem(j)->text(0) == "Vector Layers") {
+            vectorGroup = layersTree->topLevelItem(j);
+            break;
+        }
+    }
+
+    if (!vectorGroup) {
+        vectorGroup = new QTreeWidgetItem(layersTree, QStringList() << "Vector Layers");
+        vectorGroup->setIcon(0, QIcon(":/icons/folder.png"));
+        vectorGroup->setExpanded(true);
+    }
+
+    vectorGroup->addChild(layerItem);
+
+    loadedLayers.append(layerInfo);
+    projectModified = true;
+
+    // Results are in the CRS of their input; drawn reprojected when the
+    // canvas has a CRS of its own
+    if (!mapSettings.destinationCrs().isEmpty()) {
+        QString reprojectError;
+        reprojectLayer(loadedLayers.last(), mapSettings.destinationCrs(), mapSettings.destinationWkt(),
+                       &reprojectError);
+    }
+
+    if (projectInfoLabel) {
+        projectInfoLabel->setText(QString("Project: %1\nLayers: %2")
+                                  .arg(currentProjectName)
+                                  .arg(loadedLayers.size()));
+    }
+
+    updatePropertiesDisplay(layerInfo);
+    fitAllImages();
+    return true;
+}
+
+bool MainWindow::saveMemoryLayer(LayerInfo &layer)
+{
+    if (!layer.memoryBuffer) return false;
+
+    QString savePath = QFileDialog::getSaveFileName(this,
+                                                    "Save Layer As",
+                                                    QDir(getSaveLocation()).filePath(layer.name + ".gpkg"),
+                                                    "GeoPackage (*.gpkg);;Shapefile (*.shp);;GeoJSON (*.geojson)");
+    if (savePath.isEmpty()) return false;
+
+    QString errorMessage;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool saved = layer.memoryBuffer->writeToFile(savePath, layer.name, &errorMessage);
+    QApplication::restoreOverrideCursor();
+
+    if (!saved) {
+        QMessageBox::critical(this, "Save Layer", "Could not save layer:\n" + errorMessage);
+        return false;
+    }
+
+    // The layer stays in memory; the file only records where it was saved
+    layer.filePath = savePath;
+    updatePropertiesDisplay(layer);
+    emit layerSaved(layer.name, savePath);
+
+    if (messageLabel) {
+        messageLabel->setText(QString("Saved %1 to %2").arg(layer.name, savePath));
+    }
+    return true;
+}
+
+void MainWindow::identifyFeaturesAt(const QPointF &scenePos)
+{
+    // Four pixels either side of the click
+    double tolerance = 4.0 / qMax(mapView->transform().m11(), 1e-12);
+
+    for (int i = loadedLayers.size() - 1; i >= 0; --i) {
+        const LayerInfo &layer = loadedLayers[i];
+
+        // Reprojected vector layers are drawn from their reprojected features
+        QGraphicsItem *shown = layer.type == "memory" ? layer.graphicsItem : nullptr;
+        if ((layer.type == "memory" || layer.type == "vector") && layer.reprojectedItem &&
+            layer.properties["reprojected"].toBool()) {
+            shown = layer.reprojectedItem;
+        }
+        if (!shown || !shown->isVisible()) continue;
+
+        FeatureBufferItem *item = static_cast<FeatureBufferItem*>(shown);
+        int feature = item->featureAt(scenePos, tolerance);
+        if (feature < 0) continue;
+
+        const FeatureBuffer &buffer = *item->buffer();
+        QString info = QString("<b>%1</b> &mdash; feature %2<hr>").arg(layer.name).arg(feature);
+        for (int f = 0; f < buffer.fieldCount(); ++f) {
+            info += QString("<b>%1:</b> %2<br>")
+                    .arg(buffer.fields()[f].name.toHtmlEscaped())
+                    .arg(buffer.attribute(feature, f).toString().toHtmlEscaped());
+        }
+
+        QMessageBox::information(this, "Identify Results", info);
+        return;
+    }
+
+    if (messageLabel) {
+        messageLabel->setText("No feature found at this location");
+    }
+}
+
+bool MainWindow::addRasterResultLayer(const QString &filePath, const QString &referenceLayer)
+{
+    if (!mapScene) return false;
+
+    GDALDataset *dataset = (GDALDataset*)GDALOpen(filePath.toUtf8().constData(), GA_ReadOnly);
+    if (!dataset) {
+        QMessageBox::critical(this, "Raster Result", "Could not open result:\n" + filePath);
+        return false;
+    }
+
+    const int width = dataset->GetRasterXSize();
+    const int height = dataset->GetRasterYSize();
+
+    // Display a stretched preview at most 4096 pixels across; the full
+    // resolution values stay in the file
+    const double step = qMax(1.0, qMax(width, height) / 4096.0);
+    const int previewWidth = qMax(1, qRound(width / step));
+    const int previewHeight = qMax(1, qRound(height / step));
+
+    GDALRasterBand *band = dataset->GetRasterBand(1);
+    QVector<float> values(previewWidth * previewHeight);
+    CPLErr err = band->RasterIO(GF_Read, 0, 0, width, height, values.data(),
+                                previewWidth, previewHeight, GDT_Float32, 0, 0);
+    int hasNoData = 0;
+    const float noData = static_cast<float>(band->GetNoDataValue(&hasNoData));
+    double geoTransform[6];
+    const bool georeferenced = dataset->GetGeoTransform(geoTransform) == CE_None;
+    GDALClose(dataset);
+
+    if (err != CE_None) {
+        QMessageBox::critical(this, "Raster Result", "Could not read result:\n" + filePath);
+        return false;
+    }
+
+    float minValue = 0.0f;
+    float maxValue = 0.0f;
+    bool first = true;
+    for (float value : values) {
+        if ((hasNoData && value == noData) || !qIsFinite(value)) continue;
+        if (first) {
+            minValue = maxValue = value;
+            first = false;
+        } else {
+            minValue = qMin(minValue, value);
+            maxValue = qMax(maxValue, value);
+        }
+    }
+
+    const float range = maxValue > minValue ? maxValue - minValue : 1.0f;
+    QImage image(previewWidth, previewHeight, QImage::Format_ARGB32);
+    for (int y = 0; y < previewHeight; ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        const float *row = values.constData() + y * previewWidth;
+        for (int x = 0; x < previewWidth; ++x) {
+            const float value = row[x];
+            if ((hasNoData && value == noData) || !qIsFinite(value)) {
+                line[x] = qRgba(0, 0, 0, 0);
+            } else {
+                const int gray = qBound(0, static_cast<int>((value - minValue) / range * 255.0f), 255);
+                line[x] = qRgb(gray, gray, gray);
+            }
+        }
+    }
+
+    QGraphicsPixmapItem *pixmapItem = mapScene->addPixmap(QPixmap::fromImage(image));
+    pixmapItem->setTransformationMode(Qt::SmoothTransformation);
+
+    // Placed by its own georeferencing; otherwise cover exactly the area the
+    // raster it was computed from is drawn on
+    QGraphicsItem *referenceItem = nullptr;
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.name == referenceLayer && layer.graphicsItem) {
+            referenceItem = layer.shownItem();
+            break;
+        }
+    }
+
+    if (georeferenced) {
+        pixmapItem->setTransform(QTransform::fromScale(double(width) / previewWidth,
+                                                       double(height) / previewHeight) *
+                                 mapSettings.rasterToScene(geoTransform));
+        if (referenceItem) pixmapItem->setZValue(referenceItem->zValue() + 1);
+        mapSettings.markPlaced(pixmapItem);
+    } else if (referenceItem) {
+        QRectF referenceRect = referenceItem->sceneBoundingRect();
+        pixmapItem->setPos(referenceRect.topLeft());
+        pixmapItem->setTransform(QTransform::fromScale(referenceRect.width() / previewWidth,
+                                                       referenceRect.height() / previewHeight));
+        pixmapItem->setZValue(referenceItem->zValue() + 1);
+        mapSettings.markPlaced(pixmapItem);
+    } else {
+        pixmapItem->setTransform(QTransform::fromScale(double(width) / previewWidth,
+                                                       double(height) / previewHeight));
+    }
+
+    QString layerName = QFileInfo(filePath).completeBaseName();
+
+    LayerInfo layer;
+    layer.name = layerName;
+    layer.filePath = filePath;
+    layer.type = "raster";
+    layer.graphicsItem = pixmapItem;
+    layer.properties["format"] = "geotiff";
+    layer.properties["width"] = width;
+    layer.properties["height"] = height;
+    layer.properties["data_type"] = "Float32";
+    layer.properties["min_value"] = minValue;
+    layer.properties["max_value"] = maxValue;
+    layer.properties["has_geotransform"] = georeferenced;
+
+    QTreeWidgetItem *layerItem = new QTreeWidgetItem(QStringList() << layerName << "Raster (Float32)");
+    layerItem->setCheckState(0, Qt::Checked);
+    layerItem->setIcon(0, QIcon(":/icons/raster_layer.png"));
+    layerItem->setToolTip(0, QString("%1\nRange: %2 to %3").arg(filePath).arg(minValue).arg(maxValue));
+    layer.treeItem = layerItem;
+
+    QTreeWidgetItem *rasterGroup = nullptr;
+    for (int i = 0; i < layersTree->topLevelItemCount(); ++i) {
+        if (layersTree->topLevelItem(i)->text(0) == "Raster Layers") {
+            rasterGroup = layersTree->topLevelItem(i);
+            break;
+        }
+    }
+
+    if (!rasterGroup) {
+        rasterGroup = new QTreeWidgetItem(layersTree, QStringList() << "Raster Layers");
+        rasterGroup->setIcon(0, QIcon(":/icons/folder.png"));
+        rasterGroup->setExpanded(true);
+    }
+
+    rasterGroup->addChild(layerItem);
+    loadedLayers.append(layer);
+    projectModified = true;
+
+    // Warped like every other raster when the canvas has a CRS of its own
+    if (georeferenced && !mapSettings.destinationCrs().isEmpty()) {
+        QString reprojectError;
+        reprojectLayer(loadedLayers.last(), mapSettings.destinationCrs(), mapSettings.destinationWkt(),
+                       &reprojectError);
+    }
+
+    if (projectInfoLabel) {
+        projectInfoLabel->setText(QString("Project: %1\nLayers: %2")
+                                  .arg(currentProjectName)
+                                  .arg(loadedLayers.size()));
+    }
+
+    updatePropertiesDisplay(layer);
+    emit layerLoaded(layerName, layer.type);
+    return true;
+}
+
+void MainWindow::runBufferAlgorithm()
+{
+    ProcessingInput input;
+    if (!selectProcessingLayer("Buffer", "Input layer:", &input)) return;
+
+    bool ok = false;
+    double distance = QInputDialog::getDouble(this, "Buffer", "Distance (layer units):",
+                                              10.0, -1e9, 1e9, 6, &ok);
+    if (!ok) return;
+
+    int segments = QInputDialog::getInt(this, "Buffer", "Segments per quarter circle:",
+                                        8, 1, 64, 1, &ok);
+    if (!ok) return;
+
+    submitProcessingJob("Buffer", input.name + "_buffer",
+                        [input, distance, segments](ProcessingFeedback *feedback,
+                                                    FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> source = input.load(errorMessage);
+        if (!source) return false;
+        return Geoprocessing::buffer(*source, distance, segments, output, feedback, errorMessage);
+    });
+}
+
+void MainWindow::runClipAlgorithm()
+{
+    ProcessingInput input;
+    ProcessingInput overlay;
+    if (!selectProcessingLayer("Clip", "Input layer:", &input)) return;
+    if (!selectProcessingLayer("Clip", "Overlay (clip) layer:", &overlay)) return;
+
+    submitProcessingJob("Clip", input.name + "_clip",
+                        [input, overlay](ProcessingFeedback *feedback,
+                                         FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> source = input.load(errorMessage);
+        if (!source) return false;
+        QSharedPointer<const FeatureBuffer> mask = overlay.load(errorMessage);
+        if (!mask) return false;
+        return Geoprocessing::clip(*source, *mask, output, feedback, errorMessage);
+    });
+}
+
+void MainWindow::runIntersectionAlgorithm()
+{
+    ProcessingInput input;
+    ProcessingInput overlay;
+    if (!selectProcessingLayer("Intersection", "Input layer:", &input)) return;
+    if (!selectProcessingLayer("Intersection", "Overlay layer:", &overlay)) return;
+
+    submitProcessingJob("Intersection", input.name + "_intersection",
+                        [input, overlay](ProcessingFeedback *feedback,
+                                         FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> source = input.load(errorMessage);
+        if (!source) return false;
+        QSharedPointer<const FeatureBuffer> other = overlay.load(errorMessage);
+        if (!other) return false;
+        return Geoprocessing::intersection(*source, *other, output, feedback, errorMessage);
+    });
+}
+
+void MainWindow::runLineIntersectionsAlgorithm()
+{
+    QVector<ProcessingInput> lineLayers;
+    QStringList lineLayerNames;
+    for (const LayerInfo &layer : loadedLayers) {
+        if ((layer.type == "vector" || layer.type == "memory") &&
+            layer.properties.value("geometry_type").toString().contains("Line")) {
+            ProcessingInput input;
+            input.name = layer.name;
+            input.filePath = layer.filePath;
+            input.layerIndex = layer.properties.value("layer_index", 0).toInt();
+            input.geometryType = layer.properties.value("geometry_type").toString();
+            input.memory = layer.memoryBuffer;
+            lineLayers.append(input);
+            lineLayerNames << layer.name;
+        }
+    }
+
+    if (lineLayers.isEmpty()) {
+        QMessageBox::information(this, "Line Intersections", "Load a line layer first.");
+        return;
+    }
+
+    QStringList choices = lineLayerNames;
+    if (lineLayers.size() > 1) {
+        choices.prepend("All line layers");
+    }
+
+    bool ok = false;
+    QString selected = QInputDialog::getItem(this, "Line Intersections", "Input:",
+                                             choices, 0, false, &ok);
+    if (!ok || selected.isEmpty()) return;
+
+    QVector<ProcessingInput> inputs;
+    QStringList layerNames;
+    for (const ProcessingInput &input : lineLayers) {
+        if (selected == "All line layers" || input.name == selected) {
+            inputs.append(input);
+            layerNames << input.name;
+        }
+    }
+
+    QString name = (layerNames.size() == 1 ? layerNames.first() : QString("lines")) + "_intersections";
+    submitProcessingJob("Line Intersections", name,
+                        [inputs, layerNames](ProcessingFeedback *feedback,
+                                             FeatureBuffer *output, QString *errorMessage) -> bool {
+        QVector<QSharedPointer<const FeatureBuffer>> buffers;
+        QVector<const FeatureBuffer*> layers;
+        for (const ProcessingInput &input : inputs) {
+            QSharedPointer<const FeatureBuffer> buffer = input.load(errorMessage);
+            if (!buffer) return false;
+            buffers.append(buffer);
+            layers.append(buffer.data());
+        }
+        return VectorAnalysis::lineIntersections(layers, layerNames, output,
+                                                 feedback, errorMessage);
+    });
+}
+
+void MainWindow::runSumLineLengthsAlgorithm()
+{
+    ProcessingInput polygons;
+    ProcessingInput lines;
+    if (!selectProcessingLayer("Sum Line Lengths", "Polygon layer:", &polygons)) return;
+    if (!selectProcessingLayer("Sum Line Lengths", "Line layer:", &lines)) return;
+
+    bool ok = false;
+    QStringList methods;
+    methods << "Planar (layer units)" << "Geodesic (metres)";
+    QString method = QInputDialog::getItem(this, "Sum Line Lengths", "Length:",
+                                           methods, 0, false, &ok);
+    if (!ok) return;
+
+    VectorAnalysis::LengthMethod lengthMethod =
+            method == methods.last() ? VectorAnalysis::GeodesicLength : VectorAnalysis::PlanarLength;
+
+    submitProcessingJob("Sum Line Lengths", polygons.name + "_line_lengths",
+                        [polygons, lines, lengthMethod](ProcessingFeedback *feedback,
+                                                        FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> polygonBuffer = polygons.load(errorMessage);
+        if (!polygonBuffer) return false;
+        QSharedPointer<const FeatureBuffer> lineBuffer = lines.load(errorMessage);
+        if (!lineBuffer) return false;
+        return VectorAnalysis::sumLineLengths(*polygonBuffer, *lineBuffer, lengthMethod,
+                                              output, feedback, errorMessage);
+    });
+}
+
+void MainWindow::runRandomPointsAlgorithm()
+{
+    ProcessingInput source;
+    if (!selectProcessingLayer("Random Points", "Extent or polygon layer:", &source)) return;
+
+    bool ok = false;
+    bool insidePolygons = false;
+    if (source.isPolygonLayer()) {
+        QStringList modes;
+        modes << "Inside polygons" << "Within layer extent";
+        QString mode = QInputDialog::getItem(this, "Random Points", "Generate points:",
+                                             modes, 0, false, &ok);
+        if (!ok) return;
+        insidePolygons = (mode == modes.first());
+    }
+
+    // As many as a layer with the one ID field holds
+    int count = QInputDialog::getInt(this, "Random Points", "Number of points:",
+                                     1000, 1, FeatureBuffer::maxFeatures(1), 1000, &ok);
+    if (!ok) return;
+
+    quint64 seed = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+
+    submitProcessingJob("Random Points", source.name + "_random_points",
+                        [source, insidePolygons, count, seed](ProcessingFeedback *feedback,
+                                                              FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> buffer = source.load(errorMessage);
+        if (!buffer) return false;
+        if (insidePolygons) {
+            return PointGenerators::randomPointsInPolygons(*buffer, count, seed, output,
+                                                           feedback, errorMessage);
+        }
+        return PointGenerators::randomPointsInExtent(buffer->extent(), count, seed,
+                                                     buffer->spatialReferenceWkt(), output,
+                                                     feedback, errorMessage);
+    });
+}
+
+void MainWindow::runRegularPointsAlgorithm()
+{
+    ProcessingInput source;
+    if (!selectProcessingLayer("Regular Points", "Extent or polygon layer:", &source)) return;
+
+    Envelope extent;
+    if (!source.readExtent(&extent) || extent.isNull()) {
+        QMessageBox::information(this, "Regular Points", "The layer has an empty extent.");
+        return;
+    }
+
+    bool ok = false;
+    double defaultSpacing = qMax(extent.width(), extent.height()) / 100.0;
+    double spacing = QInputDialog::getDouble(this, "Regular Points", "Spacing (layer units):",
+                                             defaultSpacing > 0.0 ? defaultSpacing : 1.0,
+                                             1e-9, 1e12, 6, &ok);
+    if (!ok) return;
+
+    bool insidePolygons = false;
+    if (source.isPolygonLayer()) {
+        insidePolygons = QMessageBox::question(this, "Regular Points",
+                                               "Keep only points inside the polygons?") == QMessageBox::Yes;
+    }
+
+    submitProcessingJob("Regular Points", source.name + "_regular_points",
+                        [source, spacing, insidePolygons](ProcessingFeedback *feedback,
+                                                          FeatureBuffer *output, QString *errorMessage) -> bool {
+        QSharedPointer<const FeatureBuffer> buffer = source.load(errorMessage);
+        if (!buffer) return false;
+        return PointGenerators::regularPoints(buffer->extent(), spacing,
+                                              insidePolygons ? buffer.data() : nullptr,
+                                              buffer->spatialReferenceWkt(), output,
+                                              feedback, errorMessage);
+    });
+}
+
+void MainWindow::runRasterCalculatorAlgorithm()
+{
+    QVector<RasterInput> rasters;
+    QStringList rasterNames;
+    for (const LayerInfo &layer : loadedLayers) {
+        if ((layer.type == "geotiff" || layer.type == "georeferenced" || layer.type == "raster") &&
+            !layer.filePath.isEmpty()) {
+            RasterInput input;
+            input.name = layer.name;
+            input.filePath = layer.filePath;
+            rasters.append(input);
+            rasterNames << layer.name;
+        }
+    }
+
+    if (rasters.isEmpty()) {
+        QMessageBox::information(this, "Raster Calculator", "Load a raster layer first.");
+        return;
+    }
+
+    bool ok = false;
+    QString reference = QInputDialog::getItem(this, "Raster Calculator",
+                                              "Raster for B1, B2, ... (also defines the output grid):",
+                                              rasterNames, 0, false, &ok);
+    if (!ok || reference.isEmpty()) return;
+
+    // The reference raster goes first, it is the one plain band names refer to
+    int referenceIndex = rasterNames.indexOf(reference);
+    rasters.prepend(rasters.takeAt(referenceIndex));
+
+    int bandCount = 0;
+    GDALDataset *dataset = (GDALDataset*)GDALOpen(rasters.first().filePath.toUtf8().constData(), GA_ReadOnly);
+    if (dataset) {
+        bandCount = dataset->GetRasterCount();
+        GDALClose(dataset);
+    }
+
+    QString expression = (bandCount >= 4) ? QString("(B4 - B3) / (B4 + B3)") : QString("B1");
+    for (;;) {
+        expression = QInputDialog::getText(this, "Raster Calculator",
+                                           QString("Expression (B1..B%1 of %2, other rasters as name@band):")
+                                           .arg(bandCount).arg(reference),
+                                           QLineEdit::Normal, expression, &ok);
+        if (!ok || expression.trimmed().isEmpty()) return;
+
+        QString errorMessage;
+        if (RasterCalculator::validate(expression, rasters, &errorMessage)) break;
+        QMessageBox::warning(this, "Raster Calculator", "Invalid expression: " + errorMessage);
+    }
+
+    QString outputPath = processingOutputPath(reference + "_calc", "tif");
+
+    submitRasterProcessingJob("Raster Calculator", outputPath, reference,
+                              [expression, rasters, outputPath](ProcessingFeedback *feedback,
+                                                                FeatureBuffer *output, QString *errorMessage) -> bool {
+        Q_UNUSED(output)
+        return RasterCalculator::calculate(expression, rasters, outputPath, feedback, errorMessage);
+    });
+}
+
+void MainWindow::runTerrainAlgorithm(Terrain::Mode mode)
+{
+    const QString title = Terrain::modeName(mode);
+
+    QStringList rasterNames;
+    for (const LayerInfo &layer : loadedLayers) {
+        if ((layer.type == "geotiff" || layer.type == "georeferenced" || layer.type == "raster") &&
+            !layer.filePath.isEmpty()) {
+            rasterNames << layer.name;
+        }
+    }
+
+    if (rasterNames.isEmpty()) {
+        QMessageBox::information(this, title, "Load an elevation raster first.");
+        return;
+    }
+
+    bool ok = false;
+    QString demName = QInputDialog::getItem(this, title, "Elevation raster (band 1):",
+                                            rasterNames, 0, false, &ok);
+    if (!ok || demName.isEmpty()) return;
+
+    QString demPath;
+    QGraphicsItem *referenceItem = nullptr;
+    for (const LayerInfo &layer : loadedLayers) {
+        if (layer.name == demName) {
+            demPath = layer.filePath;
+            referenceItem = layer.shownItem();
+            break;
+        }
+    }
+
+    // Start from the parameters of an existing layer, which is then updated
+    // in place instead of adding another one
+    Terrain::Parameters parameters;
+    parameters.mode = mode;
+    LayerInfo *existing = nullptr;
+    for (LayerInfo &layer : loadedLayers) {
+        if (layer.type == "terrain" && layer.properties["dem_path"].toString() == demPath &&
+            layer.properties["terrain_mode"].toString() == title) {
+            existing = &layer;
+            parameters.azimuth = layer.properties["azimuth"].toDouble();
+            parameters.altitude = layer.properties["altitude"].toDouble();
+            parameters.zFactor = layer.properties["z_factor"].toDouble();
+            break;
+        }
+    }
+
+    if (mode == Terrain::Hillshade) {
+        parameters.azimuth = QInputDialog::getDouble(this, title, "Sun azimuth (degrees clockwise from north):",
+                                                     parameters.azimuth, 0.0, 360.0, 1, &ok);
+        if (!ok) return;
+        parameters.altitude = QInputDialog::getDouble(this, title, "Sun altitude (degrees):",
+                                                      parameters.altitude, 0.0, 90.0, 1, &ok);
+        if (!ok) return;
+    }
+    if (mode != Terrain::Aspect) {
+        parameters.zFactor = QInputDialog::getDouble(this, title, "Z factor (vertical exaggeration):",
+                                                     parameters.zFactor, 1e-6, 1e6, 6, &ok);
+        if (!ok) return;
+    }
+
+    QSharedPointer<TerrainTileSource> source(new TerrainTileSource(demPath, parameters));
+    QString errorMessage;
+    if (!source->open(&errorMessage)) {
+        QMessageBox::critical(this, title, errorMessage);
+        return;
+    }
+
+    if (existing) {
+        TiledRasterItem *item = existing->graphicsItem ?
+                    qobject_cast<TiledRasterItem*>(existing->graphicsItem->toGraphicsObject()) : nullptr;
+        if (item) {
+            // Drops the cached tiles; the visible ones are recomputed
+            item->setSource(source);
+            existing->properties["azimuth"] = parameters.azimuth;
+            existing->properties["altitude"] = parameters.altitude;
+            existing->properties["z_factor"] = parameters.zFactor;
+
+            // The warped copy is made again with the new parameters
+            if (existing->reprojectedItem) {
+                mapScene->removeItem(existing->reprojectedItem);
+                delete existing->reprojectedItem;
+                existing->reprojectedItem = nullptr;
+                existing->properties.remove("reprojected_crs");
+            }
+            if (!mapSettings.destinationCrs().isEmpty()) {
+                QString reprojectError;
+                reprojectLayer(*existing, mapSettings.destinationCrs(), mapSettings.destinationWkt(),
+                               &reprojectError);
+            } else {
+                existing->properties["reprojected"] = false;
+                applyReprojectedVisibility(*existing, !existing->treeItem ||
+                                           existing->treeItem->checkState(0) == Qt::Checked);
+            }
+            projectModified = true;
+            updatePropertiesDisplay(*existing);
+            if (messageLabel) {
+                messageLabel->setText("Updated " + existing->name);
+            }
+            return;
+        }
+    }
+
+    TiledRasterItem *item = new TiledRasterItem(source);
+    const QSize size = source->rasterSize();
+
+    // On the DEM's own grid, like the raster it is computed from; shown
+    // warped below when the canvas has a CRS of its own
+    item->setTransform(mapSettings.rasterToScene(source->geoTransform()));
+    if (referenceItem) {
+        item->setZValue(referenceItem->zValue() + 1);
+    }
+    mapSettings.markPlaced(item);
+    mapScene->addItem(item);
+
+    QString layerName = demName + "_" + title.toLower();
+    int suffix = 2;
+    for (;;) {
+        bool taken = false;
+        for (const LayerInfo &layer : loadedLayers) {
+            if (layer.name == layerName) {
+                taken = true;
+                break;
+            }
+        }
+        if (!taken) break;
+        layerName = QString("%1_%2_%3").arg(demName, title.toLower()).arg(suffix++);
+    }
+
+    LayerInfo layer;
+    layer.name = layerName;
+    layer.filePath = demPath;
+    layer.type = "terrain";
+    layer.graphicsItem = item;
+    layer.properties["format"] = "terrain";
+    layer.properties["terrain_mode"] = title;
+    layer.properties["dem_path"] = demPath;
+    layer.properties["width"] = size.width();
+    layer.properties["height"] = size.height();
+    layer.properties["azimuth"] = parameters.azimuth;
+    layer.properties["altitude"] = parameters.altitude;
+    layer.properties["z_factor"] = parameters.zFactor;
+
+    QTreeWidgetItem *layerItem = new QTreeWidgetItem(QStringList() << layerName << "Terrain (" + title + ")");
+    layerItem->setCheckState(0, Qt::Checked);
+    layerItem->setIcon(0, QIcon(":/icons/raster_layer.png"));
+    layerItem->setToolTip(0, QString("%1 of %2").arg(title, demPath));
+    layer.treeItem = layerItem;
+
+    QTreeWidgetItem *rasterGroup = nullptr;
+    for (int i = 0; i < layersTree->topLevelItemCount(); ++i) {
+        if (layersTree->topLevelItem(i)->text(0) == "Raster Layers") {
+            rasterGroup = layersTree->topLevelItem(i);
+            break;
+        }
+    }
+
+    if (!rasterGroup) {
+        rasterGroup = new QTreeWidgetItem(layersTree, QStringList() << "Raster Layers");
+        rasterGroup->setIcon(0, QIcon(":/icons/folder.png"));
+        rasterGroup->setExpanded(true);
+    }
+
+    rasterGroup->addChild(layerItem);
+    loadedLayers.append(layer);
+    projectModified = true;
+
+    if (!mapSettings.destinationCrs().isEmpty()) {
+        QString reprojectError;
+        reprojectLayer(loadedLayers.last(), mapSettings.destinationCrs(), mapSettings.destinationWkt(),
+                       &reprojectError);
+    }
+
+    if (projectInfoLabel) {
+        projectInfoLabel->setText(QString("Project: %1\nLayers: %2")
+                                  .arg(currentProjectName)
+                                  .arg(loadedLayers.size()));
+    }
+
+    updatePropertiesDisplay(layer);
+    emit layerLoaded(layerName, layer.type);
+}
+
+void MainWindow::applyReprojectedVisibility(LayerInfo &layer, bool visible)
+{
+    const bool reprojected = layer.reprojectedItem && layer.properties["reprojected"].toBool();
+    if (layer.reprojectedItem) {
+        layer.reprojectedItem->setVisible(visible && reprojected);
+    }
+    if (layer.graphicsItem) {
+        layer.graphicsItem->setVisible(visible && !reprojected);
+    }
+}
+
+void MainWindow::reanchorLayers()
+{
+    for (LayerInfo &layer : loadedLayers) {
+        mapSettings.reanchor(layer.graphicsItem);
+        mapSettings.reanchor(layer.reprojectedItem);
+    }
+}
+
+bool MainWindow::reprojectLayer(LayerInfo &layer, const QString &crs, const QString &canvasWkt,
+                                QString *errorMessage)
+{
+    const bool isRaster = layer.type == "geotiff" || layer.type == "georeferenced" ||
+            layer.type == "raster" || layer.type == "terrain";
+    const bool isVector = layer.type == "vector" || layer.type == "memory";
+    if (!(isRaster && layer.graphicsItem) && !isVector) return false;
+    if (layer.filePath.isEmpty() && layer.type != "memory") return false;
+
+    const bool visible = !layer.treeItem || layer.treeItem->checkState(0) == Qt::Checked;
+
+    // Switching back to a CRS shown before reuses its item and, for
+    // rasters, the tiles it has cached
+    if (layer.reprojectedItem && layer.properties["reprojected_crs"].toString() == crs) {
+        layer.properties["reprojected"] = true;
+        applyReprojectedVisibility(layer, visible);
+        return true;
+    }
+
+    QGraphicsItem *item = nullptr;
+
+    if (layer.type == "terrain") {
+        // Computed again from the DEM warped to the canvas CRS
+        QSharedPointer<TerrainTileSource> source(
+                    new TerrainTileSource(layer.properties["dem_path"].toString(),
+                                          LayerLoader::terrainParameters(layer.properties), canvasWkt));
+        if (source->open(errorMessage) && source->isWarped()) {
+            TiledRasterItem *rasterItem = new TiledRasterItem(source);
+            rasterItem->setTransform(mapSettings.rasterToScene(source->geoTransform()));
+            rasterItem->setZValue(layer.graphicsItem->zValue());
+            item = rasterItem;
+        }
+    } else if (isRaster) {
+        QSharedPointer<WarpedTileSource> source(
+                    new WarpedTileSource(LayerLoader::rasterDataset(layer.filePath, layer.properties), canvasWkt));
+        if (source->open(errorMessage) && !source->isSameCrs()) {
+            TiledRasterItem *rasterItem = new TiledRasterItem(source);
+            rasterItem->setTransform(mapSettings.rasterToScene(source->geoTransform()));
+            rasterItem->setZValue(layer.graphicsItem->zValue());
+            item = rasterItem;
+        }
+    } else {
+        // Features as loaded: the memory buffer, or the file read once
+        // and kept under the empty key
+        QSharedPointer<FeatureBuffer> features = layer.memoryBuffer;
+        if (!features) {
+            features = layer.reprojectedBuffers.value(QString());
+        }
+        if (!features) {
+            features.reset(new FeatureBuffer());
+            if (FeatureBuffer::readFromFile(layer.filePath, layer.properties["layer_index"].toInt(),
+                                            features.data(), errorMessage)) {
+                layer.reprojectedBuffers.insert(QString(), features);
+            } else {
+                features.reset();
+            }
+        }
+
+        if (features && !Reprojection::isSameCrs(features->spatialReferenceWkt(), canvasWkt)) {
+            QSharedPointer<FeatureBuffer> buffer = layer.reprojectedBuffers.value(crs);
+            if (!buffer) {
+                buffer.reset(new FeatureBuffer());
+                if (Reprojection::reproject(*features, canvasWkt, buffer.data(), nullptr, errorMessage)) {
+                    layer.reprojectedBuffers.insert(crs, buffer);
+                } else {
+                    buffer.reset();
+                }
+            }
+
+            if (buffer) {
+                FeatureBufferItem *sourceItem = dynamic_cast<FeatureBufferItem*>(layer.graphicsItem);
+                QColor color = sourceItem ? sourceItem->color() : FeatureBufferItem::defaultColor(buffer->geometryType());
+                FeatureBufferItem *vectorItem = new FeatureBufferItem(buffer, color);
+                vectorItem->setTransform(mapSettings.mapToSceneTransform());
+                vectorItem->setZValue(layer.graphicsItem ? layer.graphicsItem->zValue() : 1.0);
+                item = vectorItem;
+            }
+        }
+    }
+
+    if (!item) {
+        // Drawn as loaded: already in the canvas CRS, or not reprojectable
+        layer.properties["reprojected"] = false;
+        applyReprojectedVisibility(layer, visible);
+        return false;
+    }
+
+    if (layer.reprojectedItem) {
+        mapScene->removeItem(layer.reprojectedItem);
+        delete layer.reprojectedItem;
+    }
+    mapSettings.markPlaced(item);
+    mapScene->addItem(item);
+
+    layer.reprojectedItem = item;
+    layer.properties["reprojected"] = true;   // shown instead of the original
+    layer.properties["reprojected_crs"] = crs;
+    applyReprojectedVisibility(layer, visible);
+    return true;
+}
+
+// Makes the scene grid the pixels of the main GeoTIFF as shown in the
+// canvas CRS; false when it cannot be opened for that
+bool MainWindow::setMainRasterSceneGrid(const QString &dataset)
+{
+    QSharedPointer<WarpedTileSource> source(new WarpedTileSource(dataset, mapSettings.destinationWkt()));
+    if (!source->open()) return false;
+    mapSettings.setSceneGrid(source->isSameCrs() ? gdalGeoTransform : source->geoTransform());
+    return true;
+}
+
+void MainWindow::reprojectLayers(const QString &crs)
+{
+    if (!mapScene) return;
+
+    QSharedPointer<const CrsDefinition> canvasCrs = CrsRegistry::instance().crs(crs);
+    if (!canvasCrs) {
+        if (messageLabel) {
+            messageLabel->setText("Cannot reproject layers: unknown CRS " + crs);
+        }
+        return;
+    }
+    const QString canvasWkt = canvasCrs->wkt;
+
+    mapSettings.setDestinationCrs(crs, canvasWkt);
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+
+    // The scene grid follows the main GeoTIFF as it is shown in this CRS;
+    // without one, a uniform scale suited to the CRS units
+    bool mainGrid = false;
+    if (geoTIFFItem && hasGeoTransform) {
+        for (const LayerInfo &layer : loadedLayers) {
+            if (layer.graphicsItem == geoTIFFItem && !layer.filePath.isEmpty()) {
+                mainGrid = setMainRasterSceneGrid(LayerLoader::rasterDataset(layer.filePath, layer.properties));
+                break;
+            }
+        }
+    }
+    if (!mainGrid) {
+        mapSettings.setDefaultSceneGrid(!canvasCrs->geographic);
+    }
+    reanchorLayers();
+
+    int reprojected = 0;
+    QStringList failed;
+    for (LayerInfo &layer : loadedLayers) {
+        // Project layers not opened yet are reprojected when they are
+        if (deferredLayers.contains(layer.name)) continue;
+
+        QString errorMessage;
+        if (reprojectLayer(layer, crs, canvasWkt, &errorMessage)) {
+            ++reprojected;
+        } else if (!errorMessage.isEmpty()) {
+            failed << layer.name;
+        }
+    }
+
+    QApplication::restoreOverrideCursor();
+
+    labelLayerItemsForProfiler();
+    if (reprojected > 0) {
+        fitAllImages();
+    }
+    if (messageLabel && !failed.isEmpty()) {
+        messageLabel->setText("Could not reproject: " + failed.join(", "));
+    }
+}
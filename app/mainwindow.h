@@ -72,12 +72,24 @@
 #include <QDialogButtonBox>
 #include <QVariantMap>
 #include <QCloseEvent>
+#include <QThreadPool>
 
 #include "gdal_priv.h"
 #include "ogrsf_frmts.h"
 
+#include "featurebuffer.h"
+#include "mapsettings.h"
+#include "projectfile.h"
+#include "processingjobs.h"
+#include "terrain.h"
+
 // Forward declaration
 class QGraphicsSvgItem;
+class ProjectExporter;
+class MapExporter;
+class MapView;
+class QProgressDialog;
+struct LoadedLayer;
 
 class MainWindow : public QMainWindow
 {
@@ -107,16 +119,22 @@ private:
     struct LayerInfo {
         QString name;
         QString filePath;
-        QString type; // "raster", "vector", "image", "geotiff", "shapefile"
+        QString type; // "raster", "vector", "image", "geotiff", "shapefile", "memory"
         QTreeWidgetItem* treeItem;
         QGraphicsItem* graphicsItem;
         QVariantMap properties;
 
-        QList<QGraphicsItem*> vectorItems; // For vector layers with multiple item
+        QSharedPointer<FeatureBuffer> memoryBuffer; // Features of "memory" layers
+        QGraphicsItem *reprojectedItem = nullptr;   // Layer reprojected to the canvas CRS
+        QMap<QString, QSharedPointer<FeatureBuffer>> reprojectedBuffers; // Vector features by CRS
+
+        // The item the canvas draws: the reprojected one while it is in use
+        QGraphicsItem *shownItem() const
+        {
+            return reprojectedItem && properties.value("reprojected").toBool() ? reprojectedItem : graphicsItem;
+        }
 
         // Add these new member variables:
-        QMap<QString, QList<QGraphicsItem*>> layerVectorItems;
-        QList<QGraphicsItem*> currentVectorItems;
         QList<QGraphicsItem*> currentCrosshairItems;
 
 
@@ -124,17 +142,10 @@ private:
         bool hasAnyGeoreferencedLayer();
         QPointF geographicToSceneCoords(double lon, double lat);
         QPointF sceneToGeographicCoords(const QPointF &scenePoint);
+        bool transformLonLat(const QPointF &point, bool toLonLat, QPointF *result) const;
         void fitAllImages();
         void clearAllImages();
         void updatePropertiesDisplay(const LayerInfo &layer);
-        void clearVectorItems(const QString &layerName = QString());
-
-        // Vector drawing methods
-        void drawVectorLayer(const QString &filePath);
-        void drawGeometry(OGRGeometry *geom, const QColor &color, double scaleFactor);
-        void drawPoint(OGRPoint *point, const QColor &color, double scaleFactor);
-        void drawLine(OGRLineString *line, const QColor &color, double scaleFactor);
-        void drawPolygon(OGRPolygon *polygon, const QColor &color, double scaleFactor);
 
         LayerInfo() : treeItem(nullptr), graphicsItem(nullptr) {}
     };
@@ -157,12 +168,9 @@ private:
         double gdalGeoTransform[6];
         bool hasGeoTransform = false;
         bool isGeoTIFFLoaded = false;
-        QGraphicsPixmapItem *geoTIFFItem = nullptr;
-        QImage geoTIFFImage;
+        QGraphicsItem *geoTIFFItem = nullptr;
         QSize geoTIFFSize;
         QList<QGraphicsItem*> currentCrosshairItems;
-        QVector<QGraphicsItem*> currentVectorItems;
-        QMap<QString, QVector<QGraphicsItem*>> layerVectorItems;
         QGraphicsEllipseItem *coordinateMarker = nullptr;
         QGraphicsTextItem *coordinateTextItem = nullptr;
         QList<QGraphicsItem*> coordinateMarkerItems;
@@ -180,13 +188,22 @@ private:
     void setupToolBars();
     void setupDockWidgets();
     void setupCentralWidget();
+    MapView *createMapView();
+    MapView *currentMapView() const;
+    MapView *mapViewForViewport(QObject *viewport) const;
     void setupStatusBar();
     void setupConnections();
 
     // Project management
     void createNewProjectDialog();
     void saveProject();
-    void loadProject(const QString &projectPath);
+    bool loadProject(const QString &projectPath, int *layerCount = nullptr);
+    Project projectDocument(int *skippedLayers = nullptr) const;
+    void restoreProject(const Project &project);
+    bool openDeferredLayer(LayerInfo &layer, QString *errorMessage);
+    bool addLoadedLayer(LayerInfo &layer, const LoadedLayer &loaded, QString *errorMessage);
+    void openDeferredLayersInBackground(const QStringList &names);
+    void finishDeferredLayer(int generation, const LoadedLayer &loaded);
     void addRecentProject(const QString &projectPath);
     void updateRecentProjectsMenu();
 
@@ -231,9 +248,11 @@ private:
     void loadRasterFile(const QString &filePath);
     void loadImageFile(const QString &filePath);
     bool saveLayerToFile(const LayerInfo &layer, const QString &savePath);
-    void exportProject(const QString &directory);
+    void exportProject(const QString &directory, bool geoPackage = false);
+    void exportMapToFile(QString fileName);
     void importProject(const QString &directory);
     void saveAllLayers();
+    int packageLayers(const QString &layersDir, Project *project, QStringList *failedLayers);
 
     // Layer operations
     void addLayerToScene(const LayerInfo &layer);
@@ -243,12 +262,7 @@ private:
 
     // Vector operations
     void drawVectorLayer(const QString &filePath);
-    void drawGeometry(OGRGeometry *geom, const QColor &color, double scaleFactor = 100.0);
-    void drawPoint(OGRPoint *point, const QColor &color, double scaleFactor = 100.0);
-    void drawLine(OGRLineString *line, const QColor &color, double scaleFactor = 100.0);
-    void drawPolygon(OGRPolygon *polygon, const QColor &color, double scaleFactor = 100.0);
     void addVectorLayerToTree(const QString &layerName, const QString &filePath, OGRwkbGeometryType geomType);
-    void clearVectorItems(const QString &layerName = QString());
 
     // Image handling
     void clearCurrentImage();
@@ -274,14 +288,41 @@ private:
     QDockWidget *layersDock;
     QDockWidget *browserDock;
     QDockWidget *processingToolboxDock;
+    QTreeWidget *processingTree;
+    QTreeWidget *processingJobsTree;
+    ProcessingJobScheduler *jobScheduler;
+    QMap<int, QTreeWidgetItem*> processingJobItems;
+
+    // Project export, one row per exported file
+    ProjectExporter *projectExporter;
+    QDialog *exportProgressDialog;
+    QProgressBar *exportProgressBar;
+    QTreeWidget *exportFilesTree;
+    QVector<QTreeWidgetItem*> exportFileItems;
+
+    // Map export to an image file
+    MapExporter *mapExporter;
+    QProgressDialog *mapExportProgress;
+
+    // Where the result of a finished job goes
+    struct ProcessingJobOutput {
+        QString name;
+        QString rasterPath;       // raster jobs write a file instead of returning features
+        QString referenceLayer;   // raster whose place on the map the result takes
+    };
+    QMap<int, ProcessingJobOutput> processingJobOutputs;
     QDockWidget *layerStylingDock;
     QDockWidget *imagePropertiesDock;
+    QDockWidget *profilerDock;
 
     // Central widget components
     QTabWidget *mapViewsTabWidget;
-    QGraphicsView *mapView;
+    MapView *mapView;
+    QList<MapView*> extraMapViews;  // further views of mapScene, in tabs
+    int nextMapViewNumber;
     QGraphicsScene *mapScene;
-    QGraphicsPixmapItem *currentImageItem;
+    MapSettings mapSettings;
+    QGraphicsItem *currentImageItem;
 
     // Layer tree (like QGIS Layers panel)
     QTreeWidget *layersTree;
@@ -322,6 +363,18 @@ private:
     QPixmap currentPixmap;
     bool projectModified;
 
+    // Layers restored from a project whose data source is not open yet,
+    // with what the project stored for them
+    QHash<QString, ProjectLayer> deferredLayers;
+    QRectF deferredViewExtent;
+
+    // Opens project layers' data sources off the GUI thread. Results carry
+    // the generation they were started in; a newer one means the project
+    // they belong to is gone.
+    QThreadPool layerOpenPool;
+    int deferredOpenGeneration;
+    int deferredOpenPending;
+
     // Image zoom/pan state
     qreal currentScale;
     qreal rotationAngle;
@@ -340,12 +393,15 @@ private:
     QAction *exitAction;
 
     QAction *newMapViewAction;
+    QAction *linkMapViewsAction;
     QAction *panAction;
     QAction *zoomInAction;
     QAction *zoomOutAction;
     QAction *identifyAction;
     QAction *measureAction;
     QAction *bookmarkAction;
+    QAction *profilerAction;
+    QAction *profilerOverlayAction;
 
     QAction *toggleEditingAction;
     QAction *saveLayerEditsAction;
@@ -385,11 +441,11 @@ private:
     QAction *exportToPdfAction;
     QAction *exportToImageAction;
     QAction *saveAllLayersAction;
+    QAction *packageLayersAction;
 
 
     void setupCRSSelection();
     void openCRSDialog();
-    void populateCRSTree(QTreeWidget *crsTree);
     QString getCRSDisplayName(const QString &crsCode);
 
     // Helper methods for status bar
@@ -413,6 +469,37 @@ private:
     QIcon createCRSIcon();
     void showProjectionContextMenu(const QPoint &globalPos);
     void animateCRSChange();
+
+    // Processing
+    bool selectProcessingLayer(const QString &title, const QString &label,
+                               ProcessingInput *input);
+    int submitProcessingJob(const QString &title, const QString &outputName,
+                            const ProcessingJobScheduler::JobFunction &function);
+    int submitRasterProcessingJob(const QString &title, const QString &outputPath,
+                                  const QString &referenceLayer,
+                                  const ProcessingJobScheduler::JobFunction &function);
+    QString processingOutputPath(const QString &name, const QString &suffix);
+    bool addRasterResultLayer(const QString &filePath, const QString &referenceLayer);
+    bool addMemoryLayer(const QSharedPointer<FeatureBuffer> &buffer, const QString &name);
+    bool saveMemoryLayer(LayerInfo &layer);
+    void identifyFeaturesAt(const QPointF &scenePos);
+    void runBufferAlgorithm();
+    void runClipAlgorithm();
+    void runIntersectionAlgorithm();
+    void runLineIntersectionsAlgorithm();
+    void runSumLineLengthsAlgorithm();
+    void runRandomPointsAlgorithm();
+    void runRegularPointsAlgorithm();
+    void runRasterCalculatorAlgorithm();
+    void runTerrainAlgorithm(Terrain::Mode mode);
+
+    // Reprojection
+    void reprojectLayers(const QString &crs);
+    bool reprojectLayer(LayerInfo &layer, const QString &crs, const QString &canvasWkt,
+                        QString *errorMessage);
+    void reanchorLayers();
+    void applyReprojectedVisibility(LayerInfo &layer, bool visible);
+    bool setMainRasterSceneGrid(const QString &dataset);
 private slots:
     void onLoadVectorFile(const QString &filePath);
     void onCreateNewProject();
@@ -425,6 +512,9 @@ private slots:
     void onAddImageLayer();
     void onToggleEditing();
     void onPanMap();
+    void onNewMapView();
+    void onCloseMapViewTab(int index);
+    void onMapViewChanged(MapView *view);
     void onZoomIn();
     void onZoomOut();
     void onShowProcessingToolbox();
@@ -474,6 +564,22 @@ private slots:
 
     // GDAL slots
     void onOpenGeoTIFF();
+
+    // Processing slots
+    void onProcessingAlgorithmActivated(QTreeWidgetItem *item, int column);
+    void onProcessingJobStarted(int jobId);
+    void onProcessingJobProgress(int jobId, double percent);
+    void onProcessingJobFinished(int jobId, bool success);
+    void onProjectExportFileProgress(int index, qint64 bytesDone, qint64 bytesTotal);
+    void onProjectExportFileFinished(int index, int state);
+    void onProjectExportProgress(qint64 bytesDone, qint64 bytesTotal);
+    void onProjectExportFinished(bool success);
+    void onMapExportProgress(int rowsDone, int rowCount);
+    void onMapExportFinished(bool success, const QString &errorMessage);
+    void onToggleProfiler(bool enabled);
+    void onExportProfilerTrace();
+    void labelLayerItemsForProfiler();
+    void onClearFinishedJobs();
 signals:
     void projectLoaded(const QString &projectPath);
     void layerAdded(const QString &layerName);
@@ -0,0 +1,144 @@
+#include "mapview.h"
+
+#include <QLineF>
+#include <QPainter>
+#include <QWheelEvent>
+
+#include <cmath>
+
+#include "profiler.h"
+#include "profilerview.h"
+
+MapView::MapView(QGraphicsScene *scene, QWidget *parent)
+    : QGraphicsView(scene, parent)
+    , m_profilerOverlay(false)
+    , m_wheelZoom(false)
+    , m_syncing(false)
+{
+}
+
+void MapView::setProfilerOverlay(bool shown)
+{
+    m_profilerOverlay = shown;
+    viewport()->update();
+}
+
+QPointF MapView::center() const
+{
+    return mapToScene(viewport()->rect().center());
+}
+
+void MapView::showLike(const MapView *other)
+{
+    m_syncing = true;
+    QGraphicsView::setTransform(other->transform());
+    QGraphicsView::centerOn(other->center());
+    m_syncing = false;
+    rememberView();
+}
+
+void MapView::setTransform(const QTransform &matrix, bool combine)
+{
+    QGraphicsView::setTransform(matrix, combine);
+    checkViewChanged();
+}
+
+void MapView::resetTransform()
+{
+    QGraphicsView::resetTransform();
+    checkViewChanged();
+}
+
+void MapView::scale(qreal sx, qreal sy)
+{
+    QGraphicsView::scale(sx, sy);
+    checkViewChanged();
+}
+
+void MapView::rotate(qreal angle)
+{
+    QGraphicsView::rotate(angle);
+    checkViewChanged();
+}
+
+void MapView::centerOn(const QPointF &pos)
+{
+    QGraphicsView::centerOn(pos);
+    checkViewChanged();
+}
+
+void MapView::centerOn(const QGraphicsItem *item)
+{
+    QGraphicsView::centerOn(item);
+    checkViewChanged();
+}
+
+void MapView::fitInView(const QRectF &rect, Qt::AspectRatioMode aspectRatioMode)
+{
+    QGraphicsView::fitInView(rect, aspectRatioMode);
+    checkViewChanged();
+}
+
+void MapView::fitInView(const QGraphicsItem *item, Qt::AspectRatioMode aspectRatioMode)
+{
+    QGraphicsView::fitInView(item, aspectRatioMode);
+    checkViewChanged();
+}
+
+// Scroll bars and hand dragging pan through here
+void MapView::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    checkViewChanged();
+}
+
+void MapView::rememberView()
+{
+    m_lastTransform = transform();
+    m_lastCenter = center();
+}
+
+void MapView::checkViewChanged()
+{
+    if (m_syncing) return;
+
+    // Moves of less than a pixel are scroll bar rounding, not the user
+    if (transform() != m_lastTransform ||
+            QLineF(center(), m_lastCenter).length() * std::sqrt(std::abs(transform().determinant())) > 1.0) {
+        rememberView();
+        emit viewChanged(this);
+    }
+}
+
+void MapView::paintEvent(QPaintEvent *event)
+{
+    if (!Profiler::isEnabled()) {
+        QGraphicsView::paintEvent(event);
+        return;
+    }
+
+    Profiler &profiler = Profiler::instance();
+    profiler.beginFrame();
+    QGraphicsView::paintEvent(event);
+    profiler.endFrame();
+
+    if (m_profilerOverlay) {
+        QPainter painter(viewport());
+        ProfilerOverlay::draw(&painter, viewport()->rect());
+    }
+}
+
+void MapView::wheelEvent(QWheelEvent *event)
+{
+    if (!m_wheelZoom) {
+        QGraphicsView::wheelEvent(event);
+        return;
+    }
+    const qreal factor = std::pow(1.2, event->angleDelta().y() / 120.0);
+    const ViewportAnchor anchor = transformationAnchor();
+    setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+    QGraphicsView::scale(factor, factor);
+    setTransformationAnchor(anchor);
+    checkViewChanged();
+    event->accept();
+}
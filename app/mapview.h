@@ -0,0 +1,65 @@
+#ifndef MAPVIEW_H
+#define MAPVIEW_H
+
+#include <QGraphicsView>
+
+// The map canvas. Each repaint is one profiler frame, and with the overlay
+// on, the last frame's timings are drawn over the map.
+//
+// Several views can show the same scene: the items, their spatial indexes
+// and tile caches are shared, each view only keeps its own extent.
+class MapView : public QGraphicsView
+{
+    Q_OBJECT
+
+public:
+    explicit MapView(QGraphicsScene *scene, QWidget *parent = nullptr);
+
+    bool profilerOverlay() const { return m_profilerOverlay; }
+    void setProfilerOverlay(bool shown);
+
+    // Zooming with the mouse wheel, about the point under the cursor;
+    // otherwise the wheel scrolls
+    void setWheelZoom(bool enabled) { m_wheelZoom = enabled; }
+
+    // Scene point at the middle of the viewport
+    QPointF center() const;
+
+    // Same scale, rotation and centre as 'other', without reporting it back
+    // through viewChanged()
+    void showLike(const MapView *other);
+
+    // QGraphicsView's, followed by viewChanged() when the view moved. These
+    // hide rather than override (QGraphicsView's are not virtual): called
+    // through a QGraphicsView pointer, only a change that scrolls is
+    // reported, by scrollContentsBy(). Hold views as MapView.
+    void setTransform(const QTransform &matrix, bool combine = false);
+    void resetTransform();
+    void scale(qreal sx, qreal sy);
+    void rotate(qreal angle);
+    void centerOn(const QPointF &pos);
+    void centerOn(const QGraphicsItem *item);
+    void fitInView(const QRectF &rect, Qt::AspectRatioMode aspectRatioMode = Qt::IgnoreAspectRatio);
+    void fitInView(const QGraphicsItem *item, Qt::AspectRatioMode aspectRatioMode = Qt::IgnoreAspectRatio);
+
+signals:
+    // Panned, zoomed or rotated
+    void viewChanged(MapView *view);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private:
+    void rememberView();
+    void checkViewChanged();
+
+    bool m_profilerOverlay;
+    bool m_wheelZoom;
+    bool m_syncing;
+    QTransform m_lastTransform;
+    QPointF m_lastCenter;
+};
+
+#endif // MAPVIEW_H
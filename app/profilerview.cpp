@@ -0,0 +1,135 @@
+#include "profilerview.h"
+
+#include <QFontMetrics>
+#include <QLocale>
+#include <QPainter>
+
+namespace
+{
+    const double FrameBudgetMs = 1000.0 / 60.0;
+
+    double milliseconds(qint64 ns) { return ns / 1.0e6; }
+}
+
+QColor ProfilerOverlay::phaseColor(Profiler::Phase phase)
+{
+    switch (phase) {
+    case Profiler::Fetch: return QColor(66, 133, 244);
+    case Profiler::Transform: return QColor(251, 188, 5);
+    case Profiler::Rasterise: return QColor(52, 168, 83);
+    case Profiler::Composite: return QColor(234, 67, 53);
+    default: return Qt::gray;
+    }
+}
+
+void ProfilerOverlay::draw(QPainter *painter, const QRect &rect)
+{
+    const QVector<Profiler::Frame> frames = Profiler::instance().frames();
+    if (frames.isEmpty()) return;
+
+    // Rate over the last second of frames
+    const Profiler::Frame &last = frames.last();
+    int recent = 0;
+    for (int i = frames.size() - 1; i >= 0 && last.start - frames[i].start < 1000000000LL; --i) {
+        ++recent;
+    }
+
+    QStringList lines;
+    lines << QString("%1 ms frame, %2 fps").arg(milliseconds(last.duration), 0, 'f', 1).arg(recent);
+    for (int p = 0; p < Profiler::PhaseCount; ++p) {
+        lines << QString("%1: %2 ms").arg(Profiler::phaseName(Profiler::Phase(p)))
+                 .arg(milliseconds(last.phases[p]), 0, 'f', 1);
+    }
+    lines << QString("GDAL read %1, cache %2").arg(QLocale().formattedDataSize(last.gdalBytes),
+                                                    QLocale().formattedDataSize(last.gdalCacheBytes));
+    lines << QString("Tiles %1 cached, %2 requested").arg(last.tileHits).arg(last.tileMisses);
+
+    painter->save();
+    painter->resetTransform();
+    const QFontMetrics metrics(painter->font());
+    int width = 0;
+    for (const QString &line : lines) {
+        width = qMax(width, metrics.horizontalAdvance(line));
+    }
+    const int lineHeight = metrics.height();
+    const QRect box(rect.left() + 8, rect.top() + 8, width + 24, lines.size() * lineHeight + 8);
+    painter->fillRect(box, QColor(0, 0, 0, 160));
+    for (int i = 0; i < lines.size(); ++i) {
+        const int y = box.top() + 4 + i * lineHeight;
+        if (i >= 1 && i <= Profiler::PhaseCount) {
+            painter->fillRect(QRect(box.left() + 4, y + 3, 8, lineHeight - 6),
+                              phaseColor(Profiler::Phase(i - 1)));
+        }
+        painter->setPen(Qt::white);
+        painter->drawText(QRect(box.left() + 18, y, width, lineHeight), Qt::AlignLeft | Qt::AlignVCenter, lines[i]);
+    }
+    painter->restore();
+}
+
+ProfilerTimeline::ProfilerTimeline(QWidget *parent)
+    : QWidget(parent)
+{
+    m_timer.setInterval(250);
+    connect(&m_timer, &QTimer::timeout, this, [this]() {
+        if (Profiler::isEnabled()) update();
+    });
+}
+
+void ProfilerTimeline::showEvent(QShowEvent *event)
+{
+    m_timer.start();
+    QWidget::showEvent(event);
+}
+
+void ProfilerTimeline::hideEvent(QHideEvent *event)
+{
+    m_timer.stop();
+    QWidget::hideEvent(event);
+}
+
+void ProfilerTimeline::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    const QVector<Profiler::Frame> frames = Profiler::instance().frames();
+    if (frames.isEmpty()) {
+        painter.setPen(palette().color(QPalette::Disabled, QPalette::Text));
+        painter.drawText(rect(), Qt::AlignCenter,
+                         Profiler::isEnabled() ? "No frames yet" : "Profiling is off");
+        return;
+    }
+
+    // Newest on the right, two pixels per frame; the scale keeps the
+    // budget line at a third of the height unless a frame is slower
+    const int barWidth = 2;
+    const int count = qMin(frames.size(), width() / barWidth);
+    double scaleMs = FrameBudgetMs * 3.0;
+    for (int i = frames.size() - count; i < frames.size(); ++i) {
+        scaleMs = qMax(scaleMs, milliseconds(frames[i].duration));
+    }
+    const double pixelsPerMs = height() / scaleMs;
+
+    for (int i = 0; i < count; ++i) {
+        const Profiler::Frame &frame = frames[frames.size() - count + i];
+        const int x = width() - (count - i) * barWidth;
+
+        // The frame itself, then the phases stacked over it; worker phases
+        // may add up to more than the frame took
+        const int frameHeight = qRound(milliseconds(frame.duration) * pixelsPerMs);
+        painter.fillRect(QRect(x, height() - frameHeight, barWidth, frameHeight), QColor(200, 200, 200));
+        int y = height();
+        for (int p = 0; p < Profiler::PhaseCount; ++p) {
+            const int h = qRound(milliseconds(frame.phases[p]) * pixelsPerMs);
+            if (h <= 0) continue;
+            painter.fillRect(QRect(x, y - h, barWidth, h), ProfilerOverlay::phaseColor(Profiler::Phase(p)));
+            y -= h;
+        }
+    }
+
+    const int budgetY = height() - qRound(FrameBudgetMs * pixelsPerMs);
+    painter.setPen(QPen(palette().color(QPalette::Text), 1, Qt::DashLine));
+    painter.drawLine(0, budgetY, width(), budgetY);
+    painter.drawText(QPoint(4, budgetY - 4), "16.7 ms");
+    painter.drawText(QPoint(4, 14), QString("%1 ms").arg(scaleMs, 0, 'f', 1));
+}
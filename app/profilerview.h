@@ -0,0 +1,41 @@
+#ifndef PROFILERVIEW_H
+#define PROFILERVIEW_H
+
+#include <QColor>
+#include <QTimer>
+#include <QWidget>
+
+#include "profiler.h"
+
+class QPainter;
+
+// Showing what the profiler recorded
+namespace ProfilerOverlay
+{
+    QColor phaseColor(Profiler::Phase phase);
+
+    // Last frame's timings, top left of 'rect', drawn over the map
+    void draw(QPainter *painter, const QRect &rect);
+}
+
+// Recent frames as stacked bars, one colour per phase, against the 60 fps
+// budget. Refreshes itself while the profiler is enabled and it is visible.
+class ProfilerTimeline : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ProfilerTimeline(QWidget *parent = nullptr);
+
+    QSize sizeHint() const override { return QSize(400, 160); }
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private:
+    QTimer m_timer;
+};
+
+#endif // PROFILERVIEW_H
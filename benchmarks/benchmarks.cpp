@@ -0,0 +1,425 @@
+#include <QApplication>
+#include <QGraphicsScene>
+#include <QImage>
+#include <QPainter>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <cmath>
+#include <vector>
+
+#include <gdal_priv.h>
+#include <ogrsf_frmts.h>
+
+#include "featurebufferitem.h"
+#include "layerloader.h"
+#include "mapsettings.h"
+#include "reprojection.h"
+#include "tiledrasteritem.h"
+
+// Timings of the paths a user waits on: opening and decoding a GeoTIFF,
+// loading a vector layer, map <-> scene coordinate transforms and drawing a
+// frame offscreen. The data is synthetic and written at start-up, so runs
+// are comparable between machines and releases.
+//
+//   benchmarks -o results.xml,xml        (or csv, txt, lightxml, junitxml)
+//   benchmarks loadVector -iterations 10
+class Benchmarks : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void decodeGeoTiff_data();
+    void decodeGeoTiff();
+    void loadVector();
+    void mapToScene_data();
+    void mapToScene();
+    void sceneToMap();
+    void reprojectFeatures();
+    void renderFrame_data();
+    void renderFrame();
+
+private:
+    bool writeRaster(const QString &path, QString *errorMessage);
+    bool writeVectors(const QString &path, QString *errorMessage);
+
+    QTemporaryDir m_dir;
+    QString m_rasterPath;
+    QString m_vectorPath;
+    QString m_geographicWkt;
+    QString m_mercatorWkt;
+    double m_geoTransform[6];
+};
+
+namespace
+{
+    // 8192 x 8192 RGB, tiled and compressed like most GeoTIFFs users open,
+    // with overviews
+    const int RasterSize = 8192;
+    const int RasterBlock = 256;
+
+    // 200 x 250 grid of 24-vertex polygons
+    const int VectorColumns = 200;
+    const int VectorRows = 250;
+    const int RingVertices = 24;
+
+    const int TransformPoints = 1000000;
+
+    QString wktFor(int epsg)
+    {
+        OGRSpatialReference srs;
+        srs.importFromEPSG(epsg);
+        srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        char *wkt = nullptr;
+        srs.exportToWkt(&wkt);
+        const QString result = QString::fromUtf8(wkt);
+        CPLFree(wkt);
+        return result;
+    }
+
+    // Tiles of 'level' covering the pixel rect 'area' of the full resolution
+    // raster, as TiledRasterItem would request them
+    int computeTiles(RasterTileSource *source, int level, const QRect &area)
+    {
+        const int span = TiledRasterItem::TileSize << level;
+        int drawn = 0;
+        for (int row = area.top() / span; row <= area.bottom() / span; ++row) {
+            for (int column = area.left() / span; column <= area.right() / span; ++column) {
+                if (!source->computeTile(level, column, row, TiledRasterItem::TileSize).isNull()) {
+                    ++drawn;
+                }
+            }
+        }
+        return drawn;
+    }
+
+    // Lets the raster items finish the tiles a render asked for: done once
+    // the scene has stopped changing
+    void waitForTiles(QGraphicsScene *scene)
+    {
+        QSignalSpy changed(scene, &QGraphicsScene::changed);
+        QElapsedTimer timer;
+        timer.start();
+        do {
+            changed.clear();
+            QTest::qWait(250);
+        } while (!changed.isEmpty() && timer.elapsed() < 60000);
+    }
+}
+
+void Benchmarks::initTestCase()
+{
+    CPLSetConfigOption("GDAL_PAM_ENABLED", "NO");
+    GDALAllRegister();
+
+    QVERIFY2(m_dir.isValid(), qPrintable(m_dir.errorString()));
+    m_geographicWkt = wktFor(4326);
+    m_mercatorWkt = wktFor(3857);
+    QVERIFY(!m_geographicWkt.isEmpty() && !m_mercatorWkt.isEmpty());
+
+    // About 0.5 m pixels over a 4 km square
+    const double geoTransform[6] = { 10.0, 4.5e-6, 0.0, 50.0, 0.0, -4.5e-6 };
+    for (int i = 0; i < 6; ++i) m_geoTransform[i] = geoTransform[i];
+
+    QString errorMessage;
+    m_rasterPath = m_dir.filePath("synthetic.tif");
+    QVERIFY2(writeRaster(m_rasterPath, &errorMessage), qPrintable(errorMessage));
+    m_vectorPath = m_dir.filePath("synthetic.shp");
+    QVERIFY2(writeVectors(m_vectorPath, &errorMessage), qPrintable(errorMessage));
+}
+
+bool Benchmarks::writeRaster(const QString &path, QString *errorMessage)
+{
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!driver) {
+        *errorMessage = "GTiff driver not available";
+        return false;
+    }
+
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", QByteArray::number(RasterBlock).constData());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", QByteArray::number(RasterBlock).constData());
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    options = CSLSetNameValue(options, "INTERLEAVE", "PIXEL");
+    GDALDataset *dataset = driver->Create(path.toUtf8().constData(), RasterSize, RasterSize, 3,
+                                          GDT_Byte, options);
+    CSLDestroy(options);
+    if (!dataset) {
+        *errorMessage = QString::fromUtf8(CPLGetLastErrorMsg());
+        return false;
+    }
+    dataset->SetGeoTransform(m_geoTransform);
+    dataset->SetProjection(m_geographicWkt.toUtf8().constData());
+
+    // Gradients with some high-frequency detail, so compression and
+    // resampling have real work to do
+    std::vector<unsigned char> rows(size_t(RasterSize) * RasterBlock * 3);
+    bool ok = true;
+    for (int top = 0; top < RasterSize && ok; top += RasterBlock) {
+        for (int y = 0; y < RasterBlock; ++y) {
+            unsigned char *pixel = rows.data() + size_t(y) * RasterSize * 3;
+            const int row = top + y;
+            for (int x = 0; x < RasterSize; ++x, pixel += 3) {
+                pixel[0] = (unsigned char)(x * 255 / RasterSize);
+                pixel[1] = (unsigned char)(row * 255 / RasterSize);
+                pixel[2] = (unsigned char)((x ^ row) & 0xff);
+            }
+        }
+        ok = dataset->RasterIO(GF_Write, 0, top, RasterSize, RasterBlock, rows.data(),
+                               RasterSize, RasterBlock, GDT_Byte, 3, nullptr,
+                               3, RasterSize * 3, 1) == CE_None;
+    }
+
+    int overviews[] = { 2, 4, 8, 16, 32 };
+    if (ok) {
+        ok = GDALBuildOverviews(dataset, "AVERAGE", 5, overviews, 0, nullptr, nullptr, nullptr) == CE_None;
+    }
+    if (!ok) *errorMessage = QString::fromUtf8(CPLGetLastErrorMsg());
+    GDALClose(dataset);
+    return ok;
+}
+
+bool Benchmarks::writeVectors(const QString &path, QString *errorMessage)
+{
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("ESRI Shapefile");
+    if (!driver) {
+        *errorMessage = "ESRI Shapefile driver not available";
+        return false;
+    }
+    GDALDataset *dataset = driver->Create(path.toUtf8().constData(), 0, 0, 0, GDT_Unknown, nullptr);
+    if (!dataset) {
+        *errorMessage = QString::fromUtf8(CPLGetLastErrorMsg());
+        return false;
+    }
+
+    OGRSpatialReference srs;
+    srs.importFromWkt(m_geographicWkt.toUtf8().constData());
+    srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    OGRLayer *layer = dataset->CreateLayer("synthetic", &srs, wkbPolygon, nullptr);
+    bool ok = layer != nullptr;
+    if (ok) {
+        OGRFieldDefn id("id", OFTInteger);
+        OGRFieldDefn name("name", OFTString);
+        name.SetWidth(32);
+        ok = layer->CreateField(&id) == OGRERR_NONE && layer->CreateField(&name) == OGRERR_NONE;
+    }
+
+    // One polygon per cell of the raster's extent
+    const double width = RasterSize * m_geoTransform[1];
+    const double height = -RasterSize * m_geoTransform[5];
+    const double cellWidth = width / VectorColumns;
+    const double cellHeight = height / VectorRows;
+    for (int row = 0; row < VectorRows && ok; ++row) {
+        for (int column = 0; column < VectorColumns && ok; ++column) {
+            const double centerX = m_geoTransform[0] + (column + 0.5) * cellWidth;
+            const double centerY = m_geoTransform[3] - (row + 0.5) * cellHeight;
+            OGRLinearRing ring;
+            for (int i = 0; i < RingVertices; ++i) {
+                const double angle = 2.0 * M_PI * i / RingVertices;
+                const double radius = (i % 2 ? 0.45 : 0.3);
+                ring.addPoint(centerX + radius * cellWidth * std::cos(angle),
+                              centerY + radius * cellHeight * std::sin(angle));
+            }
+            ring.closeRings();
+            OGRPolygon polygon;
+            polygon.addRing(&ring);
+
+            OGRFeature *feature = OGRFeature::CreateFeature(layer->GetLayerDefn());
+            const int id = row * VectorColumns + column;
+            feature->SetField("id", id);
+            feature->SetField("name", QString("feature %1").arg(id).toUtf8().constData());
+            feature->SetGeometry(&polygon);
+            ok = layer->CreateFeature(feature) == OGRERR_NONE;
+            OGRFeature::DestroyFeature(feature);
+        }
+    }
+    if (!ok) *errorMessage = QString::fromUtf8(CPLGetLastErrorMsg());
+    GDALClose(dataset);
+    return ok;
+}
+
+void Benchmarks::decodeGeoTiff_data()
+{
+    QTest::addColumn<int>("level");
+    QTest::addColumn<QRect>("area");
+
+    // A full HD view at 1:1, and the whole raster from overviews
+    QTest::newRow("full resolution, 1920x1080") << 0 << QRect(2048, 2048, 1920, 1080);
+    QTest::newRow("whole raster, level 3") << 3 << QRect(0, 0, RasterSize, RasterSize);
+}
+
+void Benchmarks::decodeGeoTiff()
+{
+    QFETCH(int, level);
+    QFETCH(QRect, area);
+
+    // Opening as the app does (georeferencing, overviews, tile source), then
+    // every tile of the view; no cache survives between iterations
+    QBENCHMARK {
+        LoadedLayer loaded = LayerLoader::load("synthetic", "raster", m_rasterPath, QVariantMap());
+        QVERIFY2(loaded.tiles, qPrintable(loaded.errorMessage));
+        QVERIFY(computeTiles(loaded.tiles.data(), level, area) > 0);
+    }
+}
+
+void Benchmarks::loadVector()
+{
+    QVariantMap properties;
+    properties["layer_index"] = 0;
+
+    QBENCHMARK {
+        LoadedLayer loaded = LayerLoader::load("synthetic", "vector", m_vectorPath, properties);
+        QVERIFY2(loaded.features, qPrintable(loaded.errorMessage));
+        QCOMPARE(loaded.features->count(), VectorColumns * VectorRows);
+    }
+}
+
+void Benchmarks::mapToScene_data()
+{
+    QTest::addColumn<bool>("batched");
+
+    QTest::newRow("per point") << false;
+    QTest::newRow("batched") << true;
+}
+
+void Benchmarks::mapToScene()
+{
+    QFETCH(bool, batched);
+
+    // What geographicToSceneCoords() does, for a raster-anchored canvas
+    MapSettings settings;
+    settings.setSceneGrid(m_geoTransform);
+
+    std::vector<double> xy(size_t(TransformPoints) * 2);
+    for (int i = 0; i < TransformPoints; ++i) {
+        xy[2 * i] = m_geoTransform[0] + (i % 1000) * 0.001;
+        xy[2 * i + 1] = m_geoTransform[3] - (i / 1000) * 0.001;
+    }
+    QVector<QPointF> scene(TransformPoints);
+
+    QBENCHMARK {
+        if (batched) {
+            settings.mapToScene(xy.data(), TransformPoints, scene.data());
+        } else {
+            for (int i = 0; i < TransformPoints; ++i) {
+                scene[i] = settings.mapToScene(xy[2 * i], xy[2 * i + 1]);
+            }
+        }
+    }
+    QVERIFY(scene.last().y() > 0.0);
+}
+
+void Benchmarks::sceneToMap()
+{
+    // What sceneToGeographicCoords() does for each mouse move
+    MapSettings settings;
+    settings.setSceneGrid(m_geoTransform);
+
+    QVector<QPointF> scene(TransformPoints);
+    for (int i = 0; i < TransformPoints; ++i) {
+        scene[i] = QPointF(i % RasterSize, (i / RasterSize) % RasterSize);
+    }
+    double checksum = 0.0;
+
+    QBENCHMARK {
+        for (int i = 0; i < TransformPoints; ++i) {
+            checksum += settings.sceneToMap(scene[i]).x();
+        }
+    }
+    QVERIFY(checksum != 0.0);
+}
+
+void Benchmarks::reprojectFeatures()
+{
+    FeatureBuffer features;
+    QString errorMessage;
+    QVERIFY2(FeatureBuffer::readFromFile(m_vectorPath, 0, &features, &errorMessage), qPrintable(errorMessage));
+
+    QBENCHMARK {
+        FeatureBuffer reprojected;
+        QVERIFY2(Reprojection::reproject(features, m_mercatorWkt, &reprojected, nullptr, &errorMessage),
+                 qPrintable(errorMessage));
+        QCOMPARE(reprojected.count(), features.count());
+    }
+}
+
+void Benchmarks::renderFrame_data()
+{
+    QTest::addColumn<bool>("raster");
+    QTest::addColumn<bool>("vectors");
+    QTest::addColumn<double>("zoom");
+
+    // zoom is view pixels per raster pixel
+    QTest::newRow("vectors, whole extent") << false << true << 1920.0 / RasterSize;
+    QTest::newRow("raster, 1:1") << true << false << 1.0;
+    QTest::newRow("raster and vectors, whole extent") << true << true << 1920.0 / RasterSize;
+}
+
+void Benchmarks::renderFrame()
+{
+    QFETCH(bool, raster);
+    QFETCH(bool, vectors);
+    QFETCH(double, zoom);
+
+    MapSettings settings;
+    settings.setSceneGrid(m_geoTransform);
+    QGraphicsScene scene;
+
+    if (raster) {
+        LoadedLayer loaded = LayerLoader::load("synthetic", "raster", m_rasterPath, QVariantMap());
+        QVERIFY2(loaded.tiles, qPrintable(loaded.errorMessage));
+        TiledRasterItem *item = new TiledRasterItem(loaded.tiles);
+        item->setTransform(settings.rasterToScene(loaded.geoTransform));
+        scene.addItem(item);
+    }
+    if (vectors) {
+        QVariantMap properties;
+        properties["layer_index"] = 0;
+        LoadedLayer loaded = LayerLoader::load("synthetic", "vector", m_vectorPath, properties);
+        QVERIFY2(loaded.features, qPrintable(loaded.errorMessage));
+        FeatureBufferItem *item = new FeatureBufferItem(loaded.features, QColor(255, 127, 0));
+        item->setTransform(settings.mapToSceneTransform());
+        item->setZValue(1.0);
+        scene.addItem(item);
+    }
+
+    // A full HD frame centred on the raster; scene units are raster pixels
+    QImage frame(1920, 1080, QImage::Format_ARGB32_Premultiplied);
+    const QSizeF sceneSize(frame.width() / zoom, frame.height() / zoom);
+    const QRectF sceneRect(QPointF(RasterSize / 2.0 - sceneSize.width() / 2.0,
+                                   RasterSize / 2.0 - sceneSize.height() / 2.0), sceneSize);
+
+    // Steady state: the frame once the tiles in view are cached, as when
+    // panning back and forth or redrawing after an overlay changed
+    auto render = [&]() {
+        frame.fill(Qt::white);
+        QPainter painter(&frame);
+        painter.setRenderHint(QPainter::Antialiasing);
+        scene.render(&painter, QRectF(frame.rect()), sceneRect, Qt::IgnoreAspectRatio);
+    };
+    if (raster) {
+        render();
+        waitForTiles(&scene);
+    }
+
+    QBENCHMARK {
+        render();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // No display needed
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    Benchmarks benchmarks;
+    return QTest::qExec(&benchmarks, argc, argv);
+}
+
+#include "benchmarks.moc"
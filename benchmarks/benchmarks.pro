@@ -0,0 +1,14 @@
+QT       += core gui widgets testlib concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = benchmarks
+
+# Benchmarks for the app's loading, transform and drawing hot paths. They
+# link the same core library as the app, so the numbers follow the code as
+# it changes.
+SOURCES += \
+    benchmarks.cpp
+
+include(../core/core.pri)
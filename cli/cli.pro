@@ -0,0 +1,16 @@
+QT       += core gui widgets
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qgisdemo-cli
+
+# Batch rendering and processing from the command line, without a display
+SOURCES += \
+    commands.cpp \
+    main.cpp
+
+HEADERS += \
+    commands.h
+
+include(../core/core.pri)
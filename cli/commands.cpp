@@ -0,0 +1,409 @@
+#include "commands.h"
+
+#include <QColor>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "crsregistry.h"
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+#include "mapexport.h"
+#include "projectfile.h"
+#include "projectrenderer.h"
+#include "reprojection.h"
+#include "tileexport.h"
+
+namespace
+{
+    const int DefaultWidth = 2048;
+
+    QTextStream &console()
+    {
+        static QTextStream stream(stderr);
+        return stream;
+    }
+
+    void printError(const QString &message)
+    {
+        console() << "error: " << message << endl;
+    }
+
+    // Parses 'arguments' for 'command'; false (with the error and usage
+    // printed) when they do not fit
+    bool parse(QCommandLineParser *parser, const QString &command, const QStringList &arguments,
+               int positionalCount)
+    {
+        parser->addHelpOption();
+        if (!parser->parse(QStringList() << command << arguments)) {
+            printError(parser->errorText());
+            console() << parser->helpText();
+            return false;
+        }
+        if (parser->isSet("help")) {
+            console() << parser->helpText();
+            return false;
+        }
+        if (parser->positionalArguments().size() != positionalCount) {
+            printError(QString("%1 expects %2 arguments").arg(command).arg(positionalCount));
+            console() << parser->helpText();
+            return false;
+        }
+        return true;
+    }
+
+    // "minX,minY,maxX,maxY"
+    bool parseExtent(const QString &text, QRectF *extent)
+    {
+        const QStringList parts = text.split(',');
+        if (parts.size() != 4) return false;
+        double values[4];
+        for (int i = 0; i < 4; ++i) {
+            bool ok = false;
+            values[i] = parts[i].trimmed().toDouble(&ok);
+            if (!ok) return false;
+        }
+        *extent = QRectF(QPointF(values[0], values[1]), QPointF(values[2], values[3])).normalized();
+        return !extent->isEmpty();
+    }
+
+    // "WIDTHxHEIGHT"
+    bool parseSize(const QString &text, QSize *size)
+    {
+        const QStringList parts = text.toLower().split('x');
+        if (parts.size() != 2) return false;
+        bool widthOk = false;
+        bool heightOk = false;
+        *size = QSize(parts[0].toInt(&widthOk), parts[1].toInt(&heightOk));
+        return widthOk && heightOk && !size->isEmpty();
+    }
+
+    // "MIN-MAX" or a single zoom level
+    bool parseZoom(const QString &text, int *minZoom, int *maxZoom)
+    {
+        const QStringList parts = text.split('-');
+        if (parts.size() > 2) return false;
+        bool minOk = false;
+        bool maxOk = false;
+        *minZoom = parts.first().toInt(&minOk);
+        *maxZoom = parts.last().toInt(&maxOk);
+        return minOk && maxOk && *minZoom >= 0 && *maxZoom >= *minZoom && *maxZoom <= 24;
+    }
+
+    QString formatForPath(const QString &path)
+    {
+        const QString suffix = QFileInfo(path).suffix().toLower();
+        if (suffix == "png") return "PNG";
+        if (suffix == "jpg" || suffix == "jpeg") return "JPEG";
+        if (suffix == "pdf") return "PDF";
+        return "GTiff";
+    }
+
+    // Whole percents on stderr, whichever worker reports them
+    class ConsoleFeedback : public ProcessingFeedback
+    {
+    public:
+        explicit ConsoleFeedback(const QString &task) : m_task(task), m_shown(-1) {}
+
+    protected:
+        void progressChanged(double percent) override
+        {
+            QMutexLocker locker(&m_mutex);
+            const int whole = int(percent);
+            if (whole <= m_shown) return;
+            m_shown = whole;
+            console() << "\r" << m_task << ": " << whole << "%" << (whole >= 100 ? "\n" : "") << flush;
+        }
+
+    private:
+        QString m_task;
+        QMutex m_mutex;
+        int m_shown;
+    };
+
+    bool readLayer(const QString &path, int layerIndex, FeatureBuffer *buffer)
+    {
+        QString errorMessage;
+        if (!FeatureBuffer::readFromFile(path, layerIndex, buffer, &errorMessage)) {
+            printError(QString("cannot read %1: %2").arg(path, errorMessage));
+            return false;
+        }
+        return true;
+    }
+}
+
+int Commands::render(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders a project's visible layers to GeoTIFF, PNG, JPEG or PDF.");
+    parser.addPositionalArgument("project", "Project file.");
+    parser.addPositionalArgument("output", "Output file; the suffix picks the format.");
+    parser.addOptions({
+        { "crs", "Canvas CRS instead of the project's, e.g. EPSG:3857.", "crs" },
+        { "extent", "Area to render in map units (default: the project's view, or all layers "
+                    "with --crs).", "minX,minY,maxX,maxY" },
+        { "full", "Render the extent of all layers." },
+        { "size", "Output size in pixels.", "WIDTHxHEIGHT" },
+        { "width", QString("Output width in pixels, height from the extent (default %1).").arg(DefaultWidth), "pixels" },
+        { "format", "GTiff, PNG, JPEG or PDF (default: from the output suffix).", "format" },
+        { "background", "Background colour (default white).", "color", "white" },
+        { "quality", "JPEG quality (default 90).", "quality", "90" },
+        { "dpi", "PDF resolution in pixels per inch (default 300).", "dpi", "300" }
+    });
+    if (!parse(&parser, "render", arguments, 2)) return 2;
+
+    const QString projectPath = parser.positionalArguments().at(0);
+    const QString outputPath = parser.positionalArguments().at(1);
+
+    Project project;
+    QString errorMessage;
+    if (!ProjectFile::read(projectPath, &project, &errorMessage)) {
+        printError(QString("cannot read %1: %2").arg(projectPath, errorMessage));
+        return 1;
+    }
+
+    const QString crs = parser.value("crs");
+    if (!crs.isEmpty() && !CrsRegistry::instance().crs(crs)) {
+        printError("unknown CRS " + crs);
+        return 2;
+    }
+
+    RenderableMap map;
+    if (!ProjectRenderer::prepare(project, crs, &map, &errorMessage)) {
+        printError(errorMessage);
+        return 1;
+    }
+    for (const QString &warning : map.warnings) {
+        console() << "warning: " << warning << endl;
+    }
+
+    // The project's view is in its own canvas CRS
+    QRectF extent = map.extent;
+    if (parser.isSet("extent")) {
+        if (!parseExtent(parser.value("extent"), &extent)) {
+            printError("invalid extent " + parser.value("extent"));
+            return 2;
+        }
+    } else if (!parser.isSet("full") && crs.isEmpty() && project.viewExtent.isValid()) {
+        extent = project.viewExtent;
+    }
+
+    QSize size;
+    if (parser.isSet("size")) {
+        if (!parseSize(parser.value("size"), &size)) {
+            printError("invalid size " + parser.value("size"));
+            return 2;
+        }
+    } else {
+        const int width = parser.isSet("width") ? parser.value("width").toInt() : DefaultWidth;
+        if (width <= 0) {
+            printError("invalid width " + parser.value("width"));
+            return 2;
+        }
+        const QRectF sceneRect = map.mapSettings.mapToScene(extent);
+        size = QSize(width, qMax(1, qRound(width * sceneRect.height() / sceneRect.width())));
+    }
+
+    MapExporter::Settings settings = ProjectRenderer::exportSettings(map, extent, size);
+    settings.path = outputPath;
+    settings.format = parser.isSet("format") ? parser.value("format") : formatForPath(outputPath);
+    settings.background = QColor(parser.value("background"));
+    settings.quality = parser.value("quality").toInt();
+    settings.dpi = parser.value("dpi").toInt();
+    if (!settings.background.isValid()) {
+        printError("invalid background colour " + parser.value("background"));
+        return 2;
+    }
+
+    MapExporter exporter;
+    QObject::connect(&exporter, &MapExporter::progress, [](int done, int total) {
+        console() << "\rRendering: " << done << "/" << total << (done >= total ? "\n" : "") << flush;
+    });
+    QObject::connect(&exporter, &MapExporter::finished, [](bool success, const QString &message) {
+        if (!success) printError(message);
+        QCoreApplication::exit(success ? 0 : 1);
+    });
+    if (!exporter.start(map.layers, settings)) {
+        printError("nothing to render");
+        return 1;
+    }
+    return QCoreApplication::exec();
+}
+
+int Commands::tiles(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders a project's visible layers as XYZ tiles (EPSG:3857, 256 px).");
+    parser.addPositionalArgument("project", "Project file.");
+    parser.addPositionalArgument("output", "Directory for z/x/y tiles, or an .mbtiles file.");
+    parser.addOptions({
+        { "zoom", "Zoom levels (default 0-12).", "min-max", "0-12" },
+        { "bounds", "Area in longitude/latitude (default: all layers).", "west,south,east,north" },
+        { "metatile", "Tiles per metatile side (default 8).", "tiles", "8" },
+        { "format", "png or jpg (default png).", "format", "png" },
+        { "quality", "JPEG quality (default 85).", "quality", "85" },
+        { "background", "Background colour (default transparent, white for jpg).", "color" },
+        { "name", "MBTiles name (default: the output file name).", "name" }
+    });
+    if (!parse(&parser, "tiles", arguments, 2)) return 2;
+
+    const QString projectPath = parser.positionalArguments().at(0);
+    const QString outputPath = parser.positionalArguments().at(1);
+
+    TileExporter::Settings settings;
+    settings.path = outputPath;
+    settings.mbtiles = QFileInfo(outputPath).suffix().toLower() == "mbtiles";
+    settings.name = parser.value("name");
+    settings.format = parser.value("format").toLower() == "jpeg" ? "jpg" : parser.value("format").toLower();
+    settings.quality = parser.value("quality").toInt();
+    settings.metaTile = parser.value("metatile").toInt();
+    if (settings.format != "png" && settings.format != "jpg") {
+        printError("invalid format " + parser.value("format"));
+        return 2;
+    }
+    if (!parseZoom(parser.value("zoom"), &settings.minZoom, &settings.maxZoom)) {
+        printError("invalid zoom levels " + parser.value("zoom"));
+        return 2;
+    }
+    if (settings.metaTile < 1 || settings.metaTile > 32) {
+        printError("invalid metatile size " + parser.value("metatile"));
+        return 2;
+    }
+    settings.background = parser.isSet("background") ? QColor(parser.value("background"))
+                                                     : QColor(settings.format == "jpg" ? Qt::white : Qt::transparent);
+    if (!settings.background.isValid()) {
+        printError("invalid background colour " + parser.value("background"));
+        return 2;
+    }
+
+    Project project;
+    QString errorMessage;
+    if (!ProjectFile::read(projectPath, &project, &errorMessage)) {
+        printError(QString("cannot read %1: %2").arg(projectPath, errorMessage));
+        return 1;
+    }
+
+    RenderableMap map;
+    if (!ProjectRenderer::prepare(project, "EPSG:3857", &map, &errorMessage)) {
+        printError(errorMessage);
+        return 1;
+    }
+    for (const QString &warning : map.warnings) {
+        console() << "warning: " << warning << endl;
+    }
+
+    settings.extent = map.extent;
+    if (parser.isSet("bounds")) {
+        QRectF bounds;
+        if (!parseExtent(parser.value("bounds"), &bounds)) {
+            printError("invalid bounds " + parser.value("bounds"));
+            return 2;
+        }
+        settings.extent = TileExporter::mercatorFromLonLat(bounds);
+    }
+    settings.mapToScene = map.mapSettings.mapToSceneTransform();
+
+    TileExporter exporter;
+    QElapsedTimer timer;
+    QObject::connect(&exporter, &TileExporter::progress, [](qint64 done, qint64 total) {
+        console() << "\rTiles: " << done << "/" << total << flush;
+    });
+    QObject::connect(&exporter, &TileExporter::finished, [&exporter, &timer](bool success, const QString &message) {
+        const double seconds = timer.elapsed() / 1000.0;
+        console() << "\n";
+        if (success) {
+            console() << QString("%1 tiles in %2 s, %3 tiles/s")
+                         .arg(exporter.tilesDone()).arg(seconds, 0, 'f', 1)
+                         .arg(exporter.tilesDone() / qMax(seconds, 0.001), 0, 'f', 1) << endl;
+        } else {
+            printError(message);
+        }
+        QCoreApplication::exit(success ? 0 : 1);
+    });
+    timer.start();
+    if (!exporter.start(map.layers, settings)) {
+        printError("nothing to render");
+        return 1;
+    }
+    console() << exporter.tileCount() << " tiles, zoom " << settings.minZoom << "-" << settings.maxZoom << endl;
+    return QCoreApplication::exec();
+}
+
+int Commands::process(const QStringList &arguments)
+{
+    if (arguments.isEmpty() || arguments.first().startsWith('-')) {
+        printError("process expects an algorithm: buffer, clip, intersection or reproject");
+        return 2;
+    }
+    const QString algorithm = arguments.first();
+    const bool overlay = algorithm == "clip" || algorithm == "intersection";
+    if (!overlay && algorithm != "buffer" && algorithm != "reproject") {
+        printError("unknown algorithm " + algorithm);
+        return 2;
+    }
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs " + algorithm + " on vector files.");
+    parser.addPositionalArgument("input", "Input layer.");
+    if (overlay) {
+        parser.addPositionalArgument("overlay", "Overlay layer.");
+    }
+    parser.addPositionalArgument("output", "Output file (.shp, .geojson or .gpkg).");
+    parser.addOptions({
+        { "layer", "Layer index within the input (default 0).", "index", "0" },
+        { "overlay-layer", "Layer index within the overlay (default 0).", "index", "0" },
+        { "distance", "buffer: distance in layer units.", "distance" },
+        { "segments", "buffer: segments per quarter circle (default 8).", "segments", "8" },
+        { "crs", "reproject: target CRS, e.g. EPSG:3857.", "crs" }
+    });
+    if (!parse(&parser, "process " + algorithm, arguments.mid(1), overlay ? 3 : 2)) return 2;
+
+    const QStringList positional = parser.positionalArguments();
+    const QString outputPath = positional.last();
+
+    FeatureBuffer input;
+    if (!readLayer(positional.first(), parser.value("layer").toInt(), &input)) return 1;
+
+    FeatureBuffer output;
+    ConsoleFeedback feedback(algorithm);
+    QString errorMessage;
+    bool ok = false;
+    if (algorithm == "buffer") {
+        bool distanceOk = false;
+        const double distance = parser.value("distance").toDouble(&distanceOk);
+        if (!distanceOk) {
+            printError("buffer needs --distance");
+            return 2;
+        }
+        ok = Geoprocessing::buffer(input, distance, parser.value("segments").toInt(), &output,
+                                   &feedback, &errorMessage);
+    } else if (algorithm == "reproject") {
+        QSharedPointer<const CrsDefinition> target = CrsRegistry::instance().crs(parser.value("crs"));
+        if (!target) {
+            printError("reproject needs a valid --crs");
+            return 2;
+        }
+        ok = Reprojection::reproject(input, target->wkt, &output, &feedback, &errorMessage);
+    } else {
+        FeatureBuffer overlayLayer;
+        if (!readLayer(positional.at(1), parser.value("overlay-layer").toInt(), &overlayLayer)) return 1;
+        ok = algorithm == "clip"
+                ? Geoprocessing::clip(input, overlayLayer, &output, &feedback, &errorMessage)
+                : Geoprocessing::intersection(input, overlayLayer, &output, &feedback, &errorMessage);
+    }
+    if (!ok) {
+        printError(algorithm + " failed: " + errorMessage);
+        return 1;
+    }
+
+    if (!output.writeToFile(outputPath, QFileInfo(outputPath).completeBaseName(), &errorMessage)) {
+        printError(QString("cannot write %1: %2").arg(outputPath, errorMessage));
+        return 1;
+    }
+    console() << output.count() << " features written to " << outputPath << endl;
+    return 0;
+}
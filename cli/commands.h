@@ -0,0 +1,22 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <QStringList>
+
+// Command-line commands. Each takes the arguments after its name and
+// returns the process exit code: 0 on success, 1 when the work failed and
+// 2 for bad usage.
+namespace Commands
+{
+    // render <project> <output>: the project's map as GeoTIFF, PNG, JPEG or PDF
+    int render(const QStringList &arguments);
+
+    // tiles <project> <output>: an XYZ tile pyramid as z/x/y files or MBTiles
+    int tiles(const QStringList &arguments);
+
+    // process <algorithm> <input> [overlay] <output>: a vector algorithm run
+    // on files, written as Shapefile, GeoJSON or GeoPackage
+    int process(const QStringList &arguments);
+}
+
+#endif // COMMANDS_H
@@ -0,0 +1,59 @@
+#include <QApplication>
+#include <QTextStream>
+
+#include <gdal_priv.h>
+
+#include "commands.h"
+
+namespace
+{
+    void printUsage()
+    {
+        QTextStream(stderr)
+                << "Usage: qgisdemo-cli <command> [options]\n"
+                << "\n"
+                << "Commands:\n"
+                << "  render <project> <output>                  Render a project to GeoTIFF, PNG, JPEG or PDF\n"
+                << "  tiles <project> <output>                   Render an XYZ tile pyramid to z/x/y files or MBTiles\n"
+                << "  process <algorithm> <input> ... <output>   Run buffer, clip, intersection or reproject\n"
+                << "\n"
+                << "Run 'qgisdemo-cli <command> --help' for the options of a command.\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Rendering goes through QPainter and the graphics items the app uses,
+    // which need an application object but no display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    QApplication::setApplicationName("qgisdemo-cli");
+
+    // Same GDAL setup as the app
+    CPLSetConfigOption("GDAL_PAM_ENABLED", "NO");
+    CPLSetConfigOption("GDAL_CACHEMAX", "128");
+    GDALAllRegister();
+
+    QStringList arguments = QApplication::arguments().mid(1);
+    if (arguments.isEmpty() || arguments.first() == "--help" || arguments.first() == "-h") {
+        printUsage();
+        return arguments.isEmpty() ? 2 : 0;
+    }
+
+    const QString command = arguments.takeFirst();
+    if (command == "render") {
+        return Commands::render(arguments);
+    }
+    if (command == "tiles") {
+        return Commands::tiles(arguments);
+    }
+    if (command == "process") {
+        return Commands::process(arguments);
+    }
+
+    QTextStream(stderr) << "error: unknown command " << command << "\n\n";
+    printUsage();
+    return 2;
+}
@@ -0,0 +1,22 @@
+# Linking against the core library: include from the project that uses it
+# (app, cli, benchmarks), after its own QT and CONFIG settings.
+
+QT += widgets printsupport concurrent sql
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+CORE_LIB_DIR = $$OUT_PWD/../core
+LIBS += -L$$CORE_LIB_DIR -lqgisdemocore
+PRE_TARGETDEPS += $$CORE_LIB_DIR/libqgisdemocore.a
+
+# GDAL configuration
+
+INCLUDEPATH += /usr/local/include
+LIBS += -L/usr/local/lib -L/usr/local/lib64 -lgdal -lproj -lgeos_c
+
+# Processing uses only the thread-safe GEOS reentrant API
+DEFINES += GEOS_USE_ONLY_R_API
+
+# Project packages and export manifests use xxHash checksums
+LIBS += -lxxhash
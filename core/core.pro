@@ -0,0 +1,73 @@
+QT       += core gui widgets
+QT       += printsupport
+QT       += concurrent
+QT       += sql
+
+TEMPLATE = lib
+CONFIG += staticlib c++11
+
+TARGET = qgisdemocore
+
+# Everything that runs without a window: data providers, coordinate
+# transforms, processing algorithms and render/export jobs. Drawing goes
+# through QGraphicsScene and QPainter, so it renders offscreen as well as on
+# the map canvas.
+SOURCES += \
+    crscatalogue.cpp \
+    crsregistry.cpp \
+    featurebuffer.cpp \
+    featurebufferitem.cpp \
+    geopackageexport.cpp \
+    geoprocessing.cpp \
+    layerloader.cpp \
+    mapexport.cpp \
+    mapsettings.cpp \
+    pointgenerators.cpp \
+    processingjobs.cpp \
+    profiler.cpp \
+    projectexport.cpp \
+    projectfile.cpp \
+    projectpackage.cpp \
+    projectrenderer.cpp \
+    rastercalculator.cpp \
+    reprojection.cpp \
+    spatialindex.cpp \
+    terrain.cpp \
+    tileexport.cpp \
+    tiledrasteritem.cpp \
+    vectoranalysis.cpp \
+    warptilesource.cpp
+
+HEADERS += \
+    crscatalogue.h \
+    crsregistry.h \
+    featurebuffer.h \
+    featurebufferitem.h \
+    geopackageexport.h \
+    geoprocessing.h \
+    layerloader.h \
+    mapexport.h \
+    mapsettings.h \
+    pointgenerators.h \
+    processingjobs.h \
+    profiler.h \
+    projectexport.h \
+    projectfile.h \
+    projectpackage.h \
+    projectrenderer.h \
+    rastercalculator.h \
+    reprojection.h \
+    spatialindex.h \
+    terrain.h \
+    tileexport.h \
+    tiledrasteritem.h \
+    vectoranalysis.h \
+    warptilesource.h \
+    wkbutils.h
+
+# GDAL configuration
+
+INCLUDEPATH += /usr/local/include
+
+# Processing uses only the thread-safe GEOS reentrant API
+DEFINES += GEOS_USE_ONLY_R_API
@@ -0,0 +1,306 @@
+#include "crscatalogue.h"
+
+#include <QIcon>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "crsregistry.h"
+
+namespace
+{
+    QString typeName(PJ_TYPE type)
+    {
+        switch (type) {
+        case PJ_TYPE_GEOGRAPHIC_2D_CRS: return "Geographic (2D)";
+        case PJ_TYPE_GEOGRAPHIC_3D_CRS: return "Geographic (3D)";
+        case PJ_TYPE_GEOCENTRIC_CRS: return "Geocentric";
+        case PJ_TYPE_PROJECTED_CRS: return "Projected";
+        case PJ_TYPE_COMPOUND_CRS: return "Compound";
+        case PJ_TYPE_ENGINEERING_CRS: return "Engineering";
+        case PJ_TYPE_VERTICAL_CRS: return "Vertical";
+        default: return "Other";
+        }
+    }
+
+    // Lower case words of letters and digits
+    QVector<QString> tokenize(const QString &text)
+    {
+        QVector<QString> tokens;
+        QString current;
+        for (const QChar c : text) {
+            if (c.isLetterOrNumber()) {
+                current += c.toLower();
+            } else if (!current.isEmpty()) {
+                tokens.append(current);
+                current.clear();
+            }
+        }
+        if (!current.isEmpty()) tokens.append(current);
+        return tokens;
+    }
+
+    // Areas of use crossing the antimeridian run from west round to east
+    bool overlaps(const QRectF &bounds, const QRectF &area)
+    {
+        if (bounds.top() > area.bottom() || bounds.bottom() < area.top()) return false;
+        if (bounds.left() <= bounds.right()) {
+            return bounds.left() <= area.right() && bounds.right() >= area.left();
+        }
+        return area.right() >= bounds.left() || area.left() <= bounds.right();
+    }
+
+    void addTokens(const QString &text, QVector<QString> *tokens)
+    {
+        const QVector<QString> words = tokenize(text);
+        for (const QString &word : words) tokens->append(word);
+
+        // "WGS 84 / UTM" also as "wgs84utm", so "wgs84" finds it
+        if (words.size() > 1) {
+            QString compact;
+            for (const QString &word : words) compact += word;
+            tokens->append(compact);
+        }
+    }
+}
+
+QFuture<QSharedPointer<const CrsCatalogue>> CrsCatalogue::load()
+{
+    static QMutex mutex;
+    static QFuture<QSharedPointer<const CrsCatalogue>> future;
+    static bool started = false;
+
+    QMutexLocker locker(&mutex);
+    if (!started) {
+        future = QtConcurrent::run(&CrsCatalogue::read);
+        started = true;
+    }
+    return future;
+}
+
+QSharedPointer<const CrsCatalogue> CrsCatalogue::read()
+{
+    QSharedPointer<CrsCatalogue> catalogue(new CrsCatalogue());
+
+    int count = 0;
+    PROJ_CRS_INFO **list = proj_get_crs_info_list_from_database(ProjThreadContext::local().context(),
+                                                                "EPSG", nullptr, &count);
+    if (list) {
+        catalogue->m_entries.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            const PROJ_CRS_INFO *info = list[i];
+            Entry entry;
+            entry.authId = QString("%1:%2").arg(QString::fromUtf8(info->auth_name),
+                                                QString::fromUtf8(info->code));
+            entry.name = QString::fromUtf8(info->name);
+            entry.type = typeName(info->type);
+            if (info->area_name) entry.area = QString::fromUtf8(info->area_name);
+            if (info->bbox_valid) {
+                entry.bounds = QRectF(QPointF(info->west_lon_degree, info->south_lat_degree),
+                                      QPointF(info->east_lon_degree, info->north_lat_degree));
+            }
+            catalogue->m_entries.push_back(entry);
+        }
+        proj_crs_info_list_destroy(list);
+    }
+
+    std::sort(catalogue->m_entries.begin(), catalogue->m_entries.end(),
+              [](const Entry &a, const Entry &b) {
+        return QString::compare(a.name, b.name, Qt::CaseInsensitive) < 0;
+    });
+    catalogue->buildIndex();
+    return catalogue;
+}
+
+void CrsCatalogue::buildIndex()
+{
+    QHash<QString, QVector<int>> postings;
+    for (int i = 0; i < count(); ++i) {
+        const Entry &entry = m_entries[i];
+        QVector<QString> tokens;
+        addTokens(entry.authId, &tokens);
+        addTokens(entry.name, &tokens);
+        addTokens(entry.area, &tokens);
+
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+        for (const QString &token : tokens) {
+            postings[token].append(i);
+        }
+    }
+
+    m_tokens.reserve(postings.size());
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        m_tokens.push_back(it.key());
+    }
+    std::sort(m_tokens.begin(), m_tokens.end());
+    m_postings.reserve(m_tokens.size());
+    for (const QString &token : m_tokens) {
+        m_postings.push_back(postings.value(token));
+    }
+
+    // Sort orders for the model columns, so sorting a result is an
+    // integer comparison
+    std::vector<int> order(m_entries.size());
+    for (int column = 0; column < 3; ++column) {
+        for (size_t i = 0; i < order.size(); ++i) order[i] = int(i);
+        if (column == 1) {
+            std::sort(order.begin(), order.end(), [this](int a, int b) {
+                const QString &idA = m_entries[a].authId;
+                const QString &idB = m_entries[b].authId;
+                const int codeA = idA.mid(idA.indexOf(':') + 1).toInt();
+                const int codeB = idB.mid(idB.indexOf(':') + 1).toInt();
+                return codeA != codeB ? codeA < codeB : idA < idB;
+            });
+        } else if (column == 2) {
+            // Stable, so entries keep name order within a type
+            std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+                return m_entries[a].type < m_entries[b].type;
+            });
+        }
+        m_ranks[column].assign(order.size(), 0);
+        for (size_t i = 0; i < order.size(); ++i) m_ranks[column][order[i]] = int(i);
+    }
+}
+
+QVector<int> CrsCatalogue::search(const QString &text, const QString &type, const QRectF &area) const
+{
+    const bool anyType = type.isEmpty() || type == "All";
+    const QVector<QString> terms = tokenize(text);
+
+    // hits[i] == t once entry i matched the first t terms
+    std::vector<int> hits(m_entries.size(), 0);
+    for (int t = 0; t < terms.size(); ++t) {
+        const QString &term = terms[t];
+        auto it = std::lower_bound(m_tokens.begin(), m_tokens.end(), term);
+        for (; it != m_tokens.end() && it->startsWith(term); ++it) {
+            for (int index : m_postings[it - m_tokens.begin()]) {
+                if (hits[index] == t) hits[index] = t + 1;
+            }
+        }
+    }
+
+    QVector<int> result;
+    for (int i = 0; i < count(); ++i) {
+        if (hits[i] != terms.size()) continue;
+        if (!anyType && !m_entries[i].type.contains(type, Qt::CaseInsensitive)) continue;
+        if (!area.isNull() && (m_entries[i].bounds.isNull() || !overlaps(m_entries[i].bounds, area))) continue;
+        result.append(i);
+    }
+    return result;
+}
+
+CrsCatalogueModel::CrsCatalogueModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , m_sortColumn(NameColumn)
+    , m_sortOrder(Qt::AscendingOrder)
+{
+}
+
+void CrsCatalogueModel::setCatalogue(const QSharedPointer<const CrsCatalogue> &catalogue)
+{
+    m_catalogue = catalogue;
+    applyFilter();
+}
+
+void CrsCatalogueModel::setFilter(const QString &text, const QString &type, const QRectF &area)
+{
+    if (text == m_text && type == m_type && area == m_area) return;
+    m_text = text;
+    m_type = type;
+    m_area = area;
+    applyFilter();
+}
+
+void CrsCatalogueModel::applyFilter()
+{
+    beginResetModel();
+    m_rows = m_catalogue ? m_catalogue->search(m_text, m_type, m_area) : QVector<int>();
+    sortRows();
+    endResetModel();
+}
+
+void CrsCatalogueModel::sortRows()
+{
+    if (!m_catalogue || (m_sortColumn == NameColumn && m_sortOrder == Qt::AscendingOrder)) {
+        return;   // search() already returns name order
+    }
+    const CrsCatalogue *catalogue = m_catalogue.data();
+    const int column = m_sortColumn;
+    const bool descending = m_sortOrder == Qt::DescendingOrder;
+    std::sort(m_rows.begin(), m_rows.end(), [catalogue, column, descending](int a, int b) {
+        const int rankA = catalogue->rank(column, a);
+        const int rankB = catalogue->rank(column, b);
+        return descending ? rankA > rankB : rankA < rankB;
+    });
+}
+
+QString CrsCatalogueModel::authId(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.row() >= m_rows.size()) return QString();
+    return m_catalogue->entry(m_rows[index.row()]).authId;
+}
+
+int CrsCatalogueModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_rows.size();
+}
+
+int CrsCatalogueModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : 3;
+}
+
+QVariant CrsCatalogueModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_rows.size()) return QVariant();
+    const CrsCatalogue::Entry &entry = m_catalogue->entry(m_rows[index.row()]);
+
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case NameColumn: return entry.name;
+        case AuthIdColumn: return entry.authId;
+        case TypeColumn: return entry.type;
+        }
+        break;
+    case Qt::ToolTipRole:
+        return entry.area.isEmpty() ? QString("%1\n%2").arg(entry.name, entry.authId)
+                                    : QString("%1\n%2\nArea of use: %3").arg(entry.name, entry.authId, entry.area);
+    case Qt::DecorationRole:
+        if (index.column() == NameColumn) {
+            static const QIcon icon(":/icons/projection.png");
+            return icon;
+        }
+        break;
+    }
+    return QVariant();
+}
+
+QVariant CrsCatalogueModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) return QVariant();
+    switch (section) {
+    case NameColumn: return "Name";
+    case AuthIdColumn: return "Authority ID";
+    case TypeColumn: return "Type";
+    }
+    return QVariant();
+}
+
+void CrsCatalogueModel::sort(int column, Qt::SortOrder order)
+{
+    if (column < 0 || column > TypeColumn) return;
+    m_sortColumn = column;
+    m_sortOrder = order;
+
+    beginResetModel();
+    if (m_sortColumn == NameColumn && m_sortOrder == Qt::AscendingOrder) {
+        std::sort(m_rows.begin(), m_rows.end());   // name order is index order
+    } else {
+        sortRows();
+    }
+    endResetModel();
+}
@@ -0,0 +1,101 @@
+#ifndef CRSCATALOGUE_H
+#define CRSCATALOGUE_H
+
+#include <QAbstractTableModel>
+#include <QFuture>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include <vector>
+
+// Every CRS of the EPSG registry in the PROJ database, with an inverted
+// index over code, name and area of use tokens. Read once on a worker
+// thread and shared read-only afterwards.
+class CrsCatalogue
+{
+public:
+    struct Entry
+    {
+        QString authId;     // "EPSG:4326"
+        QString name;
+        QString type;       // "Geographic (2D)", "Projected", ...
+        QString area;       // area of use
+        QRectF bounds;      // west/south to east/north in degrees, west > east
+                            // across the antimeridian; null if unknown
+    };
+
+    // Starts reading the database on the first call; later calls return
+    // the same future
+    static QFuture<QSharedPointer<const CrsCatalogue>> load();
+
+    int count() const { return int(m_entries.size()); }
+    const Entry &entry(int index) const { return m_entries[index]; }
+
+    // Entries matching every whitespace separated term of 'text' (as a
+    // prefix of a code, name or area word), unless 'type' is empty or "All"
+    // whose type contains 'type', and unless 'area' (degrees) is null whose
+    // area of use is known and overlaps it. In catalogue (name) order.
+    QVector<int> search(const QString &text, const QString &type = QString(),
+                        const QRectF &area = QRectF()) const;
+
+    // Position of every entry when sorted on a model column
+    int rank(int column, int index) const { return m_ranks[column][index]; }
+
+private:
+    static QSharedPointer<const CrsCatalogue> read();
+    void buildIndex();
+
+    std::vector<Entry> m_entries;
+
+    // Sorted token list and, for each token, the entries containing it
+    std::vector<QString> m_tokens;
+    std::vector<QVector<int>> m_postings;
+
+    std::vector<int> m_ranks[3];
+};
+
+// Flat, lazily filled view on a CrsCatalogue: only the rows a view asks
+// for are formatted, and filtering swaps a vector of row indices.
+class CrsCatalogueModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        NameColumn,
+        AuthIdColumn,
+        TypeColumn
+    };
+
+    explicit CrsCatalogueModel(QObject *parent = nullptr);
+
+    void setCatalogue(const QSharedPointer<const CrsCatalogue> &catalogue);
+    bool isLoaded() const { return !m_catalogue.isNull(); }
+    int totalCount() const { return m_catalogue ? m_catalogue->count() : 0; }
+
+    void setFilter(const QString &text, const QString &type, const QRectF &area = QRectF());
+
+    QString authId(const QModelIndex &index) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+private:
+    void applyFilter();
+    void sortRows();
+
+    QSharedPointer<const CrsCatalogue> m_catalogue;
+    QVector<int> m_rows;
+    QString m_text;
+    QString m_type;
+    QRectF m_area;
+    int m_sortColumn;
+    Qt::SortOrder m_sortOrder;
+};
+
+#endif // CRSCATALOGUE_H
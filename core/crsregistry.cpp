@@ -0,0 +1,184 @@
+#include "crsregistry.h"
+
+#include <QMutexLocker>
+
+#include <ogr_spatialref.h>
+
+namespace
+{
+    // proj_identify(): 100 is an exact match, 70 the same CRS under a
+    // different name; anything lower is only similar
+    const int MinimumIdentifyConfidence = 70;
+
+    void releaseSpatialReference(OGRSpatialReference *srs)
+    {
+        if (srs) srs->Release();
+    }
+}
+
+ProjThreadContext &ProjThreadContext::local()
+{
+    thread_local ProjThreadContext context;
+    return context;
+}
+
+ProjThreadContext::ProjThreadContext()
+    : m_context(proj_context_create())
+{
+}
+
+ProjThreadContext::~ProjThreadContext()
+{
+    for (PJ *transformation : m_transformations) {
+        if (transformation) proj_destroy(transformation);
+    }
+    proj_context_destroy(m_context);
+}
+
+PJ *ProjThreadContext::transformation(const QString &sourceWkt, const QString &targetWkt)
+{
+    const QPair<QString, QString> key(sourceWkt, targetWkt);
+    auto it = m_transformations.constFind(key);
+    if (it != m_transformations.constEnd()) return it.value();
+
+    PJ *transformation = proj_create_crs_to_crs(m_context, sourceWkt.toUtf8().constData(),
+                                                targetWkt.toUtf8().constData(), nullptr);
+    if (transformation) {
+        PJ *normalized = proj_normalize_for_visualization(m_context, transformation);
+        proj_destroy(transformation);
+        transformation = normalized;
+    }
+    m_transformations.insert(key, transformation);
+    return transformation;
+}
+
+QString ProjThreadContext::lastError() const
+{
+    return QString::fromUtf8(proj_errno_string(proj_context_errno(m_context)));
+}
+
+CrsRegistry &CrsRegistry::instance()
+{
+    static CrsRegistry registry;
+    return registry;
+}
+
+QSharedPointer<const CrsDefinition> CrsRegistry::crs(const QString &definition)
+{
+    if (definition.trimmed().isEmpty()) return QSharedPointer<const CrsDefinition>();
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_definitions.constFind(definition);
+        if (it != m_definitions.constEnd()) return it.value();
+    }
+
+    // Parsed outside the lock; identification may query the PROJ database
+    QSharedPointer<const CrsDefinition> created = create(definition);
+
+    QMutexLocker locker(&m_mutex);
+    if (created) {
+        // The same CRS reached through a code and through its WKT shares
+        // one entry
+        auto it = m_definitions.constFind(created->wkt);
+        if (it != m_definitions.constEnd() && it.value()) {
+            created = it.value();
+        } else {
+            m_definitions.insert(created->wkt, created);
+        }
+    }
+    auto it = m_definitions.constFind(definition);
+    if (it != m_definitions.constEnd()) return it.value();   // another thread won
+    m_definitions.insert(definition, created);
+    return created;
+}
+
+bool CrsRegistry::isSame(const QString &definitionA, const QString &definitionB)
+{
+    QSharedPointer<const CrsDefinition> a = crs(definitionA);
+    QSharedPointer<const CrsDefinition> b = crs(definitionB);
+    if (!a || !b) return false;
+    if (a == b) return true;
+
+    const QPair<QString, QString> key = a->wkt < b->wkt ? qMakePair(a->wkt, b->wkt)
+                                                        : qMakePair(b->wkt, a->wkt);
+    QMutexLocker locker(&m_mutex);
+    auto it = m_sameCrs.constFind(key);
+    if (it != m_sameCrs.constEnd()) return it.value();
+
+    // OGRSpatialReference builds PROJ objects lazily, so comparisons stay
+    // under the lock
+    const bool same = a->srs->IsSame(b->srs.data());
+    m_sameCrs.insert(key, same);
+    return same;
+}
+
+QSharedPointer<CrsDefinition> CrsRegistry::create(const QString &definition)
+{
+    QSharedPointer<OGRSpatialReference> srs(new OGRSpatialReference(), releaseSpatialReference);
+    if (srs->SetFromUserInput(definition.toUtf8().constData()) != OGRERR_NONE) {
+        return QSharedPointer<CrsDefinition>();
+    }
+    srs->SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+
+    char *wkt = nullptr;
+    if (srs->exportToWkt(&wkt) != OGRERR_NONE || !wkt) {
+        CPLFree(wkt);
+        return QSharedPointer<CrsDefinition>();
+    }
+
+    QSharedPointer<CrsDefinition> result(new CrsDefinition());
+    result->wkt = QString::fromUtf8(wkt);
+    CPLFree(wkt);
+    result->geographic = srs->IsGeographic();
+    if (const char *name = srs->GetName()) {
+        result->name = QString::fromUtf8(name);
+    }
+
+    // An authority code on the root node is taken as is
+    const char *authority = srs->GetAuthorityName(nullptr);
+    const char *code = srs->GetAuthorityCode(nullptr);
+    if (authority && code) {
+        result->authId = QString("%1:%2").arg(QString::fromUtf8(authority), QString::fromUtf8(code));
+    } else {
+        identify(result.data());
+    }
+
+    result->srs = srs;
+    return result;
+}
+
+void CrsRegistry::identify(CrsDefinition *definition)
+{
+    PJ_CONTEXT *context = ProjThreadContext::local().context();
+    PJ *crs = proj_create(context, definition->wkt.toUtf8().constData());
+    if (!crs) return;
+
+    int *confidence = nullptr;
+    PJ_OBJ_LIST *matches = proj_identify(context, crs, "EPSG", nullptr, &confidence);
+    if (matches) {
+        int best = -1;
+        for (int i = 0; i < proj_list_get_count(matches); ++i) {
+            if (confidence[i] >= MinimumIdentifyConfidence &&
+                (best < 0 || confidence[i] > confidence[best])) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            PJ *match = proj_list_get(context, matches, best);
+            const char *authority = proj_get_id_auth_name(match, 0);
+            const char *code = proj_get_id_code(match, 0);
+            if (authority && code) {
+                definition->authId = QString("%1:%2").arg(QString::fromUtf8(authority),
+                                                          QString::fromUtf8(code));
+            }
+            if (definition->name.isEmpty() || definition->name == "unknown") {
+                definition->name = QString::fromUtf8(proj_get_name(match));
+            }
+            proj_destroy(match);
+        }
+        proj_list_destroy(matches);
+    }
+    proj_int_list_destroy(confidence);
+    proj_destroy(crs);
+}
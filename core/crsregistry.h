@@ -0,0 +1,80 @@
+#ifndef CRSREGISTRY_H
+#define CRSREGISTRY_H
+
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+
+#include <proj.h>
+
+class OGRSpatialReference;
+
+// A parsed CRS. Built once per distinct definition by CrsRegistry and
+// shared read-only afterwards.
+struct CrsDefinition
+{
+    QString authId;      // "EPSG:32633" when identified, otherwise empty
+    QString name;        // e.g. "WGS 84 / UTM zone 33N"
+    QString wkt;         // as exported by GDAL, usable as a cache key
+    bool geographic = false;
+
+    // Only touched by CrsRegistry, under its lock
+    QSharedPointer<OGRSpatialReference> srs;
+};
+
+// Per-thread PROJ context with the transformation pipelines it has built.
+// PJ objects are not thread safe, so every worker gets its own through
+// local(); pipelines live until the thread exits.
+class ProjThreadContext
+{
+public:
+    static ProjThreadContext &local();
+
+    PJ_CONTEXT *context() const { return m_context; }
+
+    // Source to target with traditional GIS axis order (x = longitude or
+    // easting) on both sides; null if PROJ cannot relate the two CRSs
+    PJ *transformation(const QString &sourceWkt, const QString &targetWkt);
+
+    QString lastError() const;
+
+    ~ProjThreadContext();
+
+private:
+    ProjThreadContext();
+    Q_DISABLE_COPY(ProjThreadContext)
+
+    PJ_CONTEXT *m_context;
+    QHash<QPair<QString, QString>, PJ*> m_transformations;
+};
+
+// Process-wide pool of parsed CRSs. Any definition GDAL accepts (authority
+// code, WKT, PROJ string) is parsed and identified once; opening many layers
+// in the same CRS then costs one parse. Safe to call from any thread.
+class CrsRegistry
+{
+public:
+    static CrsRegistry &instance();
+
+    // Null when the definition cannot be parsed
+    QSharedPointer<const CrsDefinition> crs(const QString &definition);
+
+    // Both definitions describe the same CRS; an empty or invalid one never
+    // matches. Results are cached per pair.
+    bool isSame(const QString &definitionA, const QString &definitionB);
+
+private:
+    CrsRegistry() {}
+    Q_DISABLE_COPY(CrsRegistry)
+
+    static QSharedPointer<CrsDefinition> create(const QString &definition);
+    static void identify(CrsDefinition *definition);
+
+    QMutex m_mutex;
+    QHash<QString, QSharedPointer<const CrsDefinition>> m_definitions;
+    QHash<QPair<QString, QString>, bool> m_sameCrs;
+};
+
+#endif // CRSREGISTRY_H
@@ -0,0 +1,357 @@
+#include "featurebuffer.h"
+
+#include <QFileInfo>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+FeatureBuffer::FeatureBuffer()
+    : m_geometryType(wkbUnknown)
+{
+}
+
+void FeatureBuffer::copySchema(const FeatureBuffer &other)
+{
+    m_geometryType = other.m_geometryType;
+    m_srsWkt = other.m_srsWkt;
+    m_fields = other.m_fields;
+}
+
+int FeatureBuffer::maxFeatures(int fieldCount)
+{
+    // Less the container header, rounded down for safety
+    const qint64 maxBytes = (qint64(1) << 31) - 4096;
+    const qint64 bytesPerFeature = std::max<qint64>(sizeof(Envelope),
+                                                    qint64(sizeof(QVariant)) * fieldCount);
+    return static_cast<int>(std::min<qint64>(maxBytes / bytesPerFeature, std::numeric_limits<int>::max()));
+}
+
+void FeatureBuffer::reserve(int featureCount, qint64 wkbBytes)
+{
+    m_wkb.reserve(static_cast<size_t>(wkbBytes));
+    m_offsets.reserve(featureCount);
+    m_sizes.reserve(featureCount);
+    m_envelopes.reserve(featureCount);
+    m_attributes.reserve(featureCount * m_fields.size());
+}
+
+void FeatureBuffer::clear()
+{
+    m_wkb.clear();
+    m_offsets.clear();
+    m_sizes.clear();
+    m_envelopes.clear();
+    m_attributes.clear();
+    m_extent = Envelope();
+}
+
+void FeatureBuffer::append(const unsigned char *wkb, int wkbSize, const Envelope &envelope,
+                           const QVariant *attributes)
+{
+    m_offsets.append(static_cast<qint64>(m_wkb.size()));
+    m_sizes.append(wkbSize);
+    m_wkb.insert(m_wkb.end(), wkb, wkb + wkbSize);
+    m_envelopes.append(envelope);
+    m_extent.expand(envelope);
+
+    for (int f = 0; f < m_fields.size(); ++f) {
+        m_attributes.append(attributes ? attributes[f] : QVariant());
+    }
+}
+
+void FeatureBuffer::append(const FeatureBuffer &other)
+{
+    if (other.isEmpty()) return;
+
+    // Schemas are expected to match; offsets are rebased onto our storage
+    const qint64 base = static_cast<qint64>(m_wkb.size());
+    m_wkb.insert(m_wkb.end(), other.m_wkb.begin(), other.m_wkb.end());
+    m_offsets.reserve(m_offsets.size() + other.m_offsets.size());
+    for (qint64 offset : other.m_offsets) {
+        m_offsets.append(base + offset);
+    }
+    m_sizes += other.m_sizes;
+    m_envelopes += other.m_envelopes;
+    m_attributes += other.m_attributes;
+    m_extent.expand(other.m_extent);
+}
+
+void FeatureBuffer::appendPoint(double x, double y, const QVariant *attributes)
+{
+    unsigned char wkb[21];
+    wkb[0] = 1;   // little endian
+    qToLittleEndian<quint32>(wkbPoint, wkb + 1);
+
+    quint64 bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    qToLittleEndian<quint64>(bits, wkb + 5);
+    std::memcpy(&bits, &y, sizeof(bits));
+    qToLittleEndian<quint64>(bits, wkb + 13);
+
+    append(wkb, sizeof(wkb), Envelope(x, y, x, y), attributes);
+}
+
+void FeatureBuffer::setAttribute(int feature, int field, const QVariant &value)
+{
+    if (field < 0 || field >= m_fields.size()) return;
+    m_attributes[feature * m_fields.size() + field] = value;
+}
+
+const unsigned char *FeatureBuffer::wkb(int feature) const
+{
+    return m_wkb.data() + m_offsets.at(feature);
+}
+
+int FeatureBuffer::wkbSize(int feature) const
+{
+    return m_sizes.at(feature);
+}
+
+const QVariant *FeatureBuffer::attributes(int feature) const
+{
+    if (m_fields.isEmpty()) return nullptr;
+    return m_attributes.constData() + static_cast<qint64>(feature) * m_fields.size();
+}
+
+QVariant FeatureBuffer::attribute(int feature, int field) const
+{
+    if (field < 0 || field >= m_fields.size()) return QVariant();
+    return m_attributes.at(feature * m_fields.size() + field);
+}
+
+OGRGeometry *FeatureBuffer::createGeometry(int feature) const
+{
+    OGRGeometry *geometry = nullptr;
+    OGRGeometryFactory::createFromWkb(wkb(feature), nullptr, &geometry,
+                                      static_cast<size_t>(wkbSize(feature)));
+    return geometry;
+}
+
+static QVariant fieldValue(OGRFeature *feature, int index, OGRFieldType type)
+{
+    if (!feature->IsFieldSetAndNotNull(index)) {
+        return QVariant();
+    }
+
+    switch (type) {
+    case OFTInteger:
+        return feature->GetFieldAsInteger(index);
+    case OFTInteger64:
+        return static_cast<qlonglong>(feature->GetFieldAsInteger64(index));
+    case OFTReal:
+        return feature->GetFieldAsDouble(index);
+    default:
+        return QString::fromUtf8(feature->GetFieldAsString(index));
+    }
+}
+
+bool FeatureBuffer::readFromFile(const QString &filePath, int layerIndex,
+                                 FeatureBuffer *buffer, QString *errorMessage)
+{
+    if (!buffer) return false;
+
+    GDALDataset *dataset = (GDALDataset*)GDALOpenEx(
+                filePath.toUtf8().constData(),
+                GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                nullptr, nullptr, nullptr);
+
+    if (!dataset) {
+        if (errorMessage) {
+            *errorMessage = QString("Could not open vector file %1: %2")
+                    .arg(filePath)
+                    .arg(CPLGetLastErrorMsg());
+        }
+        return false;
+    }
+
+    OGRLayer *layer = dataset->GetLayer(layerIndex);
+    if (!layer) {
+        if (errorMessage) {
+            *errorMessage = QString("Layer %1 not found in %2").arg(layerIndex).arg(filePath);
+        }
+        GDALClose(dataset);
+        return false;
+    }
+
+    buffer->clear();
+    // Z and M kept, as they are in the WKB
+    buffer->setGeometryType(layer->GetGeomType());
+
+    OGRSpatialReference *srs = layer->GetSpatialRef();
+    if (srs) {
+        char *wkt = nullptr;
+        if (srs->exportToWkt(&wkt) == OGRERR_NONE && wkt) {
+            buffer->setSpatialReferenceWkt(QString::fromUtf8(wkt));
+        }
+        CPLFree(wkt);
+    }
+
+    QVector<Field> fields;
+    OGRFeatureDefn *definition = layer->GetLayerDefn();
+    for (int f = 0; f < definition->GetFieldCount(); ++f) {
+        OGRFieldDefn *fieldDefn = definition->GetFieldDefn(f);
+        Field field;
+        field.name = QString::fromUtf8(fieldDefn->GetNameRef());
+        field.type = fieldDefn->GetType();
+        fields.append(field);
+    }
+    buffer->setFields(fields);
+
+    GIntBig featureCount = layer->GetFeatureCount(FALSE);
+    if (featureCount > 0) {
+        buffer->reserve(static_cast<int>(featureCount), featureCount * 64);
+    }
+
+    QVector<unsigned char> wkb;
+    QVector<QVariant> attributes(fields.size());
+
+    layer->ResetReading();
+    OGRFeature *feature;
+    while ((feature = layer->GetNextFeature()) != nullptr) {
+        OGRGeometry *geometry = feature->GetGeometryRef();
+        if (geometry && !geometry->IsEmpty()) {
+            int size = static_cast<int>(geometry->WkbSize());
+            wkb.resize(size);
+            geometry->exportToWkb(wkbNDR, wkb.data());
+
+            OGREnvelope ogrEnvelope;
+            geometry->getEnvelope(&ogrEnvelope);
+
+            for (int f = 0; f < fields.size(); ++f) {
+                attributes[f] = fieldValue(feature, f, fields[f].type);
+            }
+
+            buffer->append(wkb.constData(), size,
+                           Envelope(ogrEnvelope.MinX, ogrEnvelope.MinY,
+                                    ogrEnvelope.MaxX, ogrEnvelope.MaxY),
+                           attributes.constData());
+        }
+        OGRFeature::DestroyFeature(feature);
+    }
+
+    GDALClose(dataset);
+    return true;
+}
+
+bool FeatureBuffer::writeToFile(const QString &filePath, const QString &layerName,
+                                QString *errorMessage) const
+{
+    QString suffix = QFileInfo(filePath).suffix().toLower();
+    const char *driverName = (suffix == "shp") ? "ESRI Shapefile" :
+                             (suffix == "geojson" || suffix == "json") ? "GeoJSON" : "GPKG";
+
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName(driverName);
+    if (!driver) {
+        if (errorMessage) {
+            *errorMessage = QString("GDAL driver not available: %1").arg(driverName);
+        }
+        return false;
+    }
+
+    GDALDataset *dataset = driver->Create(filePath.toUtf8().constData(),
+                                          0, 0, 0, GDT_Unknown, nullptr);
+    if (!dataset) {
+        if (errorMessage) {
+            *errorMessage = QString("Could not create %1: %2")
+                    .arg(filePath)
+                    .arg(CPLGetLastErrorMsg());
+        }
+        return false;
+    }
+
+    OGRSpatialReference *srs = nullptr;
+    if (!m_srsWkt.isEmpty()) {
+        srs = new OGRSpatialReference();
+        srs->SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        if (srs->importFromWkt(m_srsWkt.toUtf8().constData()) != OGRERR_NONE) {
+            srs->Release();
+            srs = nullptr;
+        }
+    }
+
+    // Algorithms may emit multi-part results, so declare the collection type
+    OGRwkbGeometryType layerType = m_geometryType;
+    if (wkbFlatten(layerType) == wkbPolygon || wkbFlatten(layerType) == wkbLineString) {
+        layerType = OGR_GT_GetCollection(layerType);
+    }
+
+    OGRLayer *layer = dataset->CreateLayer(layerName.toUtf8().constData(),
+                                           srs, layerType, nullptr);
+    if (srs) {
+        srs->Release();
+    }
+
+    if (!layer) {
+        if (errorMessage) {
+            *errorMessage = QString("Could not create layer %1: %2")
+                    .arg(layerName)
+                    .arg(CPLGetLastErrorMsg());
+        }
+        GDALClose(dataset);
+        return false;
+    }
+
+    for (const Field &field : m_fields) {
+        OGRFieldDefn fieldDefn(field.name.toUtf8().constData(), field.type);
+        layer->CreateField(&fieldDefn);
+    }
+
+    // One transaction for the whole layer: per-feature commits dominate GPKG writes
+    dataset->StartTransaction();
+
+    bool ok = true;
+    OGRFeatureDefn *definition = layer->GetLayerDefn();
+    for (int i = 0; i < count() && ok; ++i) {
+        OGRFeature *feature = OGRFeature::CreateFeature(definition);
+
+        OGRGeometry *geometry = createGeometry(i);
+        if (geometry) {
+            if (geometry->getGeometryType() != layerType && layerType != wkbUnknown) {
+                geometry = OGRGeometryFactory::forceTo(geometry, layerType);
+            }
+            feature->SetGeometryDirectly(geometry);
+        }
+
+        const QVariant *values = attributes(i);
+        for (int f = 0; values && f < m_fields.size(); ++f) {
+            const QVariant &value = values[f];
+            if (!value.isValid() || value.isNull()) continue;
+
+            switch (m_fields[f].type) {
+            case OFTInteger:
+                feature->SetField(f, value.toInt());
+                break;
+            case OFTInteger64:
+                feature->SetField(f, static_cast<GIntBig>(value.toLongLong()));
+                break;
+            case OFTReal:
+                feature->SetField(f, value.toDouble());
+                break;
+            default:
+                feature->SetField(f, value.toString().toUtf8().constData());
+                break;
+            }
+        }
+
+        if (layer->CreateFeature(feature) != OGRERR_NONE) {
+            ok = false;
+            if (errorMessage) {
+                *errorMessage = QString("Could not write feature %1: %2")
+                        .arg(i)
+                        .arg(CPLGetLastErrorMsg());
+            }
+        }
+        OGRFeature::DestroyFeature(feature);
+    }
+
+    if (ok) {
+        dataset->CommitTransaction();
+    } else {
+        dataset->RollbackTransaction();
+    }
+
+    GDALClose(dataset);
+    return ok;
+}
@@ -0,0 +1,126 @@
+#ifndef FEATUREBUFFER_H
+#define FEATUREBUFFER_H
+
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+#include <vector>
+
+#include "ogrsf_frmts.h"
+
+// Axis-aligned bounding box in layer units
+struct Envelope
+{
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+
+    Envelope() : minX(1.0), minY(1.0), maxX(-1.0), maxY(-1.0) {}
+    Envelope(double x0, double y0, double x1, double y1)
+        : minX(x0), minY(y0), maxX(x1), maxY(y1) {}
+
+    bool isNull() const { return maxX < minX || maxY < minY; }
+    double width() const { return maxX - minX; }
+    double height() const { return maxY - minY; }
+    double centerX() const { return (minX + maxX) * 0.5; }
+    double centerY() const { return (minY + maxY) * 0.5; }
+
+    bool intersects(const Envelope &other) const
+    {
+        return minX <= other.maxX && other.minX <= maxX &&
+               minY <= other.maxY && other.minY <= maxY;
+    }
+
+    bool contains(double x, double y) const
+    {
+        return x >= minX && x <= maxX && y >= minY && y <= maxY;
+    }
+
+    void expand(const Envelope &other)
+    {
+        if (other.isNull()) return;
+        if (isNull()) {
+            *this = other;
+            return;
+        }
+        minX = qMin(minX, other.minX);
+        minY = qMin(minY, other.minY);
+        maxX = qMax(maxX, other.maxX);
+        maxY = qMax(maxY, other.maxY);
+    }
+};
+
+// Flat, append-only feature storage used by the processing algorithms.
+// Geometries are kept back to back as little-endian WKB so every worker can
+// decode them in its own GEOS/OGR context without sharing geometry objects
+// between threads. Attributes are stored row-major, one QVariant per field.
+class FeatureBuffer
+{
+public:
+    struct Field {
+        QString name;
+        OGRFieldType type;
+    };
+
+    FeatureBuffer();
+
+    // Schema; the geometry type keeps its Z and M flags
+    void setGeometryType(OGRwkbGeometryType type) { m_geometryType = type; }
+    OGRwkbGeometryType geometryType() const { return m_geometryType; }
+    void setSpatialReferenceWkt(const QString &wkt) { m_srsWkt = wkt; }
+    QString spatialReferenceWkt() const { return m_srsWkt; }
+    void setFields(const QVector<Field> &fields) { m_fields = fields; }
+    const QVector<Field> &fields() const { return m_fields; }
+    int fieldCount() const { return m_fields.size(); }
+    void copySchema(const FeatureBuffer &other);
+
+    // Features
+    int count() const { return m_offsets.size(); }
+
+    // Most features a buffer with 'fieldCount' fields holds: Qt 5 containers
+    // stop at 2 GB, which the envelopes or the attribute rows reach first
+    static int maxFeatures(int fieldCount);
+
+    bool isEmpty() const { return m_offsets.isEmpty(); }
+    void reserve(int featureCount, qint64 wkbBytes);
+    void clear();
+
+    void append(const unsigned char *wkb, int wkbSize, const Envelope &envelope,
+                const QVariant *attributes);
+    void append(const FeatureBuffer &other);
+    void appendPoint(double x, double y, const QVariant *attributes);
+
+    void setAttribute(int feature, int field, const QVariant &value);
+
+    const unsigned char *wkb(int feature) const;
+    int wkbSize(int feature) const;
+    const Envelope &envelope(int feature) const { return m_envelopes.at(feature); }
+    const QVector<Envelope> &envelopes() const { return m_envelopes; }
+    const QVariant *attributes(int feature) const;
+    QVariant attribute(int feature, int field) const;
+    Envelope extent() const { return m_extent; }
+
+    // OGR conversion
+    static bool readFromFile(const QString &filePath, int layerIndex,
+                             FeatureBuffer *buffer, QString *errorMessage = nullptr);
+    bool writeToFile(const QString &filePath, const QString &layerName,
+                     QString *errorMessage = nullptr) const;
+    OGRGeometry *createGeometry(int feature) const;
+
+private:
+    OGRwkbGeometryType m_geometryType;
+    QString m_srsWkt;
+    QVector<Field> m_fields;
+
+    // std::vector rather than QByteArray: large outputs exceed the 2 GB QByteArray limit
+    std::vector<unsigned char> m_wkb;
+    QVector<qint64> m_offsets;
+    QVector<int> m_sizes;
+    QVector<Envelope> m_envelopes;
+    QVector<QVariant> m_attributes;
+    Envelope m_extent;
+};
+
+#endif // FEATUREBUFFER_H
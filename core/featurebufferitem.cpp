@@ -0,0 +1,281 @@
+#include "featurebufferitem.h"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <QStyleOptionGraphicsItem>
+
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.h"
+#include "wkbutils.h"
+
+namespace
+{
+    const double PointSize = 6.0;   // pixels
+
+    // Vertices gathered before the paths are drawn and dropped, so a layer
+    // of millions of features never becomes one path (or one PDF object)
+    const int BatchVertices = 64 * 1024;
+
+    double squaredSegmentDistance(double px, double py, double x0, double y0, double x1, double y1)
+    {
+        const double dx = x1 - x0;
+        const double dy = y1 - y0;
+        const double lengthSquared = dx * dx + dy * dy;
+        double t = lengthSquared > 0.0 ? ((px - x0) * dx + (py - y0) * dy) / lengthSquared : 0.0;
+        t = qBound(0.0, t, 1.0);
+        const double ex = x0 + t * dx - px;
+        const double ey = y0 + t * dy - py;
+        return ex * ex + ey * ey;
+    }
+}
+
+FeatureBufferItem::FeatureBufferItem(const QSharedPointer<const FeatureBuffer> &buffer,
+                                     const QColor &color, QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+    , m_buffer(buffer)
+    , m_color(color)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+
+    if (m_buffer) {
+        m_index.build(m_buffer->envelopes());
+
+        const Envelope extent = m_buffer->extent();
+        if (!extent.isNull()) {
+            m_boundingRect = QRectF(QPointF(extent.minX, extent.minY),
+                                    QPointF(extent.maxX, extent.maxY));
+            // Room for point symbols and cosmetic pens at the edges
+            const double margin = qMax(m_boundingRect.width(), m_boundingRect.height()) * 0.01 + 1.0;
+            m_boundingRect.adjust(-margin, -margin, margin, margin);
+        }
+    }
+}
+
+QColor FeatureBufferItem::defaultColor(OGRwkbGeometryType type)
+{
+    switch (wkbFlatten(type)) {
+    case wkbPoint: return QColor(255, 0, 0, 200);
+    case wkbLineString: return QColor(0, 0, 255, 200);
+    case wkbPolygon: return QColor(0, 255, 0, 150);
+    case wkbMultiPoint: return QColor(255, 165, 0, 200);
+    case wkbMultiLineString: return QColor(75, 0, 130, 200);
+    case wkbMultiPolygon: return QColor(238, 130, 238, 150);
+    default: return QColor(128, 128, 128, 200);
+    }
+}
+
+QString FeatureBufferItem::geometryTypeLabel(OGRwkbGeometryType type)
+{
+    switch (wkbFlatten(type)) {
+    case wkbPoint: return "Point";
+    case wkbLineString: return "Line";
+    case wkbPolygon: return "Polygon";
+    case wkbMultiPoint: return "MultiPoint";
+    case wkbMultiLineString: return "MultiLine";
+    case wkbMultiPolygon: return "MultiPolygon";
+    default: return "Unknown";
+    }
+}
+
+void FeatureBufferItem::setColor(const QColor &color)
+{
+    m_color = color;
+    update();
+}
+
+QRectF FeatureBufferItem::boundingRect() const
+{
+    return m_boundingRect;
+}
+
+void FeatureBufferItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                              QWidget *widget)
+{
+    Q_UNUSED(widget)
+
+    if (!m_buffer || m_buffer->isEmpty()) return;
+
+    const QRectF exposed = option->exposedRect.isValid() ? option->exposedRect : m_boundingRect;
+    const Envelope area(exposed.left(), exposed.top(), exposed.right(), exposed.bottom());
+
+    // Size of one device pixel in map units, used to skip sub-pixel detail
+    const double lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const double pixel = 1.0 / qMax(lod, 1e-12);
+
+    QPen pen(m_color, 1);
+    pen.setCosmetic(true);
+    QColor fillColor = m_color;
+    fillColor.setAlpha(100);
+
+    QPen pointPen(m_color, PointSize, Qt::SolidLine, Qt::RoundCap);
+    pointPen.setCosmetic(true);
+
+    QVector<QPointF> dots;
+    QPainterPath lines;
+    int vertices = 0;
+
+    // Reading the features and drawing them interleave; the drawing is
+    // timed apart and taken out of the total
+    const bool profiling = Profiler::isEnabled();
+    const qint64 start = profiling ? Profiler::instance().now() : 0;
+    qint64 drawing = 0;
+
+    // Polygons are filled one feature at a time: even-odd over the rings of
+    // one feature makes its holes, but across features it would cut holes
+    // wherever two of them overlap
+    QPainterPath polygon;
+    polygon.setFillRule(Qt::OddEvenFill);
+    auto drawPolygon = [&]() {
+        const qint64 drawStart = profiling ? Profiler::instance().now() : 0;
+        painter->setPen(pen);
+        painter->setBrush(fillColor);
+        painter->drawPath(polygon);
+        polygon = QPainterPath();
+        polygon.setFillRule(Qt::OddEvenFill);
+        if (profiling) drawing += Profiler::instance().now() - drawStart;
+    };
+
+    auto flush = [&]() {
+        const qint64 flushStart = profiling ? Profiler::instance().now() : 0;
+        if (!lines.isEmpty()) {
+            QPen linePen(pen);
+            linePen.setWidthF(2.0);
+            painter->setPen(linePen);
+            painter->setBrush(Qt::NoBrush);
+            painter->drawPath(lines);
+            lines = QPainterPath();
+        }
+        if (!dots.isEmpty()) {
+            painter->setPen(pointPen);
+            painter->drawPoints(dots.constData(), dots.size());
+            dots.clear();
+        }
+        vertices = 0;
+        if (profiling) drawing += Profiler::instance().now() - flushStart;
+    };
+
+    // In index order, so later features are drawn on top as featureAt()
+    // assumes; the tree hands them out in its own order
+    QVector<int> features = m_index.query(area);
+    std::sort(features.begin(), features.end());
+
+    for (int feature : features) {
+        if (vertices >= BatchVertices) {
+            flush();
+        }
+
+        const Envelope &envelope = m_buffer->envelope(feature);
+        if (envelope.width() < pixel && envelope.height() < pixel) {
+            dots.append(QPointF(envelope.centerX(), envelope.centerY()));
+            ++vertices;
+            continue;
+        }
+
+        visitWkbParts(m_buffer->wkb(feature), m_buffer->wkbSize(feature), [&](const WkbPart &part) {
+            vertices += part.pointCount;
+            if (part.dimension == 0) {
+                for (int i = 0; i < part.pointCount; ++i) {
+                    dots.append(QPointF(part.xy[2 * i], part.xy[2 * i + 1]));
+                }
+                return;
+            }
+            if (part.pointCount < 2) return;
+
+            QPainterPath &path = (part.dimension == 2) ? polygon : lines;
+            double lastX = part.xy[0];
+            double lastY = part.xy[1];
+            path.moveTo(lastX, lastY);
+
+            // Drop vertices within a pixel of the last one drawn, keep the end point
+            const int last = part.pointCount - 1;
+            for (int i = 1; i <= last; ++i) {
+                const double x = part.xy[2 * i];
+                const double y = part.xy[2 * i + 1];
+                if (i < last && std::fabs(x - lastX) < pixel && std::fabs(y - lastY) < pixel) {
+                    continue;
+                }
+                path.lineTo(x, y);
+                lastX = x;
+                lastY = y;
+            }
+            if (part.dimension == 2) {
+                path.closeSubpath();
+            }
+        });
+        if (!polygon.isEmpty()) {
+            // Lines batched so far (mixed layers) are under it; sub-pixel
+            // dots stay batched and end up on top, too small to matter
+            if (!lines.isEmpty()) {
+                flush();
+            }
+            drawPolygon();
+        }
+    }
+    flush();
+
+    if (profiling) {
+        Profiler &profiler = Profiler::instance();
+        const qint64 total = profiler.now() - start;
+        const QString layer = data(Profiler::LayerNameKey).toString();
+        profiler.record(Profiler::Fetch, "decode features", start, total - drawing, layer);
+        profiler.record(Profiler::Rasterise, "draw features", start + total - drawing, drawing, layer);
+    }
+}
+
+int FeatureBufferItem::featureAt(const QPointF &scenePos, double tolerance) const
+{
+    if (!m_buffer) return -1;
+
+    const QPointF mapPos = mapFromScene(scenePos);
+    const double x = mapPos.x();
+    const double y = mapPos.y();
+    const QRectF toleranceRect = mapRectFromScene(QRectF(0, 0, tolerance, tolerance));
+    const double mapTolerance = qMax(toleranceRect.width(), toleranceRect.height());
+    const Envelope area(x - mapTolerance, y - mapTolerance, x + mapTolerance, y + mapTolerance);
+
+    // paint() draws in index order, so the highest index is the one on top
+    int hit = -1;
+    m_index.visit(area, [&](int feature) -> bool {
+        if (feature > hit && hitTest(feature, x, y, mapTolerance)) {
+            hit = feature;
+        }
+        return true;
+    });
+    return hit;
+}
+
+bool FeatureBufferItem::hitTest(int feature, double x, double y, double tolerance) const
+{
+    const double toleranceSquared = tolerance * tolerance;
+    bool nearEdge = false;
+    bool inside = false;
+
+    visitWkbParts(m_buffer->wkb(feature), m_buffer->wkbSize(feature), [&](const WkbPart &part) {
+        const double *xy = part.xy;
+        if (part.dimension == 0) {
+            for (int i = 0; i < part.pointCount; ++i) {
+                const double dx = xy[2 * i] - x;
+                const double dy = xy[2 * i + 1] - y;
+                if (dx * dx + dy * dy <= toleranceSquared) nearEdge = true;
+            }
+            return;
+        }
+
+        for (int i = 1; i < part.pointCount; ++i) {
+            const double x0 = xy[2 * i - 2], y0 = xy[2 * i - 1];
+            const double x1 = xy[2 * i], y1 = xy[2 * i + 1];
+            if (squaredSegmentDistance(x, y, x0, y0, x1, y1) <= toleranceSquared) {
+                nearEdge = true;
+            }
+            // Even-odd crossing count over every ring of the feature
+            if (part.dimension == 2 && ((y0 > y) != (y1 > y)) &&
+                x < x0 + (y - y0) * (x1 - x0) / (y1 - y0)) {
+                inside = !inside;
+            }
+        }
+    });
+
+    return nearEdge || inside;
+}
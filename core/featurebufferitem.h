@@ -0,0 +1,48 @@
+#ifndef FEATUREBUFFERITEM_H
+#define FEATUREBUFFERITEM_H
+
+#include <QColor>
+#include <QGraphicsItem>
+#include <QSharedPointer>
+
+#include "featurebuffer.h"
+#include "spatialindex.h"
+
+// Draws a FeatureBuffer straight from its WKB, without creating a scene item
+// per feature. Only features intersecting the exposed area are decoded, and
+// features smaller than a pixel are drawn as a single dot. Item coordinates
+// are map units; place the item with MapSettings::mapToSceneTransform().
+class FeatureBufferItem : public QGraphicsItem
+{
+public:
+    FeatureBufferItem(const QSharedPointer<const FeatureBuffer> &buffer, const QColor &color,
+                      QGraphicsItem *parent = nullptr);
+
+    QSharedPointer<const FeatureBuffer> buffer() const { return m_buffer; }
+
+    QColor color() const { return m_color; }
+    void setColor(const QColor &color);
+
+    // Colour of a layer without a style of its own, by geometry type
+    static QColor defaultColor(OGRwkbGeometryType type);
+
+    // Geometry type as the layer tree and properties show it
+    static QString geometryTypeLabel(OGRwkbGeometryType type);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget = nullptr) override;
+
+    // Topmost feature under 'scenePos', or -1. 'tolerance' is in scene units.
+    int featureAt(const QPointF &scenePos, double tolerance) const;
+
+private:
+    bool hitTest(int feature, double x, double y, double tolerance) const;
+
+    QSharedPointer<const FeatureBuffer> m_buffer;
+    SpatialIndex m_index;
+    QColor m_color;
+    QRectF m_boundingRect;
+};
+
+#endif // FEATUREBUFFERITEM_H
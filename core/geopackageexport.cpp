@@ -0,0 +1,233 @@
+#include "geopackageexport.h"
+
+#include <QFile>
+#include <QSet>
+
+#include <gdal_priv.h>
+#include <ogrsf_frmts.h>
+
+namespace
+{
+    // Features between progress reports (and cancel checks)
+    const int ProgressInterval = 4096;
+
+    // Plain ASCII identifier, unique within the file (case-insensitively,
+    // like SQLite)
+    QString tableName(const QString &layerName, QSet<QString> *used)
+    {
+        QString base;
+        for (const QChar c : layerName) {
+            base += (c.unicode() < 128 && c.isLetterOrNumber()) ? c : QChar('_');
+        }
+        if (base.isEmpty() || base[0].isDigit()) base.prepend("layer_");
+
+        QString table = base;
+        for (int n = 2; used->contains(table.toLower()); ++n) {
+            table = QString("%1_%2").arg(base).arg(n);
+        }
+        used->insert(table.toLower());
+        return table;
+    }
+
+    struct ProgressData
+    {
+        const GeoPackageExport::Progress *progress;
+        int layer;
+    };
+
+    int CPL_STDCALL gdalProgress(double complete, const char *, void *data)
+    {
+        const ProgressData *progressData = static_cast<const ProgressData*>(data);
+        const GeoPackageExport::Progress &progress = *progressData->progress;
+        return !progress || progress(progressData->layer, complete) ? TRUE : FALSE;
+    }
+
+    // Copies one vector layer into 'dataset', inside the caller's transaction
+    bool copyVectorLayer(GDALDataset *dataset, GeoPackageExport::Layer &layer, int index,
+                         const GeoPackageExport::Progress &progress, bool *canceled)
+    {
+        GDALDataset *source = static_cast<GDALDataset*>(
+                    GDALOpenEx(layer.source.toUtf8().constData(), GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                               nullptr, nullptr, nullptr));
+        OGRLayer *sourceLayer = source ? source->GetLayer(layer.layerIndex) : nullptr;
+        if (!sourceLayer) {
+            layer.errorMessage = QString("Cannot open %1").arg(layer.source);
+            if (source) GDALClose(source);
+            return false;
+        }
+
+        // The index is built in one go once the features are in, rather
+        // than grown by triggers one insert at a time
+        char **options = CSLSetNameValue(nullptr, "SPATIAL_INDEX", "NO");
+        OGRLayer *target = dataset->CreateLayer(layer.table.toUtf8().constData(), sourceLayer->GetSpatialRef(),
+                                                sourceLayer->GetGeomType(), options);
+        CSLDestroy(options);
+        if (!target) {
+            layer.errorMessage = QString("Cannot create table %1: %2").arg(layer.table, CPLGetLastErrorMsg());
+            GDALClose(source);
+            return false;
+        }
+        layer.tableIndex = dataset->GetLayerCount() - 1;
+
+        OGRFeatureDefn *sourceDefinition = sourceLayer->GetLayerDefn();
+        for (int f = 0; f < sourceDefinition->GetFieldCount(); ++f) {
+            target->CreateField(sourceDefinition->GetFieldDefn(f));
+        }
+
+        const GIntBig total = sourceLayer->GetFeatureCount(FALSE);
+        OGRFeatureDefn *targetDefinition = target->GetLayerDefn();
+        GIntBig done = 0;
+        bool ok = true;
+
+        sourceLayer->ResetReading();
+        OGRFeature *feature = nullptr;
+        while (ok && (feature = sourceLayer->GetNextFeature()) != nullptr) {
+            OGRFeature *copy = OGRFeature::CreateFeature(targetDefinition);
+            copy->SetFrom(feature, TRUE);
+            if (target->CreateFeature(copy) != OGRERR_NONE) {
+                layer.errorMessage = QString("Cannot write feature %1: %2").arg(done).arg(CPLGetLastErrorMsg());
+                ok = false;
+            }
+            OGRFeature::DestroyFeature(copy);
+            OGRFeature::DestroyFeature(feature);
+
+            if (++done % ProgressInterval == 0 && progress &&
+                !progress(index, total > 0 ? double(done) / total : 0.0)) {
+                *canceled = true;
+                ok = false;
+            }
+        }
+        GDALClose(source);
+
+        const QString geometryColumn = QString::fromUtf8(target->GetGeometryColumn());
+        if (ok && !geometryColumn.isEmpty()) {
+            const QString sql = QString("SELECT CreateSpatialIndex('%1', '%2')").arg(layer.table, geometryColumn);
+            OGRLayer *result = dataset->ExecuteSQL(sql.toUtf8().constData(), nullptr, nullptr);
+            if (result) dataset->ReleaseResultSet(result);
+        }
+        if (ok && progress) progress(index, 1.0);
+        return ok;
+    }
+}
+
+bool GeoPackageExport::canStore(const QString &layerType, bool hasGeoTransform)
+{
+    if (layerType == "vector" || layerType == "memory") return true;
+    return hasGeoTransform && (layerType == "geotiff" || layerType == "georeferenced" ||
+                               layerType == "raster" || layerType == "terrain");
+}
+
+QString GeoPackageExport::rasterDatasetName(const QString &path, const QString &table)
+{
+    return QString("GPKG:%1:%2").arg(path, table);
+}
+
+bool GeoPackageExport::write(const QString &path, QVector<Layer> *layers, const Progress &progress,
+                             QString *errorMessage)
+{
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GPKG");
+    if (!driver) {
+        if (errorMessage) *errorMessage = "GDAL driver not available: GPKG";
+        return false;
+    }
+
+    QFile::remove(path);
+    QFile::remove(path + "-wal");
+    QFile::remove(path + "-shm");
+
+    QSet<QString> used;
+    for (Layer &layer : *layers) {
+        layer.table = tableName(layer.name, &used);
+        layer.written = false;
+        layer.errorMessage.clear();
+    }
+
+    // Rasters first: each CreateCopy() opens the file on its own, which it
+    // could not while the vector transaction holds it
+    bool created = false;
+    for (int i = 0; i < layers->size(); ++i) {
+        Layer &layer = (*layers)[i];
+        if (!layer.raster) continue;
+
+        GDALDataset *source = static_cast<GDALDataset*>(GDALOpen(layer.source.toUtf8().constData(), GA_ReadOnly));
+        if (!source) {
+            layer.errorMessage = QString("Cannot open %1").arg(layer.source);
+            continue;
+        }
+
+        char **options = nullptr;
+        options = CSLSetNameValue(options, "RASTER_TABLE", layer.table.toUtf8().constData());
+        options = CSLSetNameValue(options, "TILE_FORMAT", "AUTO");
+        if (created) {
+            options = CSLSetNameValue(options, "APPEND_SUBDATASET", "YES");
+        }
+        ProgressData progressData = { &progress, i };
+        GDALDataset *target = driver->CreateCopy(path.toUtf8().constData(), source, FALSE, options,
+                                                 gdalProgress, &progressData);
+        CSLDestroy(options);
+        GDALClose(source);
+
+        if (!target) {
+            if (progress && !progress(i, 0.0)) {
+                if (errorMessage) *errorMessage = "Canceled";
+                return false;
+            }
+            layer.errorMessage = QString("Cannot write tiles: %1").arg(CPLGetLastErrorMsg());
+            continue;
+        }
+        GDALClose(target);
+        layer.written = true;
+        created = true;
+    }
+
+    bool hasVectors = false;
+    for (const Layer &layer : *layers) {
+        if (!layer.raster) hasVectors = true;
+    }
+    if (!hasVectors) {
+        if (!created && errorMessage) *errorMessage = "No layer could be written";
+        return created;
+    }
+
+    GDALDataset *dataset = created
+            ? static_cast<GDALDataset*>(GDALOpenEx(path.toUtf8().constData(),
+                                                   GDAL_OF_VECTOR | GDAL_OF_RASTER | GDAL_OF_UPDATE,
+                                                   nullptr, nullptr, nullptr))
+            : driver->Create(path.toUtf8().constData(), 0, 0, 0, GDT_Unknown, nullptr);
+    if (!dataset) {
+        if (errorMessage) *errorMessage = QString("Cannot create %1: %2").arg(path, CPLGetLastErrorMsg());
+        return false;
+    }
+
+    // All feature tables in one transaction: per-statement commits are what
+    // makes SQLite slow
+    dataset->StartTransaction();
+    bool canceled = false;
+    for (int i = 0; i < layers->size() && !canceled; ++i) {
+        Layer &layer = (*layers)[i];
+        if (layer.raster) continue;
+
+        if (copyVectorLayer(dataset, layer, i, progress, &canceled)) {
+            layer.written = true;
+        } else if (layer.tableIndex >= 0 && !canceled) {
+            // Drop what was written of it; it is the last table, so the
+            // indices handed out before stay valid
+            dataset->DeleteLayer(layer.tableIndex);
+            layer.tableIndex = -1;
+        }
+    }
+
+    if (canceled) {
+        dataset->RollbackTransaction();
+        GDALClose(dataset);
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+    const bool committed = dataset->CommitTransaction() == OGRERR_NONE;
+    GDALClose(dataset);
+    if (!committed) {
+        if (errorMessage) *errorMessage = QString("Cannot commit %1: %2").arg(path, CPLGetLastErrorMsg());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef GEOPACKAGEEXPORT_H
+#define GEOPACKAGEEXPORT_H
+
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+// Writes project layers into one GeoPackage. Georeferenced rasters become
+// tile tables, one after the other; vector layers are then copied into
+// feature tables in a single transaction, each getting its R-tree spatial
+// index built in bulk once its features are in.
+namespace GeoPackageExport
+{
+    struct Layer
+    {
+        QString name;
+        QString source;         // GDAL dataset name
+        bool raster = false;
+        int layerIndex = 0;     // vector layer within the source
+
+        // Filled in by write()
+        QString table;
+        int tableIndex = -1;    // vector layer index in the GeoPackage
+        bool written = false;
+        QString errorMessage;
+    };
+
+    // Called with the layer being written and its fraction done; returning
+    // false cancels
+    typedef std::function<bool(int layer, double fraction)> Progress;
+
+    // Layers that can go into a GeoPackage: vectors, and rasters with a
+    // geotransform
+    bool canStore(const QString &layerType, bool hasGeoTransform);
+
+    // Dataset name GDAL opens a raster table of 'path' under
+    QString rasterDatasetName(const QString &path, const QString &table);
+
+    // Creates 'path' (replacing it). False only if the file itself could
+    // not be written; layers that failed say so in their entry.
+    bool write(const QString &path, QVector<Layer> *layers, const Progress &progress = Progress(),
+               QString *errorMessage = nullptr);
+}
+
+#endif // GEOPACKAGEEXPORT_H
@@ -0,0 +1,460 @@
+#include "geoprocessing.h"
+
+#include <QHash>
+#include <QSet>
+
+#include "reprojection.h"
+#include "spatialindex.h"
+
+// ProcessingFeedback
+
+void ProcessingFeedback::setProgress(double percent)
+{
+    const int value = qBound(0, static_cast<int>(percent * 10.0), 1000);
+    if (m_progress.fetchAndStoreRelaxed(value) != value) {
+        progressChanged(value / 10.0);
+    }
+}
+
+// GeosThreadContext
+
+GeosThreadContext::GeosThreadContext()
+    : m_handle(GEOS_init_r())
+{
+    GEOSContext_setErrorMessageHandler_r(m_handle, &GeosThreadContext::errorHandler, this);
+
+    m_reader = GEOSWKBReader_create_r(m_handle);
+    m_writer = GEOSWKBWriter_create_r(m_handle);
+    GEOSWKBWriter_setByteOrder_r(m_handle, m_writer, GEOS_WKB_NDR);
+}
+
+GeosThreadContext::~GeosThreadContext()
+{
+    GEOSWKBReader_destroy_r(m_handle, m_reader);
+    GEOSWKBWriter_destroy_r(m_handle, m_writer);
+    GEOS_finish_r(m_handle);
+}
+
+GeosThreadContext &GeosThreadContext::local()
+{
+    thread_local GeosThreadContext context;
+    return context;
+}
+
+void GeosThreadContext::errorHandler(const char *message, void *userData)
+{
+    static_cast<GeosThreadContext*>(userData)->m_lastError = QString::fromUtf8(message);
+}
+
+GEOSGeometry *GeosThreadContext::read(const unsigned char *wkb, int size) const
+{
+    return GEOSWKBReader_read_r(m_handle, m_reader, wkb, static_cast<size_t>(size));
+}
+
+GEOSGeometry *GeosThreadContext::read(const FeatureBuffer &buffer, int feature) const
+{
+    return read(buffer.wkb(feature), buffer.wkbSize(feature));
+}
+
+unsigned char *GeosThreadContext::write(const GEOSGeometry *geometry, size_t *size) const
+{
+    return GEOSWKBWriter_write_r(m_handle, m_writer, geometry, size);
+}
+
+bool GeosThreadContext::append(const GEOSGeometry *geometry, const QVariant *attributes,
+                               FeatureBuffer *output) const
+{
+    if (!geometry || GEOSisEmpty_r(m_handle, geometry)) return false;
+
+    size_t size = 0;
+    unsigned char *wkb = write(geometry, &size);
+    if (!wkb) return false;
+
+    Envelope envelope;
+    GEOSGeom_getXMin_r(m_handle, geometry, &envelope.minX);
+    GEOSGeom_getYMin_r(m_handle, geometry, &envelope.minY);
+    GEOSGeom_getXMax_r(m_handle, geometry, &envelope.maxX);
+    GEOSGeom_getYMax_r(m_handle, geometry, &envelope.maxY);
+
+    output->append(wkb, static_cast<int>(size), envelope, attributes);
+    GEOSFree_r(m_handle, wkb);
+    return true;
+}
+
+int defaultChunkSize(int count)
+{
+    const int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    return qBound(16, count / (threads * 8), 4096);
+}
+
+// Helpers
+
+namespace
+{
+
+// Overlay geometries decoded and prepared on demand by one worker. Lives for a
+// single chunk so nothing GEOS-owned crosses threads.
+class OverlayCache
+{
+public:
+    OverlayCache(const GeosThreadContext &context, const FeatureBuffer &overlay)
+        : m_context(context), m_overlay(overlay) {}
+
+    ~OverlayCache()
+    {
+        GEOSContextHandle_t handle = m_context.handle();
+        for (const Entry &entry : m_entries) {
+            if (entry.prepared) GEOSPreparedGeom_destroy_r(handle, entry.prepared);
+            if (entry.geometry) GEOSGeom_destroy_r(handle, entry.geometry);
+        }
+    }
+
+    const GEOSGeometry *geometry(int id) { return entry(id).geometry; }
+    const GEOSPreparedGeometry *prepared(int id) { return entry(id).prepared; }
+
+private:
+    struct Entry {
+        GEOSGeometry *geometry;
+        const GEOSPreparedGeometry *prepared;
+    };
+
+    const Entry &entry(int id)
+    {
+        auto it = m_entries.find(id);
+        if (it == m_entries.end()) {
+            Entry entry;
+            entry.geometry = m_context.read(m_overlay, id);
+            entry.prepared = entry.geometry ? GEOSPrepare_r(m_context.handle(), entry.geometry) : nullptr;
+            it = m_entries.insert(id, entry);
+        }
+        return it.value();
+    }
+
+    const GeosThreadContext &m_context;
+    const FeatureBuffer &m_overlay;
+    QHash<int, Entry> m_entries;
+};
+
+void collectParts(GEOSContextHandle_t handle, const GEOSGeometry *geometry, int dimension,
+                  QVector<GEOSGeometry*> *parts)
+{
+    const int type = GEOSGeomTypeId_r(handle, geometry);
+    if (type >= GEOS_MULTIPOINT) {
+        const int count = GEOSGetNumGeometries_r(handle, geometry);
+        for (int i = 0; i < count; ++i) {
+            collectParts(handle, GEOSGetGeometryN_r(handle, geometry, i), dimension, parts);
+        }
+    } else if (GEOSGeom_getDimensions_r(handle, geometry) == dimension &&
+               !GEOSisEmpty_r(handle, geometry)) {
+        parts->append(GEOSGeom_clone_r(handle, geometry));
+    }
+}
+
+// Overlay results can degrade to lower dimensions (a polygon touching a clip
+// edge yields a line). Keeps only the parts matching 'dimension'; takes
+// ownership of 'geometry' and returns nullptr when nothing is left.
+GEOSGeometry *filterDimension(GEOSContextHandle_t handle, GEOSGeometry *geometry, int dimension)
+{
+    if (!geometry) return nullptr;
+
+    const int type = GEOSGeomTypeId_r(handle, geometry);
+    if (type != GEOS_GEOMETRYCOLLECTION) {
+        if (GEOSGeom_getDimensions_r(handle, geometry) == dimension &&
+            !GEOSisEmpty_r(handle, geometry)) {
+            return geometry;
+        }
+        GEOSGeom_destroy_r(handle, geometry);
+        return nullptr;
+    }
+
+    QVector<GEOSGeometry*> parts;
+    collectParts(handle, geometry, dimension, &parts);
+    GEOSGeom_destroy_r(handle, geometry);
+
+    if (parts.isEmpty()) return nullptr;
+    if (parts.size() == 1) return parts.first();
+
+    const int multiType = dimension == 0 ? GEOS_MULTIPOINT :
+                          dimension == 1 ? GEOS_MULTILINESTRING : GEOS_MULTIPOLYGON;
+    return GEOSGeom_createCollection_r(handle, multiType, parts.data(),
+                                       static_cast<unsigned int>(parts.size()));
+}
+
+bool checkInputs(const FeatureBuffer &input, FeatureBuffer *output, QString *errorMessage)
+{
+    if (!output) {
+        if (errorMessage) *errorMessage = "No output buffer given";
+        return false;
+    }
+    if (input.isEmpty()) {
+        if (errorMessage) *errorMessage = "Input layer has no features";
+        return false;
+    }
+    return true;
+}
+
+// 'overlay' in the CRS of 'input': as it is, or reprojected into
+// 'reprojected'. A layer without a CRS is taken to be in the other's.
+// Null, with 'errorMessage' set, when it cannot be reprojected.
+const FeatureBuffer *overlayInInputCrs(const FeatureBuffer &input, const FeatureBuffer &overlay,
+                                       FeatureBuffer *reprojected, QString *errorMessage)
+{
+    const QString inputWkt = input.spatialReferenceWkt();
+    const QString overlayWkt = overlay.spatialReferenceWkt();
+    if (inputWkt.isEmpty() || overlayWkt.isEmpty() || Reprojection::isSameCrs(inputWkt, overlayWkt)) {
+        return &overlay;
+    }
+
+    QString reprojectError;
+    if (!Reprojection::reproject(overlay, inputWkt, reprojected, nullptr, &reprojectError)) {
+        if (errorMessage) {
+            *errorMessage = "Cannot reproject the overlay layer to the input CRS: " + reprojectError;
+        }
+        return nullptr;
+    }
+    return reprojected;
+}
+
+bool finish(const QVector<FeatureBuffer> &chunkResults, FeatureBuffer *output,
+            ProcessingFeedback *feedback, QString *errorMessage)
+{
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+
+    // Concatenate in chunk order so output order follows input order
+    qint64 bytes = 0;
+    int features = 0;
+    for (const FeatureBuffer &chunk : chunkResults) {
+        features += chunk.count();
+        for (int i = 0; i < chunk.count(); ++i) bytes += chunk.wkbSize(i);
+    }
+    output->reserve(features, bytes);
+    for (const FeatureBuffer &chunk : chunkResults) {
+        output->append(chunk);
+    }
+    return true;
+}
+
+} // namespace
+
+// Algorithms
+
+bool Geoprocessing::buffer(const FeatureBuffer &input, double distance, int segments,
+                           FeatureBuffer *output, ProcessingFeedback *feedback,
+                           QString *errorMessage)
+{
+    if (!checkInputs(input, output, errorMessage)) return false;
+
+    output->clear();
+    output->copySchema(input);
+    output->setGeometryType(wkbPolygon);
+
+    const int chunkSize = defaultChunkSize(input.count());
+    QVector<FeatureBuffer> chunkResults((input.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(input.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        const GeosThreadContext &context = GeosThreadContext::local();
+        GEOSContextHandle_t handle = context.handle();
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        for (int i = begin; i < end; ++i) {
+            GEOSGeometry *geometry = context.read(input, i);
+            if (!geometry) continue;
+
+            GEOSGeometry *buffered = GEOSBuffer_r(handle, geometry, distance, segments);
+            context.append(buffered, input.attributes(i), &result);
+
+            if (buffered) GEOSGeom_destroy_r(handle, buffered);
+            GEOSGeom_destroy_r(handle, geometry);
+        }
+    });
+
+    return finish(chunkResults, output, feedback, errorMessage);
+}
+
+bool Geoprocessing::clip(const FeatureBuffer &input, const FeatureBuffer &overlayLayer,
+                         FeatureBuffer *output, ProcessingFeedback *feedback,
+                         QString *errorMessage)
+{
+    if (!checkInputs(input, output, errorMessage)) return false;
+
+    FeatureBuffer reprojectedOverlay;
+    const FeatureBuffer *matched = overlayInInputCrs(input, overlayLayer, &reprojectedOverlay, errorMessage);
+    if (!matched) return false;
+    const FeatureBuffer &overlay = *matched;
+
+    output->clear();
+    output->copySchema(input);
+    if (overlay.isEmpty() || !overlay.extent().intersects(input.extent())) {
+        return true;
+    }
+
+    SpatialIndex overlayIndex;
+    overlayIndex.build(overlay.envelopes());
+
+    const int chunkSize = defaultChunkSize(input.count());
+    QVector<FeatureBuffer> chunkResults((input.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(input.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        const GeosThreadContext &context = GeosThreadContext::local();
+        GEOSContextHandle_t handle = context.handle();
+        OverlayCache cache(context, overlay);
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        QVector<int> candidates;
+        QVector<GEOSGeometry*> clippers;
+
+        for (int i = begin; i < end; ++i) {
+            candidates.clear();
+            overlayIndex.query(input.envelope(i), &candidates);
+            if (candidates.isEmpty()) continue;
+
+            GEOSGeometry *geometry = context.read(input, i);
+            if (!geometry) continue;
+
+            bool inside = false;
+            clippers.clear();
+            for (int id : candidates) {
+                const GEOSPreparedGeometry *prepared = cache.prepared(id);
+                if (!prepared) continue;
+
+                // Wholly inside one overlay: pass the original WKB through untouched
+                if (GEOSPreparedContainsProperly_r(handle, prepared, geometry) == 1) {
+                    inside = true;
+                    break;
+                }
+                if (GEOSPreparedIntersects_r(handle, prepared, geometry) == 1) {
+                    clippers.append(GEOSGeom_clone_r(handle, cache.geometry(id)));
+                }
+            }
+
+            if (inside) {
+                for (GEOSGeometry *clipper : clippers) GEOSGeom_destroy_r(handle, clipper);
+                result.append(input.wkb(i), input.wkbSize(i), input.envelope(i), input.attributes(i));
+            } else if (!clippers.isEmpty()) {
+                GEOSGeometry *mask = clippers.first();
+                if (clippers.size() > 1) {
+                    GEOSGeometry *collection = GEOSGeom_createCollection_r(
+                                handle, GEOS_GEOMETRYCOLLECTION, clippers.data(),
+                                static_cast<unsigned int>(clippers.size()));
+                    mask = GEOSUnaryUnion_r(handle, collection);
+                    GEOSGeom_destroy_r(handle, collection);
+                }
+
+                if (mask) {
+                    const int dimension = GEOSGeom_getDimensions_r(handle, geometry);
+                    GEOSGeometry *clipped = filterDimension(
+                                handle, GEOSIntersection_r(handle, geometry, mask), dimension);
+                    context.append(clipped, input.attributes(i), &result);
+
+                    if (clipped) GEOSGeom_destroy_r(handle, clipped);
+                    GEOSGeom_destroy_r(handle, mask);
+                }
+            }
+
+            GEOSGeom_destroy_r(handle, geometry);
+        }
+    });
+
+    return finish(chunkResults, output, feedback, errorMessage);
+}
+
+bool Geoprocessing::intersection(const FeatureBuffer &input, const FeatureBuffer &overlayLayer,
+                                 FeatureBuffer *output, ProcessingFeedback *feedback,
+                                 QString *errorMessage)
+{
+    if (!checkInputs(input, output, errorMessage)) return false;
+
+    FeatureBuffer reprojectedOverlay;
+    const FeatureBuffer *matched = overlayInInputCrs(input, overlayLayer, &reprojectedOverlay, errorMessage);
+    if (!matched) return false;
+    const FeatureBuffer &overlay = *matched;
+
+    // Output schema: input fields followed by overlay fields
+    QVector<FeatureBuffer::Field> fields = input.fields();
+    QSet<QString> names;
+    for (const FeatureBuffer::Field &field : fields) {
+        names.insert(field.name.toLower());
+    }
+    for (FeatureBuffer::Field field : overlay.fields()) {
+        if (names.contains(field.name.toLower())) {
+            field.name += "_2";
+        }
+        names.insert(field.name.toLower());
+        fields.append(field);
+    }
+
+    output->clear();
+    output->copySchema(input);
+    output->setFields(fields);
+    if (overlay.isEmpty() || !overlay.extent().intersects(input.extent())) {
+        return true;
+    }
+
+    SpatialIndex overlayIndex;
+    overlayIndex.build(overlay.envelopes());
+
+    const int inputFieldCount = input.fieldCount();
+    const int overlayFieldCount = overlay.fieldCount();
+
+    const int chunkSize = defaultChunkSize(input.count());
+    QVector<FeatureBuffer> chunkResults((input.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(input.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        const GeosThreadContext &context = GeosThreadContext::local();
+        GEOSContextHandle_t handle = context.handle();
+        OverlayCache cache(context, overlay);
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        QVector<int> candidates;
+        QVector<QVariant> values(fields.size());
+
+        for (int i = begin; i < end; ++i) {
+            candidates.clear();
+            overlayIndex.query(input.envelope(i), &candidates);
+            if (candidates.isEmpty()) continue;
+
+            GEOSGeometry *geometry = context.read(input, i);
+            if (!geometry) continue;
+            const int dimension = GEOSGeom_getDimensions_r(handle, geometry);
+
+            const QVariant *inputValues = input.attributes(i);
+            for (int f = 0; f < inputFieldCount; ++f) {
+                values[f] = inputValues[f];
+            }
+
+            for (int id : candidates) {
+                const GEOSPreparedGeometry *prepared = cache.prepared(id);
+                if (!prepared) continue;
+
+                const QVariant *overlayValues = overlay.attributes(id);
+                for (int f = 0; f < overlayFieldCount; ++f) {
+                    values[inputFieldCount + f] = overlayValues[f];
+                }
+
+                if (GEOSPreparedContainsProperly_r(handle, prepared, geometry) == 1) {
+                    result.append(input.wkb(i), input.wkbSize(i), input.envelope(i),
+                                  values.constData());
+                } else if (GEOSPreparedIntersects_r(handle, prepared, geometry) == 1) {
+                    GEOSGeometry *intersected = filterDimension(
+                                handle, GEOSIntersection_r(handle, geometry, cache.geometry(id)),
+                                dimension);
+                    context.append(intersected, values.constData(), &result);
+                    if (intersected) GEOSGeom_destroy_r(handle, intersected);
+                }
+            }
+
+            GEOSGeom_destroy_r(handle, geometry);
+        }
+    });
+
+    return finish(chunkResults, output, feedback, errorMessage);
+}
@@ -0,0 +1,147 @@
+#ifndef GEOPROCESSING_H
+#define GEOPROCESSING_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include <QtConcurrent>
+
+#include <geos_c.h>
+
+#include "featurebuffer.h"
+
+// Progress / cancellation shared between the caller and the worker threads.
+// setProgress() may be called from any thread; subclasses that need to talk to
+// the GUI must forward the value with a queued connection.
+class ProcessingFeedback
+{
+public:
+    ProcessingFeedback() : m_canceled(0), m_progress(0) {}
+    virtual ~ProcessingFeedback() {}
+
+    void cancel() { m_canceled.storeRelease(1); }
+    bool isCanceled() const { return m_canceled.loadAcquire() != 0; }
+
+    // Percentage in [0, 100]
+    void setProgress(double percent);
+    double progress() const { return m_progress.loadAcquire() / 10.0; }
+
+protected:
+    virtual void progressChanged(double percent) { Q_UNUSED(percent) }
+
+private:
+    QAtomicInt m_canceled;
+    QAtomicInt m_progress;   // tenths of a percent
+};
+
+// Per-thread GEOS reentrant context with its own WKB reader/writer.
+// GEOS handles must never be shared between threads, so every worker gets one
+// lazily through local() and it is released when the thread exits.
+class GeosThreadContext
+{
+public:
+    static GeosThreadContext &local();
+
+    GEOSContextHandle_t handle() const { return m_handle; }
+
+    GEOSGeometry *read(const unsigned char *wkb, int size) const;
+    GEOSGeometry *read(const FeatureBuffer &buffer, int feature) const;
+
+    // Little-endian WKB of 'geometry'; release with GEOSFree_r(handle(), ...)
+    unsigned char *write(const GEOSGeometry *geometry, size_t *size) const;
+
+    // Appends 'geometry' (not taken) to 'output' as a new feature
+    bool append(const GEOSGeometry *geometry, const QVariant *attributes, FeatureBuffer *output) const;
+
+    QString lastError() const { return m_lastError; }
+
+    ~GeosThreadContext();
+
+private:
+    GeosThreadContext();
+    Q_DISABLE_COPY(GeosThreadContext)
+
+    static void errorHandler(const char *message, void *userData);
+
+    GEOSContextHandle_t m_handle;
+    GEOSWKBReader *m_reader;
+    GEOSWKBWriter *m_writer;
+    QString m_lastError;
+};
+
+// Splits [0, count) into chunks that workers claim dynamically from a shared
+// counter, so expensive features do not leave the other threads idle. The
+// calling thread works too, which keeps nested use from a pool thread safe.
+// 'function' is called as function(chunkIndex, begin, end).
+template <typename ChunkFunction>
+void parallelForChunks(int count, int chunkSize, ProcessingFeedback *feedback,
+                       ChunkFunction function)
+{
+    if (count <= 0) return;
+
+    chunkSize = qMax(1, chunkSize);
+    const int chunkCount = (count + chunkSize - 1) / chunkSize;
+    QAtomicInt nextChunk(0);
+    QAtomicInt finishedChunks(0);
+
+    auto worker = [&]() {
+        for (;;) {
+            if (feedback && feedback->isCanceled()) return;
+
+            const int chunk = nextChunk.fetchAndAddRelaxed(1);
+            if (chunk >= chunkCount) return;
+
+            const int begin = chunk * chunkSize;
+            const int end = qMin(count, begin + chunkSize);
+            function(chunk, begin, end);
+
+            const int finished = finishedChunks.fetchAndAddRelaxed(1) + 1;
+            if (feedback) {
+                feedback->setProgress(100.0 * finished / chunkCount);
+            }
+        }
+    };
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int helpers = qMin(chunkCount, pool->maxThreadCount()) - 1;
+
+    QVector<QFuture<void>> futures;
+    futures.reserve(qMax(0, helpers));
+    for (int i = 0; i < helpers; ++i) {
+        futures.append(QtConcurrent::run(pool, worker));
+    }
+
+    worker();
+
+    for (QFuture<void> &future : futures) {
+        future.waitForFinished();
+    }
+}
+
+// Chunk size giving every pool thread several chunks to balance load
+int defaultChunkSize(int count);
+
+namespace Geoprocessing
+{
+    // Buffers every feature of 'input' by 'distance' (layer units)
+    bool buffer(const FeatureBuffer &input, double distance, int segments,
+                FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+                QString *errorMessage = nullptr);
+
+    // Cuts 'input' to the area covered by 'overlay', keeping input attributes.
+    // Here and in intersection() an overlay in another CRS is reprojected to
+    // the input's first; the output is in the input CRS.
+    bool clip(const FeatureBuffer &input, const FeatureBuffer &overlay,
+              FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+              QString *errorMessage = nullptr);
+
+    // One output feature per intersecting (input, overlay) pair, carrying the
+    // attributes of both; clashing overlay field names get a "_2" suffix
+    bool intersection(const FeatureBuffer &input, const FeatureBuffer &overlay,
+                      FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+                      QString *errorMessage = nullptr);
+}
+
+#endif // GEOPROCESSING_H
@@ -0,0 +1,147 @@
+#include "layerloader.h"
+
+#include <gdal_priv.h>
+
+#include "geopackageexport.h"
+#include "warptilesource.h"
+
+namespace
+{
+    void setGeoTransform(LoadedLayer *layer, const double *geoTransform)
+    {
+        for (int i = 0; i < 6; ++i) layer->geoTransform[i] = geoTransform[i];
+        layer->hasGeoTransform = true;
+    }
+
+    // Rasters Qt has no reader for (most TIFFs with more than 8 bits or
+    // several bands): the first band as gray, or the first three as RGB,
+    // read straight into the image in one RasterIO call
+    QImage readWithGdal(const QString &datasetName)
+    {
+        GDALDataset *dataset = (GDALDataset*)GDALOpen(datasetName.toUtf8().constData(), GA_ReadOnly);
+        if (!dataset) return QImage();
+
+        const int width = dataset->GetRasterXSize();
+        const int height = dataset->GetRasterYSize();
+        const int bands = dataset->GetRasterCount() >= 3 ? 3 : 1;
+        QImage image;
+        if (dataset->GetRasterCount() > 0) {
+            image = QImage(width, height, bands == 3 ? QImage::Format_RGBX8888 : QImage::Format_Grayscale8);
+        }
+        if (!image.isNull()) {
+            // RGBX is R, G, B, 255 in memory order on every platform
+            image.fill(Qt::white);
+            int bandMap[3] = { 1, 2, 3 };
+            const int pixelSpace = bands == 3 ? 4 : 1;
+            if (dataset->RasterIO(GF_Read, 0, 0, width, height, image.bits(), width, height, GDT_Byte,
+                                  bands, bandMap, pixelSpace, image.bytesPerLine(), 1) != CE_None) {
+                image = QImage();
+            }
+        }
+        GDALClose(dataset);
+        return image;
+    }
+}
+
+QString LayerLoader::rasterDataset(const QString &filePath, const QVariantMap &properties)
+{
+    const QString table = properties.value("gpkg_table").toString();
+    return table.isEmpty() ? filePath : GeoPackageExport::rasterDatasetName(filePath, table);
+}
+
+Terrain::Parameters LayerLoader::terrainParameters(const QVariantMap &properties)
+{
+    Terrain::Parameters parameters;
+    const Terrain::Mode modes[] = { Terrain::Hillshade, Terrain::Slope, Terrain::Aspect };
+    for (Terrain::Mode mode : modes) {
+        if (Terrain::modeName(mode) == properties.value("terrain_mode").toString()) {
+            parameters.mode = mode;
+        }
+    }
+    parameters.azimuth = properties.value("azimuth", parameters.azimuth).toDouble();
+    parameters.altitude = properties.value("altitude", parameters.altitude).toDouble();
+    parameters.zFactor = properties.value("z_factor", parameters.zFactor).toDouble();
+    return parameters;
+}
+
+LoadedLayer LayerLoader::load(const QString &name, const QString &type, const QString &filePath,
+                              const QVariantMap &properties)
+{
+    LoadedLayer layer;
+    layer.name = name;
+
+    if (type == "vector" || type == "memory") {
+        QSharedPointer<FeatureBuffer> buffer(new FeatureBuffer());
+        if (FeatureBuffer::readFromFile(filePath, properties.value("layer_index").toInt(),
+                                        buffer.data(), &layer.errorMessage)) {
+            layer.features = buffer;
+        }
+        return layer;
+    }
+
+    const QString datasetName = rasterDataset(filePath, properties);
+    if (type == "terrain") {
+        QSharedPointer<TerrainTileSource> source(new TerrainTileSource(datasetName, terrainParameters(properties)));
+        if (source->open(&layer.errorMessage)) {
+            setGeoTransform(&layer, source->geoTransform());
+            layer.tiles = source;
+        }
+        return layer;
+    }
+
+    // A raster the project knows is not georeferenced is not asked again;
+    // one it knows nothing about (a bare file from an old export) is
+    QString wkt;
+    const bool known = properties.contains("has_geotransform");
+    if (!known || properties.value("has_geotransform").toBool()) {
+        GDALDataset *dataset = (GDALDataset*)GDALOpen(datasetName.toUtf8().constData(), GA_ReadOnly);
+        if (dataset) {
+            double geoTransform[6];
+            if (!known && dataset->GetGeoTransform(geoTransform) == CE_None) {
+                layer.properties["has_geotransform"] = true;
+                layer.properties["top_left_x"] = geoTransform[0];
+                layer.properties["pixel_width"] = geoTransform[1];
+                layer.properties["rotation_x"] = geoTransform[2];
+                layer.properties["top_left_y"] = geoTransform[3];
+                layer.properties["rotation_y"] = geoTransform[4];
+                layer.properties["pixel_height"] = geoTransform[5];
+                layer.properties["width"] = dataset->GetRasterXSize();
+                layer.properties["height"] = dataset->GetRasterYSize();
+            }
+            wkt = QString::fromUtf8(dataset->GetProjectionRef());
+            GDALClose(dataset);
+        }
+    }
+
+    if (!wkt.isEmpty()) {
+        // Tiled in its own CRS: only the tiles in view are read, from
+        // overviews when zoomed out
+        QSharedPointer<WarpedTileSource> source(new WarpedTileSource(datasetName, wkt));
+        if (source->open(&layer.errorMessage)) {
+            setGeoTransform(&layer, source->geoTransform());
+            layer.tiles = source;
+            layer.wkt = wkt;
+        }
+        return layer;
+    }
+
+    // QImage rather than QPixmap: it can be decoded off the GUI thread
+    layer.image = QImage(filePath);
+    if (layer.image.isNull()) {
+        layer.image = readWithGdal(datasetName);
+    }
+    if (layer.image.isNull()) {
+        layer.errorMessage = "Cannot load raster file: " + filePath;
+        return layer;
+    }
+    const QVariantMap georeferencing = known ? properties : layer.properties;
+    if (georeferencing.value("has_geotransform").toBool()) {
+        const double geoTransform[6] = {
+            georeferencing.value("top_left_x").toDouble(), georeferencing.value("pixel_width").toDouble(),
+            georeferencing.value("rotation_x").toDouble(), georeferencing.value("top_left_y").toDouble(),
+            georeferencing.value("rotation_y").toDouble(), georeferencing.value("pixel_height").toDouble()
+        };
+        setGeoTransform(&layer, geoTransform);
+    }
+    return layer;
+}
@@ -0,0 +1,50 @@
+#ifndef LAYERLOADER_H
+#define LAYERLOADER_H
+
+#include <QImage>
+#include <QSharedPointer>
+#include <QString>
+#include <QVariantMap>
+
+#include "featurebuffer.h"
+#include "terrain.h"
+#include "tiledrasteritem.h"
+
+// What opening a project layer's data source produced. Filled in on a
+// worker thread: it holds no graphics items, only what they are made from.
+struct LoadedLayer
+{
+    QString name;
+    QSharedPointer<FeatureBuffer> features;     // vector layers
+    QSharedPointer<RasterTileSource> tiles;     // georeferenced rasters, terrain
+    QImage image;                               // other rasters
+    double geoTransform[6];
+    bool hasGeoTransform = false;
+    QString wkt;                                // CRS of georeferenced rasters
+
+    // Properties found while opening that the project did not store
+    // (georeferencing of a raster it knew nothing about)
+    QVariantMap properties;
+
+    QString errorMessage;
+};
+
+// Opening project layers away from the GUI thread: everything slow (reading
+// features, opening rasters and their overviews, decoding images) happens
+// here, and is safe to run for several layers at once.
+namespace LayerLoader
+{
+    // GDAL name of a raster layer's data: rasters exported into a
+    // GeoPackage are one of its tables
+    QString rasterDataset(const QString &filePath, const QVariantMap &properties);
+
+    // Hillshade, slope or aspect settings stored with a terrain layer
+    Terrain::Parameters terrainParameters(const QVariantMap &properties);
+
+    // Georeferenced rasters are tiled in their own CRS; reprojecting them
+    // to the canvas is left to the caller
+    LoadedLayer load(const QString &name, const QString &type, const QString &filePath,
+                     const QVariantMap &properties);
+}
+
+#endif // LAYERLOADER_H
@@ -0,0 +1,504 @@
+#include "mapexport.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QGraphicsEllipseItem>
+#include <QGraphicsLineItem>
+#include <QGraphicsPathItem>
+#include <QGraphicsPixmapItem>
+#include <QGraphicsPolygonItem>
+#include <QGraphicsRectItem>
+#include <QGraphicsScene>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPageSize>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QPointer>
+#include <QSemaphore>
+#include <QStyleOptionGraphicsItem>
+#include <QThread>
+
+#include <cmath>
+
+#include <gdal_priv.h>
+
+#include "featurebufferitem.h"
+
+MapExporter::MapExporter(QObject *parent)
+    : QObject(parent)
+    , m_running(false)
+    , m_canceled(0)
+{
+    m_pool.setMaxThreadCount(1);
+    m_renderPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+MapExporter::~MapExporter()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+QVector<MapExportLayer> MapExporter::layersFromScene(QGraphicsScene *scene)
+{
+    QVector<MapExportLayer> layers;
+    if (!scene) return layers;
+
+    for (QGraphicsItem *item : scene->items(Qt::AscendingOrder)) {
+        if (!item->isVisible() || item->effectiveOpacity() <= 0.0) continue;
+        // Markers drawn at a fixed screen size have no size on the map
+        if (item->flags() & QGraphicsItem::ItemIgnoresTransformations) continue;
+
+        MapExportLayer layer;
+        layer.transform = item->sceneTransform();
+        layer.opacity = item->effectiveOpacity();
+
+        if (FeatureBufferItem *featureItem = dynamic_cast<FeatureBufferItem*>(item)) {
+            layer.kind = MapExportLayer::Features;
+            layer.features = featureItem->buffer();
+            layer.color = featureItem->color();
+        } else if (TiledRasterItem *rasterItem = dynamic_cast<TiledRasterItem*>(item)) {
+            if (!rasterItem->source()) continue;
+            layer.kind = MapExportLayer::Tiles;
+            layer.tiles = rasterItem->source();
+        } else if (QGraphicsPixmapItem *pixmapItem = dynamic_cast<QGraphicsPixmapItem*>(item)) {
+            // QPixmap belongs to the GUI thread; the workers get a QImage
+            layer.kind = MapExportLayer::Image;
+            layer.image = pixmapItem->pixmap().toImage();
+            layer.transform = QTransform::fromTranslate(pixmapItem->offset().x(), pixmapItem->offset().y())
+                    * layer.transform;
+        } else if (QGraphicsLineItem *lineItem = dynamic_cast<QGraphicsLineItem*>(item)) {
+            layer.path.moveTo(lineItem->line().p1());
+            layer.path.lineTo(lineItem->line().p2());
+            layer.pen = lineItem->pen();
+            layer.brush = Qt::NoBrush;
+        } else if (QAbstractGraphicsShapeItem *shapeItem = dynamic_cast<QAbstractGraphicsShapeItem*>(item)) {
+            if (QGraphicsPathItem *pathItem = dynamic_cast<QGraphicsPathItem*>(item)) {
+                layer.path = pathItem->path();
+            } else if (QGraphicsRectItem *rectItem = dynamic_cast<QGraphicsRectItem*>(item)) {
+                layer.path.addRect(rectItem->rect());
+            } else if (QGraphicsEllipseItem *ellipseItem = dynamic_cast<QGraphicsEllipseItem*>(item)) {
+                layer.path.addEllipse(ellipseItem->rect());
+            } else if (QGraphicsPolygonItem *polygonItem = dynamic_cast<QGraphicsPolygonItem*>(item)) {
+                layer.path.addPolygon(polygonItem->polygon());
+                layer.path.closeSubpath();
+                layer.path.setFillRule(polygonItem->fillRule());
+            } else {
+                continue;
+            }
+            layer.pen = shapeItem->pen();
+            layer.brush = shapeItem->brush();
+        } else {
+            continue;
+        }
+        layers.append(layer);
+    }
+    return layers;
+}
+
+bool MapExporter::start(const QVector<MapExportLayer> &layers, const Settings &settings)
+{
+    if (m_running || settings.size.isEmpty() || settings.sceneRect.isEmpty()) return false;
+
+    m_layers = layers;
+    m_settings = settings;
+    m_sceneToImage = QTransform::fromTranslate(-settings.sceneRect.left(), -settings.sceneRect.top())
+            * QTransform::fromScale(settings.size.width() / settings.sceneRect.width(),
+                                    settings.size.height() / settings.sceneRect.height());
+    m_canceled = 0;
+    m_running = true;
+
+    QPointer<MapExporter> self(this);
+    m_pool.start([this, self]() {
+        // Built here: indexing the features can take a while
+        m_renderer.reset(new MapLayerRenderer(m_layers));
+
+        QString errorMessage;
+        const bool success = m_settings.format == "PDF" ? runPdf(&errorMessage) : run(&errorMessage);
+        m_renderer.reset();
+
+        QMetaObject::invokeMethod(this, [self, success, errorMessage]() {
+            if (!self) return;
+            self->m_running = false;
+            emit self->finished(success, errorMessage);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+void MapExporter::cancel()
+{
+    // Queued tiles still run, but return at once: the row waits for all
+    m_canceled = 1;
+}
+
+bool MapExporter::run(QString *errorMessage)
+{
+    const Settings &settings = m_settings;
+    GDALDriver *tiffDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName(settings.format.toUtf8().constData());
+    if (!tiffDriver || !driver) {
+        if (errorMessage) *errorMessage = "GDAL driver not available: " + settings.format;
+        return false;
+    }
+
+    // PNG and JPEG cannot be written a block at a time: they are streamed
+    // out of a GeoTIFF next to them once it is complete
+    const bool direct = settings.format == "GTiff";
+    const QString tiffPath = direct ? settings.path : settings.path + ".partial.tif";
+    const int bandCount = settings.format == "JPEG" ? 3 : 4;
+    const int width = settings.size.width();
+    const int height = settings.size.height();
+
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", QByteArray::number(TileSize).constData());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", QByteArray::number(TileSize).constData());
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+    options = CSLSetNameValue(options, "PHOTOMETRIC", "RGB");
+    if (bandCount == 4) options = CSLSetNameValue(options, "ALPHA", "YES");
+    if (direct) options = CSLSetNameValue(options, "TFW", "YES");
+    GDALDataset *dataset = tiffDriver->Create(tiffPath.toUtf8().constData(), width, height, bandCount,
+                                              GDT_Byte, options);
+    CSLDestroy(options);
+    if (!dataset) {
+        if (errorMessage) *errorMessage = QString("Cannot create %1: %2").arg(tiffPath, CPLGetLastErrorMsg());
+        return false;
+    }
+
+    // Image pixel -> map: back to the scene, then to map units
+    const QTransform imageToMap = m_sceneToImage.inverted() * settings.sceneToMap;
+    double geoTransform[6] = {
+        imageToMap.dx(), imageToMap.m11(), imageToMap.m21(),
+        imageToMap.dy(), imageToMap.m12(), imageToMap.m22()
+    };
+    dataset->SetGeoTransform(geoTransform);
+    if (!settings.wkt.isEmpty()) {
+        dataset->SetProjection(settings.wkt.toUtf8().constData());
+    }
+
+    const int columns = (width + TileSize - 1) / TileSize;
+    const int rows = (height + TileSize - 1) / TileSize;
+    bool ok = true;
+
+    // One row of tiles in memory at a time: rendered in parallel, then
+    // written in order
+    for (int row = 0; row < rows && ok; ++row) {
+        QVector<QImage> tiles(columns);
+        QSemaphore rendered;
+        for (int column = 0; column < columns; ++column) {
+            m_renderPool.start([this, &tiles, &rendered, column, row]() {
+                if (!m_canceled) tiles[column] = renderTile(column, row);
+                rendered.release();
+            });
+        }
+        rendered.acquire(columns);
+        if (m_canceled) {
+            ok = false;
+            if (errorMessage) *errorMessage = "Canceled";
+            break;
+        }
+
+        for (int column = 0; column < columns && ok; ++column) {
+            QImage &tile = tiles[column];
+            const CPLErr error = dataset->RasterIO(GF_Write, column * TileSize, row * TileSize,
+                                                   tile.width(), tile.height(), tile.bits(),
+                                                   tile.width(), tile.height(), GDT_Byte, bandCount, nullptr,
+                                                   4, tile.bytesPerLine(), 1, nullptr);
+            if (error != CE_None) {
+                ok = false;
+                if (errorMessage) *errorMessage = QString("Cannot write %1: %2").arg(tiffPath, CPLGetLastErrorMsg());
+            }
+        }
+
+        reportProgress(row + 1, rows);
+    }
+    GDALClose(dataset);
+
+    if (ok && !direct) {
+        GDALDataset *source = static_cast<GDALDataset*>(GDALOpen(tiffPath.toUtf8().constData(), GA_ReadOnly));
+        char **copyOptions = CSLSetNameValue(nullptr, "WORLDFILE", "YES");
+        if (settings.format == "JPEG") {
+            copyOptions = CSLSetNameValue(copyOptions, "QUALITY", QByteArray::number(settings.quality).constData());
+        }
+        GDALDataset *target = source ? driver->CreateCopy(settings.path.toUtf8().constData(), source, FALSE,
+                                                          copyOptions, nullptr, nullptr)
+                                     : nullptr;
+        CSLDestroy(copyOptions);
+        if (target) {
+            GDALClose(target);
+        } else {
+            ok = false;
+            if (errorMessage) *errorMessage = QString("Cannot write %1: %2").arg(settings.path, CPLGetLastErrorMsg());
+        }
+        if (source) GDALClose(source);
+    }
+
+    if (!direct || !ok) {
+        tiffDriver->Delete(tiffPath.toUtf8().constData());
+    }
+    return ok;
+}
+
+bool MapExporter::runPdf(QString *errorMessage)
+{
+    const Settings &settings = m_settings;
+    const QSize size = settings.size;
+
+    // PDF viewers stop at 200 inches a side (14400 points)
+    const int maxPage = 200 * settings.dpi;
+    const int columns = (size.width() + maxPage - 1) / maxPage;
+    const int rows = (size.height() + maxPage - 1) / maxPage;
+    const QSize pageSize((size.width() + columns - 1) / columns, (size.height() + rows - 1) / rows);
+
+    QPdfWriter writer(settings.path);
+    writer.setResolution(settings.dpi);
+    writer.setTitle(QFileInfo(settings.path).completeBaseName());
+    writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+    writer.setPageSize(QPageSize(QSizeF(pageSize) / settings.dpi, QPageSize::Inch));
+
+    QPainter painter;
+    if (!painter.begin(&writer)) {
+        if (errorMessage) *errorMessage = "Cannot write " + settings.path;
+        return false;
+    }
+
+    // Painter units are output pixels: the same grid as an image export
+    const int pages = columns * rows;
+    for (int page = 0; page < pages; ++page) {
+        if (m_canceled) {
+            painter.end();
+            QFile::remove(settings.path);
+            if (errorMessage) *errorMessage = "Canceled";
+            return false;
+        }
+        if (page > 0) writer.newPage();
+
+        const QRect rect = QRect(QPoint((page % columns) * pageSize.width(), (page / columns) * pageSize.height()),
+                                 pageSize).intersected(QRect(QPoint(0, 0), size));
+        const QTransform sceneToPage = m_sceneToImage * QTransform::fromTranslate(-rect.left(), -rect.top());
+        const QRect pageRect(QPoint(0, 0), rect.size());
+        const QRectF sceneArea = sceneToPage.inverted().mapRect(QRectF(pageRect));
+
+        painter.setClipRect(pageRect);
+        painter.fillRect(pageRect, settings.background);
+        for (int i = 0; i < m_layers.size(); ++i) {
+            const MapExportLayer &layer = m_layers[i];
+            const QTransform itemToPage = layer.transform * sceneToPage;
+            painter.save();
+            painter.setOpacity(layer.opacity);
+
+            if (layer.kind == MapExportLayer::Tiles || layer.kind == MapExportLayer::Image) {
+                // Rasters go in as images at the export's resolution
+                // whatever the source's
+                const QRect area = itemToPage.mapRect(MapLayerRenderer::layerBounds(layer))
+                        .toAlignedRect().intersected(pageRect);
+                if (!area.isEmpty()) {
+                    drawRasterTiles(&painter, i, sceneToPage, area);
+                }
+            } else {
+                painter.setRenderHint(QPainter::Antialiasing, true);
+                painter.setTransform(itemToPage);
+                m_renderer->drawLayer(&painter, i, sceneArea);
+            }
+            painter.restore();
+        }
+        reportProgress(page + 1, pages);
+    }
+
+    if (!painter.end()) {
+        if (errorMessage) *errorMessage = "Cannot write " + settings.path;
+        return false;
+    }
+    return true;
+}
+
+// One raster layer on a PDF page as TileSize images, a row of them rendered
+// in parallel at a time: a page can be far too large for one image
+void MapExporter::drawRasterTiles(QPainter *painter, int layer, const QTransform &sceneToPage,
+                                  const QRect &area)
+{
+    const QTransform itemToPage = m_layers[layer].transform * sceneToPage;
+    const QTransform pageToScene = sceneToPage.inverted();
+    const int columns = (area.width() + TileSize - 1) / TileSize;
+    const int rows = (area.height() + TileSize - 1) / TileSize;
+
+    for (int row = 0; row < rows && !m_canceled; ++row) {
+        QVector<QImage> tiles(columns);
+        QVector<QRect> rects(columns);
+        QSemaphore rendered;
+        for (int column = 0; column < columns; ++column) {
+            const QRect rect = QRect(area.left() + column * TileSize, area.top() + row * TileSize,
+                                     TileSize, TileSize).intersected(area);
+            rects[column] = rect;
+            m_renderPool.start([this, &tiles, &rendered, column, rect, layer, itemToPage, pageToScene]() {
+                if (!m_canceled) {
+                    QImage image(rect.size(), QImage::Format_ARGB32_Premultiplied);
+                    image.fill(Qt::transparent);
+                    QPainter imagePainter(&image);
+                    imagePainter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+                    imagePainter.setTransform(itemToPage * QTransform::fromTranslate(-rect.left(), -rect.top()));
+                    m_renderer->drawLayer(&imagePainter, layer, pageToScene.mapRect(QRectF(rect)));
+                    imagePainter.end();
+                    tiles[column] = image;
+                }
+                rendered.release();
+            });
+        }
+        rendered.acquire(columns);
+
+        for (int column = 0; column < columns; ++column) {
+            if (!tiles[column].isNull()) {
+                painter->drawImage(rects[column].topLeft(), tiles[column]);
+            }
+        }
+    }
+}
+
+void MapExporter::reportProgress(int done, int total)
+{
+    QPointer<MapExporter> self(this);
+    QMetaObject::invokeMethod(this, [self, done, total]() {
+        if (self) emit self->progress(done, total);
+    }, Qt::QueuedConnection);
+}
+
+QImage MapExporter::renderTile(int column, int row) const
+{
+    const QRect rect = QRect(column * TileSize, row * TileSize, TileSize, TileSize)
+            .intersected(QRect(QPoint(0, 0), m_settings.size));
+    QImage image(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(m_settings.background);
+
+    const QTransform sceneToTile = m_sceneToImage * QTransform::fromTranslate(-rect.left(), -rect.top());
+    const QRectF sceneArea = sceneToTile.inverted().mapRect(QRectF(image.rect()));
+
+    QPainter painter(&image);
+    m_renderer->render(&painter, sceneToTile, sceneArea);
+    painter.end();
+
+    // Byte order R, G, B, A: what the file's bands take
+    return image.convertToFormat(QImage::Format_RGBA8888);
+}
+
+MapLayerRenderer::MapLayerRenderer(const QVector<MapExportLayer> &layers)
+    : m_layers(layers)
+    , m_tileCache(128 * 1024)
+{
+    m_featureItems.resize(m_layers.size());
+    for (int i = 0; i < m_layers.size(); ++i) {
+        if (m_layers[i].kind == MapExportLayer::Features) {
+            m_featureItems[i].reset(new FeatureBufferItem(m_layers[i].features, m_layers[i].color));
+        }
+    }
+}
+
+QRectF MapLayerRenderer::layerBounds(const MapExportLayer &layer)
+{
+    switch (layer.kind) {
+    case MapExportLayer::Tiles:
+        return QRectF(QPointF(0, 0), QSizeF(layer.tiles->rasterSize()));
+    case MapExportLayer::Image:
+        return QRectF(layer.image.rect());
+    case MapExportLayer::Shape:
+        return layer.path.controlPointRect();
+    case MapExportLayer::Features: {
+        const Envelope extent = layer.features->extent();
+        return QRectF(QPointF(extent.minX, extent.minY), QPointF(extent.maxX, extent.maxY));
+    }
+    }
+    return QRectF();
+}
+
+void MapLayerRenderer::render(QPainter *painter, const QTransform &sceneToDevice, const QRectF &sceneArea) const
+{
+    painter->setRenderHint(QPainter::Antialiasing, true);
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
+    for (int i = 0; i < m_layers.size(); ++i) {
+        painter->save();
+        painter->setTransform(m_layers[i].transform * sceneToDevice);
+        painter->setOpacity(m_layers[i].opacity);
+        drawLayer(painter, i, sceneArea);
+        painter->restore();
+    }
+}
+
+void MapLayerRenderer::drawLayer(QPainter *painter, int index, const QRectF &sceneArea) const
+{
+    const MapExportLayer &layer = m_layers[index];
+    bool invertible = false;
+    const QTransform sceneToItem = layer.transform.inverted(&invertible);
+    if (!invertible) return;
+    const QRectF itemArea = sceneToItem.mapRect(sceneArea);
+
+    switch (layer.kind) {
+    case MapExportLayer::Features: {
+        QStyleOptionGraphicsItem option;
+        option.exposedRect = itemArea;
+        m_featureItems[index]->paint(painter, &option);
+        break;
+    }
+    case MapExportLayer::Tiles:
+        drawTiles(painter, layer, itemArea);
+        break;
+    case MapExportLayer::Image: {
+        const QRectF source = itemArea.intersected(QRectF(layer.image.rect()));
+        if (!source.isEmpty()) {
+            painter->drawImage(source, layer.image, source);
+        }
+        break;
+    }
+    case MapExportLayer::Shape:
+        painter->setPen(layer.pen);
+        painter->setBrush(layer.brush);
+        painter->drawPath(layer.path);
+        break;
+    }
+}
+
+// Same levels as TiledRasterItem: one output pixel covers at most one tile
+// pixel, the tiles computed synchronously instead of on request
+void MapLayerRenderer::drawTiles(QPainter *painter, const MapExportLayer &layer, const QRectF &itemArea) const
+{
+    const QSize size = layer.tiles->rasterSize();
+    const QRectF area = itemArea.intersected(QRectF(QPointF(0, 0), QSizeF(size)));
+    if (area.isEmpty()) return;
+
+    const int tileSize = TiledRasterItem::TileSize;
+    int topLevel = 0;
+    while ((qMax(size.width(), size.height()) >> topLevel) > tileSize) {
+        ++topLevel;
+    }
+    const qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    int level = 0;
+    if (lod > 0.0 && lod < 1.0) {
+        level = qBound(0, int(std::floor(std::log2(1.0 / lod))), topLevel);
+    }
+    const qreal span = qreal(tileSize) * (1 << level);
+
+    const int firstColumn = int(area.left() / span);
+    const int lastColumn = int(std::ceil(area.right() / span)) - 1;
+    const int firstRow = int(area.top() / span);
+    const int lastRow = int(std::ceil(area.bottom() / span)) - 1;
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            const QString key = QString("%1/%2/%3/%4").arg(quintptr(layer.tiles.data())).arg(level)
+                    .arg(column).arg(row);
+            QImage tile;
+            {
+                QMutexLocker locker(&m_cacheMutex);
+                if (QImage *cached = m_tileCache.object(key)) tile = *cached;
+            }
+            if (tile.isNull()) {
+                tile = layer.tiles->computeTile(level, column, row, tileSize);
+                if (tile.isNull()) continue;
+                QMutexLocker locker(&m_cacheMutex);
+                m_tileCache.insert(key, new QImage(tile), qMax(1, int(tile.sizeInBytes() / 1024)));
+            }
+            painter->drawImage(QRectF(column * span, row * span,
+                                      tile.width() * qreal(1 << level), tile.height() * qreal(1 << level)), tile);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef MAPEXPORT_H
+#define MAPEXPORT_H
+
+#include <QAtomicInt>
+#include <QBrush>
+#include <QCache>
+#include <QColor>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QPainterPath>
+#include <QPen>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QTransform>
+#include <QVector>
+
+#include "featurebuffer.h"
+#include "tiledrasteritem.h"
+
+class QGraphicsItem;
+class QGraphicsScene;
+class QPainter;
+
+// One layer of an exported map, holding only data that can be drawn from
+// several threads at once (never the scene item itself)
+struct MapExportLayer
+{
+    enum Kind {
+        Features,
+        Tiles,
+        Image,
+        Shape
+    };
+
+    Kind kind = Shape;
+    QTransform transform;       // item to scene
+    qreal opacity = 1.0;
+
+    QSharedPointer<const FeatureBuffer> features;
+    QColor color;
+    QSharedPointer<RasterTileSource> tiles;
+    QImage image;
+    QPainterPath path;
+    QPen pen;
+    QBrush brush;
+};
+
+// Draws MapExportLayers from any number of threads at once. Vector layers
+// are painted by a FeatureBufferItem of their own (built here, so its index
+// is only read while drawing); raster tiles are computed on demand and
+// shared between callers through a cache.
+class MapLayerRenderer
+{
+public:
+    explicit MapLayerRenderer(const QVector<MapExportLayer> &layers);
+
+    const QVector<MapExportLayer> &layers() const { return m_layers; }
+
+    // Every layer, bottom to top, over 'sceneArea'; 'sceneToDevice' maps
+    // scene coordinates to the painter's device
+    void render(QPainter *painter, const QTransform &sceneToDevice, const QRectF &sceneArea) const;
+
+    // One layer, with the painter already in its item coordinates
+    void drawLayer(QPainter *painter, int index, const QRectF &sceneArea) const;
+
+    // Item coordinates
+    static QRectF layerBounds(const MapExportLayer &layer);
+
+private:
+    void drawTiles(QPainter *painter, const MapExportLayer &layer, const QRectF &itemArea) const;
+
+    QVector<MapExportLayer> m_layers;
+    QVector<QSharedPointer<QGraphicsItem>> m_featureItems;  // per layer, Features only
+
+    // Raster tiles are shared by neighbouring output tiles
+    mutable QMutex m_cacheMutex;
+    mutable QCache<QString, QImage> m_tileCache;    // cost in KiB
+};
+
+// Renders a scene extent at any size into a file without ever holding the
+// whole image: output tiles are rendered in parallel one row at a time, and
+// each finished row is written to a tiled GeoTIFF. PNG and JPEG are then
+// streamed out of that file by GDAL. GeoTIFFs carry the map's georeference;
+// every format gets a world file.
+//
+// PDF keeps vector layers as paths: features come from each layer's spatial
+// index for the page being drawn, in batches, and rasters are embedded once
+// per page at the export resolution. Maps larger than a PDF page can be
+// (200 inches) are split over several pages.
+class MapExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings {
+        QString path;
+        QString format = "GTiff";   // GDAL driver (GTiff, PNG, JPEG) or PDF
+        QRectF sceneRect;           // area to export, in scene coordinates
+        QSize size;                 // output pixels
+        QColor background = Qt::white;
+        QTransform sceneToMap;      // for the georeference
+        QString wkt;                // CRS of the map units, empty if unknown
+        int quality = 90;           // JPEG
+        int dpi = 300;              // PDF: output pixels per inch
+    };
+
+    explicit MapExporter(QObject *parent = nullptr);
+    ~MapExporter();
+
+    // Visible items of 'scene', bottom to top. Items with nothing safe to
+    // draw from off the GUI thread (text, SVG) are left out.
+    static QVector<MapExportLayer> layersFromScene(QGraphicsScene *scene);
+
+    // False while another export runs
+    bool start(const QVector<MapExportLayer> &layers, const Settings &settings);
+    void cancel();
+    bool isRunning() const { return m_running; }
+    QString path() const { return m_settings.path; }
+
+    static const int TileSize = 512;
+
+signals:
+    void progress(int done, int total);     // rows of tiles, or PDF pages
+    void finished(bool success, const QString &errorMessage);
+
+private:
+    bool run(QString *errorMessage);
+    bool runPdf(QString *errorMessage);
+    void reportProgress(int done, int total);
+    QImage renderTile(int column, int row) const;
+    void drawRasterTiles(QPainter *painter, int layer, const QTransform &sceneToPage, const QRect &area);
+
+    QThreadPool m_pool;         // the one task writing the file
+    QThreadPool m_renderPool;   // output tiles
+    QVector<MapExportLayer> m_layers;
+    QSharedPointer<MapLayerRenderer> m_renderer;    // while exporting
+    Settings m_settings;
+    QTransform m_sceneToImage;
+    bool m_running;
+    QAtomicInt m_canceled;
+};
+
+#endif // MAPEXPORT_H
@@ -0,0 +1,114 @@
+#include "mapsettings.h"
+
+#include <QGraphicsItem>
+#include <QVariant>
+
+namespace
+{
+    // QGraphicsItem::data() key holding the map to scene transform an item was placed with
+    const int PlacementKey = 0x4d53;
+
+    const double GeographicSceneScale = 100.0;   // scene units per degree
+    const double ProjectedSceneScale = 0.1;      // scene units per metre
+}
+
+MapSettings::MapSettings()
+    : m_rasterGrid(false)
+{
+    setDefaultSceneGrid();
+}
+
+void MapSettings::setDestinationCrs(const QString &crs, const QString &wkt)
+{
+    m_destinationCrs = crs;
+    m_destinationWkt = wkt;
+}
+
+void MapSettings::setSceneGrid(const double geoTransform[6])
+{
+    bool invertible = false;
+    QTransform mapToScene = pixelToMap(geoTransform).inverted(&invertible);
+    if (!invertible) {
+        setDefaultSceneGrid();
+        return;
+    }
+    m_rasterGrid = true;
+    setMapToScene(mapToScene);
+}
+
+void MapSettings::setDefaultSceneGrid(bool projectedUnits)
+{
+    const double scale = projectedUnits ? ProjectedSceneScale : GeographicSceneScale;
+    m_rasterGrid = false;
+    setMapToScene(QTransform::fromScale(scale, -scale));
+}
+
+void MapSettings::setMapToScene(const QTransform &mapToScene)
+{
+    m_mapToScene = mapToScene;
+    m_sceneToMap = mapToScene.inverted();
+
+    // Forces the device inverse to be rebuilt
+    m_viewportTransform = QTransform(0, 0, 0, 0, 0, 0);
+}
+
+void MapSettings::mapToScene(const double *xy, int count, QPointF *scene) const
+{
+    const double m11 = m_mapToScene.m11(), m12 = m_mapToScene.m12();
+    const double m21 = m_mapToScene.m21(), m22 = m_mapToScene.m22();
+    const double dx = m_mapToScene.dx(), dy = m_mapToScene.dy();
+    for (int i = 0; i < count; ++i) {
+        const double x = xy[2 * i];
+        const double y = xy[2 * i + 1];
+        scene[i] = QPointF(m11 * x + m21 * y + dx, m12 * x + m22 * y + dy);
+    }
+}
+
+QTransform MapSettings::pixelToMap(const double geoTransform[6])
+{
+    // x = gt0 + col * gt1 + row * gt2, y = gt3 + col * gt4 + row * gt5
+    return QTransform(geoTransform[1], geoTransform[4],
+                      geoTransform[2], geoTransform[5],
+                      geoTransform[0], geoTransform[3]);
+}
+
+QTransform MapSettings::rasterToScene(const double geoTransform[6]) const
+{
+    return pixelToMap(geoTransform) * m_mapToScene;
+}
+
+QPointF MapSettings::mapToDevice(const QPointF &point, const QTransform &viewportTransform) const
+{
+    return viewportTransform.map(m_mapToScene.map(point));
+}
+
+QPointF MapSettings::deviceToMap(const QPointF &point, const QTransform &viewportTransform) const
+{
+    if (viewportTransform != m_viewportTransform) {
+        m_viewportTransform = viewportTransform;
+        m_deviceToMap = (m_mapToScene * viewportTransform).inverted();
+    }
+    return m_deviceToMap.map(point);
+}
+
+void MapSettings::markPlaced(QGraphicsItem *item) const
+{
+    if (item) item->setData(PlacementKey, QVariant::fromValue(m_mapToScene));
+}
+
+void MapSettings::reanchor(QGraphicsItem *item) const
+{
+    if (!item) return;
+
+    const QVariant placed = item->data(PlacementKey);
+    if (!placed.isValid()) return;
+
+    const QTransform previous = placed.value<QTransform>();
+    if (previous == m_mapToScene) return;
+
+    // Undo the old mapping, apply the new one
+    const QTransform change = previous.inverted() * m_mapToScene;
+    item->setTransform(item->sceneTransform() * change);
+    item->setPos(0, 0);
+    markPlaced(item);
+}
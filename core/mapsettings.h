@@ -0,0 +1,76 @@
+#ifndef MAPSETTINGS_H
+#define MAPSETTINGS_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+
+class QGraphicsItem;
+
+// The one place that relates map units (the canvas CRS), scene coordinates
+// and device (viewport) pixels.
+//
+// Scene coordinates are the pixel grid of an anchor raster when there is one
+// (the main GeoTIFF, so image pixels keep their 1:1 scene size), otherwise a
+// uniform scale with Y pointing up. Both directions are plain affine
+// matrices, inverted once when the mapping changes rather than per call.
+class MapSettings
+{
+public:
+    MapSettings();
+
+    // Canvas CRS as chosen by the user (e.g. "EPSG:3857"); empty while
+    // layers are drawn in their own CRS
+    QString destinationCrs() const { return m_destinationCrs; }
+    QString destinationWkt() const { return m_destinationWkt; }
+    void setDestinationCrs(const QString &crs, const QString &wkt);
+
+    // Scene = pixels of a raster with this GDAL geotransform
+    void setSceneGrid(const double geoTransform[6]);
+    // Scene = map units times a fixed scale, Y up; a coarser scale for
+    // projected CRSs keeps metre coordinates inside the view's scroll range
+    void setDefaultSceneGrid(bool projectedUnits = false);
+    bool hasRasterGrid() const { return m_rasterGrid; }
+
+    // Map <-> scene
+    const QTransform &mapToSceneTransform() const { return m_mapToScene; }
+    const QTransform &sceneToMapTransform() const { return m_sceneToMap; }
+    QPointF mapToScene(double x, double y) const { return m_mapToScene.map(QPointF(x, y)); }
+    QPointF mapToScene(const QPointF &point) const { return m_mapToScene.map(point); }
+    QPointF sceneToMap(const QPointF &point) const { return m_sceneToMap.map(point); }
+    QRectF mapToScene(const QRectF &rect) const { return m_mapToScene.mapRect(rect); }
+    QRectF sceneToMap(const QRectF &rect) const { return m_sceneToMap.mapRect(rect); }
+
+    // Batched form for interleaved x/y map coordinates
+    void mapToScene(const double *xy, int count, QPointF *scene) const;
+
+    // Scene transform for a raster item drawn in pixel units
+    QTransform rasterToScene(const double geoTransform[6]) const;
+
+    // Map <-> device, given the view's viewportTransform(). The inverse is
+    // cached until the view transform changes.
+    QPointF mapToDevice(const QPointF &point, const QTransform &viewportTransform) const;
+    QPointF deviceToMap(const QPointF &point, const QTransform &viewportTransform) const;
+
+    // Items drawn in scene coordinates remember the mapping they were placed
+    // with; reanchor() moves them onto the current one after it changed
+    void markPlaced(QGraphicsItem *item) const;
+    void reanchor(QGraphicsItem *item) const;
+
+    static QTransform pixelToMap(const double geoTransform[6]);
+
+private:
+    void setMapToScene(const QTransform &mapToScene);
+
+    QString m_destinationCrs;
+    QString m_destinationWkt;
+    bool m_rasterGrid;
+    QTransform m_mapToScene;
+    QTransform m_sceneToMap;
+
+    mutable QTransform m_viewportTransform;
+    mutable QTransform m_deviceToMap;
+};
+
+#endif // MAPSETTINGS_H
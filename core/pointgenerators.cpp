@@ -0,0 +1,649 @@
+#include "pointgenerators.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "spatialindex.h"
+#include "wkbutils.h"
+
+namespace
+{
+
+const int BatchSize = 65536;   // random points per task
+const int BlockSize = 256;     // candidates classified per containsBatch() call
+const int MaxGridSide = 1024;
+
+// xorshift128+ seeded through splitmix64. Every batch gets its own stream, so
+// the generated points do not depend on the number of threads.
+class RandomGenerator
+{
+public:
+    RandomGenerator(quint64 seed, quint64 stream)
+    {
+        quint64 state = seed ^ (stream * 0x9E3779B97F4A7C15ull);
+        m_state[0] = splitMix(state);
+        m_state[1] = splitMix(state);
+    }
+
+    // Uniform in [0, 1)
+    double uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    static quint64 splitMix(quint64 &state)
+    {
+        quint64 z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    quint64 next()
+    {
+        quint64 s1 = m_state[0];
+        const quint64 s0 = m_state[1];
+        m_state[0] = s0;
+        s1 ^= s1 << 23;
+        m_state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+        return m_state[1] + s0;
+    }
+
+    quint64 m_state[2];
+};
+
+inline double orient(double ax, double ay, double bx, double by, double cx, double cy)
+{
+    return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+inline int clampIndex(double value, int size)
+{
+    if (!(value > 0.0)) return 0;
+    if (value >= size) return size - 1;
+    return static_cast<int>(value);
+}
+
+// Task size for 'count' work items that are each already substantial
+int coarseChunkSize(int count)
+{
+    const int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    return qMax(1, count / (threads * 8));
+}
+
+void preparePointOutput(const QString &srsWkt, FeatureBuffer *output)
+{
+    QVector<FeatureBuffer::Field> fields;
+    fields.append({ "ID", OFTInteger64 });
+
+    output->clear();
+    output->setGeometryType(wkbPoint);
+    output->setSpatialReferenceWkt(srsWkt);
+    output->setFields(fields);
+}
+
+QString tooManyPoints(const FeatureBuffer &output)
+{
+    return QString("At most %1 points fit in one layer").arg(FeatureBuffer::maxFeatures(output.fieldCount()));
+}
+
+bool finishPoints(QVector<FeatureBuffer> &chunkResults, FeatureBuffer *output,
+                  ProcessingFeedback *feedback, QString *errorMessage)
+{
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+
+    int total = 0;
+    for (const FeatureBuffer &chunk : chunkResults) {
+        total += chunk.count();
+    }
+    output->reserve(total, static_cast<qint64>(total) * 21);
+
+    // Release every chunk once copied to keep the peak memory near one copy
+    for (int i = 0; i < chunkResults.size(); ++i) {
+        output->append(chunkResults[i]);
+        chunkResults[i] = FeatureBuffer();
+    }
+
+    for (int i = 0; i < output->count(); ++i) {
+        output->setAttribute(i, 0, static_cast<qlonglong>(i) + 1);
+    }
+    return true;
+}
+
+} // namespace
+
+// PolygonGridIndex
+
+PolygonGridIndex::PolygonGridIndex()
+    : m_area(0.0)
+    , m_columns(0)
+    , m_rows(0)
+    , m_cellWidth(1.0)
+    , m_cellHeight(1.0)
+    , m_inverseCellWidth(1.0)
+    , m_inverseCellHeight(1.0)
+{
+}
+
+// Visits the cells an edge passes through, row by row using the x-range of the
+// edge inside each row band (slightly widened to stay conservative)
+template <typename Visitor>
+void PolygonGridIndex::forEachEdgeCell(const Edge &edge, Visitor visitor) const
+{
+    const double epsilon = m_cellWidth * 1e-9;
+    const double edgeMinY = qMin(edge.y0, edge.y1);
+    const double edgeMaxY = qMax(edge.y0, edge.y1);
+    const int firstRow = clampIndex((edgeMinY - m_bounds.minY) * m_inverseCellHeight, m_rows);
+    const int lastRow = clampIndex((edgeMaxY - m_bounds.minY) * m_inverseCellHeight, m_rows);
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        double xLow, xHigh;
+        if (edge.y0 == edge.y1) {
+            xLow = qMin(edge.x0, edge.x1);
+            xHigh = qMax(edge.x0, edge.x1);
+        } else {
+            const double bandLow = qMax(edgeMinY, m_bounds.minY + row * m_cellHeight);
+            const double bandHigh = qMin(edgeMaxY, m_bounds.minY + (row + 1) * m_cellHeight);
+            const double slope = (edge.x1 - edge.x0) / (edge.y1 - edge.y0);
+            const double xa = edge.x0 + (bandLow - edge.y0) * slope;
+            const double xb = edge.x0 + (bandHigh - edge.y0) * slope;
+            xLow = qMin(xa, xb);
+            xHigh = qMax(xa, xb);
+        }
+
+        const int firstColumn = clampIndex((xLow - epsilon - m_bounds.minX) * m_inverseCellWidth, m_columns);
+        const int lastColumn = clampIndex((xHigh + epsilon - m_bounds.minX) * m_inverseCellWidth, m_columns);
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            visitor(row * m_columns + column);
+        }
+    }
+}
+
+bool PolygonGridIndex::build(const unsigned char *wkb, int size)
+{
+    m_bounds = Envelope();
+    m_area = 0.0;
+    m_edges.clear();
+    m_state.clear();
+    m_centerInside.clear();
+    m_cellOffsets.clear();
+    m_cellEdges.clear();
+
+    bool ok = visitWkbParts(wkb, size, [this](const WkbPart &part) {
+        if (part.dimension != 2 || part.pointCount < 3) return;
+
+        double twiceArea = 0.0;
+        for (int i = 0; i < part.pointCount; ++i) {
+            const int j = (i + 1) % part.pointCount;   // closes unclosed rings too
+            const double x0 = part.xy[2 * i], y0 = part.xy[2 * i + 1];
+            const double x1 = part.xy[2 * j], y1 = part.xy[2 * j + 1];
+            twiceArea += x0 * y1 - x1 * y0;
+            if (x0 == x1 && y0 == y1) continue;
+
+            Edge edge = { x0, y0, x1, y1 };
+            m_edges.push_back(edge);
+            m_bounds.expand(Envelope(qMin(x0, x1), qMin(y0, y1), qMax(x0, x1), qMax(y0, y1)));
+        }
+        m_area += (part.ring == 0 ? 0.5 : -0.5) * std::fabs(twiceArea);
+    });
+
+    if (!ok || m_edges.empty()) {
+        m_edges.clear();
+        m_bounds = Envelope();
+        m_area = 0.0;
+        return false;
+    }
+
+    // About one edge per cell, following the aspect ratio of the bounds
+    const double width = m_bounds.width() > 0.0 ? m_bounds.width() : 1.0;
+    const double height = m_bounds.height() > 0.0 ? m_bounds.height() : 1.0;
+    const double targetCells = static_cast<double>(m_edges.size());
+    m_columns = qBound(1, static_cast<int>(std::ceil(std::sqrt(targetCells * width / height))), MaxGridSide);
+    m_rows = qBound(1, static_cast<int>(std::ceil(targetCells / m_columns)), MaxGridSide);
+    m_cellWidth = width / m_columns;
+    m_cellHeight = height / m_rows;
+    m_inverseCellWidth = 1.0 / m_cellWidth;
+    m_inverseCellHeight = 1.0 / m_cellHeight;
+
+    const int cellCount = m_columns * m_rows;
+
+    // Edge lists per cell (CSR: counting pass, then fill)
+    m_cellOffsets.assign(cellCount + 1, 0);
+    for (const Edge &edge : m_edges) {
+        forEachEdgeCell(edge, [this](int cell) { ++m_cellOffsets[cell + 1]; });
+    }
+    for (int cell = 0; cell < cellCount; ++cell) {
+        m_cellOffsets[cell + 1] += m_cellOffsets[cell];
+    }
+
+    m_cellEdges.resize(m_cellOffsets[cellCount]);
+    std::vector<int> fill(m_cellOffsets.begin(), m_cellOffsets.end() - 1);
+    for (int e = 0; e < static_cast<int>(m_edges.size()); ++e) {
+        forEachEdgeCell(m_edges[e], [&](int cell) { m_cellEdges[fill[cell]++] = e; });
+    }
+
+    // Inside status of every cell centre from one scanline per row: the edges
+    // crossing the row's centre line are all listed in that row's cells
+    m_state.assign(cellCount, OutsideCell);
+    m_centerInside.assign(cellCount, 0);
+
+    std::vector<int> lastRowSeen(m_edges.size(), -1);
+    std::vector<double> crossings;
+
+    for (int row = 0; row < m_rows; ++row) {
+        const double y = m_bounds.minY + (row + 0.5) * m_cellHeight;
+
+        crossings.clear();
+        for (int cell = row * m_columns; cell < (row + 1) * m_columns; ++cell) {
+            for (int k = m_cellOffsets[cell]; k < m_cellOffsets[cell + 1]; ++k) {
+                const int e = m_cellEdges[k];
+                if (lastRowSeen[e] == row) continue;
+                lastRowSeen[e] = row;
+
+                const Edge &edge = m_edges[e];
+                if ((edge.y0 > y) != (edge.y1 > y)) {
+                    crossings.push_back(edge.x0 + (y - edge.y0) * (edge.x1 - edge.x0) / (edge.y1 - edge.y0));
+                }
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        size_t passed = 0;
+        for (int column = 0; column < m_columns; ++column) {
+            const double x = m_bounds.minX + (column + 0.5) * m_cellWidth;
+            while (passed < crossings.size() && crossings[passed] < x) {
+                ++passed;
+            }
+
+            const int cell = row * m_columns + column;
+            const bool inside = (passed & 1) != 0;
+            m_centerInside[cell] = inside ? 1 : 0;
+            if (m_cellOffsets[cell + 1] > m_cellOffsets[cell]) {
+                m_state[cell] = BoundaryCell;
+            } else {
+                m_state[cell] = inside ? InsideCell : OutsideCell;
+            }
+        }
+    }
+
+    return true;
+}
+
+int PolygonGridIndex::cellOf(double x, double y) const
+{
+    return clampIndex((y - m_bounds.minY) * m_inverseCellHeight, m_rows) * m_columns +
+           clampIndex((x - m_bounds.minX) * m_inverseCellWidth, m_columns);
+}
+
+bool PolygonGridIndex::classify(int cell, double x, double y) const
+{
+    switch (m_state[cell]) {
+    case InsideCell:
+        return true;
+    case OutsideCell:
+        return false;
+    default:
+        break;
+    }
+
+    // Parity of the cell centre, flipped by every edge the centre->point
+    // segment crosses. Edge endpoints are half-open so shared vertices count once.
+    const int row = cell / m_columns;
+    const int column = cell % m_columns;
+    const double cx = m_bounds.minX + (column + 0.5) * m_cellWidth;
+    const double cy = m_bounds.minY + (row + 0.5) * m_cellHeight;
+
+    bool inside = m_centerInside[cell] != 0;
+    for (int k = m_cellOffsets[cell]; k < m_cellOffsets[cell + 1]; ++k) {
+        const Edge &edge = m_edges[m_cellEdges[k]];
+        const bool side0 = orient(cx, cy, x, y, edge.x0, edge.y0) > 0.0;
+        const bool side1 = orient(cx, cy, x, y, edge.x1, edge.y1) > 0.0;
+        if (side0 == side1) continue;
+
+        const bool centerSide = orient(edge.x0, edge.y0, edge.x1, edge.y1, cx, cy) > 0.0;
+        const bool pointSide = orient(edge.x0, edge.y0, edge.x1, edge.y1, x, y) > 0.0;
+        if (centerSide != pointSide) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool PolygonGridIndex::contains(double x, double y) const
+{
+    if (m_edges.empty() || !m_bounds.contains(x, y)) return false;
+    return classify(cellOf(x, y), x, y);
+}
+
+void PolygonGridIndex::containsBatch(const double *xs, const double *ys, int count,
+                                     unsigned char *inside) const
+{
+    if (m_edges.empty()) {
+        std::fill(inside, inside + count, 0);
+        return;
+    }
+
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128d minX = _mm_set1_pd(m_bounds.minX);
+    const __m128d minY = _mm_set1_pd(m_bounds.minY);
+    const __m128d maxX = _mm_set1_pd(m_bounds.maxX);
+    const __m128d maxY = _mm_set1_pd(m_bounds.maxY);
+    const __m128d inverseWidth = _mm_set1_pd(m_inverseCellWidth);
+    const __m128d inverseHeight = _mm_set1_pd(m_inverseCellHeight);
+    const __m128d lastColumn = _mm_set1_pd(m_columns - 1);
+    const __m128d lastRow = _mm_set1_pd(m_rows - 1);
+    const __m128d zero = _mm_setzero_pd();
+
+    for (; i + 2 <= count; i += 2) {
+        const __m128d x = _mm_loadu_pd(xs + i);
+        const __m128d y = _mm_loadu_pd(ys + i);
+
+        // Bounds test for both points; NaN compares false and lands outside
+        const __m128d inBounds = _mm_and_pd(
+                    _mm_and_pd(_mm_cmpge_pd(x, minX), _mm_cmple_pd(x, maxX)),
+                    _mm_and_pd(_mm_cmpge_pd(y, minY), _mm_cmple_pd(y, maxY)));
+        const int mask = _mm_movemask_pd(inBounds);
+        if (mask == 0) {
+            inside[i] = 0;
+            inside[i + 1] = 0;
+            continue;
+        }
+
+        const __m128d column = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_sub_pd(x, minX), inverseWidth), zero), lastColumn);
+        const __m128d row = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_sub_pd(y, minY), inverseHeight), zero), lastRow);
+        const __m128i columns = _mm_cvttpd_epi32(column);
+        const __m128i rows = _mm_cvttpd_epi32(row);
+
+        const int cell0 = _mm_cvtsi128_si32(rows) * m_columns + _mm_cvtsi128_si32(columns);
+        const int cell1 = _mm_cvtsi128_si32(_mm_shuffle_epi32(rows, 1)) * m_columns +
+                          _mm_cvtsi128_si32(_mm_shuffle_epi32(columns, 1));
+
+        inside[i] = (mask & 1) && classify(cell0, xs[i], ys[i]) ? 1 : 0;
+        inside[i + 1] = (mask & 2) && classify(cell1, xs[i + 1], ys[i + 1]) ? 1 : 0;
+    }
+#endif
+
+    for (; i < count; ++i) {
+        inside[i] = contains(xs[i], ys[i]) ? 1 : 0;
+    }
+}
+
+// Generators
+
+bool PointGenerators::randomPointsInExtent(const Envelope &extent, int count, quint64 seed,
+                                           const QString &srsWkt, FeatureBuffer *output,
+                                           ProcessingFeedback *feedback, QString *errorMessage)
+{
+    if (!output || extent.isNull() || count <= 0) {
+        if (errorMessage) *errorMessage = "A valid extent and a positive point count are required";
+        return false;
+    }
+
+    preparePointOutput(srsWkt, output);
+    if (count > FeatureBuffer::maxFeatures(output->fieldCount())) {
+        if (errorMessage) *errorMessage = tooManyPoints(*output);
+        return false;
+    }
+
+    const int batchCount = (count + BatchSize - 1) / BatchSize;
+    QVector<FeatureBuffer> chunkResults(batchCount);
+
+    parallelForChunks(batchCount, 1, feedback, [&](int batch, int, int) {
+        const int points = qMin(BatchSize, count - batch * BatchSize);
+        RandomGenerator random(seed, static_cast<quint64>(batch));
+
+        FeatureBuffer &result = chunkResults[batch];
+        result.copySchema(*output);
+        result.reserve(points, static_cast<qint64>(points) * 21);
+
+        for (int k = 0; k < points; ++k) {
+            const double x = extent.minX + random.uniform() * extent.width();
+            const double y = extent.minY + random.uniform() * extent.height();
+            result.appendPoint(x, y, nullptr);
+        }
+    });
+
+    return finishPoints(chunkResults, output, feedback, errorMessage);
+}
+
+bool PointGenerators::randomPointsInPolygons(const FeatureBuffer &polygons, int count, quint64 seed,
+                                             FeatureBuffer *output, ProcessingFeedback *feedback,
+                                             QString *errorMessage)
+{
+    if (!output || count <= 0) {
+        if (errorMessage) *errorMessage = "A positive point count is required";
+        return false;
+    }
+
+    preparePointOutput(polygons.spatialReferenceWkt(), output);
+    if (count > FeatureBuffer::maxFeatures(output->fieldCount())) {
+        if (errorMessage) *errorMessage = tooManyPoints(*output);
+        return false;
+    }
+
+    const int polygonCount = polygons.count();
+    std::vector<PolygonGridIndex> indexes(polygonCount);
+    parallelForChunks(polygonCount, coarseChunkSize(polygonCount), feedback,
+                      [&](int, int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            indexes[i].build(polygons.wkb(i), polygons.wkbSize(i));
+        }
+    });
+
+    // Polygons without an area, or with flat bounds, get no points: sampling
+    // them would use up the whole attempt budget and place nothing
+    std::vector<double> areas(polygonCount, 0.0);
+    double totalArea = 0.0;
+    for (int i = 0; i < polygonCount; ++i) {
+        const Envelope &bounds = indexes[i].bounds();
+        if (bounds.isNull() || !(bounds.width() > 0.0) || !(bounds.height() > 0.0)) continue;
+        areas[i] = qMax(0.0, indexes[i].area());
+        totalArea += areas[i];
+    }
+    if (!(totalArea > 0.0)) {
+        if (errorMessage) *errorMessage = "The layer has no polygons with an area";
+        return false;
+    }
+
+    // Points per polygon in proportion to area (largest remainder rounding)
+    std::vector<int> counts(polygonCount, 0);
+    std::vector<std::pair<double, int>> remainders;
+    remainders.reserve(polygonCount);
+    int assigned = 0;
+    for (int i = 0; i < polygonCount; ++i) {
+        const double exact = count * (areas[i] / totalArea);
+        counts[i] = static_cast<int>(std::floor(exact));
+        assigned += counts[i];
+        remainders.push_back(std::make_pair(exact - counts[i], i));
+    }
+    const int missing = qMin(count - assigned, polygonCount);
+    std::partial_sort(remainders.begin(), remainders.begin() + missing, remainders.end(),
+                      [](const std::pair<double, int> &a, const std::pair<double, int> &b) {
+        return a.first > b.first;
+    });
+    for (int k = 0; k < missing; ++k) {
+        ++counts[remainders[k].second];
+    }
+
+    // Large polygons are split so one country polygon still uses every thread
+    struct Batch {
+        int polygon;
+        int points;
+    };
+    std::vector<Batch> batches;
+    for (int i = 0; i < polygonCount; ++i) {
+        for (int left = counts[i]; left > 0; left -= BatchSize) {
+            Batch batch = { i, qMin(left, BatchSize) };
+            batches.push_back(batch);
+        }
+    }
+
+    const int batchCount = static_cast<int>(batches.size());
+    const int chunkSize = coarseChunkSize(batchCount);
+    QVector<FeatureBuffer> chunkResults((batchCount + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(batchCount, chunkSize, feedback, [&](int chunk, int begin, int end) {
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        double xs[BlockSize];
+        double ys[BlockSize];
+        unsigned char inside[BlockSize];
+
+        for (int b = begin; b < end; ++b) {
+            if (feedback && feedback->isCanceled()) return;
+
+            const Batch &batch = batches[b];
+            const PolygonGridIndex &index = indexes[batch.polygon];
+            const Envelope &bounds = index.bounds();
+            RandomGenerator random(seed, static_cast<quint64>(b));
+
+            // Slivers with a tiny area relative to their bounds give up eventually
+            const qint64 maxAttempts = static_cast<qint64>(batch.points) * 10000 + BlockSize;
+            qint64 attempts = 0;
+            int accepted = 0;
+
+            while (accepted < batch.points && attempts < maxAttempts) {
+                for (int k = 0; k < BlockSize; ++k) {
+                    xs[k] = bounds.minX + random.uniform() * bounds.width();
+                    ys[k] = bounds.minY + random.uniform() * bounds.height();
+                }
+                attempts += BlockSize;
+
+                index.containsBatch(xs, ys, BlockSize, inside);
+                for (int k = 0; k < BlockSize && accepted < batch.points; ++k) {
+                    if (inside[k]) {
+                        result.appendPoint(xs[k], ys[k], nullptr);
+                        ++accepted;
+                    }
+                }
+            }
+        }
+    });
+
+    if (!finishPoints(chunkResults, output, feedback, errorMessage)) return false;
+
+    // Still a result, but the caller is told what is missing
+    if (output->count() < count && errorMessage) {
+        *errorMessage = QString("Only %1 of %2 points were placed: some polygons are too thin "
+                                "for their share of points to be found by sampling")
+                .arg(output->count()).arg(count);
+    }
+    return true;
+}
+
+bool PointGenerators::regularPoints(const Envelope &extent, double spacing, const FeatureBuffer *mask,
+                                    const QString &srsWkt, FeatureBuffer *output,
+                                    ProcessingFeedback *feedback, QString *errorMessage)
+{
+    if (!output || extent.isNull() || !(spacing > 0.0)) {
+        if (errorMessage) *errorMessage = "A valid extent and a positive spacing are required";
+        return false;
+    }
+
+    preparePointOutput(srsWkt, output);
+
+    const double half = spacing * 0.5;
+    const qint64 columns = extent.width() >= half ?
+                static_cast<qint64>(std::floor((extent.width() - half) / spacing)) + 1 : 0;
+    const qint64 rows = extent.height() >= half ?
+                static_cast<qint64>(std::floor((extent.height() - half) / spacing)) + 1 : 0;
+
+    if (columns <= 0 || rows <= 0) return true;
+    if (columns * rows > FeatureBuffer::maxFeatures(output->fieldCount())) {
+        if (errorMessage) *errorMessage = tooManyPoints(*output) + "; increase the spacing";
+        return false;
+    }
+
+    std::vector<PolygonGridIndex> indexes;
+    SpatialIndex maskIndex;
+    if (mask) {
+        indexes.resize(mask->count());
+        parallelForChunks(mask->count(), coarseChunkSize(mask->count()), feedback,
+                          [&](int, int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                indexes[i].build(mask->wkb(i), mask->wkbSize(i));
+            }
+        });
+
+        QVector<Envelope> bounds;
+        bounds.reserve(static_cast<int>(indexes.size()));
+        for (const PolygonGridIndex &index : indexes) {
+            bounds.append(index.bounds());
+        }
+        maskIndex.build(bounds);
+    }
+
+    const int rowCount = static_cast<int>(rows);
+    const int columnCount = static_cast<int>(columns);
+    const double firstX = extent.minX + half;
+    const double firstY = extent.minY + half;
+
+    const int chunkSize = qMax(1, coarseChunkSize(rowCount));
+    QVector<FeatureBuffer> chunkResults((rowCount + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(rowCount, chunkSize, feedback, [&](int chunk, int begin, int end) {
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        std::vector<double> xs(columnCount);
+        std::vector<double> ys(columnCount);
+        std::vector<unsigned char> keep(columnCount);
+        std::vector<unsigned char> inside(columnCount);
+        for (int c = 0; c < columnCount; ++c) {
+            xs[c] = firstX + c * spacing;
+        }
+
+        QVector<int> candidates;
+
+        for (int r = begin; r < end; ++r) {
+            const double y = firstY + r * spacing;
+
+            if (!mask) {
+                for (int c = 0; c < columnCount; ++c) {
+                    result.appendPoint(xs[c], y, nullptr);
+                }
+                continue;
+            }
+
+            // Only polygons crossing this row, each tested on its own x-range
+            std::fill(keep.begin(), keep.end(), 0);
+            candidates.clear();
+            maskIndex.query(Envelope(extent.minX, y, extent.maxX, y), &candidates);
+
+            for (int id : candidates) {
+                const Envelope &bounds = indexes[id].bounds();
+                const int first = qMax(0, static_cast<int>(std::ceil((bounds.minX - firstX) / spacing)));
+                const int last = qMin(columnCount - 1, static_cast<int>(std::floor((bounds.maxX - firstX) / spacing)));
+                if (first > last) continue;
+
+                const int length = last - first + 1;
+                std::fill(ys.begin() + first, ys.begin() + last + 1, y);
+                indexes[id].containsBatch(xs.data() + first, ys.data() + first, length,
+                                          inside.data() + first);
+                for (int c = first; c <= last; ++c) {
+                    keep[c] |= inside[c];
+                }
+            }
+
+            for (int c = 0; c < columnCount; ++c) {
+                if (keep[c]) {
+                    result.appendPoint(xs[c], y, nullptr);
+                }
+            }
+        }
+    });
+
+    return finishPoints(chunkResults, output, feedback, errorMessage);
+}
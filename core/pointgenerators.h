@@ -0,0 +1,91 @@
+#ifndef POINTGENERATORS_H
+#define POINTGENERATORS_H
+
+#include <QString>
+
+#include <vector>
+
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+
+// Point-in-polygon acceleration for one (multi)polygon, even-odd rule.
+// A uniform grid over the polygon bounds marks each cell inside, outside or
+// boundary. Only points in boundary cells are tested against edges, and then
+// only against the few edges crossing that cell, starting from the known
+// status of the cell centre. Read-only after build(), so it can be shared by
+// any number of threads.
+class PolygonGridIndex
+{
+public:
+    PolygonGridIndex();
+
+    bool build(const unsigned char *wkb, int size);
+
+    const Envelope &bounds() const { return m_bounds; }
+    double area() const { return m_area; }
+    bool isEmpty() const { return m_edges.empty(); }
+
+    bool contains(double x, double y) const;
+
+    // Classifies 'count' points at once, writing 1 (inside) or 0 to 'inside'.
+    // Bounds and cell lookups are vectorised where SSE2 is available.
+    void containsBatch(const double *xs, const double *ys, int count,
+                       unsigned char *inside) const;
+
+private:
+    enum CellState : unsigned char {
+        OutsideCell,
+        InsideCell,
+        BoundaryCell
+    };
+
+    struct Edge {
+        double x0, y0, x1, y1;
+    };
+
+    template <typename Visitor>
+    void forEachEdgeCell(const Edge &edge, Visitor visitor) const;
+
+    int cellOf(double x, double y) const;
+    bool classify(int cell, double x, double y) const;
+
+    Envelope m_bounds;
+    double m_area;
+    int m_columns;
+    int m_rows;
+    double m_cellWidth;
+    double m_cellHeight;
+    double m_inverseCellWidth;
+    double m_inverseCellHeight;
+
+    std::vector<Edge> m_edges;
+    std::vector<unsigned char> m_state;
+    std::vector<unsigned char> m_centerInside;
+    std::vector<int> m_cellOffsets;   // CSR: edges of cell c are m_cellEdges[offsets[c] .. offsets[c + 1])
+    std::vector<int> m_cellEdges;
+};
+
+namespace PointGenerators
+{
+    // 'count' uniformly distributed points inside 'extent'
+    bool randomPointsInExtent(const Envelope &extent, int count, quint64 seed,
+                              const QString &srsWkt, FeatureBuffer *output,
+                              ProcessingFeedback *feedback = nullptr,
+                              QString *errorMessage = nullptr);
+
+    // 'count' points spread over the polygons of 'polygons' in proportion to
+    // their area, each drawn uniformly inside its polygon. When sampling
+    // cannot place them all, fewer are returned and 'errorMessage' says so.
+    bool randomPointsInPolygons(const FeatureBuffer &polygons, int count, quint64 seed,
+                                FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+                                QString *errorMessage = nullptr);
+
+    // Points on a 'spacing' grid over 'extent', starting half a spacing in.
+    // With a 'mask' only points falling inside one of its polygons are kept.
+    bool regularPoints(const Envelope &extent, double spacing, const FeatureBuffer *mask,
+                       const QString &srsWkt, FeatureBuffer *output,
+                       ProcessingFeedback *feedback = nullptr,
+                       QString *errorMessage = nullptr);
+}
+
+#endif // POINTGENERATORS_H
@@ -0,0 +1,229 @@
+#include "processingjobs.h"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QThread>
+
+#include <gdal_priv.h>
+#include <ogrsf_frmts.h>
+
+// ProcessingInput
+
+bool ProcessingInput::readExtent(Envelope *extent) const
+{
+    if (memory) {
+        *extent = memory->extent();
+        return true;
+    }
+
+    GDALDataset *dataset = static_cast<GDALDataset*>(
+                GDALOpenEx(filePath.toUtf8().constData(), GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                           nullptr, nullptr, nullptr));
+    if (!dataset) return false;
+
+    bool ok = false;
+    OGRLayer *layer = dataset->GetLayer(layerIndex);
+    OGREnvelope envelope;
+    if (layer && layer->GetExtent(&envelope, TRUE) == OGRERR_NONE) {
+        *extent = Envelope(envelope.MinX, envelope.MinY, envelope.MaxX, envelope.MaxY);
+        ok = true;
+    }
+
+    GDALClose(dataset);
+    return ok;
+}
+
+QSharedPointer<const FeatureBuffer> ProcessingInput::load(QString *errorMessage) const
+{
+    if (memory) {
+        return memory;
+    }
+
+    QSharedPointer<FeatureBuffer> buffer(new FeatureBuffer());
+    if (!FeatureBuffer::readFromFile(filePath, layerIndex, buffer.data(), errorMessage)) {
+        return QSharedPointer<const FeatureBuffer>();
+    }
+    return buffer;
+}
+
+// Forwards worker-side progress to the scheduler's thread
+class ProcessingJobScheduler::JobFeedback : public ProcessingFeedback
+{
+public:
+    JobFeedback(ProcessingJobScheduler *scheduler, int jobId)
+        : m_scheduler(scheduler), m_jobId(jobId) {}
+
+protected:
+    void progressChanged(double percent) override
+    {
+        QPointer<ProcessingJobScheduler> scheduler = m_scheduler;
+        const int jobId = m_jobId;
+        QMetaObject::invokeMethod(m_scheduler, [scheduler, jobId, percent]() {
+            if (scheduler) {
+                emit scheduler->jobProgress(jobId, percent);
+            }
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    ProcessingJobScheduler *m_scheduler;
+    int m_jobId;
+};
+
+// ProcessingJobScheduler
+
+ProcessingJobScheduler::ProcessingJobScheduler(QObject *parent)
+    : QObject(parent)
+    , m_nextId(1)
+{
+    // Algorithms already spread each job over every core; a few concurrent
+    // jobs keep the pool busy while one of them is reading its inputs
+    m_pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+}
+
+ProcessingJobScheduler::~ProcessingJobScheduler()
+{
+    cancelAll();
+    m_pool.waitForDone();
+}
+
+int ProcessingJobScheduler::submit(const QString &name, const JobFunction &function)
+{
+    QSharedPointer<Job> job(new Job());
+    job->name = name;
+    job->function = function;
+    job->state = Queued;
+    job->elapsedMs = 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        job->id = m_nextId++;
+        job->feedback = QSharedPointer<JobFeedback>(new JobFeedback(this, job->id));
+        m_jobs.insert(job->id, job);
+    }
+
+    emit jobQueued(job->id, name);
+    m_pool.start([this, job]() { run(job); });
+    return job->id;
+}
+
+void ProcessingJobScheduler::run(QSharedPointer<Job> job)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (job->feedback->isCanceled()) {
+            job->state = Canceled;
+        } else {
+            job->state = Running;
+            job->timer.start();
+        }
+    }
+
+    const int jobId = job->id;
+    QPointer<ProcessingJobScheduler> self(this);
+
+    if (job->state == Running) {
+        QMetaObject::invokeMethod(this, [self, jobId]() {
+            if (self) emit self->jobStarted(jobId);
+        }, Qt::QueuedConnection);
+
+        QSharedPointer<FeatureBuffer> output(new FeatureBuffer());
+        QString errorMessage;
+        bool success = job->function(job->feedback.data(), output.data(), &errorMessage);
+
+        QMutexLocker locker(&m_mutex);
+        job->elapsedMs = job->timer.elapsed();
+        job->function = JobFunction();   // drop captured inputs early
+        if (job->feedback->isCanceled()) {
+            job->state = Canceled;
+            job->errorMessage = "Canceled";
+        } else if (success) {
+            job->state = Finished;
+            job->result = output;
+            job->errorMessage = errorMessage;
+        } else {
+            job->state = Failed;
+            job->errorMessage = errorMessage;
+        }
+    }
+
+    const bool success = (job->state == Finished);
+    QMetaObject::invokeMethod(this, [self, jobId, success]() {
+        if (self) emit self->jobFinished(jobId, success);
+    }, Qt::QueuedConnection);
+}
+
+void ProcessingJobScheduler::cancel(int jobId)
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.value(jobId);
+    if (job && job->feedback) {
+        job->feedback->cancel();
+    }
+}
+
+void ProcessingJobScheduler::cancelAll()
+{
+    QMutexLocker locker(&m_mutex);
+    for (const QSharedPointer<Job> &job : m_jobs) {
+        job->feedback->cancel();
+    }
+}
+
+void ProcessingJobScheduler::setMaxConcurrentJobs(int count)
+{
+    m_pool.setMaxThreadCount(qMax(1, count));
+}
+
+int ProcessingJobScheduler::maxConcurrentJobs() const
+{
+    return m_pool.maxThreadCount();
+}
+
+int ProcessingJobScheduler::activeJobCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    int count = 0;
+    for (const QSharedPointer<Job> &job : m_jobs) {
+        if (job->state == Queued || job->state == Running) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+ProcessingJobScheduler::JobState ProcessingJobScheduler::state(int jobId) const
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.value(jobId);
+    return job ? job->state : Canceled;
+}
+
+QString ProcessingJobScheduler::name(int jobId) const
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.value(jobId);
+    return job ? job->name : QString();
+}
+
+QString ProcessingJobScheduler::errorMessage(int jobId) const
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.value(jobId);
+    return job ? job->errorMessage : QString();
+}
+
+qint64 ProcessingJobScheduler::elapsedMs(int jobId) const
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.value(jobId);
+    return job ? job->elapsedMs : 0;
+}
+
+QSharedPointer<FeatureBuffer> ProcessingJobScheduler::takeResult(int jobId)
+{
+    QMutexLocker locker(&m_mutex);
+    QSharedPointer<Job> job = m_jobs.take(jobId);
+    return job ? job->result : QSharedPointer<FeatureBuffer>();
+}
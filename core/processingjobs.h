@@ -0,0 +1,106 @@
+#ifndef PROCESSINGJOBS_H
+#define PROCESSINGJOBS_H
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+
+// A layer an algorithm reads. Captured by value on the GUI thread and
+// loaded by the job on its worker thread. Memory layers hand over their
+// buffer directly, so chained algorithms never go through a file.
+struct ProcessingInput
+{
+    QString name;
+    QString filePath;
+    int layerIndex = 0;
+    QSharedPointer<const FeatureBuffer> memory;
+    QString geometryType;   // as shown in the layer properties
+
+    bool isPolygonLayer() const { return geometryType.contains("Polygon"); }
+
+    // Layer extent from the data source, without reading the features
+    bool readExtent(Envelope *extent) const;
+    QSharedPointer<const FeatureBuffer> load(QString *errorMessage) const;
+};
+
+// Runs processing algorithms in the background. Jobs are queued on a pool
+// of their own, so a long job never blocks the chunk workers the algorithms
+// use on the global pool, and several jobs can run side by side. All signals
+// are delivered on the scheduler's (GUI) thread.
+class ProcessingJobScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Runs on a worker thread: fill 'output' and return true, or set
+    // 'errorMessage' and return false. A message set on success is a
+    // warning shown with the result. Must not touch GUI objects.
+    typedef std::function<bool(ProcessingFeedback *feedback, FeatureBuffer *output,
+                               QString *errorMessage)> JobFunction;
+
+    enum JobState {
+        Queued,
+        Running,
+        Finished,
+        Failed,
+        Canceled
+    };
+
+    explicit ProcessingJobScheduler(QObject *parent = nullptr);
+    ~ProcessingJobScheduler();
+
+    int submit(const QString &name, const JobFunction &function);
+    void cancel(int jobId);
+    void cancelAll();
+
+    void setMaxConcurrentJobs(int count);
+    int maxConcurrentJobs() const;
+    int activeJobCount() const;
+
+    JobState state(int jobId) const;
+    QString name(int jobId) const;
+    QString errorMessage(int jobId) const;
+    qint64 elapsedMs(int jobId) const;
+
+    // Hands the result of a finished job to the caller and forgets the job
+    QSharedPointer<FeatureBuffer> takeResult(int jobId);
+
+signals:
+    void jobQueued(int jobId, const QString &name);
+    void jobStarted(int jobId);
+    void jobProgress(int jobId, double percent);
+    void jobFinished(int jobId, bool success);
+
+private:
+    class JobFeedback;
+
+    struct Job {
+        int id;
+        QString name;
+        JobFunction function;
+        JobState state;
+        QSharedPointer<JobFeedback> feedback;
+        QSharedPointer<FeatureBuffer> result;
+        QString errorMessage;
+        QElapsedTimer timer;
+        qint64 elapsedMs;
+    };
+
+    void run(QSharedPointer<Job> job);
+
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;
+    QMap<int, QSharedPointer<Job>> m_jobs;
+    int m_nextId;
+};
+
+#endif // PROCESSINGJOBS_H
@@ -0,0 +1,196 @@
+#include "profiler.h"
+
+#include <QFile>
+#include <QGraphicsItem>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVariant>
+
+#include <gdal.h>
+
+QAtomicInteger<int> Profiler::s_enabled(0);
+
+Profiler::Profiler()
+    : m_nextEvent(0)
+    , m_nextFrame(0)
+    , m_frameStart(0)
+{
+    m_clock.start();
+}
+
+Profiler &Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+const char *Profiler::phaseName(Phase phase)
+{
+    switch (phase) {
+    case Fetch: return "fetch";
+    case Transform: return "transform";
+    case Rasterise: return "rasterise";
+    case Composite: return "composite";
+    default: return "other";
+    }
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    if (enabled && !isEnabled()) {
+        clear();
+    }
+    s_enabled.storeRelaxed(enabled ? 1 : 0);
+}
+
+void Profiler::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_events.clear();
+    m_nextEvent = 0;
+    m_frames.clear();
+    m_nextFrame = 0;
+    m_clock.restart();
+    for (int i = 0; i < PhaseCount; ++i) {
+        m_phaseTotals[i].storeRelaxed(0);
+    }
+    m_gdalBytes.storeRelaxed(0);
+    m_tileHits.storeRelaxed(0);
+    m_tileMisses.storeRelaxed(0);
+}
+
+void Profiler::record(Phase phase, const char *name, qint64 start, qint64 duration, const QString &layer)
+{
+    if (!isEnabled()) return;
+    m_phaseTotals[phase].fetchAndAddRelaxed(duration);
+
+    Event event = { name, phase, start, duration, quint64(quintptr(QThread::currentThreadId())), layer };
+    QMutexLocker locker(&m_mutex);
+    if (m_events.size() < MaxEvents) {
+        m_events.append(event);
+    } else {
+        m_events[m_nextEvent] = event;
+        m_nextEvent = (m_nextEvent + 1) % MaxEvents;
+    }
+}
+
+void Profiler::addGdalBytes(qint64 bytes)
+{
+    if (isEnabled()) m_gdalBytes.fetchAndAddRelaxed(bytes);
+}
+
+void Profiler::addTileLookup(bool hit)
+{
+    if (!isEnabled()) return;
+    if (hit) {
+        m_tileHits.fetchAndAddRelaxed(1);
+    } else {
+        m_tileMisses.fetchAndAddRelaxed(1);
+    }
+}
+
+void Profiler::beginFrame()
+{
+    m_frameStart = now();
+}
+
+void Profiler::endFrame()
+{
+    if (!isEnabled()) return;
+
+    // Totals are taken and reset together, so work reported by a worker
+    // between two frames goes to the next one
+    Frame frame;
+    frame.start = m_frameStart;
+    frame.duration = now() - m_frameStart;
+    for (int i = 0; i < PhaseCount; ++i) {
+        frame.phases[i] = m_phaseTotals[i].fetchAndStoreRelaxed(0);
+    }
+    frame.gdalBytes = m_gdalBytes.fetchAndStoreRelaxed(0);
+    frame.gdalCacheBytes = GDALGetCacheUsed64();
+    frame.tileHits = m_tileHits.fetchAndStoreRelaxed(0);
+    frame.tileMisses = m_tileMisses.fetchAndStoreRelaxed(0);
+
+    QMutexLocker locker(&m_mutex);
+    if (m_frames.size() < MaxFrames) {
+        m_frames.append(frame);
+    } else {
+        m_frames[m_nextFrame] = frame;
+        m_nextFrame = (m_nextFrame + 1) % MaxFrames;
+    }
+}
+
+QVector<Profiler::Frame> Profiler::frames() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_frames.mid(m_nextFrame) + m_frames.mid(0, m_nextFrame);
+}
+
+bool Profiler::writeChromeTrace(const QString &path, QString *errorMessage) const
+{
+    QVector<Event> events;
+    QVector<Frame> frames;
+    {
+        QMutexLocker locker(&m_mutex);
+        events = m_events.mid(m_nextEvent) + m_events.mid(0, m_nextEvent);
+        frames = m_frames.mid(m_nextFrame) + m_frames.mid(0, m_nextFrame);
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+
+    // Written by hand, event by event: a full trace is too large to build
+    // as one QJsonDocument first
+    auto escaped = [](const QString &text) {
+        QString result = text;
+        result.replace('\\', "\\\\").replace('"', "\\\"");
+        return result.toUtf8();
+    };
+    auto microseconds = [](qint64 ns) { return QByteArray::number(ns / 1000.0, 'f', 3); };
+
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto writeLine = [&file, &first](const QByteArray &line) {
+        if (!first) file.write(",\n");
+        file.write(line);
+        first = false;
+    };
+
+    for (const Frame &frame : frames) {
+        writeLine("{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":"
+                  + microseconds(frame.start) + ",\"dur\":" + microseconds(frame.duration) + "}");
+        writeLine("{\"name\":\"gdal\",\"ph\":\"C\",\"pid\":1,\"ts\":" + microseconds(frame.start)
+                  + ",\"args\":{\"bytes read\":" + QByteArray::number(frame.gdalBytes)
+                  + ",\"block cache\":" + QByteArray::number(frame.gdalCacheBytes) + "}}");
+        writeLine("{\"name\":\"tile cache\",\"ph\":\"C\",\"pid\":1,\"ts\":" + microseconds(frame.start)
+                  + ",\"args\":{\"hits\":" + QByteArray::number(frame.tileHits)
+                  + ",\"misses\":" + QByteArray::number(frame.tileMisses) + "}}");
+    }
+    for (const Event &event : events) {
+        QByteArray line = "{\"name\":\"" + escaped(QString::fromLatin1(event.name))
+                + "\",\"cat\":\"" + phaseName(event.phase)
+                + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(event.thread)
+                + ",\"ts\":" + microseconds(event.start) + ",\"dur\":" + microseconds(event.duration);
+        if (!event.layer.isEmpty()) {
+            line += ",\"args\":{\"layer\":\"" + escaped(event.layer) + "\"}";
+        }
+        writeLine(line + "}");
+    }
+    file.write("\n]}\n");
+
+    if (!file.flush()) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+void ProfileScope::finish()
+{
+    Profiler &profiler = Profiler::instance();
+    const QString layer = m_item ? m_item->data(Profiler::LayerNameKey).toString() : QString();
+    profiler.record(m_phase, m_name, m_start, profiler.now() - m_start, layer);
+}
@@ -0,0 +1,123 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class QGraphicsItem;
+
+// Where the map spends its time. Rendering code reports phases (reading
+// data, transforming it, rasterising, compositing) from any thread; the map
+// view brackets each frame. While disabled every entry point returns after
+// one relaxed atomic load.
+class Profiler
+{
+public:
+    enum Phase {
+        Fetch,
+        Transform,
+        Rasterise,
+        Composite,
+        PhaseCount
+    };
+
+    struct Event {
+        const char *name;
+        Phase phase;
+        qint64 start;       // ns since the profiler was enabled
+        qint64 duration;    // ns
+        quint64 thread;
+        QString layer;
+    };
+
+    // Totals of what was reported while a frame was being painted (worker
+    // threads included)
+    struct Frame {
+        qint64 start = 0;
+        qint64 duration = 0;
+        qint64 phases[PhaseCount] = {};
+        qint64 gdalBytes = 0;       // read by raster sources
+        qint64 gdalCacheBytes = 0;  // GDAL block cache in use at the end
+        int tileHits = 0;           // raster tiles found in an item's cache
+        int tileMisses = 0;
+    };
+
+    // Item data key the layer name of an item is stored under
+    static const int LayerNameKey = 0x5052;
+
+    static Profiler &instance();
+    static bool isEnabled() { return s_enabled.loadRelaxed() != 0; }
+    static const char *phaseName(Phase phase);
+
+    void setEnabled(bool enabled);
+    void clear();
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+
+    void record(Phase phase, const char *name, qint64 start, qint64 duration,
+                const QString &layer = QString());
+    void addGdalBytes(qint64 bytes);
+    void addTileLookup(bool hit);
+
+    // GUI thread, around the painting of one frame
+    void beginFrame();
+    void endFrame();
+
+    QVector<Frame> frames() const;  // oldest first
+
+    // Chrome trace event format (chrome://tracing, Perfetto)
+    bool writeChromeTrace(const QString &path, QString *errorMessage = nullptr) const;
+
+    static const int MaxEvents = 200000;
+    static const int MaxFrames = 600;
+
+private:
+    Profiler();
+
+    static QAtomicInteger<int> s_enabled;
+
+    QElapsedTimer m_clock;
+    mutable QMutex m_mutex;
+    QVector<Event> m_events;        // ring, m_nextEvent is the oldest when full
+    int m_nextEvent;
+    QVector<Frame> m_frames;        // ring as well
+    int m_nextFrame;
+
+    // Totals of the frame being painted
+    qint64 m_frameStart;
+    QAtomicInteger<qint64> m_phaseTotals[PhaseCount];
+    QAtomicInteger<qint64> m_gdalBytes;
+    QAtomicInteger<int> m_tileHits;
+    QAtomicInteger<int> m_tileMisses;
+};
+
+// Times the enclosing block as one phase. 'name' must outlive the profiler
+// (a literal); the layer name is looked up from 'item' only while enabled.
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler::Phase phase, const char *name, const QGraphicsItem *item = nullptr)
+        : m_name(Profiler::isEnabled() ? name : nullptr)
+        , m_phase(phase)
+        , m_item(item)
+        , m_start(m_name ? Profiler::instance().now() : 0)
+    {
+    }
+
+    ~ProfileScope()
+    {
+        if (m_name) finish();
+    }
+
+private:
+    void finish();
+
+    const char *m_name;
+    Profiler::Phase m_phase;
+    const QGraphicsItem *m_item;
+    qint64 m_start;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,559 @@
+#include "projectexport.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QSaveFile>
+#include <QSet>
+
+#include "projectpackage.h"
+
+namespace
+{
+    const char *ManifestFormat = "ppt-gis-export-manifest";
+    const int ManifestVersion = 1;
+
+    QString journalFileName()
+    {
+        return ProjectExporter::manifestFileName() + ".journal";
+    }
+}
+
+ProjectExporter::ProjectExporter(QObject *parent)
+    : QObject(parent)
+    , m_bytesTotal(0)
+    , m_bytesDone(0)
+    , m_remaining(0)
+    , m_running(false)
+    , m_canceled(0)
+{
+    // Copies wait on I/O, not on the CPU: several in flight keep a network
+    // mount or a RAID busy where one would leave it idle between requests
+    m_pool.setMaxThreadCount(8);
+}
+
+ProjectExporter::~ProjectExporter()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+bool ProjectExporter::start(const Project &project, const QString &directory, Format format)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_running) return false;
+
+    m_directory = directory;
+    m_project = project;
+    m_files.clear();
+    m_layerPaths.clear();
+    m_geoPackagePath = (project.name.isEmpty() ? QString("project") : project.name) + ".gpkg";
+    m_geoPackageLayers.clear();
+    m_geoPackageRows.clear();
+    m_layerTables.clear();
+    m_manifest.clear();
+    m_bytesTotal = 0;
+    m_bytesDone = 0;
+    m_canceled.storeRelease(0);
+
+    // One copy of every dataset with its sidecars, however many layers
+    // share it
+    QHash<QString, QString> datasets;   // absolute source -> dataset path
+    QHash<QString, int> tables;         // source and layer/table -> GeoPackage layer
+    for (const ProjectLayer &layer : project.layers) {
+        const QVariantMap &properties = layer.properties;
+        if (format == GeoPackage &&
+            GeoPackageExport::canStore(layer.type, properties.value("has_geotransform").toBool())) {
+            GeoPackageExport::Layer table;
+            table.name = layer.name;
+            table.raster = layer.type != "vector" && layer.type != "memory";
+            table.source = table.raster && properties.contains("gpkg_table")
+                    ? GeoPackageExport::rasterDatasetName(layer.source, properties.value("gpkg_table").toString())
+                    : layer.source;
+            table.layerIndex = properties.value("layer_index").toInt();
+
+            const QString key = QString("%1|%2").arg(table.source).arg(table.raster ? -1 : table.layerIndex);
+            if (tables.contains(key)) {
+                m_layerTables.insert(layer.name, tables.value(key));
+                continue;
+            }
+            tables.insert(key, m_geoPackageLayers.size());
+            m_layerTables.insert(layer.name, m_geoPackageLayers.size());
+
+            File file;
+            file.layer = layer.name;
+            file.source = layer.source;
+            file.path = m_geoPackagePath + ":" + layer.name;
+            file.dataset = m_geoPackagePath;
+            file.size = QFileInfo(layer.source).size();
+            m_bytesTotal += file.size;
+            m_geoPackageRows.append(m_files.size());
+            m_geoPackageLayers.append(table);
+            m_files.append(file);
+            continue;
+        }
+
+        const QString source = QFileInfo(layer.source).absoluteFilePath();
+        if (datasets.contains(source)) {
+            m_layerPaths.insert(layer.name, datasets.value(source));
+            continue;
+        }
+
+        const QString dataset = "layers/" + ProjectPackage::packagedFileName(layer.name, source, source);
+        datasets.insert(source, dataset);
+        m_layerPaths.insert(layer.name, dataset);
+
+        const QStringList sourceFiles = ProjectPackage::datasetFiles(source);
+        if (sourceFiles.isEmpty()) {
+            File file;
+            file.layer = layer.name;
+            file.source = source;
+            file.path = dataset;
+            file.dataset = dataset;
+            file.state = Failed;
+            file.errorMessage = "Source not found";
+            m_files.append(file);
+            continue;
+        }
+        for (const QString &sourceFile : sourceFiles) {
+            File file;
+            file.layer = layer.name;
+            file.source = sourceFile;
+            file.path = "layers/" + ProjectPackage::packagedFileName(layer.name, source, sourceFile);
+            file.dataset = dataset;
+            file.size = QFileInfo(sourceFile).size();
+            m_bytesTotal += file.size;
+            m_files.append(file);
+        }
+    }
+
+    QDir(directory).mkpath("layers");
+    m_manifest = readManifest(directory);
+
+    // Finished files are appended here as they complete, so an export that
+    // is interrupted can be resumed from the files it already wrote
+    m_journal.setFileName(QDir(directory).filePath(journalFileName()));
+    m_journal.open(QIODevice::WriteOnly | QIODevice::Append);
+
+    m_remaining = 0;
+    for (const File &file : m_files) {
+        if (file.state == Pending) ++m_remaining;
+    }
+    m_running = true;
+
+    if (m_remaining == 0) {
+        QMetaObject::invokeMethod(this, [this]() { finish(); }, Qt::QueuedConnection);
+        return true;
+    }
+    // The GeoPackage is one SQLite file: a single task writes all of it,
+    // alongside the file copies
+    if (!m_geoPackageRows.isEmpty()) {
+        m_pool.start([this]() { runGeoPackage(); });
+    }
+    for (int i = 0; i < m_files.size(); ++i) {
+        if (m_files[i].state == Pending && !m_geoPackageRows.contains(i)) {
+            m_pool.start([this, i]() { run(i); });
+        }
+    }
+    return true;
+}
+
+void ProjectExporter::cancel()
+{
+    m_canceled.storeRelease(1);
+}
+
+bool ProjectExporter::isRunning() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_running;
+}
+
+QString ProjectExporter::directory() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_directory;
+}
+
+QVector<ProjectExporter::File> ProjectExporter::files() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_files;
+}
+
+Project ProjectExporter::exportedProject() const
+{
+    QMutexLocker locker(&m_mutex);
+    QSet<QString> incomplete;
+    for (const File &file : m_files) {
+        if (file.state != Copied && file.state != Skipped) incomplete.insert(file.dataset);
+    }
+
+    Project project = m_project;
+    for (ProjectLayer &layer : project.layers) {
+        if (m_layerTables.contains(layer.name)) {
+            const int table = m_layerTables.value(layer.name);
+            const GeoPackageExport::Layer &written = m_geoPackageLayers[table];
+            if (m_files[m_geoPackageRows[table]].state != Copied) continue;
+
+            layer.source = QDir(m_directory).filePath(m_geoPackagePath);
+            if (written.raster) {
+                layer.properties["gpkg_table"] = written.table;
+            } else {
+                layer.properties.remove("gpkg_table");
+                layer.properties["layer_index"] = written.tableIndex;
+            }
+            continue;
+        }
+
+        const QString dataset = m_layerPaths.value(layer.name);
+        if (!dataset.isEmpty() && !incomplete.contains(dataset)) {
+            layer.source = QDir(m_directory).filePath(dataset);
+        }
+    }
+    return project;
+}
+
+void ProjectExporter::run(int index)
+{
+    File file;
+    ManifestEntry previous = {0, 0, 0, 0};
+    bool known = false;
+    QString directory;
+    {
+        QMutexLocker locker(&m_mutex);
+        file = m_files[index];
+        m_files[index].state = Copying;
+        known = m_manifest.contains(file.path);
+        if (known) previous = m_manifest.value(file.path);
+        directory = m_directory;
+    }
+
+    const QString target = QDir(directory).filePath(file.path);
+    const QFileInfo targetInfo(target);
+    const qint64 sourceModified = QFileInfo(file.source).lastModified().toMSecsSinceEpoch();
+
+    // What the manifest describes is still there untouched
+    const bool targetIntact = known && targetInfo.isFile() && targetInfo.size() == previous.size &&
+            targetInfo.lastModified().toMSecsSinceEpoch() == previous.modified;
+
+    FileState state = Failed;
+    QString errorMessage;
+    qint64 reported = 0;
+
+    if (m_canceled.loadAcquire()) {
+        state = Canceled;
+    } else if (targetIntact && previous.size == file.size && previous.sourceModified == sourceModified) {
+        // Source not touched since it was exported: not even read
+        state = Skipped;
+    } else {
+        quint64 checksum = 0;
+        const bool read = ProjectPackage::checksum(file.source, &checksum, [this](qint64) {
+            return !m_canceled.loadAcquire();
+        });
+
+        if (!read) {
+            state = m_canceled.loadAcquire() ? Canceled : Failed;
+            errorMessage = "Cannot read " + file.source;
+        } else if (targetIntact && previous.checksum == checksum) {
+            state = Skipped;
+            ManifestEntry entry = previous;
+            entry.sourceModified = sourceModified;
+            record(file.path, entry);
+        } else {
+            // Written in place: the manifest only lists it again once it is
+            // complete, so a half written file is copied again on resume
+            const bool copied = ProjectPackage::copyFile(file.source, target, [this, index, &reported](qint64 done) {
+                reportBytes(index, done, done - reported);
+                reported = done;
+                return !m_canceled.loadAcquire();
+            }, &errorMessage);
+
+            if (copied) {
+                const QFileInfo written(target);
+                ManifestEntry entry;
+                entry.size = written.size();
+                entry.modified = written.lastModified().toMSecsSinceEpoch();
+                entry.sourceModified = sourceModified;
+                entry.checksum = checksum;
+                record(file.path, entry);
+                state = Copied;
+            } else {
+                state = m_canceled.loadAcquire() ? Canceled : Failed;
+            }
+        }
+    }
+
+    // Whatever happened, the file no longer counts as outstanding
+    reportBytes(index, state == Copied || state == Skipped ? file.size : reported, file.size - reported);
+
+    bool last = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_files[index].state = state;
+        m_files[index].errorMessage = errorMessage;
+        last = --m_remaining == 0;
+    }
+
+    QPointer<ProjectExporter> self(this);
+    QMetaObject::invokeMethod(this, [self, index, state]() {
+        if (self) emit self->fileFinished(index, state);
+    }, Qt::QueuedConnection);
+    if (last) {
+        QMetaObject::invokeMethod(this, [self]() {
+            if (self) self->finish();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void ProjectExporter::runGeoPackage()
+{
+    QVector<GeoPackageExport::Layer> layers;
+    QVector<int> rows;
+    QVector<qint64> sizes;
+    QString directory;
+    {
+        QMutexLocker locker(&m_mutex);
+        layers = m_geoPackageLayers;
+        rows = m_geoPackageRows;
+        for (int row : rows) {
+            m_files[row].state = Copying;
+            sizes.append(m_files[row].size);
+        }
+        directory = m_directory;
+    }
+
+    // Written under a temporary name and renamed, so an interrupted export
+    // never leaves a GeoPackage that looks complete
+    const QString target = QDir(directory).filePath(m_geoPackagePath);
+    const QString partial = QDir(directory).filePath(QFileInfo(m_geoPackagePath).completeBaseName() + ".partial.gpkg");
+
+    QVector<qint64> reported(layers.size(), 0);
+    QString errorMessage;
+    bool written = !m_canceled.loadAcquire() &&
+            GeoPackageExport::write(partial, &layers, [this, &rows, &sizes, &reported](int layer, double fraction) {
+        const qint64 done = qint64(fraction * sizes[layer]);
+        reportBytes(rows[layer], done, done - reported[layer]);
+        reported[layer] = done;
+        return !m_canceled.loadAcquire();
+    }, &errorMessage);
+
+    if (written) {
+        QFile::remove(target);
+        written = QFile::rename(partial, target);
+        if (!written) errorMessage = "Cannot replace " + target;
+    } else {
+        QFile::remove(partial);
+    }
+
+    if (written) {
+        ManifestEntry entry;
+        const QFileInfo info(target);
+        entry.size = info.size();
+        entry.modified = info.lastModified().toMSecsSinceEpoch();
+        entry.sourceModified = 0;
+        entry.checksum = 0;
+        ProjectPackage::checksum(target, &entry.checksum);
+        record(m_geoPackagePath, entry);
+    }
+
+    const bool canceled = m_canceled.loadAcquire();
+    QVector<FileState> states;
+    bool last = false;
+    for (int i = 0; i < layers.size(); ++i) {
+        const FileState state = written && layers[i].written ? Copied : canceled ? Canceled : Failed;
+        states.append(state);
+        reportBytes(rows[i], state == Copied ? sizes[i] : reported[i], sizes[i] - reported[i]);
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_geoPackageLayers = layers;
+        for (int i = 0; i < rows.size(); ++i) {
+            m_files[rows[i]].state = states[i];
+            m_files[rows[i]].errorMessage = layers[i].errorMessage.isEmpty() ? errorMessage
+                                                                             : layers[i].errorMessage;
+        }
+        m_remaining -= rows.size();
+        last = m_remaining == 0;
+    }
+
+    QPointer<ProjectExporter> self(this);
+    for (int i = 0; i < rows.size(); ++i) {
+        const int index = rows[i];
+        const FileState state = states[i];
+        QMetaObject::invokeMethod(this, [self, index, state]() {
+            if (self) emit self->fileFinished(index, state);
+        }, Qt::QueuedConnection);
+    }
+    if (last) {
+        QMetaObject::invokeMethod(this, [self]() {
+            if (self) self->finish();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void ProjectExporter::reportBytes(int index, qint64 fileDone, qint64 delta)
+{
+    qint64 done = 0;
+    qint64 total = 0;
+    qint64 size = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_bytesDone += delta;
+        done = m_bytesDone;
+        total = m_bytesTotal;
+        size = m_files[index].size;
+    }
+
+    QPointer<ProjectExporter> self(this);
+    QMetaObject::invokeMethod(this, [self, index, fileDone, size, done, total]() {
+        if (!self) return;
+        emit self->fileProgress(index, fileDone, size);
+        emit self->progress(done, total);
+    }, Qt::QueuedConnection);
+}
+
+void ProjectExporter::finish()
+{
+    QString errorMessage;
+    const bool written = writeManifest(&errorMessage);
+
+    bool success = written;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const File &file : m_files) {
+            if (file.state != Copied && file.state != Skipped) success = false;
+        }
+        m_journal.close();
+        m_running = false;
+    }
+
+    // Everything the journal held is in the manifest now
+    if (written) {
+        QFile::remove(QDir(m_directory).filePath(journalFileName()));
+    }
+    emit finished(success);
+}
+
+QHash<QString, ProjectExporter::ManifestEntry> ProjectExporter::readManifest(const QString &path)
+{
+    const QDir directory(path);
+    QHash<QString, ManifestEntry> entries;
+    auto readEntry = [&entries](const QJsonObject &object) {
+        bool ok = false;
+        ManifestEntry entry;
+        entry.size = qint64(object["size"].toDouble());
+        entry.modified = qint64(object["modified"].toDouble());
+        entry.sourceModified = qint64(object["source_modified"].toDouble());
+        entry.checksum = object["xxh3"].toString().toULongLong(&ok, 16);
+        if (ok) entries.insert(object["path"].toString(), entry);
+    };
+
+    QFile manifest(directory.filePath(manifestFileName()));
+    if (manifest.open(QIODevice::ReadOnly)) {
+        const QJsonObject root = QJsonDocument::fromJson(manifest.readAll()).object();
+        if (root["format"].toString() == ManifestFormat && root["version"].toInt() <= ManifestVersion) {
+            for (const QJsonValue &value : root["files"].toArray()) {
+                readEntry(value.toObject());
+            }
+        }
+    }
+
+    // An interrupted export: one entry per line, newer than the manifest
+    QFile journal(directory.filePath(journalFileName()));
+    if (journal.open(QIODevice::ReadOnly)) {
+        while (!journal.atEnd()) {
+            const QJsonDocument line = QJsonDocument::fromJson(journal.readLine());
+            if (line.isObject()) readEntry(line.object());
+        }
+    }
+    return entries;
+}
+
+QStringList ProjectExporter::changedFiles(const QString &directory)
+{
+    // Size only: it is what a partial copy or a replaced file gives away,
+    // and it needs no read of the data
+    QStringList changed;
+    const QHash<QString, ManifestEntry> entries = readManifest(directory);
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QFileInfo info(QDir(directory).filePath(it.key()));
+        if (!info.exists() || info.size() != it->size) {
+            changed.append(it.key());
+        }
+    }
+    changed.sort();
+    return changed;
+}
+
+void ProjectExporter::record(const QString &path, const ManifestEntry &entry)
+{
+    QJsonObject object;
+    object["path"] = path;
+    object["size"] = double(entry.size);
+    object["modified"] = double(entry.modified);
+    object["source_modified"] = double(entry.sourceModified);
+    object["xxh3"] = QString::number(entry.checksum, 16);
+
+    QMutexLocker locker(&m_mutex);
+    m_manifest.insert(path, entry);
+    if (m_journal.isOpen()) {
+        m_journal.write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n');
+        m_journal.flush();
+    }
+}
+
+bool ProjectExporter::writeManifest(QString *errorMessage)
+{
+    QJsonArray files;
+    QString directory;
+    {
+        QMutexLocker locker(&m_mutex);
+        directory = m_directory;
+        QSet<QString> listed;
+        for (int i = 0; i < m_files.size(); ++i) {
+            const File &file = m_files[i];
+            // Layers in the GeoPackage share its one entry
+            const QString path = m_geoPackageRows.contains(i) ? file.dataset : file.path;
+            auto it = m_manifest.constFind(path);
+            if (it == m_manifest.constEnd() || (file.state != Copied && file.state != Skipped) ||
+                listed.contains(path)) {
+                continue;
+            }
+            listed.insert(path);
+
+            QJsonObject object;
+            object["path"] = path;
+            if (!m_geoPackageRows.contains(i)) object["layer"] = file.layer;
+            object["size"] = double(it->size);
+            object["modified"] = double(it->modified);
+            object["source_modified"] = double(it->sourceModified);
+            object["xxh3"] = QString::number(it->checksum, 16);
+            files.append(object);
+        }
+    }
+
+    QJsonObject root;
+    root["format"] = ManifestFormat;
+    root["version"] = ManifestVersion;
+    root["checksum"] = "xxh3-64";
+    root["files"] = files;
+
+    QSaveFile manifest(QDir(directory).filePath(manifestFileName()));
+    if (!manifest.open(QIODevice::WriteOnly)) {
+        if (errorMessage) *errorMessage = manifest.errorString();
+        return false;
+    }
+    manifest.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    if (!manifest.commit()) {
+        if (errorMessage) *errorMessage = manifest.errorString();
+        return false;
+    }
+    return true;
+}
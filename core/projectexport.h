@@ -0,0 +1,117 @@
+#ifndef PROJECTEXPORT_H
+#define PROJECTEXPORT_H
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include "geopackageexport.h"
+#include "projectfile.h"
+
+// Exports a project: its layer files are copied into a directory on a pool
+// of their own and recorded, with their checksums, in a manifest. Exporting
+// into the same directory again resumes: files the manifest shows are
+// already there, with the source's checksum, are skipped. All signals are
+// delivered on the exporter's (GUI) thread.
+//
+// In GeoPackage mode every layer a GeoPackage can hold is written into one
+// <project>.gpkg instead, by a single task; the rest are copied as files.
+class ProjectExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        LayerFiles,
+        GeoPackage
+    };
+
+    enum FileState {
+        Pending,
+        Copying,
+        Copied,
+        Skipped,    // exported before and unchanged since
+        Failed,
+        Canceled
+    };
+
+    struct File {
+        QString layer;
+        QString source;
+        QString path;       // relative to the export directory
+        QString dataset;    // path of the dataset's main file (or GeoPackage)
+        qint64 size = 0;
+        FileState state = Pending;
+        QString errorMessage;
+    };
+
+    explicit ProjectExporter(QObject *parent = nullptr);
+    ~ProjectExporter();
+
+    // Starts exporting the layers of 'project' into 'directory'; false
+    // while another export runs
+    bool start(const Project &project, const QString &directory, Format format = LayerFiles);
+    void cancel();
+    bool isRunning() const;
+
+    QString directory() const;
+    QVector<File> files() const;
+
+    // The project with its sources in the export; layers with a file that
+    // failed keep their original source
+    Project exportedProject() const;
+
+    static QString manifestFileName() { return "manifest.json"; }
+
+    // Files the manifest in 'directory' lists that are missing or no longer
+    // the size it recorded; empty when there is no manifest
+    static QStringList changedFiles(const QString &directory);
+
+signals:
+    void fileProgress(int index, qint64 bytesDone, qint64 bytesTotal);
+    void fileFinished(int index, int state);
+    void progress(qint64 bytesDone, qint64 bytesTotal);
+    void finished(bool success);
+
+private:
+    struct ManifestEntry {
+        qint64 size;
+        qint64 modified;        // of the exported file, ms since the epoch
+        qint64 sourceModified;
+        quint64 checksum;       // XXH3
+    };
+
+    void run(int index);
+    void runGeoPackage();
+    void reportBytes(int index, qint64 fileDone, qint64 delta);
+    void finish();
+    static QHash<QString, ManifestEntry> readManifest(const QString &directory);
+    void record(const QString &path, const ManifestEntry &entry);
+    bool writeManifest(QString *errorMessage);
+
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;
+    QString m_directory;
+    Project m_project;
+    QVector<File> m_files;
+    QHash<QString, QString> m_layerPaths;       // layer name -> dataset path
+    QString m_geoPackagePath;
+    QVector<GeoPackageExport::Layer> m_geoPackageLayers;
+    QVector<int> m_geoPackageRows;              // row in m_files of each
+    QHash<QString, int> m_layerTables;          // layer name -> GeoPackage layer
+    QHash<QString, ManifestEntry> m_manifest;   // by relative path
+    QFile m_journal;
+    qint64 m_bytesTotal;
+    qint64 m_bytesDone;
+    int m_remaining;
+    bool m_running;
+    QAtomicInt m_canceled;
+};
+
+#endif // PROJECTEXPORT_H
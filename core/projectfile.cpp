@@ -0,0 +1,129 @@
+#include "projectfile.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+namespace
+{
+    const char *FormatName = "ppt-gis-project";
+    const int FormatVersion = 1;
+
+    QJsonArray rectToJson(const QRectF &rect)
+    {
+        return QJsonArray() << rect.left() << rect.top() << rect.right() << rect.bottom();
+    }
+
+    QRectF rectFromJson(const QJsonValue &value)
+    {
+        const QJsonArray array = value.toArray();
+        if (array.size() != 4) return QRectF();
+        return QRectF(QPointF(array[0].toDouble(), array[1].toDouble()),
+                      QPointF(array[2].toDouble(), array[3].toDouble()));
+    }
+}
+
+bool ProjectFile::write(const QString &path, const Project &project, QString *errorMessage)
+{
+    const QDir projectDir = QFileInfo(path).absoluteDir();
+
+    QJsonArray layers;
+    for (const ProjectLayer &layer : project.layers) {
+        QJsonObject object;
+        object["name"] = layer.name;
+        object["type"] = layer.type;
+        object["source"] = layer.source.isEmpty() ? QString() : projectDir.relativeFilePath(layer.source);
+        object["group"] = layer.group;
+        object["label"] = layer.label;
+        object["visible"] = layer.visible;
+        object["z"] = layer.zValue;
+        object["opacity"] = layer.opacity;
+        if (layer.color.isValid()) {
+            object["color"] = layer.color.name(QColor::HexArgb);
+        }
+        object["properties"] = QJsonObject::fromVariantMap(layer.properties);
+        layers.append(object);
+    }
+
+    QJsonObject root;
+    root["format"] = FormatName;
+    root["version"] = FormatVersion;
+    root["name"] = project.name;
+    root["crs"] = project.crs;
+    if (project.viewExtent.isValid()) {
+        root["view_extent"] = rectToJson(project.viewExtent);
+    }
+    root["layers"] = layers;
+
+    // Written to a temporary file and renamed, so a failed save never
+    // leaves a truncated project behind
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    if (!file.commit()) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool ProjectFile::read(const QString &path, Project *project, QString *errorMessage)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage) *errorMessage = file.errorString();
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    const QJsonObject root = document.object();
+    if (parseError.error != QJsonParseError::NoError || root["format"].toString() != FormatName) {
+        if (errorMessage) *errorMessage = "Not a project file of this application";
+        return false;
+    }
+    if (root["version"].toInt() > FormatVersion) {
+        if (errorMessage) *errorMessage = "The project was saved by a newer version";
+        return false;
+    }
+
+    const QDir projectDir = QFileInfo(path).absoluteDir();
+
+    project->name = root["name"].toString();
+    project->crs = root["crs"].toString();
+    project->viewExtent = rectFromJson(root["view_extent"]);
+    project->layers.clear();
+
+    const QJsonArray layers = root["layers"].toArray();
+    project->layers.reserve(layers.size());
+    for (const QJsonValue &value : layers) {
+        const QJsonObject object = value.toObject();
+        ProjectLayer layer;
+        layer.name = object["name"].toString();
+        layer.type = object["type"].toString();
+        const QString source = object["source"].toString();
+        if (!source.isEmpty()) {
+            layer.source = QDir::cleanPath(projectDir.absoluteFilePath(source));
+        }
+        layer.group = object["group"].toString();
+        layer.label = object["label"].toString();
+        layer.visible = object["visible"].toBool(true);
+        layer.zValue = object["z"].toDouble();
+        layer.opacity = object["opacity"].toDouble(1.0);
+        if (object.contains("color")) {
+            layer.color = QColor(object["color"].toString());
+        }
+        layer.properties = object["properties"].toObject().toVariantMap();
+        if (!layer.name.isEmpty()) {
+            project->layers.append(layer);
+        }
+    }
+    return true;
+}
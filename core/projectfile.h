@@ -0,0 +1,43 @@
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+
+#include <QColor>
+#include <QRectF>
+#include <QString>
+#include <QVariantMap>
+#include <QVector>
+
+// One layer as stored in a project: where its data lives, how it is drawn
+// and the metadata (extent, sizes, counts) cached so the layer tree can be
+// restored without opening the source.
+struct ProjectLayer
+{
+    QString name;
+    QString type;           // LayerInfo::type
+    QString source;         // absolute path once read
+    QString group;          // layer tree group
+    QString label;          // second tree column, e.g. "Vector (Polygon)"
+    bool visible = true;
+    double zValue = 0.0;
+    double opacity = 1.0;
+    QColor color;           // vector layers; invalid when not set
+    QVariantMap properties; // LayerInfo::properties, "extent" as [minX, minY, maxX, maxY]
+};
+
+struct Project
+{
+    QString name;
+    QString crs;            // canvas CRS, empty when layers are drawn as loaded
+    QRectF viewExtent;      // visible area in map units of the canvas
+    QVector<ProjectLayer> layers;
+};
+
+// JSON project files. Sources are stored relative to the project file, so a
+// project moved together with its data keeps working.
+namespace ProjectFile
+{
+    bool write(const QString &path, const Project &project, QString *errorMessage = nullptr);
+    bool read(const QString &path, Project *project, QString *errorMessage = nullptr);
+}
+
+#endif // PROJECTFILE_H
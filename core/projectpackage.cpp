@@ -0,0 +1,260 @@
+#include "projectpackage.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <xxhash.h>
+
+namespace
+{
+    // Lower case, after the dataset's base name
+    const char *const SidecarSuffixes[] = {
+        "shx", "dbf", "prj", "cpg", "qix", "sbn", "sbx", "qmd",
+        "aux.xml", "ovr", "msk", "tfw", "tifw", "wld", "jgw", "pgw", "gfw", "xml"
+    };
+
+    // Large enough to keep a network file system busy, small enough for
+    // smooth progress
+    const qint64 ChunkSize = 8 * 1024 * 1024;
+
+    bool setModificationTime(const QString &path, const QDateTime &time)
+    {
+        QFile file(path);
+        return file.open(QIODevice::Append) && file.setFileTime(time, QFileDevice::FileModificationTime);
+    }
+
+    // Moves 'partial' over 'target', replacing it in one step where possible
+    bool replaceFile(const QString &partial, const QString &target)
+    {
+#ifdef Q_OS_UNIX
+        return ::rename(QFile::encodeName(partial).constData(), QFile::encodeName(target).constData()) == 0;
+#else
+        QFile::remove(target);
+        return QFile::rename(partial, target);
+#endif
+    }
+
+#ifdef Q_OS_LINUX
+    // Copy-on-write clone; only within one file system that supports it
+    bool cloneFile(const QString &source, const QString &target)
+    {
+        const int in = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return false;
+        const int out = ::open(QFile::encodeName(target).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            ::close(in);
+            return false;
+        }
+
+        const bool cloned = ::ioctl(out, FICLONE, in) == 0;
+        ::close(out);
+        ::close(in);
+        if (!cloned) QFile::remove(target);
+        return cloned;
+    }
+#endif
+}
+
+QStringList ProjectPackage::datasetFiles(const QString &filePath)
+{
+    const QFileInfo info(filePath);
+    if (!info.isFile()) return QStringList();
+
+    QStringList files;
+    files << info.absoluteFilePath();
+
+    const QString baseName = info.completeBaseName();
+    const QString suffix = info.suffix().toLower();
+    const QFileInfoList candidates = info.absoluteDir().entryInfoList(
+                QStringList() << baseName + ".*", QDir::Files);
+    for (const QFileInfo &candidate : candidates) {
+        const QString rest = candidate.fileName().mid(baseName.length() + 1).toLower();
+        for (const char *sidecar : SidecarSuffixes) {
+            // "roads.dbf" as well as "dem.tif.aux.xml"
+            if (rest == QLatin1String(sidecar) || rest == suffix + "." + QLatin1String(sidecar)) {
+                files << candidate.absoluteFilePath();
+                break;
+            }
+        }
+    }
+    return files;
+}
+
+QString ProjectPackage::packagedFileName(const QString &layerName, const QString &dataset, const QString &file)
+{
+    return layerName + QFileInfo(file).fileName().mid(QFileInfo(dataset).completeBaseName().length());
+}
+
+bool ProjectPackage::checksum(const QString &filePath, quint64 *value, const Progress &progress)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    XXH3_state_t *state = XXH3_createState();
+    XXH3_64bits_reset(state);
+    QByteArray chunk(int(ChunkSize), Qt::Uninitialized);
+    qint64 done = 0;
+    bool ok = true;
+    for (;;) {
+        const qint64 read = file.read(chunk.data(), chunk.size());
+        if (read < 0) {
+            ok = false;
+            break;
+        }
+        if (read == 0) break;
+        XXH3_64bits_update(state, chunk.constData(), size_t(read));
+        done += read;
+        if (progress && !progress(done)) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok) *value = XXH3_64bits_digest(state);
+    XXH3_freeState(state);
+    return ok;
+}
+
+bool ProjectPackage::copyFile(const QString &source, const QString &target, const Progress &progress,
+                              QString *errorMessage)
+{
+    QFile in(source);
+    QFile out(target);
+    if (!in.open(QIODevice::ReadOnly)) {
+        if (errorMessage) *errorMessage = in.errorString();
+        return false;
+    }
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (errorMessage) *errorMessage = out.errorString();
+        return false;
+    }
+
+    const qint64 size = in.size();
+    qint64 done = 0;
+#ifdef Q_OS_LINUX
+    // Falls through to the buffered loop below when the kernel cannot
+    // copy between these two files at all
+    while (done < size) {
+        const ssize_t copied = ::copy_file_range(in.handle(), nullptr, out.handle(), nullptr,
+                                                 size_t(qMin(ChunkSize, size - done)), 0);
+        if (copied <= 0) break;
+        done += copied;
+        if (progress && !progress(done)) {
+            if (errorMessage) *errorMessage = "Canceled";
+            return false;
+        }
+    }
+    in.seek(done);
+    out.seek(done);
+#endif
+
+    QByteArray chunk;
+    while (done < size) {
+        if (chunk.isEmpty()) chunk.resize(int(ChunkSize));
+        const qint64 read = in.read(chunk.data(), chunk.size());
+        if (read <= 0 || out.write(chunk.constData(), read) != read) {
+            if (errorMessage) *errorMessage = read <= 0 ? in.errorString() : out.errorString();
+            return false;
+        }
+        done += read;
+        if (progress && !progress(done)) {
+            if (errorMessage) *errorMessage = "Canceled";
+            return false;
+        }
+    }
+
+    if (!out.flush()) {
+        if (errorMessage) *errorMessage = out.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool ProjectPackage::sameContent(const QString &source, const QString &target)
+{
+    const QFileInfo sourceInfo(source);
+    const QFileInfo targetInfo(target);
+    if (!targetInfo.isFile() || sourceInfo.size() != targetInfo.size()) return false;
+
+#ifdef Q_OS_UNIX
+    // The same file, or a hard link to it
+    struct stat sourceStatus, targetStatus;
+    if (::stat(QFile::encodeName(source).constData(), &sourceStatus) == 0 &&
+        ::stat(QFile::encodeName(target).constData(), &targetStatus) == 0 &&
+        sourceStatus.st_dev == targetStatus.st_dev && sourceStatus.st_ino == targetStatus.st_ino) {
+        return true;
+    }
+#endif
+
+    if (sourceInfo.lastModified() == targetInfo.lastModified()) return true;
+
+    // Touched but possibly not changed: read both once, and take over the
+    // time so the next check is cheap again
+    quint64 sourceChecksum = 0, targetChecksum = 0;
+    if (!checksum(source, &sourceChecksum) || !checksum(target, &targetChecksum) ||
+        sourceChecksum != targetChecksum) {
+        return false;
+    }
+    setModificationTime(target, sourceInfo.lastModified());
+    return true;
+}
+
+ProjectPackage::Transfer ProjectPackage::placeFile(const QString &source, const QString &target,
+                                                   QString *errorMessage)
+{
+    if (sameContent(source, target)) return Unchanged;
+
+    const QFileInfo targetInfo(target);
+    if (!QDir().mkpath(targetInfo.absolutePath())) {
+        if (errorMessage) *errorMessage = "Cannot create " + targetInfo.absolutePath();
+        return Failed;
+    }
+
+    // Everything is written next to the target first, so an interrupted
+    // save never leaves a half written layer behind
+    const QString partial = target + ".part";
+    QFile::remove(partial);
+
+    // Cheapest first: clones and links only work within one file system
+    Transfer result = Failed;
+#ifdef Q_OS_LINUX
+    if (cloneFile(source, partial)) result = Cloned;
+#endif
+#ifdef Q_OS_UNIX
+    if (result == Failed &&
+        ::link(QFile::encodeName(source).constData(), QFile::encodeName(partial).constData()) == 0) {
+        result = Linked;
+    }
+#endif
+    if (result == Failed) {
+        if (!copyFile(source, partial, Progress(), errorMessage)) {
+            QFile::remove(partial);
+            return Failed;
+        }
+        result = Copied;
+    }
+
+    // Same modification time as the source, so the next save finds it
+    // unchanged without reading it
+    if (result != Linked) {
+        setModificationTime(partial, QFileInfo(source).lastModified());
+    }
+    if (!replaceFile(partial, target)) {
+        if (errorMessage) *errorMessage = QString("Cannot replace %1").arg(target);
+        QFile::remove(partial);
+        return Failed;
+    }
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef PROJECTPACKAGE_H
+#define PROJECTPACKAGE_H
+
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+// Placing layer files in a project directory. A file already there with the
+// same content is left alone; otherwise it is cloned or hard linked where
+// the file system allows, and copied in the kernel where it does not.
+namespace ProjectPackage
+{
+    enum Transfer {
+        Unchanged,  // the target already held the same content
+        Cloned,     // copy-on-write clone (reflink)
+        Linked,     // hard link, sharing the source's data
+        Copied,
+        Failed
+    };
+
+    // Called with the bytes done so far; returning false cancels
+    typedef std::function<bool(qint64 bytesDone)> Progress;
+
+    // The dataset file followed by the sidecars that belong to it (.shx,
+    // .dbf, .prj, .aux.xml, world files, overviews, ...)
+    QStringList datasetFiles(const QString &filePath);
+
+    // Name of 'file', one of the files of 'dataset', once packaged for
+    // 'layerName': sidecars keep their suffix, roads.dbf next to roads.shp
+    QString packagedFileName(const QString &layerName, const QString &dataset, const QString &file);
+
+    // 64 bit xxHash (XXH3) of the file's content
+    bool checksum(const QString &filePath, quint64 *value, const Progress &progress = Progress());
+
+    // Plain copy that keeps the data in the kernel (copy_file_range) where
+    // it can, in chunks so progress can be reported
+    bool copyFile(const QString &source, const QString &target, const Progress &progress = Progress(),
+                  QString *errorMessage = nullptr);
+
+    // Same size and either the same file, the same modification time or
+    // the same checksum
+    bool sameContent(const QString &source, const QString &target);
+
+    Transfer placeFile(const QString &source, const QString &target, QString *errorMessage = nullptr);
+}
+
+#endif // PROJECTPACKAGE_H
@@ -0,0 +1,197 @@
+#include "projectrenderer.h"
+
+#include <QFuture>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "crsregistry.h"
+#include "featurebufferitem.h"
+#include "layerloader.h"
+#include "reprojection.h"
+#include "terrain.h"
+#include "warptilesource.h"
+
+namespace
+{
+    bool isRasterType(const QString &type)
+    {
+        return type == "geotiff" || type == "georeferenced" || type == "raster";
+    }
+
+    // Canvas CRS and scene grid, as MainWindow::restoreProject() sets them
+    void setupMapSettings(const Project &project, const QString &crs, RenderableMap *map)
+    {
+        QSharedPointer<const CrsDefinition> canvasCrs = CrsRegistry::instance().crs(crs);
+        if (canvasCrs) {
+            map->mapSettings.setDestinationCrs(crs, canvasCrs->wkt);
+            map->mapSettings.setDefaultSceneGrid(!canvasCrs->geographic);
+            map->wkt = canvasCrs->wkt;
+            return;
+        }
+        for (const ProjectLayer &entry : project.layers) {
+            if (entry.type == "geotiff" && entry.properties.value("has_geotransform").toBool()) {
+                const double geoTransform[6] = {
+                    entry.properties.value("top_left_x").toDouble(), entry.properties.value("pixel_width").toDouble(),
+                    entry.properties.value("rotation_x").toDouble(), entry.properties.value("top_left_y").toDouble(),
+                    entry.properties.value("rotation_y").toDouble(), entry.properties.value("pixel_height").toDouble()
+                };
+                map->mapSettings.setSceneGrid(geoTransform);
+                break;
+            }
+        }
+    }
+
+    // One opened layer as drawn on the canvas; false with 'errorMessage' set
+    // when it has nothing to draw
+    bool makeLayer(const ProjectLayer &entry, const LoadedLayer &loaded, RenderableMap *map,
+                   MapExportLayer *layer, QRectF *sceneBounds, QString *errorMessage)
+    {
+        if (!loaded.errorMessage.isEmpty()) {
+            *errorMessage = loaded.errorMessage;
+            return false;
+        }
+        const MapSettings &settings = map->mapSettings;
+        const QString canvasWkt = settings.destinationWkt();
+        layer->opacity = entry.opacity;
+
+        if (loaded.features) {
+            QSharedPointer<const FeatureBuffer> features = loaded.features;
+            if (!canvasWkt.isEmpty() && !Reprojection::isSameCrs(features->spatialReferenceWkt(), canvasWkt)) {
+                QSharedPointer<FeatureBuffer> reprojected(new FeatureBuffer());
+                if (!Reprojection::reproject(*features, canvasWkt, reprojected.data(), nullptr, errorMessage)) {
+                    return false;
+                }
+                features = reprojected;
+            } else if (map->wkt.isEmpty()) {
+                map->wkt = features->spatialReferenceWkt();
+            }
+
+            layer->kind = MapExportLayer::Features;
+            layer->features = features;
+            layer->color = entry.color.isValid() ? entry.color
+                                                 : FeatureBufferItem::defaultColor(features->geometryType());
+            layer->transform = settings.mapToSceneTransform();
+            const Envelope extent = features->extent();
+            if (!extent.isNull()) {
+                *sceneBounds = layer->transform.mapRect(QRectF(QPointF(extent.minX, extent.minY),
+                                                               QPointF(extent.maxX, extent.maxY)));
+            }
+            return true;
+        }
+
+        if (loaded.tiles) {
+            QSharedPointer<RasterTileSource> tiles = loaded.tiles;
+            const double *geoTransform = loaded.geoTransform;
+            if (!canvasWkt.isEmpty() && entry.type == "terrain") {
+                // Computed from the DEM warped to the canvas CRS
+                QSharedPointer<TerrainTileSource> terrain(
+                            new TerrainTileSource(LayerLoader::rasterDataset(entry.source, entry.properties),
+                                                  LayerLoader::terrainParameters(entry.properties), canvasWkt));
+                QString warpError;
+                if (!terrain->open(&warpError)) {
+                    map->warnings.append(entry.name + ": not reprojected, " + warpError);
+                } else if (terrain->isWarped()) {
+                    tiles = terrain;
+                    geoTransform = terrain->geoTransform();
+                }
+            } else if (!canvasWkt.isEmpty() && isRasterType(entry.type)) {
+                QSharedPointer<WarpedTileSource> warped(
+                            new WarpedTileSource(LayerLoader::rasterDataset(entry.source, entry.properties), canvasWkt));
+                QString warpError;
+                if (!warped->open(&warpError)) {
+                    map->warnings.append(entry.name + ": not reprojected, " + warpError);
+                } else if (!warped->isSameCrs()) {
+                    tiles = warped;
+                    geoTransform = warped->geoTransform();
+                }
+            }
+            layer->kind = MapExportLayer::Tiles;
+            layer->tiles = tiles;
+            layer->transform = settings.rasterToScene(geoTransform);
+            *sceneBounds = layer->transform.mapRect(QRectF(QPointF(0, 0), QSizeF(tiles->rasterSize())));
+            return true;
+        }
+
+        if (!loaded.image.isNull()) {
+            layer->kind = MapExportLayer::Image;
+            layer->image = loaded.image;
+            if (loaded.hasGeoTransform) {
+                layer->transform = settings.rasterToScene(loaded.geoTransform);
+            }
+            *sceneBounds = layer->transform.mapRect(QRectF(QPointF(0, 0), QSizeF(loaded.image.size())));
+            return true;
+        }
+
+        *errorMessage = "Nothing to open for " + entry.source;
+        return false;
+    }
+}
+
+bool ProjectRenderer::prepare(const Project &project, const QString &crs, RenderableMap *map,
+                              QString *errorMessage)
+{
+    setupMapSettings(project, crs.isEmpty() ? project.crs : crs, map);
+
+    // Visible layers, bottom to top
+    QVector<ProjectLayer> entries;
+    for (const ProjectLayer &entry : project.layers) {
+        if (entry.visible) entries.append(entry);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const ProjectLayer &a, const ProjectLayer &b) {
+        return a.zValue < b.zValue;
+    });
+    if (entries.isEmpty()) {
+        if (errorMessage) *errorMessage = "The project has no visible layers";
+        return false;
+    }
+
+    // Opened in parallel; placing them is cheap and done in order
+    QVector<QFuture<LoadedLayer>> opening;
+    opening.reserve(entries.size());
+    for (const ProjectLayer &entry : entries) {
+        opening.append(QtConcurrent::run([entry]() {
+            return LayerLoader::load(entry.name, entry.type, entry.source, entry.properties);
+        }));
+    }
+
+    QRectF sceneExtent;
+    QString rasterWkt;
+    for (int i = 0; i < entries.size(); ++i) {
+        const LoadedLayer loaded = opening[i].result();
+        MapExportLayer layer;
+        QRectF sceneBounds;
+        QString layerError;
+        if (!makeLayer(entries[i], loaded, map, &layer, &sceneBounds, &layerError)) {
+            map->warnings.append(entries[i].name + ": " + layerError);
+            continue;
+        }
+        if (rasterWkt.isEmpty()) rasterWkt = loaded.wkt;
+        map->layers.append(layer);
+        sceneExtent = sceneExtent.united(sceneBounds);
+    }
+
+    // Without a canvas CRS the map units are those of the vector layers, or
+    // of the first georeferenced raster when there are none
+    if (map->wkt.isEmpty()) {
+        map->wkt = rasterWkt;
+    }
+
+    if (map->layers.isEmpty()) {
+        if (errorMessage) *errorMessage = "No layer could be opened:\n" + map->warnings.join("\n");
+        return false;
+    }
+    map->extent = map->mapSettings.sceneToMap(sceneExtent);
+    return true;
+}
+
+MapExporter::Settings ProjectRenderer::exportSettings(const RenderableMap &map, const QRectF &extent,
+                                                      const QSize &size)
+{
+    MapExporter::Settings settings;
+    settings.sceneRect = map.mapSettings.mapToScene(extent);
+    settings.size = size;
+    settings.sceneToMap = map.mapSettings.sceneToMapTransform();
+    settings.wkt = map.wkt;
+    return settings;
+}
@@ -0,0 +1,40 @@
+#ifndef PROJECTRENDERER_H
+#define PROJECTRENDERER_H
+
+#include <QRectF>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "mapexport.h"
+#include "mapsettings.h"
+#include "projectfile.h"
+
+// A project's visible layers, opened and placed the way the map canvas
+// shows them, as layers a MapExporter can draw
+struct RenderableMap
+{
+    MapSettings mapSettings;
+    QVector<MapExportLayer> layers;     // bottom to top
+    QRectF extent;                      // all layers, in map units
+    QString wkt;                        // CRS of the map units, empty if unknown
+    QStringList warnings;               // layers that could not be opened
+};
+
+// Rendering projects without a window (batch export, tile rendering). Layers
+// open in parallel; features and georeferenced rasters are reprojected to
+// the canvas CRS as MainWindow::reprojectLayer() does.
+namespace ProjectRenderer
+{
+    // 'crs' replaces the project's canvas CRS when not empty. Fails only when
+    // no layer could be opened.
+    bool prepare(const Project &project, const QString &crs, RenderableMap *map,
+                 QString *errorMessage = nullptr);
+
+    // Export of 'extent' (map units) at 'size' pixels
+    MapExporter::Settings exportSettings(const RenderableMap &map, const QRectF &extent,
+                                         const QSize &size);
+}
+
+#endif // PROJECTRENDERER_H
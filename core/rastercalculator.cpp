@@ -0,0 +1,1119 @@
+#include "rastercalculator.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <gdal_priv.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const int BlockPixels = 4096;    // evaluation block: a few registers stay in L1/L2
+    const int TileSize = 256;        // output GeoTIFF tiles
+    const int WindowRows = TileSize; // read/write windows cover whole output tiles
+    const int WindowColumns = 8 * TileSize;
+    const float NoData = -3.4028234663852886e+38f;
+
+    enum Op {
+        OpAdd, OpSub, OpMul, OpDiv, OpPow, OpMin, OpMax,
+        OpLt, OpGt, OpLe, OpGe, OpEq, OpNe, OpAnd, OpOr,
+        OpNeg, OpAbs, OpSqrt, OpExp, OpLn, OpLog10,
+        OpSin, OpCos, OpTan, OpAsin, OpAcos, OpAtan,
+        OpIf
+    };
+
+    struct Node {
+        enum Kind { Constant, Band, Operation };
+        Kind kind;
+        Op op;
+        float value;
+        int input;     // Band: index into the inputs
+        int band;      // Band: 1-based band number
+        int args[3];
+        int argCount;
+    };
+
+    struct Function {
+        const char *name;
+        Op op;
+        int argCount;
+    };
+
+    const Function Functions[] = {
+        { "abs", OpAbs, 1 }, { "sqrt", OpSqrt, 1 }, { "exp", OpExp, 1 },
+        { "ln", OpLn, 1 }, { "log10", OpLog10, 1 },
+        { "sin", OpSin, 1 }, { "cos", OpCos, 1 }, { "tan", OpTan, 1 },
+        { "asin", OpAsin, 1 }, { "acos", OpAcos, 1 }, { "atan", OpAtan, 1 },
+        { "min", OpMin, 2 }, { "max", OpMax, 2 }, { "if", OpIf, 3 }
+    };
+
+    float applyScalar(Op op, float a, float b, float c)
+    {
+        switch (op) {
+        case OpAdd: return a + b;
+        case OpSub: return a - b;
+        case OpMul: return a * b;
+        case OpDiv: return a / b;
+        case OpPow: return std::pow(a, b);
+        case OpMin: return a < b ? a : b;
+        case OpMax: return a > b ? a : b;
+        case OpLt: return a < b ? 1.0f : 0.0f;
+        case OpGt: return a > b ? 1.0f : 0.0f;
+        case OpLe: return a <= b ? 1.0f : 0.0f;
+        case OpGe: return a >= b ? 1.0f : 0.0f;
+        case OpEq: return a == b ? 1.0f : 0.0f;
+        case OpNe: return a != b ? 1.0f : 0.0f;
+        case OpAnd: return (a != 0.0f && b != 0.0f) ? 1.0f : 0.0f;
+        case OpOr: return (a != 0.0f || b != 0.0f) ? 1.0f : 0.0f;
+        case OpNeg: return -a;
+        case OpAbs: return std::fabs(a);
+        case OpSqrt: return std::sqrt(a);
+        case OpExp: return std::exp(a);
+        case OpLn: return std::log(a);
+        case OpLog10: return std::log10(a);
+        case OpSin: return std::sin(a);
+        case OpCos: return std::cos(a);
+        case OpTan: return std::tan(a);
+        case OpAsin: return std::asin(a);
+        case OpAcos: return std::acos(a);
+        case OpAtan: return std::atan(a);
+        case OpIf: return a != 0.0f ? b : c;
+        }
+        return 0.0f;
+    }
+
+    // Recursive descent parser producing a node pool. Operations on constants
+    // only are folded while parsing.
+    class Parser
+    {
+    public:
+        Parser(const QString &text, const QVector<RasterInput> &inputs)
+            : m_text(text), m_inputs(inputs), m_pos(0) {}
+
+        bool parse(int *root, QString *errorMessage)
+        {
+            next();
+            int node = parseOr();
+            if (node >= 0 && m_token.type != End) {
+                node = fail("Unexpected '" + m_token.text + "'");
+            }
+            if (node < 0) {
+                if (errorMessage) *errorMessage = m_error;
+                return false;
+            }
+            *root = node;
+            return true;
+        }
+
+        const std::vector<Node> &nodes() const { return m_nodes; }
+
+    private:
+        enum TokenType { End, Number, Identifier, QuotedName, Symbol, Invalid };
+
+        struct Token {
+            TokenType type;
+            QString text;
+            double number;
+            int position;
+        };
+
+        void next()
+        {
+            while (m_pos < m_text.size() && m_text[m_pos].isSpace()) ++m_pos;
+
+            m_token.position = m_pos;
+            m_token.number = 0.0;
+            m_token.text.clear();
+
+            if (m_pos >= m_text.size()) {
+                m_token.type = End;
+                m_token.text = "end of expression";
+                return;
+            }
+
+            const QChar c = m_text[m_pos];
+            if (c.isDigit() || (c == '.' && m_pos + 1 < m_text.size() && m_text[m_pos + 1].isDigit())) {
+                int end = m_pos;
+                while (end < m_text.size() && (m_text[end].isDigit() || m_text[end] == '.')) ++end;
+                if (end < m_text.size() && (m_text[end] == 'e' || m_text[end] == 'E')) {
+                    int exponent = end + 1;
+                    if (exponent < m_text.size() && (m_text[exponent] == '+' || m_text[exponent] == '-')) ++exponent;
+                    if (exponent < m_text.size() && m_text[exponent].isDigit()) {
+                        end = exponent;
+                        while (end < m_text.size() && m_text[end].isDigit()) ++end;
+                    }
+                }
+                m_token.text = m_text.mid(m_pos, end - m_pos);
+                bool ok = false;
+                m_token.number = m_token.text.toDouble(&ok);
+                m_token.type = ok ? Number : Invalid;
+                m_pos = end;
+            } else if (c.isLetter() || c == '_') {
+                int end = m_pos;
+                while (end < m_text.size() && (m_text[end].isLetterOrNumber() || m_text[end] == '_')) ++end;
+                m_token.type = Identifier;
+                m_token.text = m_text.mid(m_pos, end - m_pos);
+                m_pos = end;
+            } else if (c == '"') {
+                int end = m_text.indexOf('"', m_pos + 1);
+                if (end < 0) {
+                    m_token.type = Invalid;
+                    m_token.text = "\"";
+                    m_pos = m_text.size();
+                } else {
+                    m_token.type = QuotedName;
+                    m_token.text = m_text.mid(m_pos + 1, end - m_pos - 1);
+                    m_pos = end + 1;
+                }
+            } else {
+                static const char *const twoCharSymbols[] = { "<=", ">=", "==", "!=", "&&", "||" };
+                m_token.type = Invalid;
+                m_token.text = QString(c);
+                for (const char *symbol : twoCharSymbols) {
+                    if (m_text.midRef(m_pos, 2) == QLatin1String(symbol)) {
+                        m_token.type = Symbol;
+                        m_token.text = QLatin1String(symbol);
+                        break;
+                    }
+                }
+                if (m_token.type == Invalid && QString("+-*/^(),<>@").contains(c)) {
+                    m_token.type = Symbol;
+                }
+                m_pos += m_token.text.size();
+            }
+        }
+
+        bool isSymbol(const char *symbol) const
+        {
+            return m_token.type == Symbol && m_token.text == QLatin1String(symbol);
+        }
+
+        bool isKeyword(const char *keyword) const
+        {
+            return m_token.type == Identifier && m_token.text.compare(QLatin1String(keyword), Qt::CaseInsensitive) == 0;
+        }
+
+        int fail(const QString &message)
+        {
+            if (m_error.isEmpty()) {
+                m_error = QString("%1 at position %2").arg(message).arg(m_token.position + 1);
+            }
+            return -1;
+        }
+
+        int addConstant(double value)
+        {
+            Node node;
+            node.kind = Node::Constant;
+            node.op = OpAdd;
+            node.value = static_cast<float>(value);
+            node.input = -1;
+            node.band = 0;
+            node.argCount = 0;
+            m_nodes.push_back(node);
+            return static_cast<int>(m_nodes.size()) - 1;
+        }
+
+        int addBand(int input, int band)
+        {
+            int node = addConstant(0.0);
+            m_nodes[node].kind = Node::Band;
+            m_nodes[node].input = input;
+            m_nodes[node].band = band;
+            return node;
+        }
+
+        int addOperation(Op op, int a, int b = -1, int c = -1)
+        {
+            const int args[3] = { a, b, c };
+            const int argCount = (c >= 0) ? 3 : (b >= 0) ? 2 : 1;
+
+            bool constant = true;
+            for (int i = 0; i < argCount; ++i) {
+                constant = constant && m_nodes[args[i]].kind == Node::Constant;
+            }
+            if (constant) {
+                return addConstant(applyScalar(op, m_nodes[a].value,
+                                               argCount > 1 ? m_nodes[b].value : 0.0f,
+                                               argCount > 2 ? m_nodes[c].value : 0.0f));
+            }
+
+            Node node;
+            node.kind = Node::Operation;
+            node.op = op;
+            node.value = 0.0f;
+            node.input = -1;
+            node.band = 0;
+            node.argCount = argCount;
+            for (int i = 0; i < 3; ++i) node.args[i] = args[i];
+            m_nodes.push_back(node);
+            return static_cast<int>(m_nodes.size()) - 1;
+        }
+
+        int parseOr()
+        {
+            int left = parseAnd();
+            while (left >= 0 && (isKeyword("or") || isSymbol("||"))) {
+                next();
+                int right = parseAnd();
+                if (right < 0) return -1;
+                left = addOperation(OpOr, left, right);
+            }
+            return left;
+        }
+
+        int parseAnd()
+        {
+            int left = parseComparison();
+            while (left >= 0 && (isKeyword("and") || isSymbol("&&"))) {
+                next();
+                int right = parseComparison();
+                if (right < 0) return -1;
+                left = addOperation(OpAnd, left, right);
+            }
+            return left;
+        }
+
+        int parseComparison()
+        {
+            int left = parseAdditive();
+            if (left < 0) return -1;
+
+            static const struct { const char *symbol; Op op; } comparisons[] = {
+                { "<=", OpLe }, { ">=", OpGe }, { "==", OpEq }, { "!=", OpNe }, { "<", OpLt }, { ">", OpGt }
+            };
+            for (const auto &comparison : comparisons) {
+                if (isSymbol(comparison.symbol)) {
+                    next();
+                    int right = parseAdditive();
+                    if (right < 0) return -1;
+                    return addOperation(comparison.op, left, right);
+                }
+            }
+            return left;
+        }
+
+        int parseAdditive()
+        {
+            int left = parseTerm();
+            while (left >= 0 && (isSymbol("+") || isSymbol("-"))) {
+                Op op = isSymbol("+") ? OpAdd : OpSub;
+                next();
+                int right = parseTerm();
+                if (right < 0) return -1;
+                left = addOperation(op, left, right);
+            }
+            return left;
+        }
+
+        int parseTerm()
+        {
+            int left = parseUnary();
+            while (left >= 0 && (isSymbol("*") || isSymbol("/"))) {
+                Op op = isSymbol("*") ? OpMul : OpDiv;
+                next();
+                int right = parseUnary();
+                if (right < 0) return -1;
+                left = addOperation(op, left, right);
+            }
+            return left;
+        }
+
+        int parseUnary()
+        {
+            if (isSymbol("-")) {
+                next();
+                int operand = parseUnary();
+                return operand < 0 ? -1 : addOperation(OpNeg, operand);
+            }
+            if (isSymbol("+")) {
+                next();
+                return parseUnary();
+            }
+            return parsePower();
+        }
+
+        // Right associative and binding tighter than unary minus: -2^2 == -4
+        int parsePower()
+        {
+            int base = parsePrimary();
+            if (base >= 0 && isSymbol("^")) {
+                next();
+                int exponent = parseUnary();
+                if (exponent < 0) return -1;
+                return addOperation(OpPow, base, exponent);
+            }
+            return base;
+        }
+
+        int parsePrimary()
+        {
+            if (m_token.type == Number) {
+                double value = m_token.number;
+                next();
+                return addConstant(value);
+            }
+
+            if (isSymbol("(")) {
+                next();
+                int inner = parseOr();
+                if (inner < 0) return -1;
+                if (!isSymbol(")")) return fail("Expected ')'");
+                next();
+                return inner;
+            }
+
+            if (m_token.type == Identifier || m_token.type == QuotedName) {
+                const QString name = m_token.text;
+                const bool quoted = (m_token.type == QuotedName);
+                next();
+
+                if (isSymbol("@")) {
+                    next();
+                    return parseBand(name);
+                }
+                if (!quoted && isSymbol("(")) {
+                    return parseFunction(name);
+                }
+                if (!quoted && name.size() > 1 && (name[0] == 'B' || name[0] == 'b')) {
+                    bool ok = false;
+                    int band = name.mid(1).toInt(&ok);
+                    if (ok) {
+                        if (m_inputs.isEmpty()) return fail("No input raster for " + name);
+                        if (band < 1) return fail("Invalid band " + name);
+                        return addBand(0, band);
+                    }
+                }
+                return fail("Unknown name '" + name + "'");
+            }
+
+            if (m_token.type == Invalid) {
+                return fail("Unexpected character '" + m_token.text + "'");
+            }
+            return fail("Unexpected " + (m_token.type == End ? m_token.text : "'" + m_token.text + "'"));
+        }
+
+        int parseBand(const QString &layerName)
+        {
+            int input = -1;
+            for (int i = 0; i < m_inputs.size(); ++i) {
+                if (m_inputs[i].name == layerName) {
+                    input = i;
+                    break;
+                }
+            }
+            if (input < 0) return fail("Unknown raster layer '" + layerName + "'");
+
+            bool ok = false;
+            int band = m_token.text.toInt(&ok);
+            if (m_token.type != Number || !ok || band < 1) return fail("Expected a band number");
+            next();
+            return addBand(input, band);
+        }
+
+        int parseFunction(const QString &name)
+        {
+            const Function *function = nullptr;
+            for (const Function &candidate : Functions) {
+                if (name.compare(QLatin1String(candidate.name), Qt::CaseInsensitive) == 0) {
+                    function = &candidate;
+                    break;
+                }
+            }
+            if (!function) return fail("Unknown function '" + name + "'");
+
+            next();   // '('
+            int args[3] = { -1, -1, -1 };
+            for (int i = 0; i < function->argCount; ++i) {
+                if (i > 0) {
+                    if (!isSymbol(",")) return fail(QString("%1() expects %2 arguments").arg(name).arg(function->argCount));
+                    next();
+                }
+                args[i] = parseOr();
+                if (args[i] < 0) return -1;
+            }
+            if (!isSymbol(")")) return fail("Expected ')'");
+            next();
+            return addOperation(function->op, args[0], args[1], args[2]);
+        }
+
+        QString m_text;
+        QVector<RasterInput> m_inputs;
+        int m_pos;
+        Token m_token;
+        QString m_error;
+        std::vector<Node> m_nodes;
+    };
+
+    // Straight-line program over block registers. Register ids are laid out as
+    // [temporaries | constants | band slots]; temporaries are reused as soon as
+    // their value has been consumed, so deep expressions stay cache resident.
+    struct Program {
+        struct Instruction {
+            Op op;
+            int dst;      // temporary
+            int args[3];
+            int argCount;
+        };
+
+        std::vector<Instruction> code;
+        int temporaryCount = 0;
+        std::vector<float> constants;
+        std::vector<int> slotInputs;
+        std::vector<int> slotBands;
+        int result = 0;
+
+        int constantBase() const { return temporaryCount; }
+        int slotBase() const { return temporaryCount + static_cast<int>(constants.size()); }
+        int registerCount() const { return slotBase() + static_cast<int>(slotInputs.size()); }
+    };
+
+    class Compiler
+    {
+    public:
+        explicit Compiler(const std::vector<Node> &nodes) : m_nodes(nodes) {}
+
+        Program compile(int root)
+        {
+            Operand result = emit(root);
+            m_program.temporaryCount = m_temporaryCount;
+
+            // Now that every count is known, map operands to flat register ids
+            for (size_t i = 0; i < m_code.size(); ++i) {
+                Program::Instruction instruction;
+                instruction.op = m_code[i].op;
+                instruction.dst = m_code[i].dst;
+                instruction.argCount = m_code[i].argCount;
+                for (int a = 0; a < 3; ++a) {
+                    instruction.args[a] = a < instruction.argCount ? flatten(m_code[i].args[a]) : 0;
+                }
+                m_program.code.push_back(instruction);
+            }
+            m_program.result = flatten(result);
+            return m_program;
+        }
+
+    private:
+        struct Operand {
+            enum Kind { Temporary, Constant, Slot };
+            Kind kind;
+            int index;
+        };
+
+        struct PendingInstruction {
+            Op op;
+            int dst;
+            Operand args[3];
+            int argCount;
+        };
+
+        Operand emit(int nodeIndex)
+        {
+            const Node &node = m_nodes[nodeIndex];
+            Operand operand;
+
+            if (node.kind == Node::Constant) {
+                operand.kind = Operand::Constant;
+                operand.index = static_cast<int>(m_program.constants.size());
+                m_program.constants.push_back(node.value);
+                return operand;
+            }
+
+            if (node.kind == Node::Band) {
+                operand.kind = Operand::Slot;
+                for (size_t s = 0; s < m_program.slotInputs.size(); ++s) {
+                    if (m_program.slotInputs[s] == node.input && m_program.slotBands[s] == node.band) {
+                        operand.index = static_cast<int>(s);
+                        return operand;
+                    }
+                }
+                operand.index = static_cast<int>(m_program.slotInputs.size());
+                m_program.slotInputs.push_back(node.input);
+                m_program.slotBands.push_back(node.band);
+                return operand;
+            }
+
+            PendingInstruction instruction;
+            instruction.op = node.op;
+            instruction.argCount = node.argCount;
+            for (int a = 0; a < node.argCount; ++a) {
+                instruction.args[a] = emit(node.args[a]);
+            }
+            for (int a = 0; a < node.argCount; ++a) {
+                if (instruction.args[a].kind == Operand::Temporary) {
+                    m_free.push_back(instruction.args[a].index);
+                }
+            }
+
+            // Kernels are element-wise, so the result may overwrite an argument
+            if (!m_free.empty()) {
+                instruction.dst = m_free.back();
+                m_free.pop_back();
+            } else {
+                instruction.dst = m_temporaryCount++;
+            }
+            m_code.push_back(instruction);
+
+            operand.kind = Operand::Temporary;
+            operand.index = instruction.dst;
+            return operand;
+        }
+
+        int flatten(const Operand &operand) const
+        {
+            switch (operand.kind) {
+            case Operand::Temporary: return operand.index;
+            case Operand::Constant: return m_program.constantBase() + operand.index;
+            case Operand::Slot: return m_program.slotBase() + operand.index;
+            }
+            return 0;
+        }
+
+        const std::vector<Node> &m_nodes;
+        Program m_program;
+        std::vector<PendingInstruction> m_code;
+        std::vector<int> m_free;
+        int m_temporaryCount = 0;
+    };
+
+    // Block kernels. Every operation is a tight loop over one block; with SSE2
+    // four pixels are processed per instruction, the tail falls back to scalar.
+
+    struct AddOp {
+        static float scalar(float a, float b) { return a + b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+#endif
+    };
+
+    struct SubOp {
+        static float scalar(float a, float b) { return a - b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+#endif
+    };
+
+    struct MulOp {
+        static float scalar(float a, float b) { return a * b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+#endif
+    };
+
+    struct DivOp {
+        static float scalar(float a, float b) { return a / b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+#endif
+    };
+
+    struct MinOp {
+        static float scalar(float a, float b) { return a < b ? a : b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+#endif
+    };
+
+    struct MaxOp {
+        static float scalar(float a, float b) { return a > b ? a : b; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+#endif
+    };
+
+#ifdef __SSE2__
+    inline __m128 maskToOne(__m128 mask) { return _mm_and_ps(mask, _mm_set1_ps(1.0f)); }
+#endif
+
+    struct LtOp {
+        static float scalar(float a, float b) { return a < b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmplt_ps(a, b)); }
+#endif
+    };
+
+    struct GtOp {
+        static float scalar(float a, float b) { return a > b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmpgt_ps(a, b)); }
+#endif
+    };
+
+    struct LeOp {
+        static float scalar(float a, float b) { return a <= b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmple_ps(a, b)); }
+#endif
+    };
+
+    struct GeOp {
+        static float scalar(float a, float b) { return a >= b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmpge_ps(a, b)); }
+#endif
+    };
+
+    struct EqOp {
+        static float scalar(float a, float b) { return a == b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmpeq_ps(a, b)); }
+#endif
+    };
+
+    struct NeOp {
+        static float scalar(float a, float b) { return a != b ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b) { return maskToOne(_mm_cmpneq_ps(a, b)); }
+#endif
+    };
+
+    struct AndOp {
+        static float scalar(float a, float b) { return (a != 0.0f && b != 0.0f) ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            return maskToOne(_mm_and_ps(_mm_cmpneq_ps(a, zero), _mm_cmpneq_ps(b, zero)));
+        }
+#endif
+    };
+
+    struct OrOp {
+        static float scalar(float a, float b) { return (a != 0.0f || b != 0.0f) ? 1.0f : 0.0f; }
+#ifdef __SSE2__
+        static __m128 simd(__m128 a, __m128 b)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            return maskToOne(_mm_or_ps(_mm_cmpneq_ps(a, zero), _mm_cmpneq_ps(b, zero)));
+        }
+#endif
+    };
+
+    template <typename Operation>
+    void binaryKernel(const float *a, const float *b, float *out, int count)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(out + i, Operation::simd(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+#endif
+        for (; i < count; ++i) {
+            out[i] = Operation::scalar(a[i], b[i]);
+        }
+    }
+
+    void negKernel(const float *a, float *out, int count)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(out + i, _mm_xor_ps(_mm_loadu_ps(a + i), sign));
+        }
+#endif
+        for (; i < count; ++i) out[i] = -a[i];
+    }
+
+    void absKernel(const float *a, float *out, int count)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(out + i, _mm_andnot_ps(sign, _mm_loadu_ps(a + i)));
+        }
+#endif
+        for (; i < count; ++i) out[i] = std::fabs(a[i]);
+    }
+
+    void sqrtKernel(const float *a, float *out, int count)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_loadu_ps(a + i)));
+        }
+#endif
+        for (; i < count; ++i) out[i] = std::sqrt(a[i]);
+    }
+
+    void ifKernel(const float *condition, const float *a, const float *b, float *out, int count)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4) {
+            const __m128 mask = _mm_cmpneq_ps(_mm_loadu_ps(condition + i), zero);
+            _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(mask, _mm_loadu_ps(a + i)),
+                                             _mm_andnot_ps(mask, _mm_loadu_ps(b + i))));
+        }
+#endif
+        for (; i < count; ++i) out[i] = condition[i] != 0.0f ? a[i] : b[i];
+    }
+
+    // Transcendental functions have no SSE2 form; the loop is still branch free
+    template <float (*Function)(float)>
+    void mathKernel(const float *a, float *out, int count)
+    {
+        for (int i = 0; i < count; ++i) out[i] = Function(a[i]);
+    }
+
+    float powf2(float a, float b) { return std::pow(a, b); }
+    float expf1(float a) { return std::exp(a); }
+    float logf1(float a) { return std::log(a); }
+    float log10f1(float a) { return std::log10(a); }
+    float sinf1(float a) { return std::sin(a); }
+    float cosf1(float a) { return std::cos(a); }
+    float tanf1(float a) { return std::tan(a); }
+    float asinf1(float a) { return std::asin(a); }
+    float acosf1(float a) { return std::acos(a); }
+    float atanf1(float a) { return std::atan(a); }
+
+    // Runs a program over one block at a time. One per worker: it owns the
+    // temporary and constant registers, band registers point into the window.
+    class Evaluator
+    {
+    public:
+        explicit Evaluator(const Program &program)
+            : m_program(program)
+            , m_storage(static_cast<size_t>(program.slotBase()) * BlockPixels)
+            , m_registers(program.registerCount(), nullptr)
+        {
+            for (int r = 0; r < program.slotBase(); ++r) {
+                m_registers[r] = m_storage.data() + static_cast<size_t>(r) * BlockPixels;
+            }
+            for (size_t c = 0; c < program.constants.size(); ++c) {
+                float *block = m_storage.data() + static_cast<size_t>(program.constantBase() + c) * BlockPixels;
+                std::fill(block, block + BlockPixels, program.constants[c]);
+            }
+        }
+
+        // 'slots[s]' points at the first pixel of band slot s for this block
+        const float *run(const float *const *slots, int count)
+        {
+            const int slotBase = m_program.slotBase();
+            for (size_t s = 0; s < m_program.slotInputs.size(); ++s) {
+                m_registers[slotBase + s] = const_cast<float*>(slots[s]);
+            }
+
+            for (const Program::Instruction &instruction : m_program.code) {
+                const float *a = m_registers[instruction.args[0]];
+                const float *b = m_registers[instruction.args[1]];
+                const float *c = m_registers[instruction.args[2]];
+                float *out = m_registers[instruction.dst];
+
+                switch (instruction.op) {
+                case OpAdd: binaryKernel<AddOp>(a, b, out, count); break;
+                case OpSub: binaryKernel<SubOp>(a, b, out, count); break;
+                case OpMul: binaryKernel<MulOp>(a, b, out, count); break;
+                case OpDiv: binaryKernel<DivOp>(a, b, out, count); break;
+                case OpMin: binaryKernel<MinOp>(a, b, out, count); break;
+                case OpMax: binaryKernel<MaxOp>(a, b, out, count); break;
+                case OpLt: binaryKernel<LtOp>(a, b, out, count); break;
+                case OpGt: binaryKernel<GtOp>(a, b, out, count); break;
+                case OpLe: binaryKernel<LeOp>(a, b, out, count); break;
+                case OpGe: binaryKernel<GeOp>(a, b, out, count); break;
+                case OpEq: binaryKernel<EqOp>(a, b, out, count); break;
+                case OpNe: binaryKernel<NeOp>(a, b, out, count); break;
+                case OpAnd: binaryKernel<AndOp>(a, b, out, count); break;
+                case OpOr: binaryKernel<OrOp>(a, b, out, count); break;
+                case OpPow:
+                    for (int i = 0; i < count; ++i) out[i] = powf2(a[i], b[i]);
+                    break;
+                case OpNeg: negKernel(a, out, count); break;
+                case OpAbs: absKernel(a, out, count); break;
+                case OpSqrt: sqrtKernel(a, out, count); break;
+                case OpExp: mathKernel<expf1>(a, out, count); break;
+                case OpLn: mathKernel<logf1>(a, out, count); break;
+                case OpLog10: mathKernel<log10f1>(a, out, count); break;
+                case OpSin: mathKernel<sinf1>(a, out, count); break;
+                case OpCos: mathKernel<cosf1>(a, out, count); break;
+                case OpTan: mathKernel<tanf1>(a, out, count); break;
+                case OpAsin: mathKernel<asinf1>(a, out, count); break;
+                case OpAcos: mathKernel<acosf1>(a, out, count); break;
+                case OpAtan: mathKernel<atanf1>(a, out, count); break;
+                case OpIf: ifKernel(a, b, c, out, count); break;
+                }
+            }
+
+            return m_registers[m_program.result];
+        }
+
+    private:
+        const Program &m_program;
+        std::vector<float> m_storage;
+        std::vector<float*> m_registers;
+    };
+
+    struct SlotInfo {
+        bool hasNoData;
+        float noData;
+    };
+
+    bool openInputs(const QVector<RasterInput> &inputs, const std::vector<bool> &used,
+                    std::vector<GDALDataset*> *datasets, QString *errorMessage)
+    {
+        datasets->assign(inputs.size(), nullptr);
+        for (int i = 0; i < inputs.size(); ++i) {
+            if (!used[i]) continue;
+            (*datasets)[i] = static_cast<GDALDataset*>(
+                        GDALOpen(inputs[i].filePath.toUtf8().constData(), GA_ReadOnly));
+            if (!(*datasets)[i]) {
+                if (errorMessage) {
+                    *errorMessage = QString("Could not open %1: %2").arg(inputs[i].name, CPLGetLastErrorMsg());
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void closeInputs(std::vector<GDALDataset*> *datasets)
+    {
+        for (GDALDataset *dataset : *datasets) {
+            if (dataset) GDALClose(dataset);
+        }
+        datasets->clear();
+    }
+
+    // Parses, checks band numbers and raster sizes, and compiles
+    bool prepare(const QString &expression, const QVector<RasterInput> &inputs,
+                 Program *program, std::vector<SlotInfo> *slots, QString *errorMessage)
+    {
+        if (inputs.isEmpty()) {
+            if (errorMessage) *errorMessage = "No input raster";
+            return false;
+        }
+
+        Parser parser(expression, inputs);
+        int root = -1;
+        if (!parser.parse(&root, errorMessage)) return false;
+
+        *program = Compiler(parser.nodes()).compile(root);
+
+        std::vector<bool> used(inputs.size(), false);
+        used[0] = true;   // defines the output grid
+        for (int input : program->slotInputs) used[input] = true;
+
+        std::vector<GDALDataset*> datasets;
+        if (!openInputs(inputs, used, &datasets, errorMessage)) {
+            closeInputs(&datasets);
+            return false;
+        }
+
+        const int width = datasets[0]->GetRasterXSize();
+        const int height = datasets[0]->GetRasterYSize();
+        bool ok = true;
+
+        for (int i = 0; i < inputs.size() && ok; ++i) {
+            if (datasets[i] && (datasets[i]->GetRasterXSize() != width ||
+                                datasets[i]->GetRasterYSize() != height)) {
+                if (errorMessage) {
+                    *errorMessage = QString("%1 is %2 x %3 pixels but %4 is %5 x %6; all inputs must share one grid")
+                            .arg(inputs[i].name).arg(datasets[i]->GetRasterXSize()).arg(datasets[i]->GetRasterYSize())
+                            .arg(inputs[0].name).arg(width).arg(height);
+                }
+                ok = false;
+            }
+        }
+
+        slots->clear();
+        for (size_t s = 0; s < program->slotInputs.size() && ok; ++s) {
+            GDALDataset *dataset = datasets[program->slotInputs[s]];
+            const int band = program->slotBands[s];
+            if (band > dataset->GetRasterCount()) {
+                if (errorMessage) {
+                    *errorMessage = QString("%1 has %2 band(s), band %3 does not exist")
+                            .arg(inputs[program->slotInputs[s]].name)
+                            .arg(dataset->GetRasterCount()).arg(band);
+                }
+                ok = false;
+                break;
+            }
+
+            int hasNoData = 0;
+            double noData = dataset->GetRasterBand(band)->GetNoDataValue(&hasNoData);
+            SlotInfo info;
+            info.hasNoData = hasNoData != 0;
+            info.noData = static_cast<float>(noData);
+            slots->push_back(info);
+        }
+
+        closeInputs(&datasets);
+        return ok;
+    }
+}
+
+float RasterCalculator::noDataValue()
+{
+    return NoData;
+}
+
+bool RasterCalculator::validate(const QString &expression, const QVector<RasterInput> &inputs,
+                                QString *errorMessage)
+{
+    Program program;
+    std::vector<SlotInfo> slots;
+    return prepare(expression, inputs, &program, &slots, errorMessage);
+}
+
+bool RasterCalculator::calculate(const QString &expression, const QVector<RasterInput> &inputs,
+                                 const QString &outputPath, ProcessingFeedback *feedback,
+                                 QString *errorMessage)
+{
+    Program program;
+    std::vector<SlotInfo> slots;
+    if (!prepare(expression, inputs, &program, &slots, errorMessage)) return false;
+
+    GDALDataset *reference = static_cast<GDALDataset*>(
+                GDALOpen(inputs[0].filePath.toUtf8().constData(), GA_ReadOnly));
+    if (!reference) {
+        if (errorMessage) *errorMessage = "Could not open " + inputs[0].name;
+        return false;
+    }
+
+    const int width = reference->GetRasterXSize();
+    const int height = reference->GetRasterYSize();
+
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!driver) {
+        GDALClose(reference);
+        if (errorMessage) *errorMessage = "GeoTIFF driver not available";
+        return false;
+    }
+
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", QByteArray::number(TileSize).constData());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", QByteArray::number(TileSize).constData());
+    options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+
+    GDALDataset *output = driver->Create(outputPath.toUtf8().constData(), width, height, 1,
+                                         GDT_Float32, options);
+    CSLDestroy(options);
+
+    if (!output) {
+        GDALClose(reference);
+        if (errorMessage) *errorMessage = QString("Could not create %1: %2").arg(outputPath, CPLGetLastErrorMsg());
+        return false;
+    }
+
+    double geoTransform[6];
+    if (reference->GetGeoTransform(geoTransform) == CE_None) {
+        output->SetGeoTransform(geoTransform);
+    }
+    output->SetProjection(reference->GetProjectionRef());
+    GDALClose(reference);
+
+    GDALRasterBand *outputBand = output->GetRasterBand(1);
+    outputBand->SetNoDataValue(NoData);
+
+    const int windowColumns = (width + WindowColumns - 1) / WindowColumns;
+    const int windowRows = (height + WindowRows - 1) / WindowRows;
+    const int windowCount = windowColumns * windowRows;
+    const int chunkSize = qMax(1, windowCount / (QThreadPool::globalInstance()->maxThreadCount() * 4));
+
+    std::vector<bool> used(inputs.size(), false);
+    for (int input : program.slotInputs) used[input] = true;
+
+    QMutex mutex;   // guards 'output' and 'failure'
+    QString failure;
+    QAtomicInt failed(0);
+
+    parallelForChunks(windowCount, chunkSize, feedback, [&](int, int begin, int end) {
+        // GDAL dataset handles are not thread safe, so each chunk opens its own
+        std::vector<GDALDataset*> datasets;
+        QString openError;
+        if (!openInputs(inputs, used, &datasets, &openError)) {
+            closeInputs(&datasets);
+            QMutexLocker locker(&mutex);
+            if (failure.isEmpty()) failure = openError;
+            failed.storeRelease(1);
+            return;
+        }
+
+        const size_t windowPixels = static_cast<size_t>(WindowRows) * WindowColumns;
+        std::vector<std::vector<float>> slotData(program.slotInputs.size(), std::vector<float>(windowPixels));
+        std::vector<float> result(windowPixels);
+        std::vector<unsigned char> mask(BlockPixels);
+        std::vector<const float*> slotPointers(program.slotInputs.size());
+        Evaluator evaluator(program);
+
+        for (int w = begin; w < end; ++w) {
+            if (failed.loadAcquire() || (feedback && feedback->isCanceled())) break;
+
+            const int x0 = (w % windowColumns) * WindowColumns;
+            const int y0 = (w / windowColumns) * WindowRows;
+            const int columns = qMin(WindowColumns, width - x0);
+            const int rows = qMin(WindowRows, height - y0);
+            const int pixels = columns * rows;
+
+            bool ok = true;
+            for (size_t s = 0; s < slotData.size() && ok; ++s) {
+                GDALRasterBand *band = datasets[program.slotInputs[s]]->GetRasterBand(program.slotBands[s]);
+                ok = band->RasterIO(GF_Read, x0, y0, columns, rows, slotData[s].data(),
+                                    columns, rows, GDT_Float32, 0, 0) == CE_None;
+            }
+
+            for (int offset = 0; offset < pixels && ok; offset += BlockPixels) {
+                const int count = qMin(BlockPixels, pixels - offset);
+
+                std::fill(mask.begin(), mask.begin() + count, 0);
+                for (size_t s = 0; s < slotData.size(); ++s) {
+                    const float *values = slotData[s].data() + offset;
+                    slotPointers[s] = values;
+                    if (!slots[s].hasNoData) continue;
+                    const float noData = slots[s].noData;
+                    if (noData != noData) {
+                        for (int i = 0; i < count; ++i) mask[i] |= (values[i] != values[i]);
+                    } else {
+                        for (int i = 0; i < count; ++i) mask[i] |= (values[i] == noData);
+                    }
+                }
+
+                const float *values = evaluator.run(slotPointers.data(), count);
+                float *out = result.data() + offset;
+                for (int i = 0; i < count; ++i) {
+                    out[i] = (mask[i] || !std::isfinite(values[i])) ? NoData : values[i];
+                }
+            }
+
+            if (ok) {
+                QMutexLocker locker(&mutex);
+                ok = outputBand->RasterIO(GF_Write, x0, y0, columns, rows, result.data(),
+                                          columns, rows, GDT_Float32, 0, 0) == CE_None;
+                // Leave no dirty blocks behind that a cache eviction on a reader
+                // thread could try to write while another worker holds 'output'
+                output->FlushCache();
+            }
+
+            if (!ok) {
+                QMutexLocker locker(&mutex);
+                if (failure.isEmpty()) failure = CPLGetLastErrorMsg();
+                failed.storeRelease(1);
+            }
+        }
+
+        closeInputs(&datasets);
+    });
+
+    GDALClose(output);
+
+    const bool canceled = feedback && feedback->isCanceled();
+    if (canceled || failed.loadAcquire()) {
+        GDALDriver::QuietDelete(outputPath.toUtf8().constData());
+        if (errorMessage) *errorMessage = canceled ? QString("Canceled") : failure;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef RASTERCALCULATOR_H
+#define RASTERCALCULATOR_H
+
+#include <QString>
+#include <QVector>
+
+#include "geoprocessing.h"
+
+// A raster an expression can reference, either as "B<n>" (first input only)
+// or as "<name>@<n>" / "\"<name with spaces>\"@<n>".
+struct RasterInput
+{
+    QString name;
+    QString filePath;
+};
+
+namespace RasterCalculator
+{
+    // Checks the syntax of 'expression' and that every band it references
+    // exists in 'inputs'. Cheap enough to call on the GUI thread.
+    bool validate(const QString &expression, const QVector<RasterInput> &inputs,
+                  QString *errorMessage = nullptr);
+
+    // Evaluates 'expression' for every pixel and writes a tiled Float32
+    // GeoTIFF on the grid of the first input. All inputs must have the same
+    // size. Pixels where any referenced band is nodata, or where the result is
+    // not finite, are written as nodata.
+    //
+    // Operators: + - * / ^, comparisons < > <= >= == != (1 or 0), and, or.
+    // Functions: abs sqrt exp ln log10 sin cos tan asin acos atan,
+    // min(a, b), max(a, b), if(condition, a, b).
+    bool calculate(const QString &expression, const QVector<RasterInput> &inputs,
+                   const QString &outputPath, ProcessingFeedback *feedback = nullptr,
+                   QString *errorMessage = nullptr);
+
+    // Value written for nodata pixels
+    float noDataValue();
+}
+
+#endif // RASTERCALCULATOR_H
@@ -0,0 +1,256 @@
+#include "reprojection.h"
+
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "crsregistry.h"
+#include "profiler.h"
+
+namespace
+{
+
+// A coordinate sequence inside a WKB blob: 'count' points of 'stride'
+// doubles starting at byte 'offset'
+struct CoordinateRun
+{
+    size_t offset;
+    quint32 count;
+    int stride;
+};
+
+class RunCollector
+{
+public:
+    RunCollector(const unsigned char *data, size_t size, size_t base,
+                 std::vector<CoordinateRun> *runs)
+        : m_data(data), m_size(size), m_base(base), m_pos(0), m_runs(runs) {}
+
+    // FeatureBuffer WKB is always little-endian
+    bool collect()
+    {
+        if (!has(5) || m_data[m_pos] != 1) return false;
+        ++m_pos;
+
+        quint32 rawType = readUInt32();
+        if (rawType & 0x20000000u) {
+            if (!has(4)) return false;
+            m_pos += 4;   // EWKB SRID
+        }
+        const bool hasZFlag = (rawType & 0x80000000u) != 0;
+        const bool hasMFlag = (rawType & 0x40000000u) != 0;
+        quint32 type = rawType & 0x0fffffffu;
+        const quint32 isoDims = type / 1000;
+        type %= 1000;
+        const bool hasZ = hasZFlag || isoDims == 1 || isoDims == 3;
+        const bool hasM = hasMFlag || isoDims == 2 || isoDims == 3;
+        const int stride = 2 + (hasZ ? 1 : 0) + (hasM ? 1 : 0);
+
+        switch (type) {
+        case 1: // Point
+            return addRun(1, stride);
+        case 2: { // LineString
+            if (!has(4)) return false;
+            return addRun(readUInt32(), stride);
+        }
+        case 3: { // Polygon
+            if (!has(4)) return false;
+            const quint32 rings = readUInt32();
+            for (quint32 r = 0; r < rings; ++r) {
+                if (!has(4) || !addRun(readUInt32(), stride)) return false;
+            }
+            return true;
+        }
+        case 4: // MultiPoint
+        case 5: // MultiLineString
+        case 6: // MultiPolygon
+        case 7: { // GeometryCollection
+            if (!has(4)) return false;
+            const quint32 count = readUInt32();
+            for (quint32 i = 0; i < count; ++i) {
+                if (!collect()) return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+private:
+    bool has(size_t bytes) const { return m_pos + bytes <= m_size; }
+
+    quint32 readUInt32()
+    {
+        const quint32 value = qFromLittleEndian<quint32>(m_data + m_pos);
+        m_pos += 4;
+        return value;
+    }
+
+    bool addRun(quint32 count, int stride)
+    {
+        const size_t bytes = size_t(count) * stride * 8;
+        if (!has(bytes)) return false;
+        CoordinateRun run = { m_base + m_pos, count, stride };
+        m_runs->push_back(run);
+        m_pos += bytes;
+        return true;
+    }
+
+    const unsigned char *m_data;
+    size_t m_size;
+    size_t m_base;
+    size_t m_pos;
+    std::vector<CoordinateRun> *m_runs;
+};
+
+inline double readDouble(const unsigned char *p)
+{
+    const quint64 bits = qFromLittleEndian<quint64>(p);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline void writeDouble(unsigned char *p, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian<quint64>(bits, p);
+}
+
+} // namespace
+
+bool Reprojection::isSameCrs(const QString &wktA, const QString &wktB)
+{
+    if (wktA == wktB) return !wktA.isEmpty();
+    return CrsRegistry::instance().isSame(wktA, wktB);
+}
+
+bool Reprojection::reproject(const FeatureBuffer &input, const QString &targetWkt,
+                             FeatureBuffer *output, ProcessingFeedback *feedback,
+                             QString *errorMessage)
+{
+    if (!output) {
+        if (errorMessage) *errorMessage = "No output buffer";
+        return false;
+    }
+
+    ProfileScope scope(Profiler::Transform, "reproject features");
+    const QString sourceWkt = input.spatialReferenceWkt();
+    if (sourceWkt.isEmpty()) {
+        if (errorMessage) *errorMessage = "The layer has no coordinate reference system";
+        return false;
+    }
+
+    // Build it once here, so a bad CRS is reported instead of dropping every feature
+    ProjThreadContext &callerContext = ProjThreadContext::local();
+    if (!callerContext.transformation(sourceWkt, targetWkt)) {
+        if (errorMessage) *errorMessage = "Cannot create transformation: " + callerContext.lastError();
+        return false;
+    }
+
+    output->clear();
+    output->copySchema(input);
+    output->setSpatialReferenceWkt(targetWkt);
+
+    const int chunkSize = defaultChunkSize(input.count());
+    QVector<FeatureBuffer> chunkResults((input.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(input.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        PJ *transformation = ProjThreadContext::local().transformation(sourceWkt, targetWkt);
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+        if (!transformation) return;
+
+        // Copy the chunk's WKB and find every coordinate sequence in it
+        std::vector<unsigned char> bytes;
+        std::vector<size_t> featureOffsets(end - begin + 1, 0);
+        std::vector<size_t> featureRuns(end - begin + 1, 0);
+        std::vector<bool> valid(end - begin, true);
+        std::vector<CoordinateRun> runs;
+        size_t pointCount = 0;
+
+        for (int i = begin; i < end; ++i) {
+            const int local = i - begin;
+            const size_t offset = bytes.size();
+            const int size = input.wkbSize(i);
+            bytes.insert(bytes.end(), input.wkb(i), input.wkb(i) + size);
+
+            const size_t firstRun = runs.size();
+            RunCollector collector(input.wkb(i), size_t(size), offset, &runs);
+            if (!collector.collect()) {
+                runs.resize(firstRun);
+                valid[local] = false;
+            }
+            featureOffsets[local + 1] = bytes.size();
+            featureRuns[local + 1] = runs.size();
+        }
+        for (const CoordinateRun &run : runs) pointCount += run.count;
+
+        // Gather, transform in one batch, scatter back
+        std::vector<double> xs(pointCount);
+        std::vector<double> ys(pointCount);
+        size_t n = 0;
+        for (const CoordinateRun &run : runs) {
+            const unsigned char *p = bytes.data() + run.offset;
+            for (quint32 k = 0; k < run.count; ++k, p += run.stride * 8, ++n) {
+                xs[n] = readDouble(p);
+                ys[n] = readDouble(p + 8);
+            }
+        }
+
+        if (pointCount > 0) {
+            proj_trans_generic(transformation, PJ_FWD,
+                               xs.data(), sizeof(double), pointCount,
+                               ys.data(), sizeof(double), pointCount,
+                               nullptr, 0, 0, nullptr, 0, 0);
+        }
+
+        n = 0;
+        for (int local = 0; local < end - begin; ++local) {
+            Envelope envelope;
+            for (size_t r = featureRuns[local]; r < featureRuns[local + 1]; ++r) {
+                const CoordinateRun &run = runs[r];
+                unsigned char *p = bytes.data() + run.offset;
+                for (quint32 k = 0; k < run.count; ++k, p += run.stride * 8, ++n) {
+                    const double x = xs[n];
+                    const double y = ys[n];
+                    if (!std::isfinite(x) || !std::isfinite(y)) {
+                        valid[local] = false;
+                        continue;
+                    }
+                    writeDouble(p, x);
+                    writeDouble(p + 8, y);
+                    envelope.expand(Envelope(x, y, x, y));
+                }
+            }
+
+            if (!valid[local]) continue;
+            const size_t offset = featureOffsets[local];
+            result.append(bytes.data() + offset, int(featureOffsets[local + 1] - offset),
+                          envelope, input.attributes(begin + local));
+        }
+    });
+
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+
+    // Concatenate in chunk order so output order follows input order
+    qint64 totalBytes = 0;
+    int features = 0;
+    for (const FeatureBuffer &chunk : chunkResults) {
+        features += chunk.count();
+        for (int i = 0; i < chunk.count(); ++i) totalBytes += chunk.wkbSize(i);
+    }
+    output->reserve(features, totalBytes);
+    for (const FeatureBuffer &chunk : chunkResults) {
+        output->append(chunk);
+    }
+    return true;
+}
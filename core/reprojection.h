@@ -0,0 +1,25 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include <QString>
+
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+
+namespace Reprojection
+{
+    // True when both WKT strings describe the same CRS. An empty WKT (unknown
+    // CRS) never matches.
+    bool isSameCrs(const QString &wktA, const QString &wktB);
+
+    // Transforms every feature of 'input' to 'targetWkt' (x/y in
+    // longitude/latitude order for geographic CRSs). Coordinates are patched
+    // in copies of the WKB, gathered per chunk into flat x/y arrays for one
+    // proj_trans_generic call each. Z and M ordinates are kept as they are.
+    // Features that fall outside the area of the target CRS are dropped.
+    bool reproject(const FeatureBuffer &input, const QString &targetWkt,
+                   FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+                   QString *errorMessage = nullptr);
+}
+
+#endif // REPROJECTION_H
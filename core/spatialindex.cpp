@@ -0,0 +1,131 @@
+#include "spatialindex.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpatialIndex::SpatialIndex(int nodeCapacity)
+    : m_nodeCapacity(qMax(2, nodeCapacity))
+{
+}
+
+void SpatialIndex::clear()
+{
+    m_nodes.clear();
+    m_itemIds.clear();
+    m_itemEnvelopes.clear();
+}
+
+Envelope SpatialIndex::bounds() const
+{
+    return m_nodes.isEmpty() ? Envelope() : m_nodes.last().envelope;
+}
+
+// Sort-Tile-Recursive ordering: sort by x, cut into vertical slices, sort each
+// slice by y. Consecutive runs of 'capacity' entries then form compact nodes.
+template <typename CenterX, typename CenterY>
+static void strSort(QVector<int> &ids, int capacity, CenterX centerX, CenterY centerY)
+{
+    const int count = ids.size();
+    const int nodeCount = (count + capacity - 1) / capacity;
+    const int sliceCount = qMax(1, static_cast<int>(std::ceil(std::sqrt(double(nodeCount)))));
+    const int sliceSize = sliceCount * capacity;
+
+    std::sort(ids.begin(), ids.end(), [&](int a, int b) {
+        return centerX(a) < centerX(b);
+    });
+
+    for (int start = 0; start < count; start += sliceSize) {
+        auto first = ids.begin() + start;
+        auto last = ids.begin() + qMin(count, start + sliceSize);
+        std::sort(first, last, [&](int a, int b) {
+            return centerY(a) < centerY(b);
+        });
+    }
+}
+
+void SpatialIndex::build(const QVector<Envelope> &envelopes)
+{
+    clear();
+
+    m_itemEnvelopes = envelopes;
+    m_itemIds.reserve(envelopes.size());
+    for (int i = 0; i < envelopes.size(); ++i) {
+        if (!envelopes[i].isNull()) {
+            m_itemIds.append(i);
+        }
+    }
+
+    if (m_itemIds.isEmpty()) return;
+
+    // Leaf level
+    strSort(m_itemIds, m_nodeCapacity,
+            [this](int id) { return m_itemEnvelopes[id].centerX(); },
+            [this](int id) { return m_itemEnvelopes[id].centerY(); });
+
+    for (int start = 0; start < m_itemIds.size(); start += m_nodeCapacity) {
+        Node node;
+        node.first = start;
+        node.count = qMin(m_nodeCapacity, m_itemIds.size() - start);
+        node.leaf = true;
+        for (int i = start; i < start + node.count; ++i) {
+            node.envelope.expand(m_itemEnvelopes[m_itemIds[i]]);
+        }
+        m_nodes.append(node);
+    }
+
+    // Inner levels: pack the previous level until a single root remains.
+    // Children of every inner node must be contiguous, so each level is
+    // re-ordered and appended as a block before its parents are created.
+    int levelStart = 0;
+    int levelEnd = m_nodes.size();
+
+    while (levelEnd - levelStart > 1) {
+        QVector<int> order;
+        order.reserve(levelEnd - levelStart);
+        for (int n = levelStart; n < levelEnd; ++n) {
+            order.append(n);
+        }
+
+        strSort(order, m_nodeCapacity,
+                [this](int n) { return m_nodes[n].envelope.centerX(); },
+                [this](int n) { return m_nodes[n].envelope.centerY(); });
+
+        QVector<Node> sorted;
+        sorted.reserve(order.size());
+        for (int n : order) {
+            sorted.append(m_nodes[n]);
+        }
+        std::copy(sorted.begin(), sorted.end(), m_nodes.begin() + levelStart);
+
+        const int nextStart = m_nodes.size();
+        for (int start = levelStart; start < levelEnd; start += m_nodeCapacity) {
+            Node parent;
+            parent.first = start;
+            parent.count = qMin(m_nodeCapacity, levelEnd - start);
+            parent.leaf = false;
+            for (int c = start; c < start + parent.count; ++c) {
+                parent.envelope.expand(m_nodes[c].envelope);
+            }
+            m_nodes.append(parent);
+        }
+
+        levelStart = nextStart;
+        levelEnd = m_nodes.size();
+    }
+}
+
+void SpatialIndex::query(const Envelope &area, QVector<int> *results) const
+{
+    if (!results) return;
+    visit(area, [results](int id) {
+        results->append(id);
+        return true;
+    });
+}
+
+QVector<int> SpatialIndex::query(const Envelope &area) const
+{
+    QVector<int> results;
+    query(area, &results);
+    return results;
+}
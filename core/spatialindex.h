@@ -0,0 +1,76 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QVarLengthArray>
+#include <QVector>
+
+#include "featurebuffer.h"
+
+// Static, bulk-loaded R-tree (Sort-Tile-Recursive packing) over item envelopes.
+// Built once and then queried concurrently from any number of threads: queries
+// only read the node arrays, so no locking is needed.
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(int nodeCapacity = 16);
+
+    void build(const QVector<Envelope> &envelopes);
+    void clear();
+
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    int itemCount() const { return m_itemIds.size(); }
+    Envelope bounds() const;
+
+    // Appends the ids of all items whose envelope intersects 'area' to 'results'
+    void query(const Envelope &area, QVector<int> *results) const;
+    QVector<int> query(const Envelope &area) const;
+
+    // Calls visitor(itemId) for each hit; stops early when the visitor returns false
+    template <typename Visitor>
+    void visit(const Envelope &area, Visitor visitor) const;
+
+private:
+    struct Node {
+        Envelope envelope;
+        int first;   // index into m_nodes (inner) or m_itemIds (leaf)
+        int count;
+        bool leaf;
+    };
+
+    int m_nodeCapacity;
+    QVector<Node> m_nodes;      // children stored contiguously, root is last
+    QVector<int> m_itemIds;     // item ids in leaf order
+    QVector<Envelope> m_itemEnvelopes;
+};
+
+template <typename Visitor>
+void SpatialIndex::visit(const Envelope &area, Visitor visitor) const
+{
+    if (m_nodes.isEmpty() || area.isNull()) return;
+
+    QVarLengthArray<int, 128> stack;
+    stack.append(m_nodes.size() - 1);
+
+    while (!stack.isEmpty()) {
+        const Node &node = m_nodes[stack.last()];
+        stack.removeLast();
+        if (!node.envelope.intersects(area)) continue;
+
+        if (node.leaf) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                const int id = m_itemIds[i];
+                if (m_itemEnvelopes[id].intersects(area) && !visitor(id)) {
+                    return;
+                }
+            }
+        } else {
+            for (int c = node.first; c < node.first + node.count; ++c) {
+                if (m_nodes[c].envelope.intersects(area)) {
+                    stack.append(c);
+                }
+            }
+        }
+    }
+}
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,457 @@
+#include "terrain.h"
+
+#include <QColor>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <gdal_priv.h>
+#include <gdal_alg.h>
+#include <gdalwarper.h>
+
+#include "crsregistry.h"
+#include "profiler.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const double DegreesToRadians = M_PI / 180.0;
+    const double RadiansToDegrees = 180.0 / M_PI;
+
+    // Metres per degree, for DEMs in geographic coordinates
+    const double MetresPerDegreeLatitude = 110574.0;
+    const double MetresPerDegreeLongitude = 111320.0;
+
+    // gdalwarp's default: approximate the transform to within 1/8 pixel
+    const double ApproxMaxError = 0.125;
+
+    // Band 1 of 'source' as a float VRT in the CRS 'destinationWkt', NaN
+    // where the source has no data and outside it. Takes over 'source'.
+    GDALDataset *createWarpedDem(GDALDataset *source, const QByteArray &destinationWkt)
+    {
+        char **options = CSLSetNameValue(nullptr, "DST_SRS", destinationWkt.constData());
+        void *transformer = GDALCreateGenImgProjTransformer2(source, nullptr, options);
+        CSLDestroy(options);
+        if (!transformer) {
+            GDALClose(source);
+            return nullptr;
+        }
+
+        double geoTransform[6];
+        int width = 0;
+        int height = 0;
+        if (GDALSuggestedWarpOutput(source, GDALGenImgProjTransform, transformer,
+                                    geoTransform, &width, &height) != CE_None ||
+            width <= 0 || height <= 0) {
+            GDALDestroyGenImgProjTransformer(transformer);
+            GDALClose(source);
+            return nullptr;
+        }
+        GDALSetGenImgProjTransformerDstGeoTransform(transformer, geoTransform);
+
+        GDALWarpOptions *warp = GDALCreateWarpOptions();
+        warp->hSrcDS = source;
+        warp->eResampleAlg = GRA_Bilinear;
+        warp->eWorkingDataType = GDT_Float32;     // also the type of the VRT band
+        warp->nBandCount = 1;
+        warp->panSrcBands = static_cast<int*>(CPLMalloc(sizeof(int)));
+        warp->panSrcBands[0] = 1;
+        warp->panDstBands = static_cast<int*>(CPLMalloc(sizeof(int)));
+        warp->panDstBands[0] = 1;
+
+        int hasNoData = 0;
+        const double noData = source->GetRasterBand(1)->GetNoDataValue(&hasNoData);
+        if (hasNoData) {
+            warp->padfSrcNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double)));
+            warp->padfSrcNoDataReal[0] = noData;
+        }
+        warp->padfDstNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double)));
+        warp->padfDstNoDataReal[0] = std::numeric_limits<double>::quiet_NaN();
+        warp->papszWarpOptions = CSLSetNameValue(warp->papszWarpOptions, "INIT_DEST", "NO_DATA");
+
+        warp->pfnTransformer = GDALApproxTransform;
+        warp->pTransformerArg = GDALCreateApproxTransformer(GDALGenImgProjTransform, transformer, ApproxMaxError);
+        GDALApproxTransformerOwnsSubtransformer(warp->pTransformerArg, TRUE);
+
+        // The VRT owns the transformer and holds its own reference to the
+        // source, which is released here
+        GDALDatasetH warped = GDALCreateWarpedVRT(source, width, height, geoTransform, warp);
+        if (warped) {
+            GDALSetProjection(warped, destinationWkt.constData());
+        } else {
+            GDALDestroyTransformer(warp->pTransformerArg);
+        }
+        GDALDestroyWarpOptions(warp);
+        GDALReleaseDataset(source);
+        return static_cast<GDALDataset*>(warped);
+    }
+
+    // Horn gradients for 'count' cells of one row. 'above', 'row' and
+    // 'below' point at the halo column left of the first cell. 'xScale' and
+    // 'yScale' fold in the z factor, the kernel weights and the cell size.
+    void hornGradients(const float *above, const float *row, const float *below, int count,
+                       float xScale, float yScale, float *p, float *q)
+    {
+        int x = 0;
+#ifdef __SSE2__
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 xs = _mm_set1_ps(xScale);
+        const __m128 ys = _mm_set1_ps(yScale);
+        for (; x + 4 <= count; x += 4) {
+            const __m128 a = _mm_loadu_ps(above + x);
+            const __m128 b = _mm_loadu_ps(above + x + 1);
+            const __m128 c = _mm_loadu_ps(above + x + 2);
+            const __m128 d = _mm_loadu_ps(row + x);
+            const __m128 f = _mm_loadu_ps(row + x + 2);
+            const __m128 g = _mm_loadu_ps(below + x);
+            const __m128 h = _mm_loadu_ps(below + x + 1);
+            const __m128 i = _mm_loadu_ps(below + x + 2);
+
+            const __m128 right = _mm_add_ps(_mm_add_ps(c, i), _mm_mul_ps(two, f));
+            const __m128 left = _mm_add_ps(_mm_add_ps(a, g), _mm_mul_ps(two, d));
+            const __m128 bottom = _mm_add_ps(_mm_add_ps(g, i), _mm_mul_ps(two, h));
+            const __m128 top = _mm_add_ps(_mm_add_ps(a, c), _mm_mul_ps(two, b));
+
+            _mm_storeu_ps(p + x, _mm_mul_ps(_mm_sub_ps(right, left), xs));
+            _mm_storeu_ps(q + x, _mm_mul_ps(_mm_sub_ps(bottom, top), ys));
+        }
+#endif
+        for (; x < count; ++x) {
+            const float right = above[x + 2] + 2.0f * row[x + 2] + below[x + 2];
+            const float left = above[x] + 2.0f * row[x] + below[x];
+            const float bottom = below[x] + 2.0f * below[x + 1] + below[x + 2];
+            const float top = above[x] + 2.0f * above[x + 1] + above[x + 2];
+            p[x] = (right - left) * xScale;
+            q[x] = (bottom - top) * yScale;
+        }
+    }
+
+    void hillshadeRow(const float *p, const float *q, int count,
+                      const Terrain::Parameters &parameters, float *output)
+    {
+        const double azimuth = parameters.azimuth * DegreesToRadians;
+        const double altitude = parameters.altitude * DegreesToRadians;
+        const float sinAltitude = float(std::sin(altitude));
+        const float eastLight = float(std::sin(azimuth) * std::cos(altitude));
+        const float northLight = float(std::cos(azimuth) * std::cos(altitude));
+
+        int x = 0;
+#ifdef __SSE2__
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 sinAlt = _mm_set1_ps(sinAltitude);
+        const __m128 east = _mm_set1_ps(eastLight);
+        const __m128 north = _mm_set1_ps(northLight);
+        for (; x + 4 <= count; x += 4) {
+            const __m128 pv = _mm_loadu_ps(p + x);
+            const __m128 qv = _mm_loadu_ps(q + x);
+            const __m128 light = _mm_sub_ps(_mm_sub_ps(sinAlt, _mm_mul_ps(pv, east)),
+                                            _mm_mul_ps(qv, north));
+            const __m128 norm = _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(pv, pv),
+                                                                       _mm_mul_ps(qv, qv))));
+            __m128 value = _mm_mul_ps(scale, _mm_div_ps(light, norm));
+            // The operand order keeps NaN (nodata) cells NaN
+            value = _mm_max_ps(zero, value);
+            value = _mm_min_ps(scale, value);
+            _mm_storeu_ps(output + x, value);
+        }
+#endif
+        for (; x < count; ++x) {
+            const float light = sinAltitude - p[x] * eastLight - q[x] * northLight;
+            const float value = 255.0f * light / std::sqrt(1.0f + p[x] * p[x] + q[x] * q[x]);
+            output[x] = std::isnan(value) ? value : std::min(255.0f, std::max(0.0f, value));
+        }
+    }
+
+    void slopeRow(const float *p, const float *q, int count, float *output)
+    {
+        for (int x = 0; x < count; ++x) {
+            output[x] = float(std::atan(std::sqrt(p[x] * p[x] + q[x] * q[x])) * RadiansToDegrees);
+        }
+    }
+
+    void aspectRow(const float *p, const float *q, int count, float *output)
+    {
+        for (int x = 0; x < count; ++x) {
+            if (p[x] == 0.0f && q[x] == 0.0f) {
+                output[x] = -1.0f;
+                continue;
+            }
+            // Downslope direction, clockwise from north
+            double aspect = std::atan2(-p[x], -q[x]) * RadiansToDegrees;
+            if (aspect < 0.0) aspect += 360.0;
+            output[x] = float(aspect);
+        }
+    }
+}
+
+QString Terrain::modeName(Mode mode)
+{
+    switch (mode) {
+    case Hillshade: return "Hillshade";
+    case Slope: return "Slope";
+    case Aspect: return "Aspect";
+    }
+    return QString();
+}
+
+void Terrain::computeTile(const float *elevation, int width, int height,
+                          double cellWidth, double cellHeight,
+                          const Parameters &parameters, float *output)
+{
+    // p = dz/dx (east), q = dz/dy (north); a negative cellHeight flips rows
+    const float xScale = float(parameters.zFactor / (8.0 * cellWidth));
+    const float yScale = float(parameters.zFactor / (8.0 * cellHeight));
+
+    const int stride = width + 2;
+    std::vector<float> p(width);
+    std::vector<float> q(width);
+
+    for (int y = 0; y < height; ++y) {
+        const float *above = elevation + size_t(y) * stride;
+        hornGradients(above, above + stride, above + 2 * stride, width,
+                      xScale, yScale, p.data(), q.data());
+
+        float *out = output + size_t(y) * width;
+        switch (parameters.mode) {
+        case Hillshade:
+            hillshadeRow(p.data(), q.data(), width, parameters, out);
+            break;
+        case Slope:
+            slopeRow(p.data(), q.data(), width, out);
+            break;
+        case Aspect:
+            aspectRow(p.data(), q.data(), width, out);
+            break;
+        }
+    }
+}
+
+QImage Terrain::renderTile(const float *values, int width, int height, Mode mode)
+{
+    QImage image(width, height, QImage::Format_ARGB32);
+
+    QRgb hues[360];
+    if (mode == Aspect) {
+        for (int i = 0; i < 360; ++i) {
+            hues[i] = QColor::fromHsv(i, 150, 240).rgba();
+        }
+    }
+
+    bool empty = true;
+    for (int y = 0; y < height; ++y) {
+        const float *row = values + size_t(y) * width;
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            const float value = row[x];
+            if (std::isnan(value)) {
+                line[x] = qRgba(0, 0, 0, 0);
+                continue;
+            }
+            empty = false;
+
+            switch (mode) {
+            case Hillshade: {
+                const int gray = qBound(0, int(value + 0.5f), 255);
+                line[x] = qRgb(gray, gray, gray);
+                break;
+            }
+            case Slope: {
+                // Flat is white, vertical is black
+                const int gray = 255 - qBound(0, int(value * 255.0f / 90.0f + 0.5f), 255);
+                line[x] = qRgb(gray, gray, gray);
+                break;
+            }
+            case Aspect:
+                line[x] = value < 0.0f ? qRgb(220, 220, 220) : hues[int(value) % 360];
+                break;
+            }
+        }
+    }
+
+    return empty ? QImage() : image;
+}
+
+TerrainTileSource::TerrainTileSource(const QString &filePath, const Terrain::Parameters &parameters,
+                                     const QString &destinationWkt)
+    : m_filePath(filePath)
+    , m_parameters(parameters)
+    , m_destinationWkt(destinationWkt)
+    , m_warped(false)
+    , m_geographic(false)
+    , m_hasNoData(false)
+    , m_noData(0.0f)
+{
+    m_geoTransform[0] = 0.0;
+    m_geoTransform[1] = 1.0;
+    m_geoTransform[2] = 0.0;
+    m_geoTransform[3] = 0.0;
+    m_geoTransform[4] = 0.0;
+    m_geoTransform[5] = -1.0;
+}
+
+TerrainTileSource::~TerrainTileSource()
+{
+    for (GDALDataset *dataset : m_freeDatasets) {
+        GDALClose(dataset);
+    }
+}
+
+bool TerrainTileSource::open(QString *errorMessage)
+{
+    GDALDataset *dataset = acquireDataset();
+    if (!dataset) {
+        if (errorMessage) *errorMessage = "Could not open " + m_filePath;
+        return false;
+    }
+    if (dataset->GetRasterCount() < 1) {
+        releaseDataset(dataset);
+        if (errorMessage) *errorMessage = "The raster has no bands";
+        return false;
+    }
+
+    // Warped only when both CRSs are known and differ; every handle
+    // borrowed from then on is a warped VRT
+    const QString sourceWkt = QString::fromUtf8(dataset->GetProjectionRef());
+    CrsRegistry &registry = CrsRegistry::instance();
+    if (!m_destinationWkt.isEmpty() && !sourceWkt.isEmpty() &&
+        registry.crs(sourceWkt) && registry.crs(m_destinationWkt) &&
+        !registry.isSame(sourceWkt, m_destinationWkt)) {
+        dataset = createWarpedDem(dataset, m_destinationWkt.toUtf8());
+        if (!dataset) {
+            if (errorMessage) {
+                *errorMessage = QString("Cannot reproject %1: %2").arg(m_filePath, CPLGetLastErrorMsg());
+            }
+            return false;
+        }
+        m_warped = true;
+    }
+
+    m_size = QSize(dataset->GetRasterXSize(), dataset->GetRasterYSize());
+    dataset->GetGeoTransform(m_geoTransform);
+
+    int hasNoData = 0;
+    const double noData = dataset->GetRasterBand(1)->GetNoDataValue(&hasNoData);
+    m_hasNoData = hasNoData != 0;
+    m_noData = float(noData);
+
+    const char *wkt = dataset->GetProjectionRef();
+    if (wkt && *wkt) {
+        QSharedPointer<const CrsDefinition> crs = CrsRegistry::instance().crs(QString::fromUtf8(wkt));
+        m_geographic = crs && crs->geographic;
+    }
+
+    releaseDataset(dataset);
+    return true;
+}
+
+GDALDataset *TerrainTileSource::acquireDataset()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_freeDatasets.isEmpty()) {
+            return m_freeDatasets.takeLast();
+        }
+    }
+    GDALDataset *dataset = static_cast<GDALDataset*>(GDALOpen(m_filePath.toUtf8().constData(), GA_ReadOnly));
+    if (dataset && m_warped) {
+        dataset = createWarpedDem(dataset, m_destinationWkt.toUtf8());
+    }
+    return dataset;
+}
+
+void TerrainTileSource::releaseDataset(GDALDataset *dataset)
+{
+    QMutexLocker locker(&m_mutex);
+    m_freeDatasets.append(dataset);
+}
+
+QImage TerrainTileSource::computeTile(int level, int column, int row, int tileSize)
+{
+    const int step = 1 << level;
+    const int levelWidth = (m_size.width() + step - 1) / step;
+    const int levelHeight = (m_size.height() + step - 1) / step;
+
+    // Tile window in level pixels
+    const int x0 = column * tileSize;
+    const int y0 = row * tileSize;
+    const int x1 = qMin(x0 + tileSize, levelWidth);
+    const int y1 = qMin(y0 + tileSize, levelHeight);
+    if (x0 >= x1 || y0 >= y1) return QImage();
+    const int width = x1 - x0;
+    const int height = y1 - y0;
+
+    // Plus the halo, as far as the raster reaches
+    const int readX0 = qMax(0, x0 - 1);
+    const int readY0 = qMax(0, y0 - 1);
+    const int readX1 = qMin(levelWidth, x1 + 1);
+    const int readY1 = qMin(levelHeight, y1 + 1);
+    const int readWidth = readX1 - readX0;
+    const int readHeight = readY1 - readY0;
+
+    std::vector<float> window(size_t(readWidth) * readHeight);
+
+    GDALDataset *dataset = acquireDataset();
+    if (!dataset) return QImage();
+
+    GDALRasterIOExtraArg extra;
+    INIT_RASTERIO_EXTRA_ARG(extra);
+    if (step > 1) extra.eResampleAlg = GRIORA_Average;
+
+    const int sourceX = readX0 * step;
+    const int sourceY = readY0 * step;
+    const int sourceWidth = qMin(readX1 * step, m_size.width()) - sourceX;
+    const int sourceHeight = qMin(readY1 * step, m_size.height()) - sourceY;
+    CPLErr err;
+    {
+        ProfileScope scope(Profiler::Fetch, "read DEM window");
+        err = dataset->GetRasterBand(1)->RasterIO(
+                    GF_Read, sourceX, sourceY, sourceWidth, sourceHeight,
+                    window.data(), readWidth, readHeight, GDT_Float32, 0, 0, &extra);
+    }
+    releaseDataset(dataset);
+    if (err != CE_None) return QImage();
+    Profiler::instance().addGdalBytes(qint64(window.size()) * sizeof(float));
+
+    if (m_hasNoData) {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (float &value : window) {
+            if (value == m_noData) value = nan;
+        }
+    }
+
+    // Halo cells beyond the raster edge repeat the edge
+    const int stride = width + 2;
+    std::vector<float> elevation(size_t(stride) * (height + 2));
+    for (int y = 0; y < height + 2; ++y) {
+        const int sourceRow = qBound(readY0, y0 - 1 + y, readY1 - 1) - readY0;
+        const float *in = window.data() + size_t(sourceRow) * readWidth;
+        float *out = elevation.data() + size_t(y) * stride;
+        for (int x = 0; x < stride; ++x) {
+            out[x] = in[qBound(readX0, x0 - 1 + x, readX1 - 1) - readX0];
+        }
+    }
+
+    double cellWidth = m_geoTransform[1] * step;
+    double cellHeight = m_geoTransform[5] * step;
+    if (m_geographic) {
+        const double latitude = m_geoTransform[3] +
+                (y0 + height / 2.0) * step * m_geoTransform[5];
+        cellWidth *= MetresPerDegreeLongitude * std::cos(latitude * DegreesToRadians);
+        cellHeight *= MetresPerDegreeLatitude;
+    }
+    if (cellWidth == 0.0 || cellHeight == 0.0) return QImage();
+
+    ProfileScope scope(Profiler::Rasterise, "terrain kernel");
+    std::vector<float> values(size_t(width) * height);
+    Terrain::computeTile(elevation.data(), width, height, cellWidth, cellHeight,
+                         m_parameters, values.data());
+    return Terrain::renderTile(values.data(), width, height, m_parameters.mode);
+}
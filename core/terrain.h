@@ -0,0 +1,97 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include "tiledrasteritem.h"
+
+class GDALDataset;
+
+namespace Terrain
+{
+    enum Mode {
+        Hillshade,
+        Slope,
+        Aspect
+    };
+
+    struct Parameters {
+        Mode mode = Hillshade;
+        double azimuth = 315.0;    // degrees clockwise from north
+        double altitude = 45.0;    // degrees above the horizon
+        double zFactor = 1.0;      // vertical exaggeration / unit conversion
+
+        bool operator==(const Parameters &other) const
+        {
+            return mode == other.mode && azimuth == other.azimuth &&
+                   altitude == other.altitude && zFactor == other.zFactor;
+        }
+        bool operator!=(const Parameters &other) const { return !(*this == other); }
+    };
+
+    QString modeName(Mode mode);
+
+    // 3x3 Horn kernel over one tile. 'elevation' holds (width + 2) x
+    // (height + 2) values: the tile plus a one cell halo on every side, NaN
+    // for nodata. Cell sizes are signed, as in the geotransform. Writes
+    // width x height values to 'output': hillshade 0-255, slope in degrees,
+    // aspect in degrees clockwise from north (-1 where flat). Cells whose
+    // window touches nodata become NaN.
+    void computeTile(const float *elevation, int width, int height,
+                     double cellWidth, double cellHeight,
+                     const Parameters &parameters, float *output);
+
+    // Colours computed values; NaN cells are transparent
+    QImage renderTile(const float *values, int width, int height, Mode mode);
+}
+
+// Computes terrain tiles straight from a DEM, reading only the window of
+// each tile plus its halo. Coarser levels read decimated windows (GDAL uses
+// overviews when the file has them) with the cell size scaled to match.
+//
+// Given a destination CRS other than the DEM's, the elevations are first
+// warped to it (bilinear, on the fly), so the tiles line up with rasters
+// reprojected to that CRS and slopes are measured in its units.
+class TerrainTileSource : public RasterTileSource
+{
+public:
+    TerrainTileSource(const QString &filePath, const Terrain::Parameters &parameters,
+                      const QString &destinationWkt = QString());
+    ~TerrainTileSource();
+
+    bool open(QString *errorMessage = nullptr);
+
+    const Terrain::Parameters &parameters() const { return m_parameters; }
+    QString filePath() const { return m_filePath; }
+    // True when the DEM is warped to the destination CRS
+    bool isWarped() const { return m_warped; }
+    // Grid of the tiles: the DEM's, or the warped one
+    const double *geoTransform() const { return m_geoTransform; }
+
+    QSize rasterSize() const override { return m_size; }
+    QImage computeTile(int level, int column, int row, int tileSize) override;
+
+private:
+    GDALDataset *acquireDataset();
+    void releaseDataset(GDALDataset *dataset);
+
+    QString m_filePath;
+    Terrain::Parameters m_parameters;
+    QString m_destinationWkt;
+    QSize m_size;
+    double m_geoTransform[6];
+    bool m_warped;
+    bool m_geographic;
+    bool m_hasNoData;
+    float m_noData;
+
+    // GDAL handles (warped VRTs when warping) are not thread safe: each
+    // worker borrows one
+    QMutex m_mutex;
+    QVector<GDALDataset*> m_freeDatasets;
+};
+
+#endif // TERRAIN_H
@@ -0,0 +1,262 @@
+#include "tiledrasteritem.h"
+
+#include <QAtomicInteger>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QThread>
+#include <QWidget>
+
+#include <cmath>
+
+#include "profiler.h"
+
+namespace {
+
+QAtomicInteger<quint64> nextItemId(1);
+
+} // namespace
+
+QCache<TiledRasterItem::CacheKey, QImage> &TiledRasterItem::tileCache()
+{
+    static QCache<CacheKey, QImage> cache(256 * 1024);
+    return cache;
+}
+
+QThreadPool *TiledRasterItem::tilePool()
+{
+    static QThreadPool *pool = [] {
+        QThreadPool *pool = new QThreadPool();
+        pool->setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+        return pool;
+    }();
+    return pool;
+}
+
+TiledRasterItem::TiledRasterItem(const QSharedPointer<RasterTileSource> &source,
+                                 QGraphicsItem *parent)
+    : QGraphicsObject(parent)
+    , m_source(source)
+    , m_size(source ? source->rasterSize() : QSize())
+    , m_id(nextItemId.fetchAndAddRelaxed(1))
+    , m_state(new RequestState())
+    , m_generation(0)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+}
+
+TiledRasterItem::~TiledRasterItem()
+{
+    // Our tasks still in the shared pool see the new generation and neither
+    // compute nor call back; the pool is left to the other items
+    {
+        QMutexLocker locker(&m_state->mutex);
+        ++m_state->generation;
+    }
+    dropCachedTiles();
+}
+
+void TiledRasterItem::setSource(const QSharedPointer<RasterTileSource> &source)
+{
+    prepareGeometryChange();
+    m_source = source;
+    m_size = source ? source->rasterSize() : QSize();
+    invalidate();
+}
+
+void TiledRasterItem::invalidate()
+{
+    {
+        QMutexLocker locker(&m_state->mutex);
+        m_generation = ++m_state->generation;
+        m_state->wantedTiles.clear();
+    }
+    dropCachedTiles();
+    m_pending.clear();
+    update();
+}
+
+void TiledRasterItem::dropCachedTiles()
+{
+    QCache<CacheKey, QImage> &cache = tileCache();
+    const QList<CacheKey> keys = cache.keys();
+    for (const CacheKey &key : keys) {
+        if (key.item == m_id) cache.remove(key);
+    }
+}
+
+QRectF TiledRasterItem::boundingRect() const
+{
+    return QRectF(0, 0, m_size.width(), m_size.height());
+}
+
+int TiledRasterItem::maxLevel() const
+{
+    int level = 0;
+    while ((qMax(m_size.width(), m_size.height()) >> level) > TileSize) {
+        ++level;
+    }
+    return level;
+}
+
+QRectF TiledRasterItem::tileRect(const TileKey &key) const
+{
+    const qreal span = qreal(TileSize) * (1 << key.level);
+    QRectF rect(key.column * span, key.row * span, span, span);
+    return rect.intersected(boundingRect());
+}
+
+void TiledRasterItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                            QWidget *widget)
+{
+    if (!m_source || m_size.isEmpty()) return;
+    ProfileScope scope(Profiler::Composite, "draw tiles", this);
+
+    // One screen pixel should cover at most one tile pixel
+    const qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int topLevel = maxLevel();
+    int level = 0;
+    if (lod > 0.0 && lod < 1.0) {
+        level = qBound(0, int(std::floor(std::log2(1.0 / lod))), topLevel);
+    }
+
+    const qreal span = qreal(TileSize) * (1 << level);
+    const QRectF bounds = boundingRect();
+
+    auto tileRange = [&](const QRectF &area) {
+        const QRectF clipped = area.intersected(bounds);
+        if (clipped.isEmpty()) return QRect();
+        return QRect(QPoint(int(clipped.left() / span), int(clipped.top() / span)),
+                     QPoint(int(std::ceil(clipped.right() / span)) - 1,
+                            int(std::ceil(clipped.bottom() / span)) - 1));
+    };
+
+    // Everything in view is wanted, not just the exposed part being repainted
+    QRectF visibleArea = option->exposedRect;
+    if (widget) {
+        bool invertible = false;
+        QTransform toItem = painter->worldTransform().inverted(&invertible);
+        if (invertible) {
+            visibleArea = toItem.mapRect(QRectF(widget->rect()));
+        }
+    }
+    {
+        QMutexLocker locker(&m_state->mutex);
+        // Replaced rather than merged: levels shown before a zoom are no
+        // longer wanted. Coarser fallback tiles are only drawn from the
+        // cache, never requested, so the current level is all a view wants
+        m_state->wantedTiles[widget] = { level, tileRange(visibleArea) };
+
+        // Views closed since they last painted want nothing
+        if (m_state->wantedTiles.size() > 1 && scene()) {
+            QSet<const QWidget*> viewports;
+            for (QGraphicsView *view : scene()->views()) {
+                viewports.insert(view->viewport());
+            }
+            for (auto it = m_state->wantedTiles.begin(); it != m_state->wantedTiles.end();) {
+                if (it.key() && !viewports.contains(it.key())) {
+                    it = m_state->wantedTiles.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    const QRect tiles = tileRange(option->exposedRect);
+    if (tiles.isEmpty()) return;
+
+    QCache<CacheKey, QImage> &cache = tileCache();
+
+    for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            TileKey key = { level, column, row };
+            const QRectF target = tileRect(key);
+
+            QImage *image = cache.object({ m_id, key });
+            Profiler::instance().addTileLookup(image != nullptr);
+            if (image) {
+                painter->drawImage(target, *image);
+                continue;
+            }
+
+            requestTile(key);
+
+            // Until it arrives, stretch the nearest coarser tile that is cached
+            for (int parentLevel = level + 1; parentLevel <= topLevel; ++parentLevel) {
+                const int shift = parentLevel - level;
+                TileKey parent = { parentLevel, column >> shift, row >> shift };
+                QImage *image = cache.object({ m_id, parent });
+                if (!image) continue;
+
+                const QRectF parentRect = tileRect(parent);
+                const qreal scale = qreal(1 << parentLevel);
+                const QRectF source((target.left() - parentRect.left()) / scale,
+                                    (target.top() - parentRect.top()) / scale,
+                                    target.width() / scale, target.height() / scale);
+                painter->drawImage(target, *image, source);
+                break;
+            }
+        }
+    }
+}
+
+void TiledRasterItem::requestTile(const TileKey &key)
+{
+    if (m_pending.contains(key)) return;
+    m_pending.insert(key);
+
+    QSharedPointer<RasterTileSource> source = m_source;
+    QSharedPointer<RequestState> state = m_state;
+    const int generation = m_generation;
+
+    tilePool()->start([this, source, state, generation, key]() {
+        bool wanted = false;
+        {
+            QMutexLocker locker(&state->mutex);
+            wanted = state->generation == generation && state->isWanted(key);
+        }
+
+        // Tiles panned out of view before their turn are skipped; they are
+        // requested again if they come back into view
+        QImage image;
+        if (wanted) {
+            image = source->computeTile(key.level, key.column, key.row, TileSize);
+        }
+
+        // Posted under the lock: the destructor takes it to bump the
+        // generation, so the item is alive here, and QObject drops the
+        // posted call if the item goes before it is delivered
+        QMutexLocker locker(&state->mutex);
+        if (state->generation != generation) return;
+        QMetaObject::invokeMethod(this, [this, key, generation, wanted, image]() {
+            tileReady(key, generation, wanted, image);
+        }, Qt::QueuedConnection);
+    });
+}
+
+bool TiledRasterItem::RequestState::isWanted(const TileKey &key) const
+{
+    for (const WantedTiles &wanted : wantedTiles) {
+        if (wanted.level == key.level && wanted.tiles.contains(key.column, key.row)) return true;
+    }
+    return false;
+}
+
+void TiledRasterItem::tileReady(const TileKey &key, int generation, bool computed,
+                                const QImage &image)
+{
+    if (generation != m_generation) return;
+
+    m_pending.remove(key);
+
+    // A skipped tile may have scrolled back into view while it was queued
+    if (computed) {
+        // Null images are cached too, so empty tiles are not computed again
+        tileCache().insert({ m_id, key }, new QImage(image), qMax(1, int(image.sizeInBytes() / 1024)));
+    }
+    update(tileRect(key));
+}
@@ -0,0 +1,123 @@
+#ifndef TILEDRASTERITEM_H
+#define TILEDRASTERITEM_H
+
+#include <QCache>
+#include <QGraphicsObject>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QRect>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSize>
+#include <QThreadPool>
+
+// Produces the tiles a TiledRasterItem shows. computeTile() runs on worker
+// threads and may be called concurrently.
+class RasterTileSource
+{
+public:
+    virtual ~RasterTileSource() {}
+
+    // Full resolution size in pixels
+    virtual QSize rasterSize() const = 0;
+
+    // Tile (column, row) of 'level', where level L shows one pixel per 2^L
+    // source pixels. The image is tileSize x tileSize except at the right and
+    // bottom edges. A null image means nothing to draw.
+    virtual QImage computeTile(int level, int column, int row, int tileSize) = 0;
+};
+
+// Draws a raster in item coordinates (0, 0) - (width, height), one unit per
+// source pixel. Only the tiles in view are computed, at the level matching
+// the zoom, on a pool shared by every item; each finished tile is drawn as
+// soon as it arrives, with coarser cached tiles standing in until then.
+// Finished tiles go to one cache shared by every item, used from the GUI
+// thread only.
+class TiledRasterItem : public QGraphicsObject
+{
+    Q_OBJECT
+
+public:
+    explicit TiledRasterItem(const QSharedPointer<RasterTileSource> &source,
+                             QGraphicsItem *parent = nullptr);
+    ~TiledRasterItem();
+
+    QSharedPointer<RasterTileSource> source() const { return m_source; }
+
+    // Swaps in a new source (e.g. new parameters) and drops every cached tile
+    void setSource(const QSharedPointer<RasterTileSource> &source);
+    void invalidate();
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget = nullptr) override;
+
+    static const int TileSize = 256;
+
+private:
+    struct TileKey {
+        int level;
+        int column;
+        int row;
+
+        bool operator==(const TileKey &other) const
+        {
+            return level == other.level && column == other.column && row == other.row;
+        }
+    };
+    friend uint qHash(const TileKey &key, uint seed = 0)
+    {
+        return qHash((quint64(quint32(key.column)) << 32) | quint32(key.row), seed) ^ uint(key.level);
+    }
+
+    // A tile of one item in the shared cache
+    struct CacheKey {
+        quint64 item;
+        TileKey tile;
+
+        bool operator==(const CacheKey &other) const
+        {
+            return item == other.item && tile == other.tile;
+        }
+    };
+    friend uint qHash(const CacheKey &key, uint seed = 0)
+    {
+        return qHash(key.tile, seed) ^ qHash(key.item, seed);
+    }
+
+    // Wanted tiles of one view, in tile coordinates
+    struct WantedTiles {
+        int level;
+        QRect tiles;
+    };
+
+    // Shared with queued tasks so they can drop work that is no longer wanted
+    struct RequestState {
+        QMutex mutex;
+        int generation = 0;
+        // Per view (its viewport, null when rendered offscreen), the tiles it
+        // showed when last painted: a tile is wanted while any view shows it
+        QHash<const QWidget*, WantedTiles> wantedTiles;
+
+        bool isWanted(const TileKey &key) const;
+    };
+
+    int maxLevel() const;
+    QRectF tileRect(const TileKey &key) const;
+    void requestTile(const TileKey &key);
+    void tileReady(const TileKey &key, int generation, bool computed, const QImage &image);
+    void dropCachedTiles();
+
+    static QCache<CacheKey, QImage> &tileCache();   // cost in KiB
+    static QThreadPool *tilePool();
+
+    QSharedPointer<RasterTileSource> m_source;
+    QSize m_size;
+    const quint64 m_id;
+    QSet<TileKey> m_pending;
+    QSharedPointer<RequestState> m_state;
+    int m_generation;
+};
+
+#endif // TILEDRASTERITEM_H
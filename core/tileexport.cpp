@@ -0,0 +1,407 @@
+#include "tileexport.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageWriter>
+#include <QMetaObject>
+#include <QPainter>
+#include <QPointer>
+#include <QSemaphore>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QUuid>
+#include <QVariant>
+
+#include <cmath>
+
+namespace
+{
+    const double OriginShift = 20037508.342789244;     // half the EPSG:3857 world, metres
+    const double MaxLatitude = 85.05112877980659;
+
+    // Pixels rendered around a metatile and cut away: a line or point
+    // symbol crossing a tile edge is drawn whole on both sides
+    const int Margin = 32;
+
+    // Metatiles rendered per batch, for each render thread
+    const int BatchPerThread = 4;
+
+    double tileSpan(int zoom)
+    {
+        return 2.0 * OriginShift / double(qint64(1) << zoom);
+    }
+
+    // Tiles of 'zoom' covering 'extent', in XYZ numbering (row 0 at the top)
+    QRect tileRange(const QRectF &extent, int zoom)
+    {
+        const double span = tileSpan(zoom);
+        const int last = int((qint64(1) << zoom) - 1);
+        const int x0 = qBound(0, int(std::floor((extent.left() + OriginShift) / span)), last);
+        const int x1 = qBound(0, int(std::ceil((extent.right() + OriginShift) / span)) - 1, last);
+        const int y0 = qBound(0, int(std::floor((OriginShift - extent.bottom()) / span)), last);
+        const int y1 = qBound(0, int(std::ceil((OriginShift - extent.top()) / span)) - 1, last);
+        return QRect(QPoint(x0, y0), QPoint(qMax(x0, x1), qMax(y0, y1)));
+    }
+}
+
+// Where the encoded tiles go. Lives on the writing thread: the SQLite
+// connection must be used on the thread that opened it.
+class TileExporter::Writer
+{
+public:
+    explicit Writer(const Settings &settings)
+        : m_settings(settings)
+        , m_connection("tileexport-" + QUuid::createUuid().toString())
+    {
+    }
+
+    ~Writer()
+    {
+        if (!m_settings.mbtiles) return;
+        {
+            QSqlDatabase database = QSqlDatabase::database(m_connection, false);
+            if (database.isOpen()) database.close();
+        }
+        QSqlDatabase::removeDatabase(m_connection);
+    }
+
+    bool open(QString *errorMessage)
+    {
+        if (!m_settings.mbtiles) {
+            if (!QDir().mkpath(m_settings.path)) {
+                *errorMessage = "Cannot create " + m_settings.path;
+                return false;
+            }
+            return true;
+        }
+
+        // A new pyramid each time
+        QFile::remove(m_settings.path);
+        QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", m_connection);
+        database.setDatabaseName(m_settings.path);
+        if (!database.open()) {
+            *errorMessage = QString("Cannot create %1: %2").arg(m_settings.path, database.lastError().text());
+            return false;
+        }
+
+        const QRectF bounds = TileExporter::lonLatFromMercator(m_settings.extent);
+        const QStringList statements = {
+            "PRAGMA synchronous = OFF",
+            "PRAGMA journal_mode = MEMORY",
+            "CREATE TABLE metadata (name TEXT, value TEXT)",
+            "CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB)",
+            "CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, tile_column, tile_row)"
+        };
+        QSqlQuery query(database);
+        for (const QString &statement : statements) {
+            if (!query.exec(statement)) {
+                *errorMessage = QString("Cannot write %1: %2").arg(m_settings.path, query.lastError().text());
+                return false;
+            }
+        }
+
+        const QList<QPair<QString, QString>> metadata = {
+            { "name", m_settings.name.isEmpty() ? QFileInfo(m_settings.path).completeBaseName() : m_settings.name },
+            { "type", "baselayer" },
+            { "version", "1.0" },
+            { "format", m_settings.format },
+            { "minzoom", QString::number(m_settings.minZoom) },
+            { "maxzoom", QString::number(m_settings.maxZoom) },
+            { "bounds", QString("%1,%2,%3,%4").arg(bounds.left(), 0, 'f', 6).arg(bounds.top(), 0, 'f', 6)
+                                              .arg(bounds.right(), 0, 'f', 6).arg(bounds.bottom(), 0, 'f', 6) }
+        };
+        query.prepare("INSERT INTO metadata (name, value) VALUES (?, ?)");
+        for (const QPair<QString, QString> &entry : metadata) {
+            query.addBindValue(entry.first);
+            query.addBindValue(entry.second);
+            if (!query.exec()) {
+                *errorMessage = QString("Cannot write %1: %2").arg(m_settings.path, query.lastError().text());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool write(const QVector<Tile> &tiles, QString *errorMessage)
+    {
+        if (tiles.isEmpty()) return true;
+        return m_settings.mbtiles ? writeDatabase(tiles, errorMessage) : writeFiles(tiles, errorMessage);
+    }
+
+private:
+    bool writeFiles(const QVector<Tile> &tiles, QString *errorMessage)
+    {
+        const QString suffix = "." + m_settings.format;
+        QString lastDirectory;
+        for (const Tile &tile : tiles) {
+            const QString directory = QString("%1/%2/%3").arg(m_settings.path).arg(tile.zoom).arg(tile.x);
+            if (directory != lastDirectory) {
+                if (!QDir().mkpath(directory)) {
+                    *errorMessage = "Cannot create " + directory;
+                    return false;
+                }
+                lastDirectory = directory;
+            }
+            QFile file(directory + "/" + QString::number(tile.y) + suffix);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(tile.data) != tile.data.size()) {
+                *errorMessage = QString("Cannot write %1: %2").arg(file.fileName(), file.errorString());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // One transaction per batch; MBTiles rows count from the bottom (TMS)
+    bool writeDatabase(const QVector<Tile> &tiles, QString *errorMessage)
+    {
+        QSqlDatabase database = QSqlDatabase::database(m_connection, false);
+        database.transaction();
+        QSqlQuery query(database);
+        query.prepare("INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) "
+                      "VALUES (?, ?, ?, ?)");
+        for (const Tile &tile : tiles) {
+            query.addBindValue(tile.zoom);
+            query.addBindValue(tile.x);
+            query.addBindValue(int((qint64(1) << tile.zoom) - 1 - tile.y));
+            query.addBindValue(tile.data);
+            if (!query.exec()) {
+                *errorMessage = QString("Cannot write %1: %2").arg(m_settings.path, query.lastError().text());
+                database.rollback();
+                return false;
+            }
+        }
+        if (!database.commit()) {
+            *errorMessage = QString("Cannot write %1: %2").arg(m_settings.path, database.lastError().text());
+            return false;
+        }
+        return true;
+    }
+
+    Settings m_settings;
+    QString m_connection;
+};
+
+TileExporter::TileExporter(QObject *parent)
+    : QObject(parent)
+    , m_running(false)
+    , m_canceled(0)
+    , m_tilesDone(0)
+{
+    m_pool.setMaxThreadCount(1);
+    m_renderPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+TileExporter::~TileExporter()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+QRectF TileExporter::mercatorFromLonLat(const QRectF &lonLat)
+{
+    auto x = [](double lon) { return lon * OriginShift / 180.0; };
+    auto y = [](double lat) {
+        lat = qBound(-MaxLatitude, lat, MaxLatitude);
+        return std::log(std::tan((90.0 + lat) * M_PI / 360.0)) * OriginShift / M_PI;
+    };
+    return QRectF(QPointF(x(lonLat.left()), y(lonLat.top())),
+                  QPointF(x(lonLat.right()), y(lonLat.bottom()))).normalized();
+}
+
+QRectF TileExporter::lonLatFromMercator(const QRectF &mercator)
+{
+    auto lon = [](double x) { return x / OriginShift * 180.0; };
+    auto lat = [](double y) { return std::atan(std::exp(y / OriginShift * M_PI)) * 360.0 / M_PI - 90.0; };
+    return QRectF(QPointF(lon(mercator.left()), lat(mercator.top())),
+                  QPointF(lon(mercator.right()), lat(mercator.bottom()))).normalized();
+}
+
+qint64 TileExporter::tileCount() const
+{
+    qint64 count = 0;
+    for (int zoom = m_settings.minZoom; zoom <= m_settings.maxZoom; ++zoom) {
+        const QRect range = tileRange(m_settings.extent, zoom);
+        count += qint64(range.width()) * range.height();
+    }
+    return count;
+}
+
+bool TileExporter::start(const QVector<MapExportLayer> &layers, const Settings &settings)
+{
+    if (m_running || settings.extent.isEmpty() || settings.minZoom < 0 || settings.maxZoom < settings.minZoom ||
+            settings.maxZoom > 30 || settings.metaTile < 1) {
+        return false;
+    }
+
+    m_layers = layers;
+    m_settings = settings;
+    m_canceled = 0;
+    m_tilesDone = 0;
+    m_running = true;
+
+    QPointer<TileExporter> self(this);
+    m_pool.start([this, self]() {
+        // Built here: indexing the features can take a while
+        m_renderer.reset(new MapLayerRenderer(m_layers));
+        m_layerBounds.clear();
+        for (const MapExportLayer &layer : m_layers) {
+            m_layerBounds.append(layer.transform.mapRect(MapLayerRenderer::layerBounds(layer)));
+        }
+        QImage empty(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+        empty.fill(m_settings.background);
+        m_emptyTile = encode(empty);
+
+        QString errorMessage;
+        const bool success = run(&errorMessage);
+        m_renderer.reset();
+
+        QMetaObject::invokeMethod(this, [self, success, errorMessage]() {
+            if (!self) return;
+            self->m_running = false;
+            emit self->finished(success, errorMessage);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+void TileExporter::cancel()
+{
+    // Queued metatiles still run, but return at once: the batch waits for all
+    m_canceled = 1;
+}
+
+bool TileExporter::run(QString *errorMessage)
+{
+    Writer writer(m_settings);
+    if (!writer.open(errorMessage)) return false;
+
+    const int batchSize = m_renderPool.maxThreadCount() * BatchPerThread;
+    for (int zoom = m_settings.minZoom; zoom <= m_settings.maxZoom; ++zoom) {
+        const QVector<MetaTile> pending = metaTiles(zoom);
+
+        // Rendered in parallel a batch at a time, then written in order
+        for (int first = 0; first < pending.size(); first += batchSize) {
+            const int count = qMin(batchSize, pending.size() - first);
+            QVector<QVector<Tile>> rendered(count);
+            QSemaphore done;
+            for (int i = 0; i < count; ++i) {
+                const MetaTile metaTile = pending[first + i];
+                m_renderPool.start([this, &rendered, &done, i, metaTile]() {
+                    if (!m_canceled) rendered[i] = renderMetaTile(metaTile);
+                    done.release();
+                });
+            }
+            done.acquire(count);
+            if (m_canceled) {
+                *errorMessage = "Canceled";
+                return false;
+            }
+
+            for (int i = 0; i < count; ++i) {
+                if (!writer.write(rendered[i], errorMessage)) return false;
+                m_tilesDone.fetchAndAddRelease(qint64(pending[first + i].columns) * pending[first + i].rows);
+            }
+            reportProgress();
+        }
+    }
+    return true;
+}
+
+// Metatiles aligned to multiples of the metatile size, so a pyramid
+// rendered in parts cuts its tiles the same way
+QVector<TileExporter::MetaTile> TileExporter::metaTiles(int zoom) const
+{
+    QVector<MetaTile> result;
+    const QRect range = tileRange(m_settings.extent, zoom);
+    const int size = m_settings.metaTile;
+    for (int top = range.top() - range.top() % size; top <= range.bottom(); top += size) {
+        for (int left = range.left() - range.left() % size; left <= range.right(); left += size) {
+            MetaTile metaTile;
+            metaTile.zoom = zoom;
+            metaTile.x = qMax(left, range.left());
+            metaTile.y = qMax(top, range.top());
+            metaTile.columns = qMin(left + size - 1, range.right()) - metaTile.x + 1;
+            metaTile.rows = qMin(top + size - 1, range.bottom()) - metaTile.y + 1;
+            result.append(metaTile);
+        }
+    }
+    return result;
+}
+
+QVector<TileExporter::Tile> TileExporter::renderMetaTile(const MetaTile &metaTile) const
+{
+    const double resolution = tileSpan(metaTile.zoom) / TileSize;   // metres per pixel
+    const double left = -OriginShift + metaTile.x * tileSpan(metaTile.zoom) - Margin * resolution;
+    const double top = OriginShift - metaTile.y * tileSpan(metaTile.zoom) + Margin * resolution;
+    const QSize size(metaTile.columns * TileSize + 2 * Margin, metaTile.rows * TileSize + 2 * Margin);
+
+    // Map -> image: X right, Y down from the top left corner
+    const QTransform mapToImage(1.0 / resolution, 0.0, 0.0, -1.0 / resolution, -left / resolution, top / resolution);
+    const QTransform sceneToImage = m_settings.mapToScene.inverted() * mapToImage;
+    const QRectF sceneArea = sceneToImage.inverted().mapRect(QRectF(QPointF(0, 0), QSizeF(size)));
+
+    bool touched = false;
+    for (const QRectF &bounds : m_layerBounds) {
+        if (bounds.intersects(sceneArea)) {
+            touched = true;
+            break;
+        }
+    }
+
+    QVector<Tile> tiles;
+    if (!touched && m_settings.background.alpha() == 0) return tiles;
+    tiles.reserve(metaTile.columns * metaTile.rows);
+
+    QImage image;
+    if (touched) {
+        image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        image.fill(m_settings.background);
+        QPainter painter(&image);
+        m_renderer->render(&painter, sceneToImage, sceneArea);
+        painter.end();
+    }
+
+    for (int row = 0; row < metaTile.rows; ++row) {
+        for (int column = 0; column < metaTile.columns; ++column) {
+            Tile tile;
+            tile.zoom = metaTile.zoom;
+            tile.x = metaTile.x + column;
+            tile.y = metaTile.y + row;
+            tile.data = touched ? encode(image.copy(Margin + column * TileSize, Margin + row * TileSize,
+                                                    TileSize, TileSize))
+                                : m_emptyTile;
+            tiles.append(tile);
+        }
+    }
+    return tiles;
+}
+
+QByteArray TileExporter::encode(const QImage &image) const
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, m_settings.format.toLatin1());
+    if (m_settings.format == "jpg") {
+        writer.setQuality(m_settings.quality);
+        writer.write(image.convertToFormat(QImage::Format_RGB32));
+    } else {
+        writer.write(image);
+    }
+    return data;
+}
+
+void TileExporter::reportProgress()
+{
+    QPointer<TileExporter> self(this);
+    const qint64 done = m_tilesDone.loadAcquire();
+    const qint64 total = tileCount();
+    QMetaObject::invokeMethod(this, [self, done, total]() {
+        if (self) emit self->progress(done, total);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,101 @@
+#ifndef TILEEXPORT_H
+#define TILEEXPORT_H
+
+#include <QAtomicInt>
+#include <QColor>
+#include <QObject>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QTransform>
+#include <QVector>
+
+#include "mapexport.h"
+
+// Renders a web map tile pyramid (the XYZ / WMTS GoogleMapsCompatible grid
+// of 256 px tiles in EPSG:3857) into z/x/y files or an MBTiles database.
+//
+// Tiles are rendered a metatile at a time: one image of several tiles per
+// side, with a margin so lines and points are not cut at tile edges, then
+// cut up. Metatiles render in parallel on every core; the encoded tiles
+// are written in batches by one thread. Metatiles that no layer touches
+// are not rendered at all.
+class TileExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings {
+        QString path;               // directory, or an .mbtiles file
+        bool mbtiles = false;
+        QString name;               // MBTiles metadata
+        QRectF extent;              // area to cover in EPSG:3857 metres
+        int minZoom = 0;
+        int maxZoom = 12;
+        int metaTile = 8;           // tiles per metatile side
+        QString format = "png";     // png or jpg
+        int quality = 85;           // jpg
+        QColor background = Qt::transparent;
+        QTransform mapToScene;      // EPSG:3857 metres to scene
+    };
+
+    explicit TileExporter(QObject *parent = nullptr);
+    ~TileExporter();
+
+    // False while another export runs. The layers must be placed on a scene
+    // whose map units are EPSG:3857 metres.
+    bool start(const QVector<MapExportLayer> &layers, const Settings &settings);
+    void cancel();
+    bool isRunning() const { return m_running; }
+
+    // Tiles in the pyramid, and tiles rendered so far (written or, outside
+    // every layer with a transparent background, skipped)
+    qint64 tileCount() const;
+    qint64 tilesDone() const { return m_tilesDone.loadAcquire(); }
+
+    static const int TileSize = 256;
+
+    // Web Mercator <-> longitude/latitude, in degrees
+    static QRectF mercatorFromLonLat(const QRectF &lonLat);
+    static QRectF lonLatFromMercator(const QRectF &mercator);
+
+signals:
+    void progress(qint64 done, qint64 total);   // tiles
+    void finished(bool success, const QString &errorMessage);
+
+private:
+    struct Tile {
+        int zoom;
+        int x;
+        int y;
+        QByteArray data;
+    };
+    struct MetaTile {
+        int zoom;
+        int x;                      // first tile
+        int y;
+        int columns;
+        int rows;
+    };
+    class Writer;
+
+    bool run(QString *errorMessage);
+    QVector<MetaTile> metaTiles(int zoom) const;
+    QVector<Tile> renderMetaTile(const MetaTile &metaTile) const;
+    QByteArray encode(const QImage &image) const;
+    void reportProgress();
+
+    QThreadPool m_pool;             // the one task writing the tiles
+    QThreadPool m_renderPool;       // metatiles
+    QSharedPointer<MapLayerRenderer> m_renderer;    // while exporting
+    QVector<QRectF> m_layerBounds;  // scene coordinates
+    QVector<MapExportLayer> m_layers;
+    Settings m_settings;
+    QByteArray m_emptyTile;         // background only
+    bool m_running;
+    QAtomicInt m_canceled;
+    QAtomicInteger<qint64> m_tilesDone;
+};
+
+#endif // TILEEXPORT_H
@@ -0,0 +1,617 @@
+#include "vectoranalysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "crsregistry.h"
+#include "reprojection.h"
+#include "spatialindex.h"
+#include "wkbutils.h"
+
+#include <geodesic.h>
+
+namespace
+{
+
+// Segment with endpoints ordered by x (then y), so x0 is its left edge
+struct Segment
+{
+    double x0, y0, x1, y1;
+    int layer;
+    int feature;
+    int part;
+    int index;          // position along the part, zero-length segments skipped
+    int closingIndex;   // index of the part's last segment if it is closed, else -1
+};
+
+// Consecutive segments of one part, the last and first of a closed one
+// included: they always meet at their shared vertex
+inline bool adjacent(const Segment &a, const Segment &b)
+{
+    if (a.layer != b.layer || a.feature != b.feature || a.part != b.part) return false;
+    if (a.index - b.index == 1 || b.index - a.index == 1) return true;
+    return a.closingIndex > 0 &&
+           ((a.index == 0 && b.index == a.closingIndex) || (b.index == 0 && a.index == a.closingIndex));
+}
+
+struct Hit
+{
+    double x, y;
+    int layerA, featureA;
+    int layerB, featureB;
+
+    bool operator<(const Hit &other) const
+    {
+        if (layerA != other.layerA) return layerA < other.layerA;
+        if (featureA != other.featureA) return featureA < other.featureA;
+        if (layerB != other.layerB) return layerB < other.layerB;
+        if (featureB != other.featureB) return featureB < other.featureB;
+        if (x != other.x) return x < other.x;
+        return y < other.y;
+    }
+
+    bool operator==(const Hit &other) const
+    {
+        return layerA == other.layerA && featureA == other.featureA &&
+               layerB == other.layerB && featureB == other.featureB &&
+               x == other.x && y == other.y;
+    }
+};
+
+void collectSegments(const FeatureBuffer &buffer, int layer, ProcessingFeedback *feedback,
+                     std::vector<Segment> *segments)
+{
+    const int chunkSize = defaultChunkSize(buffer.count());
+    std::vector<std::vector<Segment>> chunks((buffer.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(buffer.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        std::vector<Segment> &out = chunks[chunk];
+        for (int feature = begin; feature < end; ++feature) {
+            visitWkbParts(buffer.wkb(feature), buffer.wkbSize(feature),
+                          [&](const WkbPart &part) {
+                const size_t first = out.size();
+                int index = 0;
+                for (int i = 0; i + 1 < part.pointCount; ++i) {
+                    double ax = part.xy[2 * i], ay = part.xy[2 * i + 1];
+                    double bx = part.xy[2 * i + 2], by = part.xy[2 * i + 3];
+                    if (ax == bx && ay == by) continue;
+                    if (bx < ax || (bx == ax && by < ay)) {
+                        std::swap(ax, bx);
+                        std::swap(ay, by);
+                    }
+                    Segment segment = { ax, ay, bx, by, layer, feature, part.part, index++, -1 };
+                    out.push_back(segment);
+                }
+
+                const int last = part.pointCount - 1;
+                if (index > 1 && part.xy[0] == part.xy[2 * last] && part.xy[1] == part.xy[2 * last + 1]) {
+                    for (size_t s = first; s < out.size(); ++s) {
+                        out[s].closingIndex = index - 1;
+                    }
+                }
+            });
+        }
+    });
+
+    size_t total = segments->size();
+    for (const std::vector<Segment> &chunk : chunks) total += chunk.size();
+    segments->reserve(total);
+    for (const std::vector<Segment> &chunk : chunks) {
+        segments->insert(segments->end(), chunk.begin(), chunk.end());
+    }
+}
+
+inline double orient(double ax, double ay, double bx, double by, double cx, double cy)
+{
+    return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+// c is known to be collinear with a-b; true if it lies within the segment box
+inline bool onSegment(const Segment &s, double cx, double cy)
+{
+    return cx >= s.x0 && cx <= s.x1 &&
+           cy >= qMin(s.y0, s.y1) && cy <= qMax(s.y0, s.y1);
+}
+
+// Plain floating point orientation tests, so nearly collinear or nearly
+// touching segments may be classified either way. Returns the number of
+// intersection points written to xs/ys (0, 1 or 2 for collinear overlaps).
+int intersect(const Segment &a, const Segment &b, double *xs, double *ys)
+{
+    const double d1 = orient(b.x0, b.y0, b.x1, b.y1, a.x0, a.y0);
+    const double d2 = orient(b.x0, b.y0, b.x1, b.y1, a.x1, a.y1);
+    const double d3 = orient(a.x0, a.y0, a.x1, a.y1, b.x0, b.y0);
+    const double d4 = orient(a.x0, a.y0, a.x1, a.y1, b.x1, b.y1);
+
+    if (((d1 < 0 && d2 > 0) || (d1 > 0 && d2 < 0)) &&
+        ((d3 < 0 && d4 > 0) || (d3 > 0 && d4 < 0))) {
+        const double t = d3 / (d3 - d4);
+        // Clamp to the common box: rounding must not move the point out of
+        // the x-range both segments were binned for
+        xs[0] = qBound(qMax(a.x0, b.x0), b.x0 + t * (b.x1 - b.x0), qMin(a.x1, b.x1));
+        ys[0] = qBound(qMax(qMin(a.y0, a.y1), qMin(b.y0, b.y1)),
+                       b.y0 + t * (b.y1 - b.y0),
+                       qMin(qMax(a.y0, a.y1), qMax(b.y0, b.y1)));
+        return 1;
+    }
+
+    // Touching or collinear: the hits are endpoints lying on the other segment
+    int count = 0;
+    auto add = [&](double x, double y) {
+        for (int i = 0; i < count; ++i) {
+            if (xs[i] == x && ys[i] == y) return;
+        }
+        if (count < 2) {
+            xs[count] = x;
+            ys[count] = y;
+            ++count;
+        }
+    };
+
+    if (d1 == 0 && onSegment(b, a.x0, a.y0)) add(a.x0, a.y0);
+    if (d2 == 0 && onSegment(b, a.x1, a.y1)) add(a.x1, a.y1);
+    if (d3 == 0 && onSegment(a, b.x0, b.y0)) add(b.x0, b.y0);
+    if (d4 == 0 && onSegment(a, b.x1, b.y1)) add(b.x1, b.y1);
+    return count;
+}
+
+inline bool isEndpoint(const Segment &s, double x, double y)
+{
+    return (s.x0 == x && s.y0 == y) || (s.x1 == x && s.y1 == y);
+}
+
+// Ellipsoid of the layer CRS and, when it is projected, the geographic CRS
+// to unproject to before measuring. Worked out once per run; the PROJ
+// pipeline itself comes from each worker's ProjThreadContext.
+struct GeodesicSetup
+{
+    geod_geodesic geod;
+    QString sourceWkt;
+    QString geographicWkt;   // empty for geographic layers
+};
+
+GeodesicSetup geodesicSetup(const QString &srsWkt)
+{
+    GeodesicSetup setup;
+
+    OGRSpatialReference srs;
+    if (srsWkt.isEmpty() || srs.importFromWkt(srsWkt.toUtf8().constData()) != OGRERR_NONE) {
+        srs.SetWellKnownGeogCS("WGS84");
+    }
+    const double inverseFlattening = srs.GetInvFlattening();
+    geod_init(&setup.geod, srs.GetSemiMajor(),
+              inverseFlattening != 0.0 ? 1.0 / inverseFlattening : 0.0);
+
+    if (!srs.IsGeographic()) {
+        OGRSpatialReference *geographic = srs.CloneGeogCS();
+        if (geographic) {
+            char *wkt = nullptr;
+            if (geographic->exportToWkt(&wkt) == OGRERR_NONE) {
+                setup.sourceWkt = srsWkt;
+                setup.geographicWkt = QString::fromUtf8(wkt);
+            }
+            CPLFree(wkt);
+            geographic->Release();
+        }
+    }
+    return setup;
+}
+
+// Length of the linear parts of a WKB geometry. Geodesic lengths are measured
+// on the ellipsoid of the layer CRS, unprojecting first when it is projected.
+// Uses the calling thread's PROJ pipeline, so each worker needs its own
+// instance.
+class LengthCalculator
+{
+public:
+    LengthCalculator(VectorAnalysis::LengthMethod method, const GeodesicSetup &setup)
+        : m_geodesic(method == VectorAnalysis::GeodesicLength)
+        , m_geod(setup.geod)
+        , m_transform(nullptr)
+    {
+        if (m_geodesic && !setup.geographicWkt.isEmpty()) {
+            m_transform = ProjThreadContext::local().transformation(setup.sourceWkt, setup.geographicWkt);
+        }
+    }
+
+    double length(const unsigned char *wkb, int size)
+    {
+        double total = 0.0;
+        visitWkbParts(wkb, size, [&](const WkbPart &part) {
+            if (part.dimension == 0 || part.pointCount < 2) return;
+            total += m_geodesic ? geodesicLength(part) : planarLength(part);
+        });
+        return total;
+    }
+
+private:
+    static double planarLength(const WkbPart &part)
+    {
+        double total = 0.0;
+        for (int i = 1; i < part.pointCount; ++i) {
+            total += std::hypot(part.xy[2 * i] - part.xy[2 * i - 2],
+                                part.xy[2 * i + 1] - part.xy[2 * i - 1]);
+        }
+        return total;
+    }
+
+    double geodesicLength(const WkbPart &part)
+    {
+        m_x.resize(part.pointCount);
+        m_y.resize(part.pointCount);
+        for (int i = 0; i < part.pointCount; ++i) {
+            m_x[i] = part.xy[2 * i];
+            m_y[i] = part.xy[2 * i + 1];
+        }
+        if (m_transform) {
+            proj_trans_generic(m_transform, PJ_FWD,
+                               m_x.data(), sizeof(double), part.pointCount,
+                               m_y.data(), sizeof(double), part.pointCount,
+                               nullptr, 0, 0, nullptr, 0, 0);
+            for (int i = 0; i < part.pointCount; ++i) {
+                if (!std::isfinite(m_x[i]) || !std::isfinite(m_y[i])) return 0.0;
+            }
+        }
+
+        double total = 0.0;
+        for (int i = 1; i < part.pointCount; ++i) {
+            double distance = 0.0;
+            geod_inverse(&m_geod, m_y[i - 1], m_x[i - 1], m_y[i], m_x[i],
+                         &distance, nullptr, nullptr);
+            total += distance;
+        }
+        return total;
+    }
+
+    bool m_geodesic;
+    geod_geodesic m_geod;
+    PJ *m_transform;     // owned by ProjThreadContext
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+};
+
+QString uniqueFieldName(const QVector<FeatureBuffer::Field> &fields, const QString &name)
+{
+    QString candidate = name;
+    for (int suffix = 2; ; ++suffix) {
+        bool taken = false;
+        for (const FeatureBuffer::Field &field : fields) {
+            if (field.name.compare(candidate, Qt::CaseInsensitive) == 0) {
+                taken = true;
+                break;
+            }
+        }
+        if (!taken) return candidate;
+        candidate = QString("%1_%2").arg(name).arg(suffix);
+    }
+}
+
+} // namespace
+
+// Plane sweep over vertical strips. Segments are binned into every strip their
+// x-range overlaps; each strip is swept left to right independently keeping an
+// active list of segments whose x-range still covers the sweep position, so
+// only segments overlapping in x (and then in y) are ever tested. A hit is kept
+// only by the strip containing its x, which removes duplicates from segments
+// that span several strips.
+bool VectorAnalysis::lineIntersections(const QVector<const FeatureBuffer*> &layers,
+                                       const QStringList &layerNames,
+                                       FeatureBuffer *output, ProcessingFeedback *feedback,
+                                       QString *errorMessage)
+{
+    if (!output) {
+        if (errorMessage) *errorMessage = "No output buffer given";
+        return false;
+    }
+
+    QVector<FeatureBuffer::Field> fields;
+    fields.append({ "LAYER_A", OFTString });
+    fields.append({ "FEATURE_A", OFTInteger64 });
+    fields.append({ "LAYER_B", OFTString });
+    fields.append({ "FEATURE_B", OFTInteger64 });
+
+    output->clear();
+    output->setGeometryType(wkbPoint);
+    output->setFields(fields);
+    if (!layers.isEmpty() && layers.first()) {
+        output->setSpatialReferenceWkt(layers.first()->spatialReferenceWkt());
+    }
+
+    std::vector<Segment> segments;
+    for (int l = 0; l < layers.size(); ++l) {
+        if (layers[l]) {
+            collectSegments(*layers[l], l, feedback, &segments);
+        }
+    }
+
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+    if (segments.size() < 2) return true;
+    if (segments.size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        if (errorMessage) *errorMessage = "Too many segments";
+        return false;
+    }
+
+    const int segmentCount = static_cast<int>(segments.size());
+
+    // Strip boundaries from quantiles of a sample of left edges, so strips
+    // hold similar numbers of segments even for clustered data
+    const int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    const int stripCount = qBound(threads * 4, segmentCount / 4096, 16384);
+
+    std::vector<double> sample;
+    const int step = qMax(1, segmentCount / 65536);
+    for (int i = 0; i < segmentCount; i += step) {
+        sample.push_back(segments[i].x0);
+    }
+    std::sort(sample.begin(), sample.end());
+
+    std::vector<double> boundaries;   // stripCount - 1 inner boundaries
+    for (int s = 1; s < stripCount; ++s) {
+        boundaries.push_back(sample[static_cast<size_t>(s) * sample.size() / stripCount]);
+    }
+
+    auto stripOf = [&boundaries](double x) {
+        return static_cast<int>(std::upper_bound(boundaries.begin(), boundaries.end(), x) -
+                                boundaries.begin());
+    };
+
+    // Bin segment ids into every strip they overlap (counting pass, then fill)
+    std::vector<size_t> stripOffsets(stripCount + 1, 0);
+    for (const Segment &segment : segments) {
+        const int first = stripOf(segment.x0);
+        const int last = stripOf(segment.x1);
+        for (int s = first; s <= last; ++s) {
+            ++stripOffsets[s + 1];
+        }
+    }
+    for (int s = 0; s < stripCount; ++s) {
+        stripOffsets[s + 1] += stripOffsets[s];
+    }
+
+    std::vector<int> stripIds(stripOffsets[stripCount]);
+    {
+        std::vector<size_t> fill(stripOffsets.begin(), stripOffsets.end() - 1);
+        for (int id = 0; id < segmentCount; ++id) {
+            const int first = stripOf(segments[id].x0);
+            const int last = stripOf(segments[id].x1);
+            for (int s = first; s <= last; ++s) {
+                stripIds[fill[s]++] = id;
+            }
+        }
+    }
+
+    QVector<FeatureBuffer> chunkResults(stripCount);
+
+    parallelForChunks(stripCount, 1, feedback, [&](int strip, int, int) {
+        int *first = stripIds.data() + stripOffsets[strip];
+        int *last = stripIds.data() + stripOffsets[strip + 1];
+        std::sort(first, last, [&segments](int a, int b) {
+            return segments[a].x0 < segments[b].x0;
+        });
+
+        std::vector<int> active;
+        std::vector<Hit> hits;
+        double xs[2], ys[2];
+
+        for (int *it = first; it != last; ++it) {
+            const int id = *it;
+            const Segment &current = segments[id];
+            const double currentMinY = qMin(current.y0, current.y1);
+            const double currentMaxY = qMax(current.y0, current.y1);
+
+            // Drop segments that ended before the sweep position
+            size_t kept = 0;
+            for (size_t i = 0; i < active.size(); ++i) {
+                if (segments[active[i]].x1 >= current.x0) {
+                    active[kept++] = active[i];
+                }
+            }
+            active.resize(kept);
+
+            for (int otherId : active) {
+                const Segment &other = segments[otherId];
+                if (qMax(other.y0, other.y1) < currentMinY ||
+                    qMin(other.y0, other.y1) > currentMaxY) {
+                    continue;
+                }
+
+                // Fixed argument order keeps the construction identical in every strip
+                const Segment &a = otherId < id ? other : current;
+                const Segment &b = otherId < id ? current : other;
+                const int count = intersect(a, b, xs, ys);
+
+                for (int h = 0; h < count; ++h) {
+                    if (stripOf(xs[h]) != strip) continue;
+
+                    // Adjacent segments always meet at their shared vertex;
+                    // other segments of the part meeting at a vertex are a
+                    // self-touch and reported
+                    if (adjacent(a, b) && isEndpoint(a, xs[h], ys[h]) && isEndpoint(b, xs[h], ys[h])) {
+                        continue;
+                    }
+
+                    Hit hit;
+                    hit.x = xs[h];
+                    hit.y = ys[h];
+                    const bool swapped = b.layer < a.layer ||
+                            (b.layer == a.layer && b.feature < a.feature);
+                    hit.layerA = swapped ? b.layer : a.layer;
+                    hit.featureA = swapped ? b.feature : a.feature;
+                    hit.layerB = swapped ? a.layer : b.layer;
+                    hit.featureB = swapped ? a.feature : b.feature;
+                    hits.push_back(hit);
+                }
+            }
+
+            active.push_back(id);
+        }
+
+        std::sort(hits.begin(), hits.end());
+        hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+
+        FeatureBuffer &result = chunkResults[strip];
+        result.copySchema(*output);
+        result.reserve(static_cast<int>(hits.size()), static_cast<qint64>(hits.size()) * 21);
+
+        QVariant values[4];
+        for (const Hit &hit : hits) {
+            values[0] = layerNames.value(hit.layerA);
+            values[1] = static_cast<qlonglong>(hit.featureA);
+            values[2] = layerNames.value(hit.layerB);
+            values[3] = static_cast<qlonglong>(hit.featureB);
+            result.appendPoint(hit.x, hit.y, values);
+        }
+    });
+
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+
+    for (const FeatureBuffer &chunk : chunkResults) {
+        output->append(chunk);
+    }
+    return true;
+}
+
+bool VectorAnalysis::sumLineLengths(const FeatureBuffer &polygons, const FeatureBuffer &lineLayer,
+                                    LengthMethod method, FeatureBuffer *output,
+                                    ProcessingFeedback *feedback, QString *errorMessage)
+{
+    if (!output) {
+        if (errorMessage) *errorMessage = "No output buffer given";
+        return false;
+    }
+    if (polygons.isEmpty()) {
+        if (errorMessage) *errorMessage = "Polygon layer has no features";
+        return false;
+    }
+
+    QVector<FeatureBuffer::Field> fields = polygons.fields();
+    fields.append({ uniqueFieldName(fields, "LENGTH"), OFTReal });
+    fields.append({ uniqueFieldName(fields, "COUNT"), OFTInteger64 });
+
+    output->clear();
+    output->copySchema(polygons);
+    output->setFields(fields);
+
+    // Lines in another CRS are measured in the polygons' one; a layer
+    // without a CRS is taken to be in the other's
+    const QString polygonWkt = polygons.spatialReferenceWkt();
+    const QString lineWkt = lineLayer.spatialReferenceWkt();
+    FeatureBuffer reprojectedLines;
+    const FeatureBuffer *matched = &lineLayer;
+    if (!polygonWkt.isEmpty() && !lineWkt.isEmpty() && !Reprojection::isSameCrs(polygonWkt, lineWkt)) {
+        QString reprojectError;
+        if (!Reprojection::reproject(lineLayer, polygonWkt, &reprojectedLines, nullptr, &reprojectError)) {
+            if (errorMessage) {
+                *errorMessage = "Cannot reproject the line layer to the polygon CRS: " + reprojectError;
+            }
+            return false;
+        }
+        matched = &reprojectedLines;
+    }
+    const FeatureBuffer &lines = *matched;
+
+    const GeodesicSetup setup = geodesicSetup(polygonWkt.isEmpty() ? lineWkt : polygonWkt);
+
+    // Whole-line lengths, used when a line lies entirely inside a polygon
+    std::vector<double> lineLengths(lines.count(), 0.0);
+    parallelForChunks(lines.count(), defaultChunkSize(lines.count()), feedback,
+                      [&](int, int begin, int end) {
+        LengthCalculator calculator(method, setup);
+        for (int i = begin; i < end; ++i) {
+            lineLengths[i] = calculator.length(lines.wkb(i), lines.wkbSize(i));
+        }
+    });
+
+    SpatialIndex lineIndex;
+    lineIndex.build(lines.envelopes());
+
+    const int polygonFieldCount = polygons.fieldCount();
+    const int chunkSize = defaultChunkSize(polygons.count());
+    QVector<FeatureBuffer> chunkResults((polygons.count() + chunkSize - 1) / chunkSize);
+
+    parallelForChunks(polygons.count(), chunkSize, feedback,
+                      [&](int chunk, int begin, int end) {
+        const GeosThreadContext &context = GeosThreadContext::local();
+        GEOSContextHandle_t handle = context.handle();
+        LengthCalculator calculator(method, setup);
+
+        FeatureBuffer &result = chunkResults[chunk];
+        result.copySchema(*output);
+
+        QVector<int> candidates;
+        QVector<QVariant> values(fields.size());
+
+        for (int i = begin; i < end; ++i) {
+            double total = 0.0;
+            qlonglong count = 0;
+
+            candidates.clear();
+            lineIndex.query(polygons.envelope(i), &candidates);
+
+            GEOSGeometry *polygon = candidates.isEmpty() ? nullptr : context.read(polygons, i);
+            const GEOSPreparedGeometry *prepared = polygon ? GEOSPrepare_r(handle, polygon) : nullptr;
+
+            for (int id : candidates) {
+                if (!prepared) break;
+
+                GEOSGeometry *line = context.read(lines, id);
+                if (!line) continue;
+
+                if (GEOSPreparedContainsProperly_r(handle, prepared, line) == 1) {
+                    total += lineLengths[id];
+                    ++count;
+                } else if (GEOSPreparedIntersects_r(handle, prepared, line) == 1) {
+                    GEOSGeometry *inside = GEOSIntersection_r(handle, polygon, line);
+                    if (inside) {
+                        if (method == PlanarLength) {
+                            double length = 0.0;
+                            if (GEOSLength_r(handle, inside, &length) == 1) total += length;
+                        } else {
+                            size_t size = 0;
+                            unsigned char *wkb = context.write(inside, &size);
+                            if (wkb) {
+                                total += calculator.length(wkb, static_cast<int>(size));
+                                GEOSFree_r(handle, wkb);
+                            }
+                        }
+                        GEOSGeom_destroy_r(handle, inside);
+                    }
+                    ++count;
+                }
+
+                GEOSGeom_destroy_r(handle, line);
+            }
+
+            if (prepared) GEOSPreparedGeom_destroy_r(handle, prepared);
+            if (polygon) GEOSGeom_destroy_r(handle, polygon);
+
+            const QVariant *polygonValues = polygons.attributes(i);
+            for (int f = 0; f < polygonFieldCount; ++f) {
+                values[f] = polygonValues[f];
+            }
+            values[polygonFieldCount] = total;
+            values[polygonFieldCount + 1] = count;
+
+            result.append(polygons.wkb(i), polygons.wkbSize(i), polygons.envelope(i),
+                          values.constData());
+        }
+    });
+
+    if (feedback && feedback->isCanceled()) {
+        if (errorMessage) *errorMessage = "Canceled";
+        return false;
+    }
+
+    for (const FeatureBuffer &chunk : chunkResults) {
+        output->append(chunk);
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef VECTORANALYSIS_H
+#define VECTORANALYSIS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+
+namespace VectorAnalysis
+{
+    enum LengthMethod {
+        PlanarLength,     // layer units
+        GeodesicLength    // metres on the layer's ellipsoid
+    };
+
+    // Points where segments of the given line layers cross or touch, one per
+    // (feature, feature, location). Consecutive segments of the same part
+    // (and the last and first of a closed one) sharing a vertex are not
+    // reported; other segments of a part meeting at a vertex are. Polygon
+    // layers contribute their rings.
+    // Output fields: LAYER_A, FEATURE_A, LAYER_B, FEATURE_B (feature = index
+    // within the source layer).
+    bool lineIntersections(const QVector<const FeatureBuffer*> &layers,
+                           const QStringList &layerNames,
+                           FeatureBuffer *output, ProcessingFeedback *feedback = nullptr,
+                           QString *errorMessage = nullptr);
+
+    // Copy of 'polygons' with two extra fields: LENGTH, the total length of
+    // the parts of 'lines' inside each polygon, and COUNT, the number of lines
+    // intersecting it. Lines in another CRS are reprojected to the polygons'
+    // CRS first.
+    bool sumLineLengths(const FeatureBuffer &polygons, const FeatureBuffer &lines,
+                        LengthMethod method, FeatureBuffer *output,
+                        ProcessingFeedback *feedback = nullptr,
+                        QString *errorMessage = nullptr);
+}
+
+#endif // VECTORANALYSIS_H
@@ -0,0 +1,278 @@
+#include "warptilesource.h"
+
+#include <QMutexLocker>
+
+#include <cmath>
+#include <vector>
+
+#include <gdal_priv.h>
+#include <gdal_alg.h>
+#include <gdalwarper.h>
+
+#include "crsregistry.h"
+#include "profiler.h"
+
+namespace
+{
+    // gdalwarp's default: approximate the transform to within 1/8 pixel
+    const double ApproxMaxError = 0.125;
+}
+
+WarpedTileSource::WarpedTileSource(const QString &filePath, const QString &destinationWkt)
+    : m_filePath(filePath)
+    , m_destinationWkt(destinationWkt)
+    , m_sameCrs(false)
+    , m_bandCount(1)
+    , m_alphaBand(0)
+{
+    for (int i = 0; i < 6; ++i) m_geoTransform[i] = 0.0;
+
+    // Tiles already run in parallel; a couple of warp threads per tile
+    // overlap reading the source with resampling it
+    m_warpThreads = CPLGetConfigOption("GDAL_NUM_THREADS", "2");
+}
+
+WarpedTileSource::~WarpedTileSource()
+{
+    for (const QVector<GDALDataset*> &datasets : m_freeDatasets) {
+        for (GDALDataset *dataset : datasets) {
+            GDALClose(dataset);
+        }
+    }
+}
+
+bool WarpedTileSource::open(QString *errorMessage)
+{
+    GDALDataset *dataset = acquireDataset(-1);
+    if (!dataset) {
+        if (errorMessage) *errorMessage = "Could not open " + m_filePath;
+        return false;
+    }
+
+    double sourceTransform[6];
+    const char *sourceWkt = dataset->GetProjectionRef();
+    if (dataset->GetGeoTransform(sourceTransform) != CE_None || !sourceWkt || !*sourceWkt) {
+        releaseDataset(-1, dataset);
+        if (errorMessage) *errorMessage = "The raster has no georeference";
+        return false;
+    }
+
+    CrsRegistry &registry = CrsRegistry::instance();
+    if (!registry.crs(QString::fromUtf8(sourceWkt)) || !registry.crs(m_destinationWkt)) {
+        releaseDataset(-1, dataset);
+        if (errorMessage) *errorMessage = "Unsupported coordinate reference system";
+        return false;
+    }
+    m_sameCrs = registry.isSame(QString::fromUtf8(sourceWkt), m_destinationWkt);
+
+    const int bands = dataset->GetRasterCount();
+    m_bandCount = bands >= 3 ? 3 : 1;
+    if (bands >= 4 && dataset->GetRasterBand(4)->GetColorInterpretation() == GCI_AlphaBand) {
+        m_alphaBand = 4;
+    } else if (bands == 2 && dataset->GetRasterBand(2)->GetColorInterpretation() == GCI_AlphaBand) {
+        m_alphaBand = 2;
+    }
+
+    GDALRasterBand *band = dataset->GetRasterBand(1);
+    for (int i = 0; i < band->GetOverviewCount(); ++i) {
+        GDALRasterBand *overview = band->GetOverview(i);
+        const int width = overview ? overview->GetXSize() : 0;
+        m_overviewFactors.append(width > 0 ? qRound(double(dataset->GetRasterXSize()) / width) : 0);
+    }
+
+    // Output grid at about the source resolution, covering all of it
+    char **options = CSLSetNameValue(nullptr, "DST_SRS", m_destinationWkt.toUtf8().constData());
+    void *transformer = GDALCreateGenImgProjTransformer2(dataset, nullptr, options);
+    CSLDestroy(options);
+
+    bool ok = false;
+    if (transformer) {
+        int width = 0;
+        int height = 0;
+        double extent[4];
+        ok = GDALSuggestedWarpOutput2(dataset, GDALGenImgProjTransform, transformer,
+                                      m_geoTransform, &width, &height, extent, 0) == CE_None;
+        m_size = QSize(width, height);
+        GDALDestroyGenImgProjTransformer(transformer);
+    }
+    releaseDataset(-1, dataset);
+
+    if (!ok || m_size.isEmpty()) {
+        if (errorMessage) {
+            *errorMessage = QString("Cannot reproject %1: %2").arg(m_filePath, CPLGetLastErrorMsg());
+        }
+        return false;
+    }
+    return true;
+}
+
+QRectF WarpedTileSource::extent() const
+{
+    return QRectF(QPointF(m_geoTransform[0], m_geoTransform[3]),
+                  QPointF(m_geoTransform[0] + m_size.width() * m_geoTransform[1],
+                          m_geoTransform[3] + m_size.height() * m_geoTransform[5])).normalized();
+}
+
+GDALDataset *WarpedTileSource::acquireDataset(int overview)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        QVector<GDALDataset*> &datasets = m_freeDatasets[overview];
+        if (!datasets.isEmpty()) {
+            return datasets.takeLast();
+        }
+    }
+
+    char **openOptions = nullptr;
+    if (overview >= 0) {
+        openOptions = CSLSetNameValue(openOptions, "OVERVIEW_LEVEL", QByteArray::number(overview).constData());
+    }
+    GDALDataset *dataset = static_cast<GDALDataset*>(
+                GDALOpenEx(m_filePath.toUtf8().constData(), GDAL_OF_RASTER | GDAL_OF_READONLY,
+                           nullptr, openOptions, nullptr));
+    CSLDestroy(openOptions);
+    return dataset;
+}
+
+void WarpedTileSource::releaseDataset(int overview, GDALDataset *dataset)
+{
+    QMutexLocker locker(&m_mutex);
+    m_freeDatasets[overview].append(dataset);
+}
+
+int WarpedTileSource::overviewForLevel(int level) const
+{
+    // The output grid keeps the source resolution, so level L needs about
+    // 2^L source pixels per output pixel: take the coarsest overview that
+    // is not coarser than that
+    const int wanted = 1 << level;
+    int best = -1;
+    int bestFactor = 1;
+    for (int i = 0; i < m_overviewFactors.size(); ++i) {
+        const int factor = m_overviewFactors[i];
+        if (factor > bestFactor && factor <= wanted) {
+            best = i;
+            bestFactor = factor;
+        }
+    }
+    return best;
+}
+
+QImage WarpedTileSource::computeTile(int level, int column, int row, int tileSize)
+{
+    const int step = 1 << level;
+    const int levelWidth = (m_size.width() + step - 1) / step;
+    const int levelHeight = (m_size.height() + step - 1) / step;
+
+    const int x0 = column * tileSize;
+    const int y0 = row * tileSize;
+    const int width = qMin(x0 + tileSize, levelWidth) - x0;
+    const int height = qMin(y0 + tileSize, levelHeight) - y0;
+    if (width <= 0 || height <= 0) return QImage();
+
+    GDALDriver *memDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+    if (!memDriver) return QImage();
+
+    const int outputBands = m_bandCount + 1;   // plus alpha
+    GDALDataset *tile = memDriver->Create("", width, height, outputBands, GDT_Byte, nullptr);
+    if (!tile) return QImage();
+
+    double tileTransform[6] = {
+        m_geoTransform[0] + x0 * step * m_geoTransform[1], m_geoTransform[1] * step, 0.0,
+        m_geoTransform[3] + y0 * step * m_geoTransform[5], 0.0, m_geoTransform[5] * step
+    };
+    tile->SetGeoTransform(tileTransform);
+    tile->SetProjection(m_destinationWkt.toUtf8().constData());
+
+    const int overview = overviewForLevel(level);
+    GDALDataset *source = acquireDataset(overview);
+    if (!source) {
+        GDALClose(tile);
+        return QImage();
+    }
+
+    CPLErr err = CE_Failure;
+    const qint64 warpStart = Profiler::isEnabled() ? Profiler::instance().now() : 0;
+    void *transformer = GDALCreateGenImgProjTransformer2(source, tile, nullptr);
+    if (transformer) {
+        void *approx = GDALCreateApproxTransformer(GDALGenImgProjTransform, transformer, ApproxMaxError);
+        GDALApproxTransformerOwnsSubtransformer(approx, TRUE);
+
+        GDALWarpOptions *options = GDALCreateWarpOptions();
+        options->hSrcDS = source;
+        options->hDstDS = tile;
+        options->nBandCount = m_bandCount;
+        options->panSrcBands = static_cast<int*>(CPLMalloc(sizeof(int) * m_bandCount));
+        options->panDstBands = static_cast<int*>(CPLMalloc(sizeof(int) * m_bandCount));
+        for (int i = 0; i < m_bandCount; ++i) {
+            options->panSrcBands[i] = i + 1;
+            options->panDstBands[i] = i + 1;
+        }
+        options->nSrcAlphaBand = m_alphaBand;
+        options->nDstAlphaBand = outputBands;
+
+        int hasNoData = 0;
+        const double noData = source->GetRasterBand(1)->GetNoDataValue(&hasNoData);
+        if (hasNoData && !m_alphaBand) {
+            options->padfSrcNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double) * m_bandCount));
+            for (int i = 0; i < m_bandCount; ++i) {
+                options->padfSrcNoDataReal[i] = noData;
+            }
+        }
+
+        options->eResampleAlg = step > 1 ? GRA_Average : GRA_Bilinear;
+        options->pfnTransformer = GDALApproxTransform;
+        options->pTransformerArg = approx;
+        options->papszWarpOptions = CSLSetNameValue(options->papszWarpOptions, "INIT_DEST", "0");
+        options->papszWarpOptions = CSLSetNameValue(options->papszWarpOptions, "SKIP_NOSOURCE", "YES");
+        options->papszWarpOptions = CSLSetNameValue(options->papszWarpOptions, "NUM_THREADS",
+                                                    m_warpThreads.constData());
+
+        GDALWarpOperation operation;
+        err = operation.Initialize(options);
+        if (err == CE_None) {
+            err = operation.ChunkAndWarpImage(0, 0, width, height);
+        }
+
+        GDALDestroyWarpOptions(options);
+        GDALDestroyApproxTransformer(approx);
+    }
+    releaseDataset(overview, source);
+    if (Profiler::isEnabled()) {
+        // The warp reads and reprojects in one go; the bytes are what it
+        // produced, about what it read from the matching overview
+        Profiler &profiler = Profiler::instance();
+        profiler.record(Profiler::Transform, "warp tile", warpStart, profiler.now() - warpStart);
+        profiler.addGdalBytes(qint64(width) * height * m_bandCount);
+    }
+
+    ProfileScope imageScope(Profiler::Rasterise, "tile to image");
+    std::vector<GByte> pixels(size_t(width) * height * outputBands);
+    if (err == CE_None) {
+        // Band interleaved: all of band 1, then band 2, ...
+        err = tile->RasterIO(GF_Read, 0, 0, width, height, pixels.data(), width, height,
+                             GDT_Byte, outputBands, nullptr, 0, 0, 0, nullptr);
+    }
+    GDALClose(tile);
+    if (err != CE_None) return QImage();
+
+    const size_t bandSize = size_t(width) * height;
+    const GByte *alpha = pixels.data() + bandSize * m_bandCount;
+    const GByte *red = pixels.data();
+    const GByte *green = m_bandCount == 3 ? red + bandSize : red;
+    const GByte *blue = m_bandCount == 3 ? red + 2 * bandSize : red;
+
+    QImage image(width, height, QImage::Format_ARGB32);
+    bool empty = true;
+    for (int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        const size_t offset = size_t(y) * width;
+        for (int x = 0; x < width; ++x) {
+            const size_t i = offset + x;
+            line[x] = qRgba(red[i], green[i], blue[i], alpha[i]);
+            if (alpha[i]) empty = false;
+        }
+    }
+
+    return empty ? QImage() : image;
+}
@@ -0,0 +1,58 @@
+#ifndef WARPTILESOURCE_H
+#define WARPTILESOURCE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include "tiledrasteritem.h"
+
+class GDALDataset;
+
+// Reprojects a raster to another CRS one tile at a time. Only the tiles in
+// view are warped, from the source overview closest to the zoom level, with
+// an approximate transformer (error below 1/8 pixel) and GDAL's own warp
+// threads. Tiles are RGB(A) for rasters with three or more bands, gray
+// otherwise, transparent outside the source.
+class WarpedTileSource : public RasterTileSource
+{
+public:
+    WarpedTileSource(const QString &filePath, const QString &destinationWkt);
+    ~WarpedTileSource();
+
+    bool open(QString *errorMessage = nullptr);
+
+    // True when the raster already is in the destination CRS
+    bool isSameCrs() const { return m_sameCrs; }
+
+    // Destination grid: pixel (column, row) maps to
+    // (gt[0] + column * gt[1], gt[3] + row * gt[5])
+    const double *geoTransform() const { return m_geoTransform; }
+    QRectF extent() const;
+
+    QSize rasterSize() const override { return m_size; }
+    QImage computeTile(int level, int column, int row, int tileSize) override;
+
+private:
+    GDALDataset *acquireDataset(int overview);
+    void releaseDataset(int overview, GDALDataset *dataset);
+    int overviewForLevel(int level) const;
+
+    QString m_filePath;
+    QString m_destinationWkt;
+    QSize m_size;
+    double m_geoTransform[6];
+    bool m_sameCrs;
+    int m_bandCount;       // 1 (gray) or 3 (RGB) bands are warped
+    int m_alphaBand;       // source alpha band, 0 if none
+    QVector<int> m_overviewFactors;   // source decimation of each overview
+    QByteArray m_warpThreads;
+
+    // Source handles per overview (-1 = full resolution), one per worker
+    QMutex m_mutex;
+    QHash<int, QVector<GDALDataset*>> m_freeDatasets;
+};
+
+#endif // WARPTILESOURCE_H
@@ -0,0 +1,167 @@
+#ifndef WKBUTILS_H
+#define WKBUTILS_H
+
+#include <QtEndian>
+
+#include <cstring>
+#include <vector>
+
+// One coordinate sequence of a WKB geometry, decoded to interleaved x/y
+struct WkbPart
+{
+    const double *xy;   // x0, y0, x1, y1, ...
+    int pointCount;
+    int dimension;      // 0 point, 1 linestring, 2 polygon ring
+    int part;           // running index of the sequence within the geometry
+    int polygon;        // running polygon index, -1 for points and lines
+    int ring;           // 0 = exterior ring, > 0 = holes
+};
+
+namespace WkbDetail
+{
+    class Cursor
+    {
+    public:
+        Cursor(const unsigned char *data, int size) : m_pos(data), m_end(data + size) {}
+
+        bool has(size_t bytes) const { return m_pos + bytes <= m_end; }
+
+        bool readByteOrder(bool *littleEndian)
+        {
+            if (!has(1)) return false;
+            *littleEndian = (*m_pos++ == 1);
+            return true;
+        }
+
+        bool readUInt32(bool littleEndian, quint32 *value)
+        {
+            if (!has(4)) return false;
+            *value = littleEndian ? qFromLittleEndian<quint32>(m_pos) : qFromBigEndian<quint32>(m_pos);
+            m_pos += 4;
+            return true;
+        }
+
+        double readDoubleUnchecked(bool littleEndian)
+        {
+            quint64 bits = littleEndian ? qFromLittleEndian<quint64>(m_pos) : qFromBigEndian<quint64>(m_pos);
+            m_pos += 8;
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        void skip(size_t bytes) { m_pos += bytes; }
+
+    private:
+        const unsigned char *m_pos;
+        const unsigned char *m_end;
+    };
+
+    struct State
+    {
+        std::vector<double> xy;
+        int part = 0;
+        int polygon = 0;
+    };
+
+    // Reads 'count' points of 'stride' ordinates, keeping only x/y
+    inline bool readPoints(Cursor &cursor, bool littleEndian, quint32 count, int stride,
+                           std::vector<double> *xy)
+    {
+        if (!cursor.has(static_cast<size_t>(count) * stride * 8)) return false;
+        xy->resize(static_cast<size_t>(count) * 2);
+        for (quint32 i = 0; i < count; ++i) {
+            (*xy)[2 * i] = cursor.readDoubleUnchecked(littleEndian);
+            (*xy)[2 * i + 1] = cursor.readDoubleUnchecked(littleEndian);
+            cursor.skip(static_cast<size_t>(stride - 2) * 8);
+        }
+        return true;
+    }
+
+    template <typename Visitor>
+    bool visitGeometry(Cursor &cursor, State &state, Visitor &visitor)
+    {
+        bool littleEndian;
+        quint32 rawType;
+        if (!cursor.readByteOrder(&littleEndian) || !cursor.readUInt32(littleEndian, &rawType)) {
+            return false;
+        }
+
+        // Accept ISO (1000/2000/3000 offsets) and the old OGC/EWKB high-bit flags
+        bool hasZ = (rawType & 0x80000000u) != 0;
+        bool hasM = (rawType & 0x40000000u) != 0;
+        if (rawType & 0x20000000u) {
+            // EWKB SRID
+            quint32 srid;
+            if (!cursor.readUInt32(littleEndian, &srid)) return false;
+        }
+        quint32 type = rawType & 0x0fffffffu;
+        const quint32 isoDims = type / 1000;
+        type %= 1000;
+        hasZ = hasZ || isoDims == 1 || isoDims == 3;
+        hasM = hasM || isoDims == 2 || isoDims == 3;
+        const int stride = 2 + (hasZ ? 1 : 0) + (hasM ? 1 : 0);
+
+        switch (type) {
+        case 1: { // Point
+            if (!readPoints(cursor, littleEndian, 1, stride, &state.xy)) return false;
+            WkbPart part = { state.xy.data(), 1, 0, state.part++, -1, 0 };
+            visitor(part);
+            return true;
+        }
+        case 2: { // LineString
+            quint32 count;
+            if (!cursor.readUInt32(littleEndian, &count) ||
+                !readPoints(cursor, littleEndian, count, stride, &state.xy)) {
+                return false;
+            }
+            WkbPart part = { state.xy.data(), static_cast<int>(count), 1, state.part++, -1, 0 };
+            visitor(part);
+            return true;
+        }
+        case 3: { // Polygon
+            quint32 ringCount;
+            if (!cursor.readUInt32(littleEndian, &ringCount)) return false;
+            const int polygon = state.polygon++;
+            for (quint32 r = 0; r < ringCount; ++r) {
+                quint32 count;
+                if (!cursor.readUInt32(littleEndian, &count) ||
+                    !readPoints(cursor, littleEndian, count, stride, &state.xy)) {
+                    return false;
+                }
+                WkbPart part = { state.xy.data(), static_cast<int>(count), 2,
+                                 state.part++, polygon, static_cast<int>(r) };
+                visitor(part);
+            }
+            return true;
+        }
+        case 4: // MultiPoint
+        case 5: // MultiLineString
+        case 6: // MultiPolygon
+        case 7: { // GeometryCollection
+            quint32 count;
+            if (!cursor.readUInt32(littleEndian, &count)) return false;
+            for (quint32 i = 0; i < count; ++i) {
+                if (!visitGeometry(cursor, state, visitor)) return false;
+            }
+            return true;
+        }
+        default:
+            // Curves and surfaces are not decoded
+            return false;
+        }
+    }
+}
+
+// Walks every coordinate sequence of a WKB geometry, calling visitor(const WkbPart&).
+// The xy pointer is only valid during the call. Returns false on malformed or
+// unsupported input.
+template <typename Visitor>
+bool visitWkbParts(const unsigned char *wkb, int size, Visitor visitor)
+{
+    WkbDetail::Cursor cursor(wkb, size);
+    WkbDetail::State state;
+    return WkbDetail::visitGeometry(cursor, state, visitor);
+}
+
+#endif // WKBUTILS_H
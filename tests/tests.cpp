@@ -0,0 +1,703 @@
+#include <QtTest>
+
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <gdal_priv.h>
+#include <ogr_api.h>
+#include <ogr_spatialref.h>
+#include <ogrsf_frmts.h>
+
+#include "featurebuffer.h"
+#include "geoprocessing.h"
+#include "projectexport.h"
+#include "projectfile.h"
+#include "rastercalculator.h"
+#include "reprojection.h"
+#include "vectoranalysis.h"
+
+// Small layers with known answers for the processing algorithms: the
+// benchmarks measure speed, these that the results are right.
+//
+//   tests                      (or make check)
+//   tests lineIntersections
+//   tests rasterCalculator:"division by zero"
+class Tests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void lineIntersections_data();
+    void lineIntersections();
+
+    void fileKeepsZ();
+
+    void rasterCalculator_data();
+    void rasterCalculator();
+    void rasterCalculatorErrors_data();
+    void rasterCalculatorErrors();
+
+    void clip();
+    void clipOverlayInOtherCrs();
+    void intersection();
+    void buffer();
+
+    void sumLineLengths();
+    void sumLineLengthsInOtherCrs();
+
+    void reprojectPoint();
+    void reprojectDropsNonFinite();
+
+    void projectFileRoundTrip();
+    void projectFileRejectsOtherJson();
+
+    void exportManifestDiff();
+    void exportResumesFromJournal();
+};
+
+namespace
+{
+    const double EarthRadius = 6378137.0;   // of EPSG:3857
+
+    QString wktForEpsg(int code)
+    {
+        OGRSpatialReference srs;
+        srs.importFromEPSG(code);
+        char *wkt = nullptr;
+        srs.exportToWkt(&wkt);
+        const QString result = QString::fromUtf8(wkt);
+        CPLFree(wkt);
+        return result;
+    }
+
+    QPointF mercator(double lon, double lat)
+    {
+        const double radians = M_PI / 180.0;
+        return QPointF(EarthRadius * lon * radians,
+                       EarthRadius * std::log(std::tan(M_PI / 4.0 + lat * radians / 2.0)));
+    }
+
+    // One feature per WKT; with 'idField' each gets a 1-based integer id
+    FeatureBuffer layerFromWkt(const QStringList &wkts, OGRwkbGeometryType type = wkbLineString,
+                               const QString &srsWkt = QString(), const QString &idField = QString())
+    {
+        FeatureBuffer buffer;
+        buffer.setGeometryType(type);
+        buffer.setSpatialReferenceWkt(srsWkt);
+        if (!idField.isEmpty()) {
+            buffer.setFields({ { idField, OFTInteger } });
+        }
+        for (const QString &wkt : wkts) {
+            const QVariant id(buffer.count() + 1);
+            const QByteArray text = wkt.toUtf8();
+            OGRGeometry *geometry = nullptr;
+            if (OGRGeometryFactory::createFromWkt(text.constData(), nullptr, &geometry) != OGRERR_NONE) {
+                qFatal("Invalid WKT: %s", text.constData());
+            }
+
+            std::vector<unsigned char> wkb(geometry->WkbSize());
+            geometry->exportToWkb(wkbNDR, wkb.data());
+            OGREnvelope extent;
+            geometry->getEnvelope(&extent);
+            buffer.append(wkb.data(), static_cast<int>(wkb.size()),
+                          Envelope(extent.MinX, extent.MinY, extent.MaxX, extent.MaxY),
+                          idField.isEmpty() ? nullptr : &id);
+            OGRGeometryFactory::destroyGeometry(geometry);
+        }
+        return buffer;
+    }
+
+    // "featureA featureB x y" per output point, sorted, so results compare
+    // whatever order the strips produced them in
+    QStringList hitList(const FeatureBuffer &output)
+    {
+        QStringList hits;
+        for (int i = 0; i < output.count(); ++i) {
+            OGRGeometry *geometry = output.createGeometry(i);
+            const OGRPoint *point = geometry ? dynamic_cast<const OGRPoint*>(geometry) : nullptr;
+            if (point) {
+                hits << QString("%1 %2 %3 %4")
+                        .arg(output.attribute(i, 1).toLongLong())
+                        .arg(output.attribute(i, 3).toLongLong())
+                        .arg(point->getX())
+                        .arg(point->getY());
+            }
+            OGRGeometryFactory::destroyGeometry(geometry);
+        }
+        std::sort(hits.begin(), hits.end());
+        return hits;
+    }
+
+    double area(const FeatureBuffer &buffer, int feature)
+    {
+        OGRGeometry *geometry = buffer.createGeometry(feature);
+        const double result = geometry ? OGR_G_Area(OGRGeometry::ToHandle(geometry)) : 0.0;
+        OGRGeometryFactory::destroyGeometry(geometry);
+        return result;
+    }
+
+    int fieldIndex(const FeatureBuffer &buffer, const QString &name)
+    {
+        for (int i = 0; i < buffer.fieldCount(); ++i) {
+            if (buffer.fields()[i].name == name) return i;
+        }
+        return -1;
+    }
+
+    // One row Float32 GeoTIFF, one list of values per band
+    void writeRaster(const QString &path, const QVector<QVector<float>> &bands, double noData)
+    {
+        GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+        const int width = bands.first().size();
+        GDALDataset *dataset = driver->Create(path.toUtf8().constData(), width, 1, bands.size(),
+                                              GDT_Float32, nullptr);
+        if (!dataset) qFatal("Cannot create %s", qPrintable(path));
+        double geoTransform[6] = { 0.0, 1.0, 0.0, 1.0, 0.0, -1.0 };
+        dataset->SetGeoTransform(geoTransform);
+        for (int b = 0; b < bands.size(); ++b) {
+            GDALRasterBand *band = dataset->GetRasterBand(b + 1);
+            band->SetNoDataValue(noData);
+            QVector<float> values = bands[b];
+            if (band->RasterIO(GF_Write, 0, 0, width, 1, values.data(), width, 1,
+                               GDT_Float32, 0, 0) != CE_None) {
+                qFatal("Cannot write %s", qPrintable(path));
+            }
+        }
+        GDALClose(dataset);
+    }
+
+    // The first band's values, "N" for nodata
+    QString readRaster(const QString &path)
+    {
+        GDALDataset *dataset = (GDALDataset*)GDALOpen(path.toUtf8().constData(), GA_ReadOnly);
+        if (!dataset) return QString();
+        const int width = dataset->GetRasterXSize();
+        QVector<float> values(width);
+        dataset->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, width, 1, values.data(), width, 1,
+                                            GDT_Float32, 0, 0);
+        GDALClose(dataset);
+
+        QStringList text;
+        for (float value : values) {
+            text << (value == RasterCalculator::noDataValue() ? QString("N") : QString::number(value, 'g', 6));
+        }
+        return text.join(' ');
+    }
+
+    void writeFile(const QString &path, const QByteArray &content)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(content) != content.size()) {
+            qFatal("Cannot write %s", qPrintable(path));
+        }
+    }
+
+    // Runs an export to the end; the state of each file by its path
+    QMap<QString, int> exportProject(const Project &project, const QString &directory)
+    {
+        ProjectExporter exporter;
+        QSignalSpy finished(&exporter, &ProjectExporter::finished);
+        if (!exporter.start(project, directory) || !finished.wait(10000)) return QMap<QString, int>();
+
+        QMap<QString, int> states;
+        for (const ProjectExporter::File &file : exporter.files()) {
+            states.insert(file.path, file.state);
+        }
+        return states;
+    }
+
+    // Two single-file layers in 'directory'/data
+    Project exportFixture(const QString &directory)
+    {
+        QDir(directory).mkpath("data");
+        writeFile(directory + "/data/roads.csv", "id,name\n1,Main\n2,High\n");
+        writeFile(directory + "/data/rivers.csv", "id,name\n1,Avon\n");
+
+        Project project;
+        project.name = "export";
+        for (const QString &name : { QString("roads"), QString("rivers") }) {
+            ProjectLayer layer;
+            layer.name = name;
+            layer.type = "vector";
+            layer.source = directory + "/data/" + name + ".csv";
+            project.layers.append(layer);
+        }
+        return project;
+    }
+}
+
+void Tests::initTestCase()
+{
+    GDALAllRegister();
+}
+
+void Tests::lineIntersections_data()
+{
+    QTest::addColumn<QStringList>("features");
+    QTest::addColumn<QStringList>("expected");
+
+    QTest::newRow("crossing")
+            << QStringList{ "LINESTRING (0 0, 2 2)", "LINESTRING (0 2, 2 0)" }
+            << QStringList{ "0 1 1 1" };
+    QTest::newRow("disjoint")
+            << QStringList{ "LINESTRING (0 0, 1 0)", "LINESTRING (0 1, 1 1)" }
+            << QStringList();
+    QTest::newRow("touching at an end")
+            << QStringList{ "LINESTRING (0 0, 2 0)", "LINESTRING (1 0, 1 2)" }
+            << QStringList{ "0 1 1 0" };
+    QTest::newRow("sharing an end point")
+            << QStringList{ "LINESTRING (0 0, 1 1)", "LINESTRING (1 1, 2 0)" }
+            << QStringList{ "0 1 1 1" };
+    QTest::newRow("collinear overlap")
+            << QStringList{ "LINESTRING (0 0, 3 0)", "LINESTRING (1 0, 4 0)" }
+            << QStringList{ "0 1 1 0", "0 1 3 0" };
+    QTest::newRow("consecutive segments")
+            << QStringList{ "LINESTRING (0 0, 1 0, 1 1, 2 1)" }
+            << QStringList();
+    QTest::newRow("closed ring")
+            << QStringList{ "POLYGON ((0 0, 1 0, 1 1, 0 1, 0 0))" }
+            << QStringList();
+    QTest::newRow("self-touch at a vertex")
+            << QStringList{ "LINESTRING (0 0, 2 0, 2 2, 1 1, 2 0)" }
+            << QStringList{ "0 0 2 0" };
+    QTest::newRow("self-crossing")
+            << QStringList{ "LINESTRING (0 0, 2 2, 2 0, 0 2)" }
+            << QStringList{ "0 0 1 1" };
+    QTest::newRow("repeated vertex")
+            << QStringList{ "LINESTRING (0 0, 1 0, 1 0, 1 1)" }
+            << QStringList();
+}
+
+void Tests::lineIntersections()
+{
+    QFETCH(QStringList, features);
+    QFETCH(QStringList, expected);
+
+    const FeatureBuffer layer = layerFromWkt(features);
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(VectorAnalysis::lineIntersections({ &layer }, QStringList{ "lines" }, &output,
+                                               nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(hitList(output), expected);
+}
+
+void Tests::fileKeepsZ()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const FeatureBuffer lines = layerFromWkt({ "LINESTRING Z (0 0 1, 1 1 2)" }, wkbLineString25D,
+                                             wktForEpsg(4326));
+
+    QString errorMessage;
+    const QString path = directory.filePath("lines.gpkg");
+    QVERIFY2(lines.writeToFile(path, "lines", &errorMessage), qPrintable(errorMessage));
+
+    FeatureBuffer read;
+    QVERIFY2(FeatureBuffer::readFromFile(path, 0, &read, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(read.count(), 1);
+    QCOMPARE(read.geometryType(), wkbMultiLineString25D);
+
+    OGRGeometry *geometry = read.createGeometry(0);
+    QVERIFY(geometry && geometry->Is3D());
+    QCOMPARE(geometry->getGeometryType(), read.geometryType());
+    OGRGeometryFactory::destroyGeometry(geometry);
+}
+
+// Rasters: "bands" with B1 = 1 2 nodata 4 and B2 = 0 2 3 8, and "dem" (also
+// named "height model") with 10 20 30 40. Expected values per pixel, N for
+// nodata.
+void Tests::rasterCalculator_data()
+{
+    QTest::addColumn<QString>("expression");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("product before sum") << "B1 + B2 * 2" << "1 6 N 20";
+    QTest::newRow("parentheses") << "(B1 + B2) * 2" << "2 8 N 24";
+    QTest::newRow("comparison after arithmetic") << "B1 + B2 * 2 > 5 or B1 == 1" << "1 1 N 1";
+    QTest::newRow("and, not equal") << "B1 >= 2 and B2 != 8" << "0 1 N 0";
+    QTest::newRow("unary minus") << "-B1 - -B2" << "-1 0 N 4";
+    QTest::newRow("power before unary minus") << "-B1^2" << "-1 -4 N -16";
+    QTest::newRow("power right associative") << "2^B1^2" << "2 16 N 65536";
+    QTest::newRow("functions") << "max(B1, B2) + abs(-B1)" << "2 4 N 12";
+    QTest::newRow("if") << "if(B1 > 1, B1, 0)" << "0 2 N 4";
+    QTest::newRow("named band") << "dem@1 / 10 + B1" << "2 4 N 8";
+    QTest::newRow("quoted name") << "\"height model\"@1 - dem@1" << "0 0 0 0";
+    QTest::newRow("nodata only from referenced bands") << "sqrt(B2 * B2)" << "0 2 3 8";
+    QTest::newRow("division by zero") << "B1 / B2" << "N 1 N 0.5";
+    QTest::newRow("zero by zero") << "B2 / B2" << "N 1 1 1";
+    QTest::newRow("log of negative") << "ln(B1 - 3)" << "N N N 0";
+}
+
+void Tests::rasterCalculator()
+{
+    QFETCH(QString, expression);
+    QFETCH(QString, expected);
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    writeRaster(directory.filePath("bands.tif"), { { 1, 2, -9999, 4 }, { 0, 2, 3, 8 } }, -9999);
+    writeRaster(directory.filePath("dem.tif"), { { 10, 20, 30, 40 } }, -9999);
+    const QVector<RasterInput> inputs = {
+        { "bands", directory.filePath("bands.tif") },
+        { "dem", directory.filePath("dem.tif") },
+        { "height model", directory.filePath("dem.tif") }
+    };
+
+    QString errorMessage;
+    const QString output = directory.filePath("out.tif");
+    QVERIFY2(RasterCalculator::calculate(expression, inputs, output, nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(readRaster(output), expected);
+}
+
+void Tests::rasterCalculatorErrors_data()
+{
+    QTest::addColumn<QString>("expression");
+    QTest::addColumn<QString>("error");
+
+    QTest::newRow("missing operand") << "B1 +" << "Unexpected end of expression at position 5";
+    QTest::newRow("unclosed parenthesis") << "(B1 + 2" << "Expected ')' at position 8";
+    QTest::newRow("two values") << "1 2" << "Unexpected '2' at position 3";
+    QTest::newRow("invalid character") << "B1 $ 2" << "Unexpected '$' at position 4";
+    QTest::newRow("unterminated quote") << "\"dem@1" << "Unexpected character '\"' at position 1";
+    QTest::newRow("unknown name") << "x + 1" << "Unknown name 'x' at position 3";
+    QTest::newRow("unknown function") << "foo(B1)" << "Unknown function 'foo' at position 4";
+    QTest::newRow("too few arguments") << "min(B1)" << "min() expects 2 arguments at position 7";
+    QTest::newRow("unknown layer") << "nope@1" << "Unknown raster layer 'nope' at position 6";
+    QTest::newRow("band zero") << "dem@0" << "Expected a band number at position 5";
+    QTest::newRow("missing band") << "B3" << "bands has 2 band(s), band 3 does not exist";
+}
+
+void Tests::rasterCalculatorErrors()
+{
+    QFETCH(QString, expression);
+    QFETCH(QString, error);
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    writeRaster(directory.filePath("bands.tif"), { { 1, 2 }, { 3, 4 } }, -9999);
+    writeRaster(directory.filePath("dem.tif"), { { 10, 20 } }, -9999);
+    const QVector<RasterInput> inputs = {
+        { "bands", directory.filePath("bands.tif") },
+        { "dem", directory.filePath("dem.tif") }
+    };
+
+    QString errorMessage;
+    QVERIFY(!RasterCalculator::validate(expression, inputs, &errorMessage));
+    QCOMPARE(errorMessage, error);
+}
+
+void Tests::clip()
+{
+    const FeatureBuffer input = layerFromWkt({ "POLYGON ((0 0, 2 0, 2 2, 0 2, 0 0))",
+                                               "POLYGON ((5 5, 6 5, 6 6, 5 6, 5 5))" },
+                                             wkbPolygon, QString(), "ID");
+    const FeatureBuffer overlay = layerFromWkt({ "POLYGON ((1 1, 3 1, 3 3, 1 3, 1 1))" }, wkbPolygon);
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Geoprocessing::clip(input, overlay, &output, nullptr, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(output.count(), 1);
+    QCOMPARE(output.attribute(0, 0).toInt(), 1);
+    QVERIFY(qAbs(area(output, 0) - 1.0) < 1e-9);
+}
+
+void Tests::clipOverlayInOtherCrs()
+{
+    // The overlay is the square (1 1, 3 3) in degrees, given in Web Mercator
+    const FeatureBuffer input = layerFromWkt({ "POLYGON ((0 0, 2 0, 2 2, 0 2, 0 0))" },
+                                             wkbPolygon, wktForEpsg(4326));
+    const QPointF low = mercator(1, 1);
+    const QPointF high = mercator(3, 3);
+    const FeatureBuffer overlay = layerFromWkt(
+                { QString("POLYGON ((%1 %2, %3 %2, %3 %4, %1 %4, %1 %2))")
+                  .arg(low.x(), 0, 'f', 6).arg(low.y(), 0, 'f', 6)
+                  .arg(high.x(), 0, 'f', 6).arg(high.y(), 0, 'f', 6) },
+                wkbPolygon, wktForEpsg(3857));
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Geoprocessing::clip(input, overlay, &output, nullptr, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(output.count(), 1);
+    QVERIFY(qAbs(area(output, 0) - 1.0) < 1e-6);
+}
+
+void Tests::intersection()
+{
+    const FeatureBuffer input = layerFromWkt({ "POLYGON ((0 0, 2 0, 2 2, 0 2, 0 0))" },
+                                             wkbPolygon, QString(), "ID");
+    const FeatureBuffer overlay = layerFromWkt({ "POLYGON ((1 1, 3 1, 3 3, 1 3, 1 1))",
+                                                 "POLYGON ((1 -1, 3 -1, 3 0.5, 1 0.5, 1 -1))",
+                                                 "POLYGON ((8 8, 9 8, 9 9, 8 9, 8 8))" },
+                                               wkbPolygon, QString(), "ID");
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Geoprocessing::intersection(input, overlay, &output, nullptr, &errorMessage),
+             qPrintable(errorMessage));
+
+    const int inputId = fieldIndex(output, "ID");
+    const int overlayId = fieldIndex(output, "ID_2");
+    QVERIFY(inputId >= 0 && overlayId >= 0);
+
+    QStringList pieces;
+    for (int i = 0; i < output.count(); ++i) {
+        pieces << QString("%1 %2 %3").arg(output.attribute(i, inputId).toInt())
+                  .arg(output.attribute(i, overlayId).toInt()).arg(area(output, i));
+    }
+    pieces.sort();
+    QCOMPARE(pieces, QStringList({ "1 1 1", "1 2 0.5" }));
+}
+
+void Tests::buffer()
+{
+    const FeatureBuffer input = layerFromWkt({ "POINT (0 0)" }, wkbPoint);
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Geoprocessing::buffer(input, 1.0, 8, &output, nullptr, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(output.count(), 1);
+
+    // A 32-gon inscribed in the unit circle
+    QVERIFY(qAbs(area(output, 0) - 16.0 * std::sin(M_PI / 16.0)) < 1e-9);
+    const Envelope bounds = output.envelope(0);
+    QVERIFY(qAbs(bounds.minX + 1.0) < 1e-9 && qAbs(bounds.maxX - 1.0) < 1e-9);
+    QVERIFY(qAbs(bounds.minY + 1.0) < 1e-9 && qAbs(bounds.maxY - 1.0) < 1e-9);
+}
+
+void Tests::sumLineLengths()
+{
+    const FeatureBuffer polygons = layerFromWkt({ "POLYGON ((0 0, 10 0, 10 10, 0 10, 0 0))",
+                                                  "POLYGON ((20 0, 30 0, 30 10, 20 10, 20 0))" },
+                                                wkbPolygon);
+    const FeatureBuffer lines = layerFromWkt({ "LINESTRING (-5 5, 15 5)",
+                                               "LINESTRING (2 2, 2 4)",
+                                               "LINESTRING (40 40, 50 50)" });
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(VectorAnalysis::sumLineLengths(polygons, lines, VectorAnalysis::PlanarLength, &output,
+                                            nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(output.count(), 2);
+
+    const int length = fieldIndex(output, "LENGTH");
+    const int count = fieldIndex(output, "COUNT");
+    QVERIFY(length >= 0 && count >= 0);
+    QCOMPARE(output.attribute(0, length).toDouble(), 12.0);
+    QCOMPARE(output.attribute(0, count).toInt(), 2);
+    QCOMPARE(output.attribute(1, length).toDouble(), 0.0);
+    QCOMPARE(output.attribute(1, count).toInt(), 0);
+}
+
+void Tests::sumLineLengthsInOtherCrs()
+{
+    // Polygon in Web Mercator around a north-south line given in degrees
+    const QPointF low = mercator(0, -1);
+    const QPointF high = mercator(1, 1);
+    const FeatureBuffer polygons = layerFromWkt(
+                { QString("POLYGON ((%1 %2, %3 %2, %3 %4, %1 %4, %1 %2))")
+                  .arg(low.x(), 0, 'f', 6).arg(low.y(), 0, 'f', 6)
+                  .arg(high.x(), 0, 'f', 6).arg(high.y(), 0, 'f', 6) },
+                wkbPolygon, wktForEpsg(3857));
+    const FeatureBuffer lines = layerFromWkt({ "LINESTRING (0.5 -0.5, 0.5 0.5)" }, wkbLineString,
+                                             wktForEpsg(4326));
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(VectorAnalysis::sumLineLengths(polygons, lines, VectorAnalysis::PlanarLength, &output,
+                                            nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(output.count(), 1);
+
+    // Measured in the polygons' CRS
+    const double expected = mercator(0.5, 0.5).y() - mercator(0.5, -0.5).y();
+    QVERIFY(qAbs(output.attribute(0, fieldIndex(output, "LENGTH")).toDouble() - expected) < 1e-3);
+    QCOMPARE(output.attribute(0, fieldIndex(output, "COUNT")).toInt(), 1);
+}
+
+void Tests::reprojectPoint()
+{
+    const FeatureBuffer input = layerFromWkt({ "POINT (10 50)" }, wkbPoint, wktForEpsg(4326));
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Reprojection::reproject(input, wktForEpsg(3857), &output, nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(output.count(), 1);
+
+    OGRGeometry *geometry = output.createGeometry(0);
+    const OGRPoint *point = geometry ? dynamic_cast<const OGRPoint*>(geometry) : nullptr;
+    QVERIFY(point);
+    QVERIFY(qAbs(point->getX() - 1113194.9079327357) < 1e-3);
+    QVERIFY(qAbs(point->getY() - 6446275.841017158) < 1e-3);
+    OGRGeometryFactory::destroyGeometry(geometry);
+
+    QVERIFY(Reprojection::isSameCrs(output.spatialReferenceWkt(), wktForEpsg(3857)));
+}
+
+void Tests::reprojectDropsNonFinite()
+{
+    // The pole has no Web Mercator coordinates
+    const FeatureBuffer input = layerFromWkt({ "POINT (10 50)", "POINT (0 90)", "POINT (-10 -50)" },
+                                             wkbPoint, wktForEpsg(4326), "ID");
+
+    FeatureBuffer output;
+    QString errorMessage;
+    QVERIFY2(Reprojection::reproject(input, wktForEpsg(3857), &output, nullptr, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(output.count(), 2);
+    QCOMPARE(output.attribute(0, 0).toInt(), 1);
+    QCOMPARE(output.attribute(1, 0).toInt(), 3);
+    for (int i = 0; i < output.count(); ++i) {
+        const Envelope bounds = output.envelope(i);
+        QVERIFY(std::isfinite(bounds.minX) && std::isfinite(bounds.minY));
+    }
+}
+
+void Tests::projectFileRoundTrip()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    QDir(directory.path()).mkpath("before/data");
+
+    Project project;
+    project.name = "roads";
+    project.crs = "EPSG:3857";
+    project.viewExtent = QRectF(QPointF(-10.5, 20.0), QPointF(30.0, 45.25));
+
+    ProjectLayer layer;
+    layer.name = "roads";
+    layer.type = "vector";
+    layer.source = directory.filePath("before/data/roads.shp");
+    layer.group = "Vector Layers";
+    layer.label = "Vector (Line)";
+    layer.visible = false;
+    layer.zValue = 3.0;
+    layer.opacity = 0.5;
+    layer.color = QColor(10, 20, 30, 40);
+    layer.properties["layer_index"] = 2;
+    layer.properties["extent"] = QVariantList({ 1.0, 2.0, 3.0, 4.0 });
+    project.layers.append(layer);
+
+    ProjectLayer memory;
+    memory.name = "scratch";
+    memory.type = "memory";
+    project.layers.append(memory);
+
+    QString errorMessage;
+    QVERIFY2(ProjectFile::write(directory.filePath("before/project.json"), project, &errorMessage),
+             qPrintable(errorMessage));
+
+    // Sources are relative: the project still finds its data once moved
+    QVERIFY(QDir(directory.path()).rename("before", "after"));
+
+    Project read;
+    QVERIFY2(ProjectFile::read(directory.filePath("after/project.json"), &read, &errorMessage),
+             qPrintable(errorMessage));
+    QCOMPARE(read.name, project.name);
+    QCOMPARE(read.crs, project.crs);
+    QCOMPARE(read.viewExtent, project.viewExtent);
+    QCOMPARE(read.layers.size(), 2);
+
+    const ProjectLayer &roads = read.layers[0];
+    QCOMPARE(roads.name, layer.name);
+    QCOMPARE(roads.type, layer.type);
+    QCOMPARE(roads.source, QDir::cleanPath(directory.filePath("after/data/roads.shp")));
+    QCOMPARE(roads.group, layer.group);
+    QCOMPARE(roads.label, layer.label);
+    QCOMPARE(roads.visible, false);
+    QCOMPARE(roads.zValue, 3.0);
+    QCOMPARE(roads.opacity, 0.5);
+    QCOMPARE(roads.color, layer.color);
+    QCOMPARE(roads.properties.value("layer_index").toInt(), 2);
+    QCOMPARE(roads.properties.value("extent").toList().size(), 4);
+
+    QCOMPARE(read.layers[1].name, QString("scratch"));
+    QVERIFY(read.layers[1].source.isEmpty());
+    QVERIFY(!read.layers[1].color.isValid());
+}
+
+void Tests::projectFileRejectsOtherJson()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    writeFile(directory.filePath("other.json"), "{\"layers\": []}");
+
+    Project project;
+    QString errorMessage;
+    QVERIFY(!ProjectFile::read(directory.filePath("other.json"), &project, &errorMessage));
+    QCOMPARE(errorMessage, QString("Not a project file of this application"));
+}
+
+void Tests::exportManifestDiff()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const Project project = exportFixture(directory.path());
+    const QString target = directory.filePath("export");
+
+    const QMap<QString, int> first = exportProject(project, target);
+    QCOMPARE(first.size(), 2);
+    for (int state : first) QCOMPARE(state, int(ProjectExporter::Copied));
+    QVERIFY(QFile::exists(QDir(target).filePath(ProjectExporter::manifestFileName())));
+    QVERIFY(ProjectExporter::changedFiles(target).isEmpty());
+
+    // A damaged copy shows up in the diff and is the only file copied again
+    const QString damaged = first.firstKey();
+    QFile file(QDir(target).filePath(damaged));
+    QVERIFY(file.open(QIODevice::Append));
+    file.write("extra");
+    file.close();
+    QCOMPARE(ProjectExporter::changedFiles(target), QStringList({ damaged }));
+
+    const QMap<QString, int> second = exportProject(project, target);
+    QCOMPARE(second.value(damaged), int(ProjectExporter::Copied));
+    QCOMPARE(second.value(first.lastKey()), int(ProjectExporter::Skipped));
+    QVERIFY(ProjectExporter::changedFiles(target).isEmpty());
+}
+
+void Tests::exportResumesFromJournal()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const Project project = exportFixture(directory.path());
+    const QString target = directory.filePath("export");
+    QCOMPARE(exportProject(project, target).size(), 2);
+
+    // An export interrupted before writing its manifest: only the journal,
+    // holding the first file
+    QFile manifest(QDir(target).filePath(ProjectExporter::manifestFileName()));
+    QVERIFY(manifest.open(QIODevice::ReadOnly));
+    const QJsonArray entries = QJsonDocument::fromJson(manifest.readAll()).object()["files"].toArray();
+    manifest.close();
+    QCOMPARE(entries.size(), 2);
+    QVERIFY(manifest.remove());
+    writeFile(QDir(target).filePath(ProjectExporter::manifestFileName() + ".journal"),
+              QJsonDocument(entries[0].toObject()).toJson(QJsonDocument::Compact) + '\n');
+
+    const QString journaled = entries[0].toObject()["path"].toString();
+    const QMap<QString, int> resumed = exportProject(project, target);
+    QCOMPARE(resumed.size(), 2);
+    for (auto it = resumed.constBegin(); it != resumed.constEnd(); ++it) {
+        QCOMPARE(it.value(), int(it.key() == journaled ? ProjectExporter::Skipped : ProjectExporter::Copied));
+    }
+
+    // Finished: the journal is folded into a new manifest
+    QVERIFY(!QFile::exists(QDir(target).filePath(ProjectExporter::manifestFileName() + ".journal")));
+    QVERIFY(ProjectExporter::changedFiles(target).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(Tests)
+
+#include "tests.moc"
@@ -0,0 +1,13 @@
+QT       += core testlib concurrent
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tests
+
+# Correctness checks for the processing algorithms, on small hand-made
+# layers whose answers are known. 'make check' runs them.
+SOURCES += \
+    tests.cpp
+
+include(../core/core.pri)